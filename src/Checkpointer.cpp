@@ -0,0 +1,156 @@
+// Periodic checkpoints of a tiled render, written off the render threads.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "Checkpointer.h"
+#include "RayTracer.h"
+#include "TileRenderer.h"
+#include "fileio/checkpoint.h"
+#include "stats/timeline.h"
+
+Checkpointer::Checkpointer( RayTracer *tracer, const char *fileName, double interval,
+	unsigned long long settingsHash, const std::vector<unsigned char>& done )
+	: m_tracer( tracer ), m_fileName( fileName ), m_nInterval( interval ),
+	  m_nSettingsHash( settingsHash ), m_nSaves( 0 ), m_bDirty( false ), m_bQuit( false )
+{
+	unsigned char *buf;
+	int w, h;
+	tracer->getBuffer( buf, w, h );
+	const int size = TileRenderer::TILE_SIZE;
+	m_nTilesX = ( w + size - 1 ) / size;
+	m_done.assign( m_nTilesX * ( ( h + size - 1 ) / size ), 0 );
+	if( done.size() == m_done.size() )
+		m_done = done;
+
+	m_thread = std::thread( &Checkpointer::run, this );
+}
+
+Checkpointer::~Checkpointer()
+{
+	{
+		std::lock_guard<std::mutex> guard( m_lock );
+		m_bQuit = true;
+	}
+	m_wake.notify_all();
+	if( m_thread.joinable() )
+		m_thread.join();
+}
+
+void Checkpointer::tileDone( int x, int y, int, int, const unsigned char *, int, void *data )
+{
+	Checkpointer *cp = (Checkpointer *)data;
+	const int size = TileRenderer::TILE_SIZE;
+
+	// The tile's pixels were stored before this; the lock passes that on
+	// to the saving thread, which only reads tiles it sees flagged.
+	std::lock_guard<std::mutex> guard( cp->m_lock );
+	cp->m_done[ ( y / size ) * cp->m_nTilesX + x / size ] = 1;
+	cp->m_bDirty = true;
+}
+
+bool Checkpointer::finish()
+{
+	{
+		std::lock_guard<std::mutex> guard( m_lock );
+		m_bQuit = true;
+	}
+	m_wake.notify_all();
+	if( m_thread.joinable() )
+		m_thread.join();
+
+	return !m_bDirty || save();
+}
+
+void Checkpointer::run()
+{
+	nameTimelineThread( "checkpoint" );
+
+	std::unique_lock<std::mutex> lock( m_lock );
+	while( !m_bQuit ) {
+		m_wake.wait_for( lock, std::chrono::duration<double>( m_nInterval ) );
+		if( m_bQuit || !m_bDirty )
+			continue;
+
+		lock.unlock();
+		save();
+		lock.lock();
+	}
+}
+
+// Copy the finished tiles out of the tracer's image and write them.
+bool Checkpointer::save()
+{
+	Checkpoint cp;
+	{
+		std::lock_guard<std::mutex> guard( m_lock );
+		cp.tilesDone = m_done;
+		m_bDirty = false;
+	}
+
+	unsigned char *buf;
+	float *hdr;
+	m_tracer->getBuffer( buf, cp.width, cp.height );
+	m_tracer->getHDRBuffer( hdr, cp.width, cp.height );
+	cp.settingsHash = m_nSettingsHash;
+	cp.seed = m_tracer->getSeed();
+	cp.tileSize = TileRenderer::TILE_SIZE;
+
+	// tiles still being traced are left black
+	size_t n = (size_t)cp.width * cp.height * 3;
+	cp.rgb.assign( n, 0 );
+	if( hdr )
+		cp.hdr.assign( n, 0.0f );
+	for( size_t t = 0; t < cp.tilesDone.size(); ++t ) {
+		if( !cp.tilesDone[t] )
+			continue;
+
+		int x = ( t % m_nTilesX ) * cp.tileSize;
+		int y = ( t / m_nTilesX ) * cp.tileSize;
+		int w = std::min( cp.tileSize, cp.width - x );
+		int h = std::min( cp.tileSize, cp.height - y );
+		for( int j = y; j < y + h; ++j ) {
+			size_t row = ( (size_t)j * cp.width + x ) * 3;
+			memcpy( &cp.rgb[ row ], buf + row, w * 3 );
+			if( hdr )
+				memcpy( &cp.hdr[ row ], hdr + row, w * 3 * sizeof( float ) );
+		}
+	}
+
+	if( !writeCheckpoint( m_fileName, cp ) )
+		return false;
+	++m_nSaves;
+	return true;
+}
+
+bool Checkpointer::resume( RayTracer *tracer, const char *fileName, unsigned long long settingsHash,
+	std::vector<unsigned char>& done )
+{
+	Checkpoint cp;
+	if( !readCheckpoint( fileName, cp ) ) {
+		fprintf( stderr, "can't read the checkpoint %s\n", fileName );
+		return false;
+	}
+
+	unsigned char *buf;
+	float *hdr;
+	int w, h;
+	tracer->getBuffer( buf, w, h );
+	tracer->getHDRBuffer( hdr, w, h );
+	if( cp.settingsHash != settingsHash || cp.width != w || cp.height != h
+		|| cp.tileSize != TileRenderer::TILE_SIZE || cp.hdr.empty() != !hdr ) {
+		fprintf( stderr, "%s was made from another scene file or other settings\n", fileName );
+		return false;
+	}
+
+	// Unfinished tiles are traced over, so the whole image can be copied.
+	memcpy( buf, &cp.rgb[0], cp.rgb.size() );
+	if( hdr )
+		memcpy( hdr, &cp.hdr[0], cp.hdr.size() * sizeof( float ) );
+	tracer->setSeed( cp.seed );
+	done = cp.tilesDone;
+	return true;
+}
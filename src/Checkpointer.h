@@ -0,0 +1,65 @@
+#ifndef __CHECKPOINTER_H__
+#define __CHECKPOINTER_H__
+
+// Saves a TileRenderer render's progress to a checkpoint file every so
+// often (see fileio/checkpoint.h), and restores it to finish the render.
+// The render threads only flag their finished tiles (pass tileDone and the
+// Checkpointer to TileRenderer::start); a thread of the Checkpointer's own
+// copies the flagged tiles out of the tracer's image and does the writing,
+// so the disk never holds a render thread up.
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class RayTracer;
+
+class Checkpointer
+{
+public:
+	// tracer is set up (traceSetup) for the render; done, if not empty,
+	// flags the tiles it already has, from resume().  settingsHash goes
+	// into every checkpoint written.
+	Checkpointer( RayTracer *tracer, const char *fileName, double interval,
+		unsigned long long settingsHash, const std::vector<unsigned char>& done );
+
+	// Stops saving, without a last save.
+	~Checkpointer();
+
+	// TileRenderer::TileCallback
+	static void tileDone( int x, int y, int w, int h, const unsigned char *pixels, int stride, void *data );
+
+	// Stop saving, and save once more if a tile was finished since the
+	// last time, e.g. after a render that was stopped.
+	bool finish();
+
+	int numSaves() const { return m_nSaves; }
+
+	// Read fileName into tracer's image (it must be set up for the render)
+	// and flag the tiles it has in done.  False, with a message, if it
+	// can't be read or was made with other settings.
+	static bool resume( RayTracer *tracer, const char *fileName, unsigned long long settingsHash,
+		std::vector<unsigned char>& done );
+
+private:
+	void run();
+	bool save();
+
+	RayTracer *m_tracer;
+	const char *m_fileName;
+	double m_nInterval;
+	unsigned long long m_nSettingsHash;
+	int m_nTilesX;
+	int m_nSaves;
+
+	std::mutex m_lock;					// guards m_done, m_bDirty and m_bQuit
+	std::condition_variable m_wake;
+	std::vector<unsigned char> m_done;
+	bool m_bDirty;						// tiles done since the last save
+	bool m_bQuit;
+
+	std::thread m_thread;
+};
+
+#endif // __CHECKPOINTER_H__
@@ -1,6 +1,6 @@
 // The main ray tracer.
 
-#include <Fl/fl_ask.h>
+#include <iostream>
 
 #include "RayTracer.h"
 #include "scene/light.h"
@@ -8,19 +8,61 @@
 #include "scene/ray.h"
 #include "fileio/read.h"
 #include "fileio/parse.h"
+#include "fileio/hdrimage.h"
+#include "stats/objectstats.h"
+#include "stats/raystats.h"
+#include "stats/timeline.h"
+#include <algorithm>
 #include <math.h>
 #include <stdlib.h> 
 #include <time.h> 
+#include <string.h>
+
+// Jitter offsets come from a hash of the seed and the sample's position
+// instead of rand(), so a pixel gets the same samples whichever thread,
+// process or resumed run traces it.
+struct SampleRandom
+{
+	SampleRandom( unsigned int seed, double x, double y )
+	{
+		unsigned long long bx, by;
+		memcpy( &bx, &x, sizeof( bx ) );
+		memcpy( &by, &y, sizeof( by ) );
+		state = seed * 0x9E3779B97F4A7C15ULL ^ bx ^ ( by << 32 | by >> 32 );
+	}
+
+	// splitmix64
+	unsigned int next()
+	{
+		unsigned long long z = ( state += 0x9E3779B97F4A7C15ULL );
+		z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+		z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+		return (unsigned int)( ( z ^ ( z >> 31 ) ) >> 32 );
+	}
+
+	unsigned long long state;
+};
 
 // Trace a top-level ray through normalized window coordinates (x,y)
 // through the projection plane, and out into the scene.  All we do is
 // enter the main ray-tracing method, getting things started by plugging
 // in an initial ray weight of (0.0,0.0,0.0) and an initial recursion depth of 0.
-vec3f RayTracer::trace( Scene *scene, double x, double y )
+// If hit is non-NULL the primary ray and its intersection are recorded
+// there so the sample can be re-shaded later.
+vec3f RayTracer::trace( Scene *scene, double x, double y, PrimaryHit *hit )
 {
     ray r( vec3f(0,0,0), vec3f(0,0,0) );
-    scene->getCamera()->rayThrough( x,y,r );
-	return traceRay( scene, r, vec3f(1.0,1.0,1.0), m_nDepth, 1.0 ).clamp();
+    camera.rayThrough( x,y,r );
+	RAY_STAT( STAT_PRIMARY_RAYS );
+
+	if( hit == NULL )
+		return clampColor( traceRay( scene, r, vec3f(1.0,1.0,1.0), m_nDepth, 1.0 ) );
+
+	hit->r = r;
+	hit->hit = scene->intersect( r, hit->i );
+	if( !hit->hit )
+		return vec3f( 0.0, 0.0, 0.0 );
+	return clampColor( shadeHit( scene, r, hit->i, vec3f(1.0,1.0,1.0), m_nDepth, 1.0 ) );
 }
 
 // Do recursive ray tracing!  You'll want to insert a lot of code here
@@ -31,53 +73,7 @@ vec3f RayTracer::traceRay( Scene *scene, const ray& r,
 	isect i;
 
 	if( scene->intersect( r, i ) ) {
-		// YOUR CODE HERE
-
-		// An intersection occured!  We've got work to do.  For now,
-		// this code gets the material for the surface that was intersected,
-		// and asks that material to provide a color for the ray.  
-
-		// This is a great place to insert code for recursive ray tracing.
-		// Instead of just returning the result of shade(), add some
-		// more steps: add in the contributions from reflected and refracted
-		// rays.
-
-		const Material& m = i.getMaterial();
-		vec3f incidentColor = m.shade(scene, r, i);
-		if (depth <= 0) {
-			return incidentColor;
-		}
-		
-		vec3f incidentDirection = r.getDirection().normalize();
-		
-		if (!m.kr.iszero()) {
-			vec3f reflectedPosition = r.at(i.t) + RAY_EPSILON * i.N.normalize();
-			vec3f reflectedDirection = (incidentDirection + 2 * (-incidentDirection.dot(i.N.normalize()) * i.N.normalize())).normalize();
-			ray reflectednRay(reflectedPosition, reflectedDirection);
-			vec3f reflectedColor = traceRay(scene, reflectednRay, thresh, depth - 1, m.index);
-			incidentColor += prod(m.kr, reflectedColor);
-		}
-
-		if (!m.kt.iszero()) {
-			double n_i = (m.index == prev_index ? m.index : 1.0);
-			double n_t = (m.index == prev_index ? 1.0 : m.index);
-			double n_r = n_i / n_t;
-			double c = -i.N.dot(incidentDirection) / (incidentDirection.length() * i.N.length());
-			vec3f refractedPosition = r.at(i.t) - RAY_EPSILON * i.N.normalize();
-
-			if (1 - pow(n_r, 2) * (1 - pow(c, 2)) > RAY_EPSILON) {
-				vec3f refractedDirection = n_r * incidentDirection + (n_r * c - sqrt(1 - pow(n_r, 2) * (1 - pow(c, 2)))) * i.N;
-				ray refractedRay(refractedPosition, refractedDirection);
-				vec3f refractedColor = traceRay(scene, refractedRay, thresh, depth - 1, m.index);
-				incidentColor += prod(m.kt, refractedColor);
-			}
-		}
-		
-
-		return incidentColor.clamp();
-		
-		//return m.shade(scene, r, i);
-	
+		return shadeHit( scene, r, i, thresh, depth, prev_index );
 	} else {
 		// No intersection.  This ray travels to infinity, so we color
 		// it according to the background color, which in this (simple) case
@@ -87,20 +83,98 @@ vec3f RayTracer::traceRay( Scene *scene, const ray& r,
 	}
 }
 
+// Everything traceRay does once the intersection is known: local shading
+// plus the recursive reflected and refracted contributions.
+vec3f RayTracer::shadeHit( Scene *scene, const ray& r, const isect& i,
+	const vec3f& thresh, int depth, double prev_index )
+{
+	// An intersection occured!  We've got work to do.  For now,
+	// this code gets the material for the surface that was intersected,
+	// and asks that material to provide a color for the ray.  
+
+	// This is a great place to insert code for recursive ray tracing.
+	// Instead of just returning the result of shade(), add some
+	// more steps: add in the contributions from reflected and refracted
+	// rays.
+
+	Material scratch;
+	const Material& m = i.getMaterial( scratch );
+	vec3f incidentColor;
+	if (objectStatsEnabled()) {
+		double start = timelineNow();
+		incidentColor = m.shade(scene, r, i, m_lighting);
+		threadObjectCosts(scene->getNumOwners())[i.obj->getOwnerIndex()].shadeSeconds += timelineNow() - start;
+	} else
+		incidentColor = m.shade(scene, r, i, m_lighting);
+	if (depth <= 0) {
+		return incidentColor;
+	}
+	
+	vec3f incidentDirection = r.getDirection().normalize();
+	
+	if (!m.kr.iszero()) {
+		vec3f reflectedPosition = r.at(i.t) + RAY_EPSILON * i.N.normalize();
+		vec3f reflectedDirection = (incidentDirection + 2 * (-incidentDirection.dot(i.N.normalize()) * i.N.normalize())).normalize();
+		ray reflectednRay(reflectedPosition, reflectedDirection);
+		RAY_STAT( STAT_REFLECTION_RAYS );
+		vec3f reflectedColor = traceRay(scene, reflectednRay, thresh, depth - 1, m.index);
+		incidentColor += prod(m.kr, reflectedColor);
+	}
+
+	if (!m.kt.iszero()) {
+		double n_i = (m.index == prev_index ? m.index : 1.0);
+		double n_t = (m.index == prev_index ? 1.0 : m.index);
+		double n_r = n_i / n_t;
+		double c = -i.N.dot(incidentDirection) / (incidentDirection.length() * i.N.length());
+		vec3f refractedPosition = r.at(i.t) - RAY_EPSILON * i.N.normalize();
+
+		if (1 - pow(n_r, 2) * (1 - pow(c, 2)) > RAY_EPSILON) {
+			vec3f refractedDirection = n_r * incidentDirection + (n_r * c - sqrt(1 - pow(n_r, 2) * (1 - pow(c, 2)))) * i.N;
+			ray refractedRay(refractedPosition, refractedDirection);
+			RAY_STAT( STAT_REFRACTION_RAYS );
+			vec3f refractedColor = traceRay(scene, refractedRay, thresh, depth - 1, m.index);
+			incidentColor += prod(m.kt, refractedColor);
+		}
+	}
+	
+
+	return clampColor( incidentColor );
+}
+
 RayTracer::RayTracer()
 {
 	buffer = NULL;
 	buffer_width = buffer_height = 256;
 	scene = NULL;
+	m_bOwnsScene = false;
+
+	m_hdrBuffer = NULL;
+	m_bHDR = false;
+	m_nExposure = 0.0;
+
+	m_nDepth = 0;
+	m_nAntialiasing = 0;
+	m_nJitter = 0;
+	m_nAdaptiveThreshold = 0.0;
+	m_nSuperSampling = 0;
+	m_nSeed = 0;
 
 	m_bSceneLoaded = false;
+	m_bCachePrimaryHits = false;
+	m_nGBufferPixels = 0;
+	m_nGBufferAntialiasing = 0;
+	m_nGBufferJitter = 0;
+
+	m_nHeatmap = HEATMAP_OFF;
 }
 
 
 RayTracer::~RayTracer()
 {
 	delete [] buffer;
-	delete scene;
+	delete [] m_hdrBuffer;
+	if( m_bOwnsScene )
+		delete scene;
 }
 
 void RayTracer::getBuffer( unsigned char *&buf, int &w, int &h )
@@ -112,7 +186,7 @@ void RayTracer::getBuffer( unsigned char *&buf, int &w, int &h )
 
 double RayTracer::aspectRatio()
 {
-	return scene ? scene->getCamera()->getAspectRatio() : 1;
+	return scene ? camera.getAspectRatio() : 1;
 }
 
 bool RayTracer::sceneLoaded()
@@ -122,38 +196,83 @@ bool RayTracer::sceneLoaded()
 
 bool RayTracer::loadScene( char* fn )
 {
+	Scene *loaded;
 	try
 	{
-		scene = readScene( fn );
+		loaded = readScene( fn );
 	}
-	catch( ParseError pe )
+	catch( ParseError& pe )
 	{
-		fl_alert( "ParseError: %s\n", pe );
+		cerr << "Parse error: " << pe << endl;
 		return false;
 	}
 
-	if( !scene )
+	if( !loaded )
 		return false;
-	
-	buffer_width = 256;
-	buffer_height = (int)(buffer_width / scene->getCamera()->getAspectRatio() + 0.5);
 
-	bufferSize = buffer_width * buffer_height * 3;
-	buffer = new unsigned char[ bufferSize ];
-	
+	setScene( loaded );
+	return true;
+}
+
+// Also used for scenes built in memory, e.g. by the benchmark's
+// generators.
+void RayTracer::setScene( Scene *s )
+{
+	attachScene( s, true );
+
 	// separate objects into bounded and unbounded
 	scene->initScene();
 	
 	// Add any specialized scene loading code here
+}
+
+void RayTracer::useScene( Scene *s )
+{
+	attachScene( s, false );
+}
+
+void RayTracer::attachScene( Scene *s, bool owned )
+{
+	if( m_bOwnsScene && scene != s )
+		delete scene;
+	scene = s;
+	m_bOwnsScene = owned;
+	camera = *scene->getCamera();
+
+	buffer_width = 256;
+	buffer_height = (int)(buffer_width / camera.getAspectRatio() + 0.5);
+
+	bufferSize = buffer_width * buffer_height * 3;
+	delete [] buffer;
+	buffer = new unsigned char[ bufferSize ];
+
+	// cached hits refer to the old scene's objects
+	m_gbuffer.clear();
+	m_nGBufferPixels = 0;
 	
 	m_bSceneLoaded = true;
-
-	return true;
 }
 
-void RayTracer::traceSetup( int w, int h )
+void RayTracer::traceSetup( int w, int h, bool keepImage )
 {
-	if( buffer_width != w || buffer_height != h )
+	if( !keepImage )
+	{
+		// streaming: tiles are traced into the caller's memory instead
+		buffer_width = w;
+		buffer_height = h;
+		bufferSize = 0;
+		delete [] buffer;
+		buffer = NULL;
+		delete [] m_hdrBuffer;
+		m_hdrBuffer = NULL;
+
+		m_nGBufferPixels = 0;
+		m_gbuffer.clear();
+		m_heat.clear();
+		return;
+	}
+
+	if( buffer_width != w || buffer_height != h || !buffer )
 	{
 		buffer_width = w;
 		buffer_height = h;
@@ -163,6 +282,28 @@ void RayTracer::traceSetup( int w, int h )
 		buffer = new unsigned char[ bufferSize ];
 	}
 	memset( buffer, 0, w*h*3 );
+
+	delete [] m_hdrBuffer;
+	m_hdrBuffer = NULL;
+	if( m_bHDR )
+	{
+		m_hdrBuffer = new float[ bufferSize ];
+		memset( m_hdrBuffer, 0, bufferSize * sizeof(float) );
+	}
+
+	// a full render follows, so start a fresh G-buffer for it
+	m_nGBufferPixels = 0;
+	m_nGBufferAntialiasing = m_nAntialiasing;
+	m_nGBufferJitter = m_nJitter;
+	if( m_bCachePrimaryHits )
+		m_gbuffer.assign( buffer_width * buffer_height * samplesPerPixel(), PrimaryHit() );
+	else
+		m_gbuffer.clear();
+
+	if( m_nHeatmap != HEATMAP_OFF )
+		m_heat.assign( buffer_width * buffer_height, 0.0f );
+	else
+		m_heat.clear();
 }
 
 void RayTracer::traceLines( int start, int stop )
@@ -174,12 +315,23 @@ void RayTracer::traceLines( int start, int stop )
 	if( stop > buffer_height )
 		stop = buffer_height;
 
+	ScopedTimer timer( "traceLines" );
 	for( int j = start; j < stop; ++j )
 		for( int i = 0; i < buffer_width; ++i )
 			tracePixel(i,j);
 }
 
 void RayTracer::tracePixel( int i, int j )
+{
+	if( !buffer )
+		return;
+
+	tracePixel( i, j, buffer + ( i + j * buffer_width ) * 3 );
+}
+
+// Trace pixel (i,j) of the buffer_width x buffer_height image and store
+// its RGB bytes at pixel.
+void RayTracer::tracePixel( int i, int j, unsigned char *pixel )
 {
 	vec3f col;
 	if( !scene )
@@ -189,19 +341,59 @@ void RayTracer::tracePixel( int i, int j )
 	double y = double(j) / double(buffer_height);
 	double width = 1.0 / double(buffer_width);
 	double height = 1.0 / double(buffer_height);
+
+	// the heatmap's cost measure starts here
+	float *heat = m_heat.empty() ? NULL : &m_heat[ i + j * buffer_width ];
+	double start = 0.0;
+	RayStatCounters before;
+	if( heat ) {
+		if( m_nHeatmap == HEATMAP_TIME )
+			start = timelineNow();
+		else
+			threadRayStats( before );
+	}
+
+	// adaptive supersampling picks its samples from the colours it sees,
+	// so only the fixed sampling patterns can be cached and re-shaded
+	PrimaryHit *hits = NULL;
+	if( !m_nSuperSampling && !m_gbuffer.empty() && m_nAntialiasing == m_nGBufferAntialiasing )
+		hits = &m_gbuffer[ ( i + j * buffer_width ) * samplesPerPixel() ];
 	
 	col = (m_nSuperSampling ? 
 		superTrace(width, height, x, y, m_nSuperSampling) : //BUGS
-		simpleTrace(width, height, x, y)
+		simpleTrace(width, height, x, y, hits)
 	);
 
+	if( hits )
+		++m_nGBufferPixels;
+
+	if( heat )
+		*heat = pixelCost( start, before );
+
 	//col = trace( scene,x,y );
 
-	unsigned char *pixel = buffer + ( i + j * buffer_width ) * 3;
+	storePixel( i, j, col, pixel );
+}
 
-	pixel[0] = (int)( 255.0 * col[0]);
-	pixel[1] = (int)( 255.0 * col[1]);
-	pixel[2] = (int)( 255.0 * col[2]);
+// Colours are kept in [0,1] all the way through the recursion for 8-bit
+// output; the HDR buffer keeps the unclamped radiance instead.
+vec3f RayTracer::clampColor( const vec3f& col ) const
+{
+	return m_bHDR ? col : col.clamp();
+}
+
+void RayTracer::storePixel( int i, int j, const vec3f& col, unsigned char *pixel )
+{
+	if( m_bHDR ) {
+		float hdr[3] = { (float)col[0], (float)col[1], (float)col[2] };
+		if( m_hdrBuffer )
+			memcpy( m_hdrBuffer + ( i + j * buffer_width ) * 3, hdr, sizeof(hdr) );
+		::toneMap( hdr, pixel, 3, m_nExposure );
+	} else {
+		pixel[0] = (int)( 255.0 * col[0]);
+		pixel[1] = (int)( 255.0 * col[1]);
+		pixel[2] = (int)( 255.0 * col[2]);
+	}
 }
 
 vec3f RayTracer::superTrace(double width, double height, double x, double y, int depth)
@@ -249,7 +441,7 @@ vec3f RayTracer::superTrace(double width, double height, double x, double y, int
 	}
 }
 
-vec3f RayTracer::simpleTrace(double width, double height, double x, double y)
+vec3f RayTracer::simpleTrace(double width, double height, double x, double y, PrimaryHit *hits)
 {
 	vec3f col;
 	vec3f a[9];
@@ -258,34 +450,35 @@ vec3f RayTracer::simpleTrace(double width, double height, double x, double y)
 	double sub_height = height / 2.0;
 	if (m_nAntialiasing) {
 		if (m_nJitter) {
+			SampleRandom rng( m_nSeed, x, y );
 			for (int i = 0; i<18; i++)
 			{
-				m[i] = 2.0*(((double)((rand() + i + (int)(y * 1000)) % 5)) / 5.0 - 0.5);
+				m[i] = 2.0*(((double)(rng.next() % 5)) / 5.0 - 0.5);
 			}
-			a[0] = trace(scene, x - sub_width + m[0] * sub_width / 2.0, y - sub_height + m[9] * sub_height / 2.0);
-			a[1] = trace(scene, x - sub_width + m[1] * sub_width / 2.0, y + m[10] * sub_height / 2.0);
-			a[2] = trace(scene, x - sub_width + m[2] * sub_width / 2.0, y + sub_height + m[11] * sub_height / 2.0);
-			a[3] = trace(scene, x + m[3] * sub_width / 2.0, y - sub_height + m[12] * sub_height / 2.0);
-			a[4] = trace(scene, x + m[4] * sub_width / 2.0, y + m[13] * sub_height / 2.0);
-			a[5] = trace(scene, x + m[5] * sub_width / 2.0, y + sub_height + m[14] * sub_height / 2.0);
-			a[6] = trace(scene, x + sub_width + m[6] * sub_width / 2.0, y - sub_height + m[15] * sub_height / 2.0);
-			a[7] = trace(scene, x + sub_width + m[7] * sub_width / 2.0, y + m[16] * sub_height / 2.0);
-			a[8] = trace(scene, x + sub_width + m[8] * sub_width / 2.0, y + sub_height + m[17] * sub_height / 2.0);
+			a[0] = trace(scene, x - sub_width + m[0] * sub_width / 2.0, y - sub_height + m[9] * sub_height / 2.0, hits ? &hits[0] : NULL);
+			a[1] = trace(scene, x - sub_width + m[1] * sub_width / 2.0, y + m[10] * sub_height / 2.0, hits ? &hits[1] : NULL);
+			a[2] = trace(scene, x - sub_width + m[2] * sub_width / 2.0, y + sub_height + m[11] * sub_height / 2.0, hits ? &hits[2] : NULL);
+			a[3] = trace(scene, x + m[3] * sub_width / 2.0, y - sub_height + m[12] * sub_height / 2.0, hits ? &hits[3] : NULL);
+			a[4] = trace(scene, x + m[4] * sub_width / 2.0, y + m[13] * sub_height / 2.0, hits ? &hits[4] : NULL);
+			a[5] = trace(scene, x + m[5] * sub_width / 2.0, y + sub_height + m[14] * sub_height / 2.0, hits ? &hits[5] : NULL);
+			a[6] = trace(scene, x + sub_width + m[6] * sub_width / 2.0, y - sub_height + m[15] * sub_height / 2.0, hits ? &hits[6] : NULL);
+			a[7] = trace(scene, x + sub_width + m[7] * sub_width / 2.0, y + m[16] * sub_height / 2.0, hits ? &hits[7] : NULL);
+			a[8] = trace(scene, x + sub_width + m[8] * sub_width / 2.0, y + sub_height + m[17] * sub_height / 2.0, hits ? &hits[8] : NULL);
 			col[0] = col[1] = col[2] = 0;
 			for (int i = 0; i<9; i++)
 				col += a[i];
 			col /= 9;
 		}
 		else {
-			a[0] = trace(scene, x - sub_width, y - sub_height);
-			a[1] = trace(scene, x - sub_width, y);
-			a[2] = trace(scene, x - sub_width, y + sub_height);
-			a[3] = trace(scene, x, y - sub_height);
-			a[4] = trace(scene, x, y);
-			a[5] = trace(scene, x, y + sub_height);
-			a[6] = trace(scene, x + sub_width, y - sub_height);
-			a[7] = trace(scene, x + sub_width, y);
-			a[8] = trace(scene, x + sub_width, y + sub_height);
+			a[0] = trace(scene, x - sub_width, y - sub_height, hits ? &hits[0] : NULL);
+			a[1] = trace(scene, x - sub_width, y, hits ? &hits[1] : NULL);
+			a[2] = trace(scene, x - sub_width, y + sub_height, hits ? &hits[2] : NULL);
+			a[3] = trace(scene, x, y - sub_height, hits ? &hits[3] : NULL);
+			a[4] = trace(scene, x, y, hits ? &hits[4] : NULL);
+			a[5] = trace(scene, x, y + sub_height, hits ? &hits[5] : NULL);
+			a[6] = trace(scene, x + sub_width, y - sub_height, hits ? &hits[6] : NULL);
+			a[7] = trace(scene, x + sub_width, y, hits ? &hits[7] : NULL);
+			a[8] = trace(scene, x + sub_width, y + sub_height, hits ? &hits[8] : NULL);
 			col[0] = col[1] = col[2] = 0;
 			for (int i = 0; i<9; i++)
 				col += a[i];
@@ -294,17 +487,78 @@ vec3f RayTracer::simpleTrace(double width, double height, double x, double y)
 	}
 	else {
 		if (m_nJitter) {
-			m[0] = 2.0*(((double)((rand() + (int)(x * 1000)) % 3)) / 3.0 - 0.5);
-			m[1] = 2.0*(((double)((rand() + (int)(y * 1000)) % 3)) / 3.0 - 0.5);
-			col = trace(scene, x + m[0] * sub_width, y + m[1] * sub_height);
+			SampleRandom rng( m_nSeed, x, y );
+			m[0] = 2.0*(((double)(rng.next() % 3)) / 3.0 - 0.5);
+			m[1] = 2.0*(((double)(rng.next() % 3)) / 3.0 - 0.5);
+			col = trace(scene, x + m[0] * sub_width, y + m[1] * sub_height, hits);
 		}
 		else {
-			col = trace(scene, x, y);
+			col = trace(scene, x, y, hits);
 		}
 	}
 	return col;
 }
 
+int RayTracer::samplesPerPixel()
+{
+	// simpleTrace fires a 3x3 grid when antialiasing, else a single ray
+	return m_nGBufferAntialiasing ? 9 : 1;
+}
+
+bool RayTracer::canReshade()
+{
+	return scene && !m_gbuffer.empty()
+		&& m_nGBufferPixels == buffer_width * buffer_height
+		&& !m_nSuperSampling
+		&& m_nAntialiasing == m_nGBufferAntialiasing
+		&& m_nJitter == m_nGBufferJitter
+		&& ( m_hdrBuffer != NULL ) == m_bHDR
+		&& m_nHeatmap == HEATMAP_OFF;
+}
+
+void RayTracer::reshadeLines( int start, int stop )
+{
+	if( !canReshade() )
+		return;
+
+	if( stop > buffer_height )
+		stop = buffer_height;
+
+	for( int j = start; j < stop; ++j )
+		for( int i = 0; i < buffer_width; ++i )
+			reshadePixel(i,j);
+}
+
+// Same result as tracePixel, but the primary rays are taken from the
+// G-buffer instead of being intersected against the scene again.
+void RayTracer::reshadePixel( int i, int j )
+{
+	int spp = samplesPerPixel();
+	const PrimaryHit *hits = &m_gbuffer[ ( i + j * buffer_width ) * spp ];
+
+	vec3f col;
+	for( int k = 0; k < spp; ++k ) {
+		if( hits[k].hit )
+			col += clampColor( shadeHit( scene, hits[k].r, hits[k].i, vec3f(1.0,1.0,1.0), m_nDepth, 1.0 ) );
+	}
+	col /= spp;
+
+	storePixel( i, j, col, buffer + ( i + j * buffer_width ) * 3 );
+}
+
+// Re-quantize the whole 8-bit image from the HDR buffer, e.g. after the
+// exposure has changed.  Nothing is re-traced.
+void RayTracer::toneMap()
+{
+	if( m_hdrBuffer && buffer )
+		::toneMap( m_hdrBuffer, buffer, (size_t)buffer_width * buffer_height * 3, m_nExposure );
+}
+
+void RayTracer::setSeed(unsigned int seed)
+{
+	m_nSeed = seed;
+}
+
 void RayTracer::setDepth(int i)
 {
 	m_nDepth = i;
@@ -317,15 +571,15 @@ void RayTracer::setAntialiasing(int i)
 
 void RayTracer::setAmbientLightRed(double d)
 {
-	this->scene->setAmbientLightRed(d);
+	m_lighting.ambient[0] = d;
 }
 void RayTracer::setAmbientLightGreen(double d)
 {
-	this->scene->setAmbientLightGreen(d);
+	m_lighting.ambient[1] = d;
 }
 void RayTracer::setAmbientLightBlue(double d)
 {
-	this->scene->setAmbientLightBlue(d);
+	m_lighting.ambient[2] = d;
 }
 void RayTracer::setJitter(int i)
 {
@@ -337,20 +591,107 @@ void RayTracer::setAdaptiveThreshold(double d)
 }
 void RayTracer::setConstantAttenuationCoefficient(double d)
 {
-	this->scene->setConstantAttenuationCoefficient(d);
-	this->scene->setCustomDistanceAttenuation(true);
+	m_lighting.constantAttenuation = d;
+	m_lighting.customAttenuation = true;
 }
 void RayTracer::setLinearAttenuationCoefficient(double d)
 {
-	this->scene->setLinearAttenuationCoefficient(d);
-	this->scene->setCustomDistanceAttenuation(true);
+	m_lighting.linearAttenuation = d;
+	m_lighting.customAttenuation = true;
 }
 void RayTracer::setQuadraticAttenuationCoefficient(double d)
 {
-	this->scene->setQuadraticAttenuationCoefficient(d);
-	this->scene->setCustomDistanceAttenuation(true);
+	m_lighting.quadraticAttenuation = d;
+	m_lighting.customAttenuation = true;
 }
 void RayTracer::setSuperSampling(int i)
 {
 	m_nSuperSampling = i;
-}
\ No newline at end of file
+}
+void RayTracer::setHDR(bool b)
+{
+	m_bHDR = b;
+	m_lighting.clampLights = !b;
+}
+void RayTracer::setExposure(double d)
+{
+	m_nExposure = d;
+}
+void RayTracer::getHDRBuffer( float *&buf, int &w, int &h )
+{
+	buf = m_hdrBuffer;
+	w = buffer_width;
+	h = buffer_height;
+}
+void RayTracer::setCachePrimaryHits(bool b)
+{
+	m_bCachePrimaryHits = b;
+}
+bool RayTracer::heatmapSupported( HeatmapMetric m )
+{
+	return m == HEATMAP_OFF || m == HEATMAP_TIME || rayStatsEnabled();
+}
+
+void RayTracer::setHeatmap( HeatmapMetric m )
+{
+	m_nHeatmap = heatmapSupported( m ) ? m : HEATMAP_OFF;
+}
+
+const float *RayTracer::getHeatmapValues( int &w, int &h )
+{
+	w = buffer_width;
+	h = buffer_height;
+	return m_heat.empty() ? NULL : &m_heat[0];
+}
+
+// The cost of the pixel whose measure began with start (the clock) or
+// before (this thread's counters).
+float RayTracer::pixelCost( double start, const RayStatCounters& before ) const
+{
+	if( m_nHeatmap == HEATMAP_TIME )
+		return (float)( timelineNow() - start );
+
+	RayStatCounters after;
+	threadRayStats( after );
+	int first = m_nHeatmap == HEATMAP_RAYS ? STAT_PRIMARY_RAYS : STAT_BBOX_TESTS;
+	int last = m_nHeatmap == HEATMAP_RAYS ? STAT_SHADOW_RAYS : STAT_TRIANGLE_TESTS;
+	unsigned long long n = 0;
+	for( int s = first; s <= last; ++s )
+		n += after.count[s] - before.count[s];
+	return (float)n;
+}
+
+// Blue (cheap) through cyan, green and yellow to red (expensive).
+static vec3f heatColor( double v )
+{
+	static const double ramp[5][3] = {
+		{ 0.0, 0.0, 1.0 }, { 0.0, 1.0, 1.0 }, { 0.0, 1.0, 0.0 }, { 1.0, 1.0, 0.0 }, { 1.0, 0.0, 0.0 }
+	};
+	v = max( 0.0, min( 1.0, v ) ) * 4.0;
+	int k = min( (int)v, 3 );
+	double f = v - k;
+	return vec3f( ramp[k][0] + f * ( ramp[k+1][0] - ramp[k][0] ),
+		ramp[k][1] + f * ( ramp[k+1][1] - ramp[k][1] ),
+		ramp[k][2] + f * ( ramp[k+1][2] - ramp[k][2] ) );
+}
+
+void RayTracer::heatmapImage()
+{
+	if( m_heat.empty() || !buffer )
+		return;
+
+	// Scale to the 99th percentile so a few outliers don't turn the
+	// rest of the frame blue; anything above it is drawn red.
+	vector<float> sorted( m_heat );
+	size_t k = ( sorted.size() - 1 ) * 99 / 100;
+	nth_element( sorted.begin(), sorted.begin() + k, sorted.end() );
+	double scale = sorted[k] > 0.0f ? sorted[k] : *max_element( sorted.begin(), sorted.end() );
+	if( scale <= 0.0 )
+		scale = 1.0;
+
+	for( size_t p = 0; p < m_heat.size(); ++p ) {
+		vec3f col = heatColor( m_heat[p] / scale );
+		for( int c = 0; c < 3; ++c )
+			buffer[ p * 3 + c ] = (unsigned char)( 255.0 * col[c] );
+	}
+}
@@ -1,32 +1,93 @@
 #ifndef __RAYTRACER_H__
 #define __RAYTRACER_H__
 
-// The main ray tracer.
+// The main ray tracer.  It and what it uses (scene/, SceneObjects/,
+// fileio/, stats/ and TileRenderer) are the renderer proper: they don't
+// touch the UI or any global tracer, so a render-farm worker can link
+// them alone and run several RayTracers in one process.  The FLTK app
+// (ui/) and the command line (main.cpp) sit on top.  Only the optional
+// instrumentation in stats/ is process-wide.
+
+#include <vector>
+#include <atomic>
 
 #include "scene/scene.h"
+#include "scene/light.h"
 #include "scene/ray.h"
+#include "stats/raystats.h"
+
+// A cached primary sample: the camera ray and whatever it struck first.
+// Kept per pixel so that lighting changes can be re-shaded without
+// re-intersecting the scene.
+struct PrimaryHit
+{
+	PrimaryHit()
+		: r( vec3f(0,0,0), vec3f(0,0,0) ), hit( false ) {}
+
+	ray r;
+	isect i;
+	bool hit;
+};
 
 class RayTracer
 {
 public:
+	// What the heatmap diagnostic shows per pixel.  Rays and tests come
+	// from the ray counters, so they need a RAY_STATS build.
+	enum HeatmapMetric
+	{
+		HEATMAP_OFF,
+		HEATMAP_TIME,		// wall-clock seconds
+		HEATMAP_RAYS,		// rays of every kind
+		HEATMAP_TESTS		// bounding box and primitive intersection tests
+	};
+
     RayTracer();
     ~RayTracer();
 
-    vec3f trace( Scene *scene, double x, double y );
+    vec3f trace( Scene *scene, double x, double y, PrimaryHit *hit = NULL );
 	vec3f traceRay( Scene *scene, const ray& r, const vec3f& thresh, int depth, double prev_index );
+	vec3f shadeHit( Scene *scene, const ray& r, const isect& i, const vec3f& thresh, int depth, double prev_index );
 
 
 	void getBuffer( unsigned char *&buf, int &w, int &h );
+
+	// Linear radiance, 3 floats per pixel, when HDR rendering is on
+	// (setHDR before traceSetup); NULL otherwise.
+	void getHDRBuffer( float *&buf, int &w, int &h );
+	void toneMap();
 	double aspectRatio();
-	void traceSetup( int w, int h );
+	// keepImage = false sets up a w x h render without allocating the
+	// image buffer, for callers that trace tiles into memory of their own
+	void traceSetup( int w, int h, bool keepImage = true );
 	void traceLines( int start = 0, int stop = 10000000 );
 	void tracePixel( int i, int j );
+	void tracePixel( int i, int j, unsigned char *pixel );
 	vec3f superTrace(double width, double height, double x, double y, int depth);
-	vec3f simpleTrace(double width, double height, double x, double y);
+	vec3f simpleTrace(double width, double height, double x, double y, PrimaryHit *hits = NULL);
+
+	// Re-shade from the primary hits cached by the last full render.
+	// Only valid when canReshade() is true, i.e. the image size and
+	// the sampling pattern haven't changed since then.
+	bool canReshade();
+	void reshadeLines( int start = 0, int stop = 10000000 );
+	void reshadePixel( int i, int j );
 
 	bool loadScene( char* fn );
+	// Take over s (it is deleted with the tracer) in place of any loaded scene.
+	void setScene( Scene *s );
+	// Render s, which has been through initScene and stays the caller's:
+	// e.g. one cached scene shared by several tracers at once.
+	void useScene( Scene *s );
+	const Scene *getScene() const { return scene; }
+
+	// This tracer's view: a copy of the scene's camera, made when the
+	// scene is set, that can be moved without touching the scene.
+	Camera *getCamera() { return &camera; }
 
 	bool sceneLoaded();
+	// The ambient light and attenuation overrides are this tracer's own;
+	// setting them never touches a scene other tracers may be using.
 	void setAmbientLightRed(double d);
 	void setAmbientLightGreen(double d);
 	void setAmbientLightBlue(double d);
@@ -39,23 +100,62 @@ public:
 	void			setLinearAttenuationCoefficient(double d);
 	void			setQuadraticAttenuationCoefficient(double d);
 	void setSuperSampling(int i);
+	// Jitter is a function of the seed and the sample position only, so
+	// any part of an image can be re-traced to the same result.
+	void setSeed(unsigned int seed);
+	unsigned int getSeed() const { return m_nSeed; }
+	void setCachePrimaryHits(bool b);
+	void setHDR(bool b);
+	void setExposure(double d);
+
+	// With a metric set, every traced pixel records its cost (set it
+	// before traceSetup).  Once the image is done, heatmapImage() paints
+	// the 8-bit buffer with a false-colour picture of the costs.
+	static bool heatmapSupported( HeatmapMetric m );
+	void setHeatmap( HeatmapMetric m );
+	HeatmapMetric getHeatmap() const { return m_nHeatmap; }
+	void heatmapImage();
+	// One raw cost per pixel, rows bottom-up; NULL if none were recorded.
+	const float *getHeatmapValues( int &w, int &h );
 
 private:
+	vec3f clampColor( const vec3f& col ) const;
+	float pixelCost( double start, const RayStatCounters& before ) const;
+	void attachScene( Scene *s, bool owned );
+	void storePixel( int i, int j, const vec3f& col, unsigned char *pixel );
+
 	unsigned char *buffer;
 	int buffer_width, buffer_height;
 	int bufferSize;
 	Scene *scene;
+	bool m_bOwnsScene;
+	Camera camera;
 
 	int m_nDepth;
 	int m_nAntialiasing;
 	int         m_nJitter;
 	double      m_nAdaptiveThreshold;
-	double      m_nConstantAttenuationCoefficient;
-	double      m_nLinearAttenuationCoefficient;
-	double      m_nQuadraticAttenuationCoefficient;
+	LightingOptions m_lighting;		// in place of the shared scene's
 	int m_nSuperSampling;
+	unsigned int m_nSeed;
 
 	bool m_bSceneLoaded;
+	bool m_bCachePrimaryHits;
+
+	// unclamped float image, kept alongside the 8-bit one when m_bHDR
+	float *m_hdrBuffer;
+	bool m_bHDR;
+	double m_nExposure;
+
+	// primary hit G-buffer, samplesPerPixel() entries per pixel
+	int samplesPerPixel();
+	vector<PrimaryHit> m_gbuffer;
+	std::atomic<int> m_nGBufferPixels;
+	int m_nGBufferAntialiasing;
+	int m_nGBufferJitter;
+
+	HeatmapMetric m_nHeatmap;
+	vector<float> m_heat;
 };
 
 #endif // __RAYTRACER_H__
@@ -2,9 +2,12 @@
 #include <assert.h>
 
 #include "Box.h"
+#include "../stats/raystats.h"
 
 bool Box::intersectLocal( const ray& r, isect& i ) const
 {
+	RAY_STAT( STAT_BOX_TESTS );
+
 	// YOUR CODE HERE:
     // Add box intersection code here.
 	// it currently ignores all boxes and just returns false.
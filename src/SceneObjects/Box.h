@@ -7,13 +7,14 @@ class Box
 	: public MaterialSceneObject
 {
 public:
-	Box( Scene *scene, Material *mat )
+	Box( Scene *scene, MaterialID mat )
 		: MaterialSceneObject( scene, mat )
 	{
 	}
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual const char *getTypeName() const { return "box"; }
     virtual BoundingBox ComputeLocalBoundingBox()
     {
         BoundingBox localbounds;
@@ -23,4 +24,6 @@ public:
     }
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( Box )
+
 #endif // __BOX_H__
@@ -2,9 +2,12 @@
 #include <cmath>
 
 #include "Cone.h"
+#include "../stats/raystats.h"
 
 bool Cone::intersectLocal( const ray& r, isect& i ) const
 {
+	RAY_STAT( STAT_CONE_TESTS );
+
 	i.obj = this;
 
 	if( intersectCaps( r, i ) ) {
@@ -12,6 +15,7 @@ bool Cone::intersectLocal( const ray& r, isect& i ) const
 		if( intersectBody( r, ii ) ) {
 			if( ii.t < i.t ) {
 				i = ii;
+				RAY_STAT( STAT_ISECT_COPIES );
 				i.obj = this;
 			}
 		}
@@ -42,6 +46,12 @@ bool Cone::intersectBody( const ray& r, isect& i ) const
 	double t1 = (-b - disc) / (2.0 * a);
 	double t2 = (-b + disc) / (2.0 * a);
 
+	// a is negative for rays steeper than the side, and then the roots
+	// come out the other way round
+	if( t1 > t2 ) {
+		swap( t1, t2 );
+	}
+
 	if( t2 < RAY_EPSILON ) {
 		return false;
 	}
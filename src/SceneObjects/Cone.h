@@ -7,7 +7,7 @@ class Cone
 	: public MaterialSceneObject
 {
 public:
-	Cone( Scene *scene, Material *mat, 
+	Cone( Scene *scene, MaterialID mat, 
 			double h = 1.0, double br = 1.0, double tr = 0.0, 
 			bool cap = false )
 		: MaterialSceneObject( scene, mat )
@@ -22,6 +22,7 @@ public:
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual const char *getTypeName() const { return "cone"; }
 
     virtual BoundingBox ComputeLocalBoundingBox()
     {
@@ -36,6 +37,11 @@ public:
 	bool intersectBody( const ray& r, isect& i ) const;
 	bool intersectCaps( const ray& r, isect& i ) const;
 
+	double getHeight() const { return height; }
+	double getBottomRadius() const { return b_radius; }
+	double getTopRadius() const { return t_radius; }
+	bool isCapped() const { return capped; }
+
 
 protected:
 	void computeABC()
@@ -57,4 +63,6 @@ protected:
 
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( Cone )
+
 #endif // __CONE_H__
@@ -1,9 +1,12 @@
 #include <cmath>
 
 #include "Cylinder.h"
+#include "../stats/raystats.h"
 
 bool Cylinder::intersectLocal( const ray& r, isect& i ) const
 {
+	RAY_STAT( STAT_CYLINDER_TESTS );
+
 	i.obj = this;
 
 	if( intersectCaps( r, i ) ) {
@@ -11,6 +14,7 @@ bool Cylinder::intersectLocal( const ray& r, isect& i ) const
 		if( intersectBody( r, ii ) ) {
 			if( ii.t < i.t ) {
 				i = ii;
+				RAY_STAT( STAT_ISECT_COPIES );
 				i.obj = this;
 			}
 		}
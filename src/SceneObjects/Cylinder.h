@@ -7,13 +7,14 @@ class Cylinder
 	: public MaterialSceneObject
 {
 public:
-	Cylinder( Scene *scene, Material *mat , bool cap = true)
+	Cylinder( Scene *scene, MaterialID mat , bool cap = true)
 		: MaterialSceneObject( scene, mat ), capped( cap )
 	{
 	}
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual const char *getTypeName() const { return "cylinder"; }
 
     virtual BoundingBox ComputeLocalBoundingBox()
     {
@@ -26,8 +27,12 @@ public:
     bool intersectBody( const ray& r, isect& i ) const;
 	bool intersectCaps( const ray& r, isect& i ) const;
 
+	bool isCapped() const { return capped; }
+
 protected:
 	bool capped;
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( Cylinder )
+
 #endif // __CYLINDER_H__
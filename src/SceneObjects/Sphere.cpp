@@ -1,9 +1,12 @@
 #include <cmath>
 
 #include "Sphere.h"
+#include "../stats/raystats.h"
 
 bool Sphere::intersectLocal( const ray& r, isect& i ) const
 {
+	RAY_STAT( STAT_SPHERE_TESTS );
+
 	vec3f v = -r.getPosition();
 	double b = v.dot(r.getDirection());
 	double discriminant = b*b - v.dot(v) + 1;
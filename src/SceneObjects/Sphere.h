@@ -7,13 +7,14 @@ class Sphere
 	: public MaterialSceneObject
 {
 public:
-	Sphere( Scene *scene, Material *mat )
+	Sphere( Scene *scene, MaterialID mat )
 		: MaterialSceneObject( scene, mat )
 	{
 	}
     
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual const char *getTypeName() const { return "sphere"; }
 
     virtual BoundingBox ComputeLocalBoundingBox()
     {
@@ -23,4 +24,7 @@ public:
         return localbounds;
     }
 };
+
+ARENA_TRIVIAL_DESTRUCTOR( Sphere )
+
 #endif // __SPHERE_H__
@@ -1,9 +1,12 @@
 #include <cmath>
 
 #include "Square.h"
+#include "../stats/raystats.h"
 
 bool Square::intersectLocal( const ray& r, isect& i ) const
 {
+	RAY_STAT( STAT_SQUARE_TESTS );
+
 	vec3f p = r.getPosition();
 	vec3f d = r.getDirection();
 
@@ -7,13 +7,14 @@ class Square
 	: public MaterialSceneObject
 {
 public:
-	Square( Scene *scene, Material *mat )
+	Square( Scene *scene, MaterialID mat )
 		: MaterialSceneObject( scene, mat )
 	{
 	}
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual const char *getTypeName() const { return "square"; }
 
     virtual BoundingBox ComputeLocalBoundingBox()
     {
@@ -24,4 +25,6 @@ public:
     }
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( Square )
+
 #endif // __SQUARE_H__
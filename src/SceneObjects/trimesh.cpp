@@ -1,22 +1,20 @@
 #include <cmath>
 #include <float.h>
+#include <map>
+#include <thread>
+#include <unordered_map>
 #include "trimesh.h"
-
-Trimesh::~Trimesh()
-{
-    for( Materials::iterator i = materials.begin(); i != materials.end(); ++i )
-    {
-        delete *i;
-    }
-}
+#include "../stats/raystats.h"
 
 // must add vertices, normals, and materials IN ORDER
 void Trimesh::addVertex( const vec3f &v )
 {
     vertices.push_back( v );
+    vertexData = &vertices[0];
+    numVertices = vertices.size();
 }
 
-void Trimesh::addMaterial( Material *m )
+void Trimesh::addMaterial( MaterialID m )
 {
     materials.push_back( m );
 }
@@ -24,17 +22,41 @@ void Trimesh::addMaterial( Material *m )
 void Trimesh::addNormal( const vec3f &n )
 {
     normals.push_back( n );
+    normalData = &normals[0];
+    numNormals = normals.size();
+}
+
+void Trimesh::swapVertices( vector<vec3f>& v, vector<vec3f>& n )
+{
+    vertices.clear();
+    normals.clear();
+    vertices.swap( v );
+    normals.swap( n );
+    vertexData = vertices.empty() ? NULL : &vertices[0];
+    numVertices = vertices.size();
+    normalData = normals.empty() ? NULL : &normals[0];
+    numNormals = normals.size();
+}
+
+void Trimesh::setVertexArrays( const vec3f *v, int nv, const vec3f *n, int nn )
+{
+    vertices.clear();
+    normals.clear();
+    vertexData = v;
+    numVertices = nv;
+    normalData = n;
+    numNormals = nn;
 }
 
 // Returns false if the vertices a,b,c don't all exist
 bool Trimesh::addFace( int a, int b, int c )
 {
-    int vcnt = vertices.size();
+    int vcnt = numVertices;
 
-    if( a >= vcnt || b >= vcnt || c >= vcnt )
+    if( a < 0 || b < 0 || c < 0 || a >= vcnt || b >= vcnt || c >= vcnt )
         return false;
 
-    TrimeshFace *newFace = new TrimeshFace( scene, new Material(*this->material), this, a, b, c );
+    TrimeshFace *newFace = scene->create<TrimeshFace>( scene, material, this, a, b, c );
     newFace->setTransform(this->transform);
     faces.push_back( newFace );
     scene->add(newFace);
@@ -46,9 +68,9 @@ Trimesh::doubleCheck()
 // Check to make sure that if we have per-vertex materials or normals
 // they are the right number.
 {
-    if( materials.size() && materials.size() != vertices.size() )
+    if( materials.size() && (int)materials.size() != numVertices )
         return "Bad Trimesh: Wrong number of materials.";
-    if( normals.size() && normals.size() != vertices.size() )
+    if( numNormals && numNormals != numVertices )
         return "Bad Trimesh: Wrong number of normals.";
 
     return 0;
@@ -59,12 +81,15 @@ Trimesh::doubleCheck()
 // intersection in bary.
 // Uses the algorithm and notation from _Graphic Gems 5_, p. 232.
 //
-// Calculates and returns the normal of the triangle too.
+// Calculates and returns the normal of the triangle too; the shading
+// normal and material are left to finishIntersection.
 bool TrimeshFace::intersectLocal( const ray& r, isect& i ) const
 {
-    const vec3f& a = parent->vertices[ids[0]];
-    const vec3f& b = parent->vertices[ids[1]];
-    const vec3f& c = parent->vertices[ids[2]];
+    RAY_STAT( STAT_TRIANGLE_TESTS );
+
+    vec3f a = parent->getVertex( ids[0] );
+    vec3f b = parent->getVertex( ids[1] );
+    vec3f c = parent->getVertex( ids[2] );
     
     vec3f bary;
     float t;
@@ -119,60 +144,448 @@ bool TrimeshFace::intersectLocal( const ray& r, isect& i ) const
 
     // if we get this far, we have an intersection.  Fill in the info.
     i.setT( t );
-    if(parent->normals.size())
+    i.setN( n );
+    i.bary = bary;
+    i.obj = this;
+    
+    return true;
+}
+
+// Interpolate the vertex normals at the closest hit.
+void TrimeshFace::finishIntersection( isect& i ) const
+{
+    const vec3f& bary = i.bary;
+
+    if( parent->numNormals )
     {
         // use interpolated normals
-        i.setN( (bary[0] * parent->normals[ids[0]]
-                 + bary[1] * parent->normals[ids[1]]
-                 + bary[2] * parent->normals[ids[2]]).normalize() );
-    } else {
-        i.setN( n );           // use face normal
+        vec3f n = ( bary[0] * parent->getNormal( ids[0] )
+                    + bary[1] * parent->getNormal( ids[1] )
+                    + bary[2] * parent->getNormal( ids[2] ) ).normalize();
+        i.setN( getWorldTransform().localToGlobalCoordsNormal( n ) );
     }
-    i.obj = this;
+}
+
+const Material& TrimeshFace::getMaterialAt( const isect& i, Material& scratch ) const
+{
+    if( !parent->hasVertexMaterials() )
+        return MaterialSceneObject::getMaterialAt( i, scratch );
 
     // linearly interpolate materials
-    if( parent->materials.size() )
+    RAY_STAT( STAT_MATERIAL_COPIES );
+    scratch = Material();
+    for( int jj = 0; jj < 3; ++jj )
+        scratch += i.bary[jj] * scene->getMaterial( parent->getVertexMaterial( ids[jj] ) );
+    return scratch;
+}
+
+// Octahedral normal encoding: the unit sphere is folded onto an octahedron
+// and flattened into a square, which two 16-bit numbers cover evenly.
+static inline float signNotZero( float f )
+{
+    return f < 0.0f ? -1.0f : 1.0f;
+}
+
+static unsigned int encodeOctahedral( const vec3f& n )
+{
+    double sum = fabs( n[0] ) + fabs( n[1] ) + fabs( n[2] );
+    if( sum == 0.0 )
+        return 0;
+
+    float x = (float)( n[0] / sum );
+    float y = (float)( n[1] / sum );
+    if( n[2] < 0.0 ) {
+        float fx = ( 1.0f - fabs( y ) ) * signNotZero( x );
+        float fy = ( 1.0f - fabs( x ) ) * signNotZero( y );
+        x = fx;
+        y = fy;
+    }
+
+    int qx = (int)floor( x * 32767.0f + 0.5f );
+    int qy = (int)floor( y * 32767.0f + 0.5f );
+    return ( (unsigned int)(unsigned short)(short)qx << 16 ) | (unsigned short)(short)qy;
+}
+
+static vec3f decodeOctahedral( unsigned int e )
+{
+    float x = (short)( e >> 16 ) / 32767.0f;
+    float y = (short)( e & 0xffff ) / 32767.0f;
+    float z = 1.0f - fabs( x ) - fabs( y );
+    if( z < 0.0f ) {
+        float fx = ( 1.0f - fabs( y ) ) * signNotZero( x );
+        float fy = ( 1.0f - fabs( x ) ) * signNotZero( y );
+        x = fx;
+        y = fy;
+    }
+    return vec3f( x, y, z ).normalize();
+}
+
+vec3f Trimesh::getNormal( int i ) const
+{
+    if( packedNormals.size() )
+        return decodeOctahedral( packedNormals[i] );
+    return normalData[i];
+}
+
+void Trimesh::compact( PositionEncoding positions )
+{
+    int cnt = numVertices;
+
+    if( positionEncoding == POSITIONS_DOUBLE && positions != POSITIONS_DOUBLE && cnt )
     {
-        Material *m = new Material();
-        for( int jj = 0; jj < 3; ++jj )
-            (*m) += bary[jj] * (*parent->materials[ ids[jj] ]);
-        i.setMaterial( m );
+        if( positions == POSITIONS_FLOAT ) {
+            floatPositions.resize( 3 * cnt );
+            for( int i = 0; i < cnt; ++i )
+                for( int k = 0; k < 3; ++k )
+                    floatPositions[3*i + k] = (float)vertexData[i][k];
+        } else {
+            vec3f lo = vertexData[0];
+            vec3f hi = vertexData[0];
+            for( int i = 1; i < cnt; ++i ) {
+                lo = minimum( lo, vertexData[i] );
+                hi = maximum( hi, vertexData[i] );
+            }
+            quantizeOrigin = lo;
+            for( int k = 0; k < 3; ++k )
+                quantizeStep[k] = ( hi[k] - lo[k] ) / 65535.0;
+
+            quantizedPositions.resize( 3 * cnt );
+            for( int i = 0; i < cnt; ++i )
+                for( int k = 0; k < 3; ++k )
+                    quantizedPositions[3*i + k] = quantizeStep[k] > 0.0
+                        ? (unsigned short)floor( ( vertexData[i][k] - lo[k] ) / quantizeStep[k] + 0.5 )
+                        : 0;
+        }
+
+        positionEncoding = positions;
+        Vertices().swap( vertices );
+        vertexData = NULL;
+    }
+
+    if( numNormals && packedNormals.empty() )
+    {
+        packedNormals.resize( numNormals );
+        for( int i = 0; i < numNormals; ++i )
+            packedNormals[i] = encodeOctahedral( normalData[i] );
+        Normals().swap( normals );
+        normalData = NULL;
+    }
+
+    if( materials.size() )
+    {
+        map<MaterialID, int> index;
+        vector<unsigned short> which( materials.size() );
+        Materials kept;
+        for( size_t i = 0; i < materials.size(); ++i )
+        {
+            map<MaterialID, int>::iterator m = index.find( materials[i] );
+            if( m == index.end() ) {
+                if( kept.size() > 0xffff )
+                    return;     // too many to index; leave them as they are
+                m = index.insert( make_pair( materials[i], (int)kept.size() ) ).first;
+                kept.push_back( materials[i] );
+            }
+            which[i] = m->second;
+        }
+
+        palette.swap( kept );
+        materialIndex.swap( which );
+        Materials().swap( materials );
+    }
+}
+
+size_t Trimesh::vertexBytes() const
+{
+    size_t bytes = floatPositions.size() * sizeof( float )
+        + quantizedPositions.size() * sizeof( unsigned short )
+        + packedNormals.size() * sizeof( unsigned int )
+        + palette.size() * sizeof( MaterialID )
+        + materialIndex.size() * sizeof( unsigned short )
+        + materials.size() * sizeof( MaterialID );
+    if( positionEncoding == POSITIONS_DOUBLE )
+        bytes += numVertices * sizeof( vec3f );
+    if( packedNormals.empty() )
+        bytes += numNormals * sizeof( vec3f );
+    return bytes;
+}
+
+// Copy vertex and normal arrays the mesh only points at into its own
+// vectors, so they can be grown.
+void Trimesh::takeOwnershipOfVertices()
+{
+    // vertices and normals are empty while the mesh points at mapped
+    // arrays (see setVertexArrays), so compare with data(), not &v[0]
+    if( numVertices && vertexData != vertices.data() ) {
+        vertices.assign( vertexData, vertexData + numVertices );
+        vertexData = vertices.data();
+    }
+    if( numNormals && normalData != normals.data() ) {
+        normals.assign( normalData, normalData + numNormals );
+        normalData = normals.data();
+    }
+}
+
+// Meshes smaller than this are not worth splitting between threads.
+static const int PARALLEL_GRAIN = 16384;
+
+// Run body( begin, end ) over [0, n) in contiguous slices, one per thread.
+template <class Body>
+static void parallelFor( int n, int numThreads, Body body )
+{
+    if( numThreads <= 0 )
+        numThreads = std::thread::hardware_concurrency();
+    if( numThreads > n / PARALLEL_GRAIN )
+        numThreads = n / PARALLEL_GRAIN;
+    if( numThreads <= 1 ) {
+        body( 0, n );
+        return;
+    }
+
+    vector<std::thread> threads;
+    for( int t = 0; t < numThreads; ++t )
+        threads.push_back( std::thread( body, (int)( (long long)n * t / numThreads ),
+                                        (int)( (long long)n * ( t + 1 ) / numThreads ) ) );
+    for( int t = 0; t < numThreads; ++t )
+        threads[t].join();
+}
+
+// Pack a cell's coordinates into a hash key, 21 bits each.
+static inline unsigned long long cellKey( long long x, long long y, long long z )
+{
+    const unsigned long long mask = ( 1ULL << 21 ) - 1;
+    return ( (unsigned long long)x & mask ) << 42 | ( (unsigned long long)y & mask ) << 21
+        | ( (unsigned long long)z & mask );
+}
+
+// Put vertices that lie within dist of each other in the same group:
+// group[v] is the lowest numbered vertex of v's group.  Vertices are
+// hashed into cells several times dist across, so a vertex only has to
+// look in the neighbouring cells it is within dist of, usually none.
+static void weldVertices( const vec3f *v, int n, double dist, vector<int>& group )
+{
+    group.resize( n );
+    if( dist <= 0.0 ) {
+        for( int i = 0; i < n; ++i )
+            group[i] = i;
+        return;
+    }
+
+    const double cellSize = 8.0 * dist;
+    double dist2 = dist * dist;
+
+    // chains of vertices by (hashed) cell; key collisions only cost time
+    std::unordered_map<unsigned long long, int> head;
+    head.reserve( n );
+    vector<int> next( n, -1 );
+
+    for( int i = 0; i < n; ++i )
+    {
+        long long cell[3];
+        int lo[3], hi[3];
+        for( int k = 0; k < 3; ++k )
+        {
+            double c = floor( v[i][k] / cellSize );
+            double offset = v[i][k] - c * cellSize;
+            cell[k] = (long long)c;
+            lo[k] = offset < dist ? -1 : 0;
+            hi[k] = cellSize - offset < dist ? 1 : 0;
+        }
+
+        group[i] = i;
+        for( int dx = lo[0]; dx <= hi[0] && group[i] == i; ++dx )
+        for( int dy = lo[1]; dy <= hi[1] && group[i] == i; ++dy )
+        for( int dz = lo[2]; dz <= hi[2] && group[i] == i; ++dz )
+        {
+            std::unordered_map<unsigned long long, int>::const_iterator h
+                = head.find( cellKey( cell[0] + dx, cell[1] + dy, cell[2] + dz ) );
+            if( h == head.end() )
+                continue;
+            for( int j = h->second; j >= 0; j = next[j] )
+            {
+                if( ( v[j] - v[i] ).length_squared() <= dist2 )
+                {
+                    group[i] = group[j];
+                    break;
+                }
+            }
+        }
+
+        unsigned long long key = cellKey( cell[0], cell[1], cell[2] );
+        std::unordered_map<unsigned long long, int>::iterator h = head.find( key );
+        if( h == head.end() ) {
+            head[key] = i;
+        } else {
+            next[i] = h->second;
+            h->second = i;
+        }
     }
-    
-    return true;
 }
 
 void
-Trimesh::generateNormals()
+Trimesh::generateNormals( const NormalOptions& opts )
 // Once you've loaded all the verts and faces, we can generate per
 // vertex normals by averaging the normals of the neighboring faces.
+//
+// The faces around each (welded) vertex are gathered into a compressed
+// list first, so every normal is a sum over its own neighbours and the
+// vertices can be done in parallel without locking.
 {
-    int cnt = vertices.size();
-    normals.resize( cnt );
-    int *numFaces = new int[ cnt ]; // the number of faces assoc. with each vertex
-    memset( numFaces, 0, sizeof(int)*cnt );
-    
-    for( Faces::iterator fi = faces.begin(); fi != faces.end(); ++fi )
-    {
-        vec3f a = vertices[(**fi)[0]];
-        vec3f b = vertices[(**fi)[1]];
-        vec3f c = vertices[(**fi)[2]];
-        
-        vec3f faceNormal = ((b-a).cross(c-a)).normalize();
-        
-        for( int i = 0; i < 3; ++i )
+    if( positionEncoding != POSITIONS_DOUBLE || packedNormals.size() )
+        return;     // already compacted
+
+    takeOwnershipOfVertices();
+
+    int cnt = numVertices;
+    int nf = faces.size();
+    int numThreads = opts.numThreads;
+
+    // face normals, with each corner's weight
+    vector<vec3f> faceNormal( nf );
+    vector<float> cornerWeight( 3 * nf );
+    parallelFor( nf, numThreads, [&]( int begin, int end ) {
+        for( int f = begin; f < end; ++f )
         {
-            normals[(**fi)[i]] += faceNormal;
-            ++numFaces[(**fi)[i]];
+            const int *ids = faces[f]->ids;
+            vec3f a = vertexData[ids[0]];
+            vec3f b = vertexData[ids[1]];
+            vec3f c = vertexData[ids[2]];
+
+            vec3f cross = (b-a).cross(c-a);
+            if( cross.iszero() ) {
+                // degenerate; contributes nothing
+                faceNormal[f] = vec3f();
+                cornerWeight[3*f] = cornerWeight[3*f+1] = cornerWeight[3*f+2] = 0.0f;
+                continue;
+            }
+            faceNormal[f] = cross.normalize();
+
+            if( opts.weighting == NormalOptions::AREA ) {
+                cornerWeight[3*f] = cornerWeight[3*f+1] = cornerWeight[3*f+2] = (float)cross.length();
+            } else if( opts.weighting == NormalOptions::ANGLE ) {
+                const vec3f *p[3] = { &a, &b, &c };
+                for( int k = 0; k < 3; ++k )
+                {
+                    vec3f e1 = *p[(k+1)%3] - *p[k];
+                    vec3f e2 = *p[(k+2)%3] - *p[k];
+                    double len = e1.length() * e2.length();
+                    double cosine = len > 0.0 ? ( e1 * e2 ) / len : 1.0;
+                    cornerWeight[3*f + k] = (float)acos( cosine < -1.0 ? -1.0 : ( cosine > 1.0 ? 1.0 : cosine ) );
+                }
+            } else {
+                cornerWeight[3*f] = cornerWeight[3*f+1] = cornerWeight[3*f+2] = 1.0f;
+            }
         }
-    }
+    } );
+
+    vector<int> group;
+    weldVertices( vertexData, cnt, opts.weldDistance, group );
 
-    for( int i = 0; i < cnt; ++i )
+    // corners around each group, in face order
+    vector<int> first( cnt + 1, 0 );
+    for( int f = 0; f < nf; ++f )
+        for( int k = 0; k < 3; ++k )
+            ++first[ group[ faces[f]->ids[k] ] + 1 ];
+    for( int g = 0; g < cnt; ++g )
+        first[g + 1] += first[g];
+    vector<int> corners( 3 * nf );
     {
-        if( numFaces[i] )
-            normals[i]  /= numFaces[i];
+        vector<int> fill( first.begin(), first.end() - 1 );
+        for( int f = 0; f < nf; ++f )
+            for( int k = 0; k < 3; ++k )
+                corners[ fill[ group[ faces[f]->ids[k] ] ]++ ] = 3*f + k;
     }
 
-    delete [] numFaces;
-}
+    // Sum the neighbours whose faces are within the crease angle of
+    // reference (all of them if reference is NULL).
+    double creaseCos = cos( opts.creaseAngle * 3.14159265358979323846 / 180.0 );
+    bool creases = opts.creaseAngle < 180.0;
+    bool average = opts.weighting == NormalOptions::UNIFORM;
+    auto gather = [&]( int g, const vec3f *reference ) -> vec3f {
+        vec3f sum;
+        int num = 0;
+        for( int i = first[g]; i < first[g + 1]; ++i )
+        {
+            int f = corners[i] / 3;
+            if( cornerWeight[ corners[i] ] == 0.0f )
+                continue;
+            if( reference && faceNormal[f] * *reference < creaseCos )
+                continue;
+            if( average )
+                sum += faceNormal[f];
+            else
+                sum += cornerWeight[ corners[i] ] * faceNormal[f];
+            ++num;
+        }
+        if( !num )
+            return sum;
+        if( average ) {
+            sum /= num;
+            return sum;
+        }
+        return sum.normalize();
+    };
+
+    normals.assign( cnt, vec3f() );
+
+    if( !creases ) {
+        // one normal per group, shared by all its vertices
+        vector<vec3f> groupNormal( cnt );
+        parallelFor( cnt, numThreads, [&]( int begin, int end ) {
+            for( int g = begin; g < end; ++g )
+                if( group[g] == g )
+                    groupNormal[g] = gather( g, NULL );
+        } );
+        parallelFor( cnt, numThreads, [&]( int begin, int end ) {
+            for( int v = begin; v < end; ++v )
+                normals[v] = groupNormal[ group[v] ];
+        } );
+    } else {
+        // one normal per corner, then split vertices whose corners disagree
+        vector<vec3f> cornerNormal( 3 * nf );
+        parallelFor( nf, numThreads, [&]( int begin, int end ) {
+            for( int f = begin; f < end; ++f )
+                for( int k = 0; k < 3; ++k )
+                    cornerNormal[3*f + k] = gather( group[ faces[f]->ids[k] ], &faceNormal[f] );
+        } );
 
+        bool splitMaterials = (int)materials.size() == cnt;
+        vector<bool> used( cnt, false );
+        vector<int> nextCopy( cnt, -1 );   // further copies of a vertex
+        for( int f = 0; f < nf; ++f )
+        {
+            for( int k = 0; k < 3; ++k )
+            {
+                const vec3f& n = cornerNormal[3*f + k];
+                int v = faces[f]->ids[k];
+                if( !used[v] ) {
+                    used[v] = true;
+                    normals[v] = n;
+                    continue;
+                }
+
+                int last = v;
+                while( !( normals[last] == n ) && nextCopy[last] >= 0 )
+                    last = nextCopy[last];
+                if( normals[last] == n ) {
+                    faces[f]->ids[k] = last;
+                    continue;
+                }
+
+                int copy = vertices.size();
+                vec3f position = vertices[v];
+                vertices.push_back( position );
+                normals.push_back( n );
+                nextCopy.push_back( -1 );
+                nextCopy[last] = copy;
+                if( splitMaterials )
+                    materials.push_back( materials[v] );
+                faces[f]->ids[k] = copy;
+            }
+        }
+    }
+
+    vertexData = vertices.empty() ? NULL : &vertices[0];
+    numVertices = vertices.size();
+    normalData = normals.empty() ? NULL : &normals[0];
+    numNormals = normals.size();
+}
@@ -9,44 +9,146 @@
 #include "../scene/scene.h"
 class TrimeshFace;
 
+// How Trimesh::generateNormals builds the vertex normals.  The defaults
+// give the plain average of the neighbouring face normals.
+struct NormalOptions
+{
+    enum Weighting { UNIFORM, AREA, ANGLE };
+
+    Weighting weighting;    // what each neighbouring face counts for
+    double weldDistance;    // vertices this close share a normal (0: off)
+    double creaseAngle;     // degrees; faces meeting more sharply than this
+                            // are not smoothed together (180: no creases)
+    int numThreads;         // 0: one per core
+
+    NormalOptions()
+        : weighting( UNIFORM ), weldDistance( 0.0 ), creaseAngle( 180.0 ),
+          numThreads( 0 ) {}
+};
+
 class Trimesh : public MaterialSceneObject
 {
     friend class TrimeshFace;
     typedef vector<vec3f> Normals;
     typedef vector<vec3f> Vertices;
     typedef vector<TrimeshFace*> Faces;
-    typedef vector<Material*> Materials;
+    typedef vector<MaterialID> Materials;
     Vertices vertices;
     Faces faces;
     Normals normals;
     Materials materials;
+
+    // What the faces actually read: either the vectors above or arrays
+    // owned by someone else (e.g. a memory-mapped .rayb file).
+    const vec3f *vertexData;
+    int numVertices;
+    const vec3f *normalData;
+    int numNormals;
+
 public:
-    Trimesh( Scene *scene, Material *mat, TransformNode *transform )
-        : MaterialSceneObject(scene, mat)
+    // How compact() stores vertex positions.
+    enum PositionEncoding
+    {
+        POSITIONS_DOUBLE,       // vec3f, as loaded
+        POSITIONS_FLOAT,        // 3 floats
+        POSITIONS_QUANTIZED     // 3 x 16 bits across the mesh's bounds
+    };
+
+private:
+    // The compact form.  Positions are decoded for every intersection
+    // test; normals and materials only for the closest hit.
+    PositionEncoding positionEncoding;
+    vector<float> floatPositions;
+    vector<unsigned short> quantizedPositions;
+    vec3f quantizeOrigin, quantizeStep;
+    vector<unsigned int> packedNormals;         // octahedral, 2 x 16 bits
+    Materials palette;                          // distinct vertex materials
+    vector<unsigned short> materialIndex;       // into palette, per vertex
+
+public:
+    Trimesh( Scene *scene, MaterialID mat, TransformNode *transform )
+        : MaterialSceneObject(scene, mat),
+          vertexData( NULL ), numVertices( 0 ),
+          normalData( NULL ), numNormals( 0 ),
+          positionEncoding( POSITIONS_DOUBLE )
     {
         this->transform = transform;
     }
 
-    ~Trimesh();
-    
     // must add vertices, normals, and materials IN ORDER
     void addVertex( const vec3f & );
-    void addMaterial( Material *m );
+    void addMaterial( MaterialID m );
     void addNormal( const vec3f & );
 
     bool addFace( int a, int b, int c );
 
+    // use vertex and normal arrays the mesh does not own instead of
+    // copying them in with addVertex/addNormal; they must outlive it
+    void setVertexArrays( const vec3f *v, int nv, const vec3f *n, int nn );
+
+    // take over filled vertex and normal vectors (leaving v and n empty)
+    // instead of adding them one at a time
+    void swapVertices( vector<vec3f>& v, vector<vec3f>& n );
+
+    int getNumVertices() const { return numVertices; }
+    int getNumNormals() const { return numNormals; }
+    int getNumFaces() const { return faces.size(); }
+    const TrimeshFace *getFace( int i ) const { return faces[i]; }
+    bool hasVertexMaterials() const { return materials.size() || palette.size(); }
+
+    virtual int getPrimitiveCount() const { return faces.size(); }
+    virtual const char *getTypeName() const { return "trimesh"; }
+
+    // These decode the compact form if the mesh has been compacted.
+    vec3f getVertex( int i ) const
+    {
+        switch( positionEncoding ) {
+        case POSITIONS_FLOAT:
+            return vec3f( floatPositions[3*i], floatPositions[3*i+1], floatPositions[3*i+2] );
+        case POSITIONS_QUANTIZED:
+            return quantizeOrigin + vec3f(
+                quantizeStep[0] * quantizedPositions[3*i],
+                quantizeStep[1] * quantizedPositions[3*i+1],
+                quantizeStep[2] * quantizedPositions[3*i+2] );
+        default:
+            return vertexData[i];
+        }
+    }
+    vec3f getNormal( int i ) const;
+    MaterialID getVertexMaterial( int i ) const
+    {
+        if( palette.size() )
+            return palette[ materialIndex[i] ];
+        return materials[i];
+    }
+
     char *doubleCheck();
+
+    // Re-encode the loaded mesh to save memory: positions as floats or
+    // quantized, normals octahedral in 32 bits, and vertex materials as
+    // 16-bit indices into a palette of the distinct ones.  Call this last;
+    // the mesh cannot be added to or have normals generated afterwards.
+    void compact( PositionEncoding positions );
+
+    // Bytes used by the vertex data (positions, normals, material refs).
+    size_t vertexBytes() const;
     
-    void generateNormals();
+    // Fill in one normal per vertex.  With a crease angle, vertices on a
+    // crease are split so each side gets its own normal; per-vertex
+    // materials must already be added so they can be split with them.
+    void generateNormals( const NormalOptions& opts = NormalOptions() );
+
+private:
+    void takeOwnershipOfVertices();
 };
 
 class TrimeshFace : public MaterialSceneObject
 {
+    friend class Trimesh;
     Trimesh *parent;
     int ids[3];
 public:
-    TrimeshFace( Scene *scene, Material *mat, Trimesh *parent, int a, int b, int c)
+    TrimeshFace( Scene *scene, MaterialID mat, Trimesh *parent, int a, int b, int c)
         : MaterialSceneObject( scene, mat )
     {
         this->parent = parent;
@@ -63,19 +165,30 @@ public:
     virtual bool intersectLocal( const ray& r, isect& i ) const;
 
     virtual bool hasBoundingBoxCapability() const { return true; }
+
+    virtual const Geometry *getOwner() const { return parent; }
+    virtual const char *getTypeName() const { return "triangle"; }
       
+    virtual void finishIntersection( isect& i ) const;
+    virtual const Material& getMaterialAt( const isect& i, Material& scratch ) const;
+
     virtual BoundingBox ComputeLocalBoundingBox()
     {
+        vec3f a = parent->getVertex( ids[0] );
+        vec3f b = parent->getVertex( ids[1] );
+        vec3f c = parent->getVertex( ids[2] );
+
         BoundingBox localbounds;
-        localbounds.max = maximum( parent->vertices[ids[0]], parent->vertices[ids[1]]);
-		localbounds.min = minimum( parent->vertices[ids[0]], parent->vertices[ids[1]]);
+        localbounds.max = maximum( a, b );
+		localbounds.min = minimum( a, b );
         
-        localbounds.max = maximum( parent->vertices[ids[2]], localbounds.max);
-		localbounds.min = minimum( parent->vertices[ids[2]], localbounds.min);
+        localbounds.max = maximum( c, localbounds.max);
+		localbounds.min = minimum( c, localbounds.min);
         return localbounds;
     }
     
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( TrimeshFace )
 
 #endif // TRIMESH_H__
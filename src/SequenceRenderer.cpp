@@ -0,0 +1,179 @@
+// Back-to-back rendering of an animation's frames on one loaded scene.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "SequenceRenderer.h"
+#include "RayTracer.h"
+#include "TileRenderer.h"
+#include "fileio/bitmap.h"
+#include "fileio/hdrimage.h"
+#include "scene/animation.h"
+#include "stats/timeline.h"
+
+SequenceSettings::SequenceSettings()
+	: width( 150 ), height( 0 ), first( 0 ), last( -1 ), depth( 0 ), antialiasing( 0 ),
+	  jitter( 0 ), superSampling( 0 ), exposure( 0.0 ), numThreads( 0 ), report( false )
+{
+}
+
+std::string sequenceFrameName( const std::string& outName, int frame )
+{
+	char num[32];
+
+	// a pattern: exactly one %d, with an optional zero-padded width
+	size_t pct = outName.find( '%' );
+	if( pct != std::string::npos ) {
+		size_t d = outName.find_first_not_of( "0123456789", pct + 1 );
+		if( d != std::string::npos && outName[d] == 'd' && outName.find( '%', d ) == std::string::npos ) {
+			snprintf( num, sizeof( num ), outName.substr( pct, d + 1 - pct ).c_str(), frame );
+			return outName.substr( 0, pct ) + num + outName.substr( d + 1 );
+		}
+	}
+
+	snprintf( num, sizeof( num ), "%04d", frame );
+	size_t dot = outName.find_last_of( '.' );
+	if( dot == std::string::npos || outName.find_first_of( "/\\", dot ) != std::string::npos )
+		return outName + num;
+	return outName.substr( 0, dot ) + num + outName.substr( dot );
+}
+
+// A tracer of its own on the shared scene, for one thread's frames.
+static RayTracer *makeTracer( Scene *scene, const SequenceSettings& s )
+{
+	RayTracer *tracer = new RayTracer();
+	tracer->useScene( scene );
+	if( s.height > 0 )
+		tracer->getCamera()->setAspectRatio( (double)s.width / s.height );
+
+	tracer->setDepth( s.depth );
+	tracer->setAntialiasing( s.antialiasing );
+	tracer->setJitter( s.jitter );
+	tracer->setSuperSampling( s.superSampling );
+	tracer->setExposure( s.exposure );
+	tracer->setHDR( isHDRFileName( sequenceFrameName( s.outName, 0 ).c_str() ) || s.exposure != 0.0 );
+	return tracer;
+}
+
+// Pose the camera for frame, render it on numThreads threads and write it.
+static bool renderFrame( RayTracer *tracer, const Animation& anim, int frame,
+	const SequenceSettings& s, int numThreads, std::mutex *reportLock )
+{
+	ScopedTimer timer( "frame", "frame", frame );
+	double start = timelineNow();
+
+	anim.poseCamera( frame, tracer->getCamera() );
+	int width = s.width;
+	int height = s.height > 0 ? s.height
+		: std::max( 1, (int)( width / tracer->aspectRatio() + 0.5 ) );
+	tracer->traceSetup( width, height );
+
+	if( numThreads == 1 ) {
+		tracer->traceLines( 0, height );
+	} else {
+		TileRenderer renderer( tracer );
+		renderer.start( numThreads );
+		renderer.wait();
+	}
+
+	std::string name = sequenceFrameName( s.outName, frame );
+	bool ok;
+	if( isHDRFileName( name.c_str() ) ) {
+		float *hdr;
+		tracer->getHDRBuffer( hdr, width, height );
+		ok = hdr && writeHDR( name.c_str(), width, height, hdr );
+	} else {
+		unsigned char *buf;
+		tracer->getBuffer( buf, width, height );
+		ok = writeBMP( (char *)name.c_str(), width, height, buf );
+	}
+
+	std::lock_guard<std::mutex> guard( *reportLock );
+	if( !ok )
+		fprintf( stderr, "error writing %s\n", name.c_str() );
+	else if( s.report )
+		fprintf( stderr, "frame %d: %.3f seconds\n", frame, timelineNow() - start );
+	return ok;
+}
+
+// Frames for the workers of a scene that stands still.
+struct FrameQueue
+{
+	FrameQueue( Scene *sc, const Animation& a, const SequenceSettings& s, int first, int l, std::mutex *lock )
+		: scene( sc ), anim( a ), settings( s ), next( first ), last( l ), ok( true ), reportLock( lock ) {}
+
+	Scene *scene;
+	const Animation& anim;
+	const SequenceSettings& settings;
+	std::atomic<int> next;
+	int last;
+	std::atomic<bool> ok;
+	std::mutex *reportLock;
+};
+
+static void frameWorker( FrameQueue *queue )
+{
+	nameTimelineThread( "frame worker" );
+
+	RayTracer *tracer = makeTracer( queue->scene, queue->settings );
+	int frame;
+	while( ( frame = queue->next++ ) <= queue->last ) {
+		if( !renderFrame( tracer, queue->anim, frame, queue->settings, 1, queue->reportLock ) )
+			queue->ok = false;
+	}
+	delete tracer;
+}
+
+bool renderSequence( Scene *scene, const Animation& anim, const SequenceSettings& s )
+{
+	int first = std::max( s.first, 0 );
+	int last = s.last < 0 ? anim.numFrames() - 1 : std::min( s.last, anim.numFrames() - 1 );
+
+	int numThreads = s.numThreads;
+	if( numThreads <= 0 )
+		numThreads = std::thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+
+	RayTracer *tracer = makeTracer( scene, s );
+	std::mutex reportLock;
+	bool ok = true;
+
+	// A frame with fewer tiles than this leaves threads idle at its end;
+	// if the scene itself stands still, render several such frames at once
+	// instead, each whole on one thread.
+	int width = s.width;
+	int height = s.height > 0 ? s.height : std::max( 1, (int)( width / tracer->aspectRatio() + 0.5 ) );
+	int tiles = ( ( width + TileRenderer::TILE_SIZE - 1 ) / TileRenderer::TILE_SIZE )
+		* ( ( height + TileRenderer::TILE_SIZE - 1 ) / TileRenderer::TILE_SIZE );
+	bool framesAtOnce = !anim.movesObjects() && numThreads > 1 && last > first && tiles < 2 * numThreads;
+
+	if( framesAtOnce ) {
+		FrameQueue queue( scene, anim, s, first, last, &reportLock );
+		std::vector<std::thread> workers;
+		for( int w = 0; w < std::min( numThreads, last - first + 1 ); ++w )
+			workers.push_back( std::thread( frameWorker, &queue ) );
+		for( size_t w = 0; w < workers.size(); ++w )
+			workers[w].join();
+		ok = queue.ok;
+	} else {
+		// moved objects are refitted in the shared scene, so their frames
+		// go one at a time
+		for( int frame = first; frame <= last; ++frame ) {
+			if( anim.movesObjects() ) {
+				anim.poseObjects( frame, scene );
+				scene->refit();
+			}
+			if( !renderFrame( tracer, anim, frame, s, numThreads, &reportLock ) )
+				ok = false;
+		}
+	}
+
+	delete tracer;
+	return ok;
+}
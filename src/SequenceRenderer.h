@@ -0,0 +1,45 @@
+#ifndef __SEQUENCERENDERER_H__
+#define __SEQUENCERENDERER_H__
+
+// Renders the frames of an Animation back to back from one loaded scene.
+// Nothing is parsed or set up again between frames: the camera is posed
+// on the tracer's own copy, and moved objects only have their transforms
+// and bounds refitted (Scene::refit).  Frames are cut into tiles for every
+// thread, except that small frames of a scene whose objects don't move
+// render whole, one per thread, side by side.
+
+#include <string>
+
+class Animation;
+class Scene;
+
+struct SequenceSettings
+{
+	SequenceSettings();
+
+	int width;
+	int height;				// 0: from the camera's aspect ratio
+	int first, last;		// inclusive; last < 0 runs to the end
+	int depth;
+	int antialiasing;
+	int jitter;
+	int superSampling;
+	double exposure;
+	int numThreads;			// 0: one per hardware core
+	bool report;			// a line on stderr per frame
+
+	// The frame files: a printf pattern with one %d (e.g. f%04d.bmp), or
+	// a plain name that gets a four-digit frame number before its
+	// extension.  .pfm or .hdr keeps the float image.
+	std::string outName;
+};
+
+// The file name of frame in a sequence written to outName.
+std::string sequenceFrameName( const std::string& outName, int frame );
+
+// Render settings.first..last of anim on scene, which has been through
+// initScene and must be the one anim was bound to.  Returns false if a
+// frame couldn't be written.
+bool renderSequence( Scene *scene, const Animation& anim, const SequenceSettings& settings );
+
+#endif // __SEQUENCERENDERER_H__
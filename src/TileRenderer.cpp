@@ -0,0 +1,166 @@
+// Multi-threaded tile rendering on top of RayTracer::tracePixel.
+
+#include <algorithm>
+#include <string.h>
+#include <utility>
+
+#include "TileRenderer.h"
+#include "RayTracer.h"
+#include "stats/timeline.h"
+
+const int TileRenderer::TILE_SIZE;
+
+TileRenderer::TileRenderer( RayTracer *tracer )
+	: raytracer( tracer ), m_buffer( NULL ), m_nWidth( 0 ), m_nHeight( 0 ),
+	  m_nTilesX( 0 ), m_nTilesY( 0 ), m_nNextTile( 0 ), m_nTilesDone( 0 ),
+	  m_nRunning( 0 ), m_bCancel( false ), m_callback( NULL ), m_callbackData( NULL ),
+	  m_nStart( 0.0 ), m_nFinish( 0.0 ), m_nThreads( 0 )
+{
+	for( int s = 0; s < NUM_RAY_STATS; ++s )
+		m_rays.count[s] = 0;
+}
+
+TileRenderer::~TileRenderer()
+{
+	stop();
+}
+
+void TileRenderer::start( int numThreads, TileCallback cb, void *data )
+{
+	stop();
+
+	raytracer->getBuffer( m_buffer, m_nWidth, m_nHeight );
+
+	m_nTilesX = ( m_nWidth + TILE_SIZE - 1 ) / TILE_SIZE;
+	m_nTilesY = ( m_nHeight + TILE_SIZE - 1 ) / TILE_SIZE;
+	m_nNextTile = 0;
+	m_nTilesDone = 0;
+	m_bCancel = false;
+	m_callback = cb;
+	m_callbackData = data;
+
+	if( numThreads <= 0 )
+		numThreads = std::thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+
+	m_nThreads = numThreads;
+	for( int s = 0; s < NUM_RAY_STATS; ++s )
+		m_rays.count[s] = 0;
+	m_nStart = m_nFinish = timelineNow();
+
+	m_nRunning = numThreads;
+	for( int i = 0; i < numThreads; ++i )
+		m_threads.push_back( std::thread( &TileRenderer::worker, this ) );
+}
+
+void TileRenderer::stop()
+{
+	m_bCancel = true;
+	wait();
+}
+
+void TileRenderer::wait()
+{
+	for( size_t i = 0; i < m_threads.size(); ++i )
+		m_threads[i].join();
+	m_threads.clear();
+}
+
+void TileRenderer::tileRect( int t, int& x, int& y, int& w, int& h ) const
+{
+	x = ( t % m_nTilesX ) * TILE_SIZE;
+	y = ( t / m_nTilesX ) * TILE_SIZE;
+	w = std::min( TILE_SIZE, m_nWidth - x );
+	h = std::min( TILE_SIZE, m_nHeight - y );
+}
+
+void TileRenderer::getStats( RenderStats& stats ) const
+{
+	std::lock_guard<std::mutex> guard( m_statsLock );
+	stats.seconds = m_nFinish - m_nStart;
+	stats.width = m_nWidth;
+	stats.height = m_nHeight;
+	stats.threads = m_nThreads;
+	stats.tilesDone = m_nTilesDone;
+	stats.rays = m_rays;
+}
+
+// TileCallback for renderImage: copy the tile into the caller's image.
+static void copyTile( int x, int y, int w, int h, const unsigned char *pixels, int stride, void *data )
+{
+	const std::pair<unsigned char *, int> *image = (const std::pair<unsigned char *, int> *)data;
+	for( int j = 0; j < h; ++j )
+		memcpy( image->first + ( ( y + j ) * image->second + x ) * 3, pixels + j * stride, w * 3 );
+}
+
+bool TileRenderer::renderImage( RayTracer *tracer, int width, int height, unsigned char *rgb,
+	int numThreads, RenderStats *stats )
+{
+	if( !tracer->sceneLoaded() )
+		return false;
+
+	tracer->traceSetup( width, height, false );
+
+	std::pair<unsigned char *, int> image( rgb, width );
+	TileRenderer renderer( tracer );
+	renderer.start( numThreads, copyTile, &image );
+	renderer.wait();
+
+	if( stats )
+		renderer.getStats( *stats );
+	return true;
+}
+
+void TileRenderer::worker()
+{
+	nameTimelineThread( "tile worker" );
+	ScopedTimer busy( "worker", "thread" );
+
+	RayStatCounters before;
+	threadRayStats( before );
+
+	std::vector<unsigned char> tile;
+	if( !m_buffer )
+		tile.resize( TILE_SIZE * TILE_SIZE * 3 );
+
+	int t;
+	while( !m_bCancel && ( t = m_nNextTile++ ) < numTiles() ) {
+		if( t < (int)m_skip.size() && m_skip[t] ) {
+			++m_nTilesDone;
+			continue;
+		}
+
+		int x, y, w, h;
+		tileRect( t, x, y, w, h );
+		ScopedTimer timer( "tile", "tile", t );
+
+		unsigned char *pixels;
+		int stride;
+		if( m_buffer ) {
+			pixels = m_buffer + ( x + y * m_nWidth ) * 3;
+			stride = m_nWidth * 3;
+		} else {
+			pixels = &tile[0];
+			stride = w * 3;
+		}
+
+		for( int j = 0; j < h; ++j )
+			for( int i = 0; i < w; ++i )
+				raytracer->tracePixel( x + i, y + j, pixels + j * stride + i * 3 );
+
+		++m_nTilesDone;
+		if( m_callback )
+			m_callback( x, y, w, h, pixels, stride, m_callbackData );
+	}
+
+	RayStatCounters after;
+	threadRayStats( after );
+	{
+		std::lock_guard<std::mutex> guard( m_statsLock );
+		for( int s = 0; s < NUM_RAY_STATS; ++s )
+			m_rays.count[s] += after.count[s] - before.count[s];
+		m_nFinish = std::max( m_nFinish, timelineNow() );
+	}
+	--m_nRunning;
+}
@@ -0,0 +1,102 @@
+#ifndef __TILERENDERER_H__
+#define __TILERENDERER_H__
+
+// Renders a RayTracer's image on a pool of worker threads, one square
+// tile at a time.  The tracer's settings must not be touched while a
+// render is running: they are the snapshot the workers render from.
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "stats/raystats.h"
+
+class RayTracer;
+
+// What one render cost.  The ray counters are those of the render's own
+// workers, so renders running side by side in one process don't mix.
+struct RenderStats
+{
+	double seconds;			// from start() until the last worker finished
+	int width, height;
+	int threads;
+	int tilesDone;
+	RayStatCounters rays;	// all zero without RAY_STATS
+};
+
+class TileRenderer
+{
+public:
+	// Called on a worker thread each time a tile is finished.  pixels
+	// points at the tile's first RGB byte, with stride bytes per row; it is
+	// inside the tracer's buffer, or, when the tracer has no buffer (see
+	// RayTracer::traceSetup), in worker memory that is reused afterwards.
+	typedef void (*TileCallback)( int x, int y, int w, int h,
+		const unsigned char *pixels, int stride, void *data );
+
+	static const int TILE_SIZE = 32;
+
+	TileRenderer( RayTracer *tracer );
+	~TileRenderer();
+
+	// Start rendering the image set up with RayTracer::traceSetup.
+	// numThreads = 0 uses one thread per hardware core.
+	void start( int numThreads = 0, TileCallback cb = NULL, void *data = NULL );
+
+	// Leave the tiles flagged in done (one flag per tile, numbered as
+	// tileRect does) as they are, e.g. those a checkpoint already has.
+	// They count as done straight away.  Call before start().
+	void skipTiles( const std::vector<unsigned char>& done ) { m_skip = done; }
+
+	// Ask the workers to stop after their current tile, and wait for them.
+	void stop();
+
+	// Wait for the render to finish.
+	void wait();
+
+	bool isRunning() const { return m_nRunning > 0; }
+	int numTiles() const { return m_nTilesX * m_nTilesY; }
+	int tilesDone() const { return m_nTilesDone; }
+
+	// Pixel rectangle covered by tile t.
+	void tileRect( int t, int& x, int& y, int& w, int& h ) const;
+
+	// The last render's costs; only complete once it has finished.
+	void getStats( RenderStats& stats ) const;
+
+	// Set tracer up for a width x height image and render it into rgb
+	// (width * height * 3 bytes, rows bottom-up as in the tracer's own
+	// buffer), waiting until it is done.  The tracer keeps no image of its
+	// own afterwards.  Returns false if it has no scene.
+	static bool renderImage( RayTracer *tracer, int width, int height, unsigned char *rgb,
+		int numThreads = 0, RenderStats *stats = NULL );
+
+private:
+	void worker();
+
+	RayTracer *raytracer;
+	std::vector<std::thread> m_threads;
+
+	unsigned char *m_buffer;
+	int m_nWidth, m_nHeight;
+	int m_nTilesX, m_nTilesY;
+
+	std::atomic<int> m_nNextTile;
+	std::atomic<int> m_nTilesDone;
+	std::atomic<int> m_nRunning;
+	std::atomic<bool> m_bCancel;
+
+	std::vector<unsigned char> m_skip;
+
+	TileCallback m_callback;
+	void *m_callbackData;
+
+	// the workers add their counts in as they finish
+	mutable std::mutex m_statsLock;
+	double m_nStart, m_nFinish;
+	int m_nThreads;
+	RayStatCounters m_rays;
+};
+
+#endif // __TILERENDERER_H__
@@ -0,0 +1,214 @@
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "imagemetrics.h"
+
+using namespace std;
+
+// Normalized Gaussian weights for offsets -radius..radius.
+static vector<double> gaussian( double sigma, int radius )
+{
+	vector<double> k( 2 * radius + 1 );
+	double sum = 0.0;
+	for( int i = -radius; i <= radius; ++i ) {
+		k[ i + radius ] = exp( -0.5 * i * i / ( sigma * sigma ) );
+		sum += k[ i + radius ];
+	}
+	for( size_t i = 0; i < k.size(); ++i ) {
+		k[i] /= sum;
+	}
+	return k;
+}
+
+// Separable convolution of a one-channel image; the edges are extended.
+static void blur( const vector<double>& in, vector<double>& out, int width, int height,
+	const vector<double>& k )
+{
+	int radius = k.size() / 2;
+	vector<double> rows( in.size() );
+	for( int y = 0; y < height; ++y ) {
+		for( int x = 0; x < width; ++x ) {
+			double s = 0.0;
+			for( int i = -radius; i <= radius; ++i ) {
+				int xi = min( max( x + i, 0 ), width - 1 );
+				s += k[ i + radius ] * in[ y * width + xi ];
+			}
+			rows[ y * width + x ] = s;
+		}
+	}
+
+	out.resize( in.size() );
+	for( int y = 0; y < height; ++y ) {
+		for( int x = 0; x < width; ++x ) {
+			double s = 0.0;
+			for( int i = -radius; i <= radius; ++i ) {
+				int yi = min( max( y + i, 0 ), height - 1 );
+				s += k[ i + radius ] * rows[ yi * width + x ];
+			}
+			out[ y * width + x ] = s;
+		}
+	}
+}
+
+static void luma( const unsigned char *rgb, int n, vector<double>& y )
+{
+	y.resize( n );
+	for( int p = 0; p < n; ++p ) {
+		y[p] = 0.299 * rgb[3*p] + 0.587 * rgb[3*p+1] + 0.114 * rgb[3*p+2];
+	}
+}
+
+double imagePSNR( const unsigned char *ref, const unsigned char *test, int width, int height )
+{
+	size_t n = (size_t)width * height * 3;
+	double sum = 0.0;
+	for( size_t k = 0; k < n; ++k ) {
+		double d = (double)ref[k] - test[k];
+		sum += d * d;
+	}
+	if( sum == 0.0 ) {
+		return 99.0;
+	}
+	return 10.0 * log10( 255.0 * 255.0 / ( sum / n ) );
+}
+
+double imageSSIM( const unsigned char *ref, const unsigned char *test, int width, int height )
+{
+	const double C1 = ( 0.01 * 255 ) * ( 0.01 * 255 );
+	const double C2 = ( 0.03 * 255 ) * ( 0.03 * 255 );
+
+	int n = width * height;
+	vector<double> x, y;
+	luma( ref, n, x );
+	luma( test, n, y );
+
+	vector<double> xx( n ), yy( n ), xy( n );
+	for( int p = 0; p < n; ++p ) {
+		xx[p] = x[p] * x[p];
+		yy[p] = y[p] * y[p];
+		xy[p] = x[p] * y[p];
+	}
+
+	vector<double> k = gaussian( 1.5, 5 );
+	vector<double> mx, my, sxx, syy, sxy;
+	blur( x, mx, width, height, k );
+	blur( y, my, width, height, k );
+	blur( xx, sxx, width, height, k );
+	blur( yy, syy, width, height, k );
+	blur( xy, sxy, width, height, k );
+
+	double sum = 0.0;
+	for( int p = 0; p < n; ++p ) {
+		double vx = sxx[p] - mx[p] * mx[p];
+		double vy = syy[p] - my[p] * my[p];
+		double cxy = sxy[p] - mx[p] * my[p];
+		sum += ( ( 2 * mx[p] * my[p] + C1 ) * ( 2 * cxy + C2 ) )
+			/ ( ( mx[p] * mx[p] + my[p] * my[p] + C1 ) * ( vx + vy + C2 ) );
+	}
+	return sum / n;
+}
+
+static double toLinear( double c )
+{
+	return c <= 0.04045 ? c / 12.92 : pow( ( c + 0.055 ) / 1.055, 2.4 );
+}
+
+static double labF( double t )
+{
+	return t > 216.0 / 24389.0 ? pow( t, 1.0 / 3.0 ) : ( 24389.0 / 27.0 * t + 16.0 ) / 116.0;
+}
+
+// Linear sRGB to CIE L*a*b* (D65 white).
+static void toLab( double r, double g, double b, double lab[3] )
+{
+	double X = ( 0.4124 * r + 0.3576 * g + 0.1805 * b ) / 0.9505;
+	double Y = 0.2126 * r + 0.7152 * g + 0.0722 * b;
+	double Z = ( 0.0193 * r + 0.1192 * g + 0.9505 * b ) / 1.0890;
+	double fx = labF( X ), fy = labF( Y ), fz = labF( Z );
+	lab[0] = 116.0 * fy - 16.0;
+	lab[1] = 500.0 * ( fx - fy );
+	lab[2] = 200.0 * ( fy - fz );
+}
+
+// HyAB distance, raised to FLIP's 0.7.
+static double hyab( const double a[3], const double b[3] )
+{
+	double da = a[1] - b[1], db = a[2] - b[2];
+	return pow( fabs( a[0] - b[0] ) + sqrt( da * da + db * db ), 0.7 );
+}
+
+// Blurred L*a*b* of an image: the colour as the eye would resolve it.
+static void filteredLab( const unsigned char *rgb, int width, int height,
+	const vector<double>& k, vector<double>& lab )
+{
+	int n = width * height;
+	vector<double> channel[3];
+	for( int c = 0; c < 3; ++c ) {
+		vector<double> lin( n );
+		for( int p = 0; p < n; ++p ) {
+			lin[p] = toLinear( rgb[ 3*p + c ] / 255.0 );
+		}
+		blur( lin, channel[c], width, height, k );
+	}
+
+	lab.resize( 3 * n );
+	for( int p = 0; p < n; ++p ) {
+		toLab( channel[0][p], channel[1][p], channel[2][p], &lab[ 3*p ] );
+	}
+}
+
+// Sobel gradient magnitude of the luma in [0,1], itself in about [0,1].
+static void edges( const unsigned char *rgb, int width, int height, vector<double>& g )
+{
+	int n = width * height;
+	vector<double> y;
+	luma( rgb, n, y );
+
+	g.resize( n );
+	for( int j = 0; j < height; ++j ) {
+		for( int i = 0; i < width; ++i ) {
+			int i0 = max( i - 1, 0 ), i1 = min( i + 1, width - 1 );
+			int j0 = max( j - 1, 0 ), j1 = min( j + 1, height - 1 );
+			double gx = ( y[ j0*width + i1 ] + 2 * y[ j*width + i1 ] + y[ j1*width + i1 ] )
+				- ( y[ j0*width + i0 ] + 2 * y[ j*width + i0 ] + y[ j1*width + i0 ] );
+			double gy = ( y[ j1*width + i0 ] + 2 * y[ j1*width + i ] + y[ j1*width + i1 ] )
+				- ( y[ j0*width + i0 ] + 2 * y[ j0*width + i ] + y[ j0*width + i1 ] );
+			g[ j*width + i ] = sqrt( gx * gx + gy * gy ) / ( 8.0 * 255.0 );
+		}
+	}
+}
+
+double imageFlipError( const unsigned char *ref, const unsigned char *test, int width, int height )
+{
+	// FLIP's colour-error remapping: distances up to pc of the largest
+	// (green against blue) cover [0,pt], the rest the remainder.
+	const double pc = 0.4, pt = 0.95;
+	double green[3], blue[3];
+	toLab( 0, 1, 0, green );
+	toLab( 0, 0, 1, blue );
+	double cmax = hyab( green, blue );
+
+	int n = width * height;
+	vector<double> k = gaussian( 1.0, 3 );
+	vector<double> labRef, labTest;
+	filteredLab( ref, width, height, k, labRef );
+	filteredLab( test, width, height, k, labTest );
+
+	vector<double> edgeRef, edgeTest;
+	edges( ref, width, height, edgeRef );
+	edges( test, width, height, edgeTest );
+
+	double sum = 0.0;
+	for( int p = 0; p < n; ++p ) {
+		double d = hyab( &labRef[ 3*p ], &labTest[ 3*p ] );
+		double color = d < pc * cmax ? d * pt / ( pc * cmax )
+			: pt + ( d - pc * cmax ) / ( cmax - pc * cmax ) * ( 1.0 - pt );
+		color = min( color, 1.0 );
+
+		double feature = sqrt( min( fabs( edgeRef[p] - edgeTest[p] ), 1.0 ) / sqrt( 2.0 ) );
+		sum += pow( color, 1.0 - feature );
+	}
+	return sum / n;
+}
@@ -0,0 +1,29 @@
+//
+// imagemetrics.h
+//
+// Full-reference image error measures for comparing a render against a
+// better-sampled one of the same size.  Images are 8-bit RGB triples in
+// row-major order, as RayTracer::getBuffer and readBMP give them.
+//
+
+#ifndef __IMAGEMETRICS_H__
+#define __IMAGEMETRICS_H__
+
+// Peak signal-to-noise ratio over all three channels, in dB; higher is
+// better.  Identical images give 99 rather than infinity.
+double imagePSNR( const unsigned char *ref, const unsigned char *test, int width, int height );
+
+// Mean structural similarity of the luma, over 11x11 Gaussian windows
+// (sigma 1.5), as Wang et al. define it; 1 means identical.
+double imageSSIM( const unsigned char *ref, const unsigned char *test, int width, int height );
+
+// A simplified FLIP: the colour difference after a blur that stands in
+// for the eye's contrast sensitivity, in [0,1], raised to a power that
+// shrinks where the images' edges differ, so jaggies and lost detail
+// count for more than their colour error alone.  The mean over the
+// image; 0 means identical.  It follows the structure of NVIDIA's FLIP
+// (HyAB distance in L*a*b*, feature-weighted exponent) without its exact
+// filters, so use it to rank renders, not to quote FLIP numbers.
+double imageFlipError( const unsigned char *ref, const unsigned char *test, int width, int height );
+
+#endif // __IMAGEMETRICS_H__
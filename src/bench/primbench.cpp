@@ -0,0 +1,494 @@
+//=============================================================================
+// primbench: times the innermost intersection kernels on their own and
+// checks them against straightforward reference versions.
+//
+// Each primitive's intersectLocal (and BoundingBox::intersect) is given
+// three fixed sets of rays in its local frame:
+//
+//   hit    aimed into the primitive's bounds, so most of them hit
+//   miss   random directions, so most of them miss
+//   graze  aimed at the edges of the bounds, where the kernels' boundary
+//          and epsilon tests decide
+//
+// and the report gives ns per test (best of the repeats) and the hit rate.
+// Every answer is also compared with the reference: a mismatch is a hit
+// on one side and a miss on the other, or distances that differ.  Grazing
+// rays may legitimately disagree by an epsilon, so only mismatches in the
+// hit and miss sets make the program fail.
+//
+// Build it from this file and the tracer sources without main.cpp.
+//
+// usage: primbench [-n <rays>] [-k <repeats>] [-s <seed>] [-o <out.json>]
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <vector>
+
+#include "../scene/scene.h"
+#include "../scene/ray.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/trimesh.h"
+#include "../stats/timeline.h"
+
+// from getopt.cpp
+extern int getopt(int argc, char **argv, char *optstring);
+extern char* optarg;
+
+// Relative tolerance on distances: TrimeshFace keeps t in a float.
+static const double T_TOLERANCE = 1e-5;
+
+// Cone under test: a capped frustum, so both caps are exercised.
+static const double CONE_HEIGHT = 1.0;
+static const double CONE_BOTTOM = 1.0;
+static const double CONE_TOP = 0.5;
+
+static const vec3f TRI_A( -0.5, -0.5, 0.0 );
+static const vec3f TRI_B( 0.5, -0.4, 0.1 );
+static const vec3f TRI_C( 0.0, 0.5, -0.1 );
+
+// xorshift32, as in scenegen.cpp: the same rays on every platform.
+class Random
+{
+public:
+	Random( unsigned int seed ) : m_nState( seed ? seed : 0x9e3779b9u ) {}
+
+	double next()
+	{
+		m_nState ^= m_nState << 13;
+		m_nState ^= m_nState >> 17;
+		m_nState ^= m_nState << 5;
+		return ( m_nState & 0xffffff ) / 16777216.0;
+	}
+
+	double range( double lo, double hi ) { return lo + ( hi - lo ) * next(); }
+
+	vec3f unitVector()
+	{
+		while( true ) {
+			vec3f v( range( -1, 1 ), range( -1, 1 ), range( -1, 1 ) );
+			double l = v.length_squared();
+			if( l > 1e-6 && l <= 1.0 )
+				return v / sqrt( l );
+		}
+	}
+
+private:
+	unsigned int m_nState;
+};
+
+//
+// Reference kernels.  Each returns the nearest t > RAY_EPSILON, written
+// from the shape's definition rather than from the production code.
+//
+
+// Smallest root of a t^2 + b t + c = 0 that is above RAY_EPSILON and for
+// which inside( t ) holds.
+template <class Inside>
+static bool nearestRoot( double a, double b, double c, Inside inside, double& best )
+{
+	if( fabs( a ) < 1e-300 ) {
+		if( b == 0.0 )
+			return false;
+		double t = -c / b;
+		if( t > RAY_EPSILON && t < best && inside( t ) ) {
+			best = t;
+			return true;
+		}
+		return false;
+	}
+
+	double disc = b * b - 4 * a * c;
+	if( disc < 0.0 )
+		return false;
+	disc = sqrt( disc );
+
+	bool found = false;
+	double roots[2] = { ( -b - disc ) / ( 2 * a ), ( -b + disc ) / ( 2 * a ) };
+	for( int k = 0; k < 2; ++k ) {
+		double t = roots[k];
+		if( t > RAY_EPSILON && t < best && inside( t ) ) {
+			best = t;
+			found = true;
+		}
+	}
+	return found;
+}
+
+// The plane axis = value, clipped by inside( point ).
+template <class Inside>
+static void planeHit( const ray& r, int axis, double value, Inside inside, double& best )
+{
+	double d = r.getDirection()[axis];
+	if( d == 0.0 )
+		return;
+	double t = ( value - r.getPosition()[axis] ) / d;
+	if( t > RAY_EPSILON && t < best && inside( r.at( t ) ) )
+		best = t;
+}
+
+static bool referenceSphere( const ray& r, double& t )
+{
+	const vec3f& p = r.getPosition();
+	const vec3f& d = r.getDirection();
+	t = HUGE_VAL;
+	nearestRoot( d.dot( d ), 2 * p.dot( d ), p.dot( p ) - 1.0,
+		[]( double ) { return true; }, t );
+	return t < HUGE_VAL;
+}
+
+struct InUnitFace
+{
+	int u, v;
+	bool operator()( const vec3f& P ) const { return fabs( P[u] ) <= 0.5 && fabs( P[v] ) <= 0.5; }
+};
+
+static bool referenceBox( const ray& r, double& t )
+{
+	t = HUGE_VAL;
+	for( int axis = 0; axis < 3; ++axis ) {
+		InUnitFace face = { ( axis + 1 ) % 3, ( axis + 2 ) % 3 };
+		planeHit( r, axis, -0.5, face, t );
+		planeHit( r, axis, 0.5, face, t );
+	}
+	return t < HUGE_VAL;
+}
+
+static bool referenceSquare( const ray& r, double& t )
+{
+	t = HUGE_VAL;
+	InUnitFace face = { 0, 1 };
+	planeHit( r, 2, 0.0, face, t );
+	return t < HUGE_VAL;
+}
+
+// A capped cone along z from radius r0 at z = 0 to r1 at z = h; the
+// cylinder is the case r0 = r1 = 1, h = 1.
+static bool referenceFrustum( const ray& r, double h, double r0, double r1, double& t )
+{
+	const vec3f& p = r.getPosition();
+	const vec3f& d = r.getDirection();
+	double k = ( r1 - r0 ) / h;
+
+	// x^2 + y^2 = ( r0 + k z )^2
+	double e = r0 + k * p[2];
+	double a = d[0] * d[0] + d[1] * d[1] - k * k * d[2] * d[2];
+	double b = 2 * ( p[0] * d[0] + p[1] * d[1] - e * k * d[2] );
+	double c = p[0] * p[0] + p[1] * p[1] - e * e;
+
+	t = HUGE_VAL;
+	nearestRoot( a, b, c, [&]( double s ) {
+		double z = p[2] + s * d[2];
+		return z >= 0.0 && z <= h;
+	}, t );
+	planeHit( r, 2, 0.0, [&]( const vec3f& P ) { return P[0] * P[0] + P[1] * P[1] <= r0 * r0; }, t );
+	planeHit( r, 2, h, [&]( const vec3f& P ) { return P[0] * P[0] + P[1] * P[1] <= r1 * r1; }, t );
+	return t < HUGE_VAL;
+}
+
+static bool referenceCylinder( const ray& r, double& t )
+{
+	return referenceFrustum( r, 1.0, 1.0, 1.0, t );
+}
+
+static bool referenceCone( const ray& r, double& t )
+{
+	return referenceFrustum( r, CONE_HEIGHT, CONE_BOTTOM, CONE_TOP, t );
+}
+
+// Moller-Trumbore, front faces only (the mesh kernel culls back faces).
+static bool referenceTriangle( const ray& r, double& t )
+{
+	vec3f e1 = TRI_B - TRI_A;
+	vec3f e2 = TRI_C - TRI_A;
+	const vec3f& d = r.getDirection();
+
+	if( d.dot( e1.cross( e2 ).normalize() ) > -NORMAL_EPSILON )
+		return false;
+
+	vec3f pv = d.cross( e2 );
+	double det = e1.dot( pv );
+	vec3f tv = r.getPosition() - TRI_A;
+	double u = tv.dot( pv ) / det;
+	if( u < 0.0 || u > 1.0 )
+		return false;
+	vec3f qv = tv.cross( e1 );
+	double v = d.dot( qv ) / det;
+	if( v < 0.0 || u + v > 1.0 )
+		return false;
+
+	t = e2.dot( qv ) / det;
+	return t >= RAY_EPSILON;
+}
+
+// The slab test, for the unit box: entry and exit distance, hit if the
+// interval is not empty and not behind the ray.
+static bool referenceSlabs( const ray& r, double& tMin, double& tMax )
+{
+	tMin = -HUGE_VAL;
+	tMax = HUGE_VAL;
+	for( int axis = 0; axis < 3; ++axis ) {
+		double d = r.getDirection()[axis];
+		double p = r.getPosition()[axis];
+		if( d == 0.0 ) {
+			if( p < -0.5 || p > 0.5 )
+				return false;
+			continue;
+		}
+		double t1 = ( -0.5 - p ) / d;
+		double t2 = ( 0.5 - p ) / d;
+		if( t1 > t2 ) {
+			double tmp = t1; t1 = t2; t2 = tmp;
+		}
+		tMin = max( tMin, t1 );
+		tMax = min( tMax, t2 );
+	}
+	return tMin <= tMax && tMax >= 0.0;
+}
+
+//
+// The kernels under test
+//
+
+struct Kernel
+{
+	const char *name;
+	const Geometry *geometry;			// NULL for the bounding box
+	BoundingBox bounds;					// where the rays are aimed
+	bool (*reference)( const ray& r, double& t );
+};
+
+static BoundingBox makeBounds( const vec3f& lo, const vec3f& hi )
+{
+	BoundingBox b;
+	b.min = lo;
+	b.max = hi;
+	return b;
+}
+
+// One test of kernel k; t[0] is the hit distance (the entry distance for
+// the bounding box, which also gives its exit in t[1]).
+static inline bool runKernel( const Kernel& k, const ray& r, double t[2] )
+{
+	if( k.geometry == NULL )
+		return k.bounds.intersect( r, t[0], t[1] );
+
+	isect i;
+	if( !k.geometry->intersectLocal( r, i ) )
+		return false;
+	t[0] = t[1] = i.t;
+	return true;
+}
+
+static bool runReference( const Kernel& k, const ray& r, double t[2] )
+{
+	if( k.geometry == NULL )
+		return referenceSlabs( r, t[0], t[1] );
+
+	bool hit = k.reference( r, t[0] );
+	t[1] = t[0];
+	return hit;
+}
+
+static bool closeEnough( double a, double b )
+{
+	return fabs( a - b ) <= T_TOLERANCE * max( 1.0, fabs( b ) );
+}
+
+enum RaySet { HIT_RAYS, MISS_RAYS, GRAZE_RAYS, NUM_RAY_SETS };
+static const char *raySetNames[ NUM_RAY_SETS ] = { "hit", "miss", "graze" };
+
+static void makeRays( const BoundingBox& b, RaySet set, int count, Random& random, vector<ray>& rays )
+{
+	vec3f extent = b.max - b.min;
+	vec3f center = ( b.min + b.max ) / 2;
+	double radius = 2 * extent.length() + 1;
+
+	rays.clear();
+	rays.reserve( count );
+	for( int n = 0; n < count; ++n ) {
+		vec3f origin = center + radius * random.unitVector();
+		vec3f dir;
+		if( set == HIT_RAYS ) {
+			vec3f target;
+			for( int a = 0; a < 3; ++a )
+				target[a] = b.min[a] + extent[a] * random.range( 0.1, 0.9 );
+			dir = target - origin;
+		} else if( set == MISS_RAYS ) {
+			dir = random.unitVector();
+		} else {
+			// a point on one of the twelve edges
+			int free = (int)( random.next() * 3 );
+			vec3f target;
+			for( int a = 0; a < 3; ++a ) {
+				if( a == free )
+					target[a] = random.range( b.min[a], b.max[a] );
+				else
+					target[a] = random.next() < 0.5 ? b.min[a] : b.max[a];
+			}
+			dir = target - origin;
+		}
+		rays.push_back( ray( origin, dir.normalize() ) );
+	}
+}
+
+struct Result
+{
+	double nsPerTest;
+	double hitRate;
+	int mismatches;
+};
+
+static Result measure( const Kernel& k, const vector<ray>& rays, int repeats )
+{
+	Result res;
+	int n = rays.size();
+
+	// correctness, and the hit rate
+	int hits = 0;
+	res.mismatches = 0;
+	for( int j = 0; j < n; ++j ) {
+		double t[2], tr[2];
+		bool hit = runKernel( k, rays[j], t );
+		bool refHit = runReference( k, rays[j], tr );
+		hits += hit;
+		if( hit != refHit || ( hit && !( closeEnough( t[0], tr[0] ) && closeEnough( t[1], tr[1] ) ) ) )
+			++res.mismatches;
+	}
+	res.hitRate = n ? (double)hits / n : 0.0;
+
+	// speed: the best of the repeats
+	double best = HUGE_VAL;
+	volatile double sink = 0.0;
+	for( int rep = 0; rep < repeats; ++rep ) {
+		double sum = 0.0;
+		double start = timelineNow();
+		for( int j = 0; j < n; ++j ) {
+			double t[2];
+			if( runKernel( k, rays[j], t ) )
+				sum += t[0];
+		}
+		double elapsed = timelineNow() - start;
+		sink = sink + sum;
+		if( elapsed < best )
+			best = elapsed;
+	}
+	res.nsPerTest = n ? best / n * 1e9 : 0.0;
+	return res;
+}
+
+static void usage( const char *progname )
+{
+	fprintf( stderr, "usage: %s [options]\n", progname );
+	fprintf( stderr, "  -n <#>      rays per set (default 100000)\n" );
+	fprintf( stderr, "  -k <#>      timed repeats, the best is kept (default 5)\n" );
+	fprintf( stderr, "  -s <#>      random seed (default 1)\n" );
+	fprintf( stderr, "  -o <file>   also write the results as JSON\n" );
+}
+
+int main( int argc, char **argv )
+{
+	int count = 100000;
+	int repeats = 5;
+	unsigned int seed = 1;
+	const char *outName = NULL;
+
+	int c;
+	while( ( c = getopt( argc, argv, (char *)"n:k:s:o:" ) ) != EOF ) {
+		switch( c ) {
+		case 'n': count = atoi( optarg ); break;
+		case 'k': repeats = atoi( optarg ); break;
+		case 's': seed = (unsigned int)atoi( optarg ); break;
+		case 'o': outName = optarg; break;
+		default:
+			usage( argv[0] );
+			return 1;
+		}
+	}
+	if( count <= 0 || repeats <= 0 ) {
+		usage( argv[0] );
+		return 1;
+	}
+
+	Scene scene;
+	MaterialID mat = scene.addMaterial( Material() );
+
+	Trimesh *mesh = scene.create<Trimesh>( &scene, mat, &scene.transformRoot );
+	mesh->addVertex( TRI_A );
+	mesh->addVertex( TRI_B );
+	mesh->addVertex( TRI_C );
+	mesh->addFace( 0, 1, 2 );
+
+	vec3f triMin = minimum( minimum( TRI_A, TRI_B ), TRI_C );
+	vec3f triMax = maximum( maximum( TRI_A, TRI_B ), TRI_C );
+	double coneRadius = max( CONE_BOTTOM, CONE_TOP );
+
+	const Kernel kernels[] = {
+		{ "sphere", scene.create<Sphere>( &scene, mat ),
+			makeBounds( vec3f( -1, -1, -1 ), vec3f( 1, 1, 1 ) ), referenceSphere },
+		{ "box", scene.create<Box>( &scene, mat ),
+			makeBounds( vec3f( -0.5, -0.5, -0.5 ), vec3f( 0.5, 0.5, 0.5 ) ), referenceBox },
+		{ "square", scene.create<Square>( &scene, mat ),
+			makeBounds( vec3f( -0.5, -0.5, 0 ), vec3f( 0.5, 0.5, 0 ) ), referenceSquare },
+		{ "cylinder", scene.create<Cylinder>( &scene, mat, true ),
+			makeBounds( vec3f( -1, -1, 0 ), vec3f( 1, 1, 1 ) ), referenceCylinder },
+		{ "cone", scene.create<Cone>( &scene, mat, CONE_HEIGHT, CONE_BOTTOM, CONE_TOP, true ),
+			makeBounds( vec3f( -coneRadius, -coneRadius, 0 ), vec3f( coneRadius, coneRadius, CONE_HEIGHT ) ), referenceCone },
+		{ "triangle", mesh->getFace( 0 ), makeBounds( triMin, triMax ), referenceTriangle },
+		{ "bbox", NULL, makeBounds( vec3f( -0.5, -0.5, -0.5 ), vec3f( 0.5, 0.5, 0.5 ) ), NULL },
+	};
+	const int numKernels = sizeof( kernels ) / sizeof( kernels[0] );
+
+	FILE *json = NULL;
+	if( outName && !( json = fopen( outName, "w" ) ) ) {
+		fprintf( stderr, "can't write %s\n", outName );
+		return 1;
+	}
+	if( json )
+		fprintf( json, "{\n  \"rays_per_set\": %d,\n  \"repeats\": %d,\n  \"seed\": %u,\n  \"kernels\": [", count, repeats, seed );
+
+	printf( "%-10s %-6s %10s %9s %11s\n", "kernel", "rays", "ns/test", "hit rate", "mismatches" );
+
+	bool failed = false;
+	vector<ray> rays;
+	for( int k = 0; k < numKernels; ++k ) {
+		if( json )
+			fprintf( json, "%s\n    { \"name\": \"%s\"", k ? "," : "", kernels[k].name );
+
+		for( int s = 0; s < NUM_RAY_SETS; ++s ) {
+			// every kernel and set gets its own fixed rays
+			Random random( seed * 7919u + k * 31u + s );
+			makeRays( kernels[k].bounds, (RaySet)s, count, random, rays );
+
+			Result res = measure( kernels[k], rays, repeats );
+			printf( "%-10s %-6s %10.2f %8.1f%% %11d\n", kernels[k].name, raySetNames[s],
+				res.nsPerTest, res.hitRate * 100, res.mismatches );
+			if( json )
+				fprintf( json, ",\n      \"%s\": { \"ns_per_test\": %.3f, \"hit_rate\": %.5f, \"mismatches\": %d }",
+					raySetNames[s], res.nsPerTest, res.hitRate, res.mismatches );
+
+			if( s != GRAZE_RAYS && res.mismatches > 0 )
+				failed = true;
+		}
+
+		if( json )
+			fprintf( json, " }" );
+	}
+
+	if( json ) {
+		fprintf( json, "\n  ]\n}\n" );
+		fclose( json );
+	}
+
+	if( failed ) {
+		fprintf( stderr, "kernels disagree with the reference on hit or miss rays\n" );
+		return 1;
+	}
+	return 0;
+}
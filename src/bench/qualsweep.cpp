@@ -0,0 +1,316 @@
+//=============================================================================
+// qualsweep: renders one scene across a sweep of the sampling settings
+// (recursion depth, antialiasing, jitter and adaptive supersampling) and
+// scores every image against a high-sample reference, so that quality
+// can be traded against time on evidence rather than by eye.
+//
+// The reference is the scene traced at k times the resolution with the
+// 3x3 antialiasing grid and box-filtered down, i.e. 9k^2 samples per
+// pixel, or a BMP of the right size given with -R.  Each render is scored
+// with PSNR, SSIM and a FLIP-style perceptual error (see imagemetrics.h)
+// and timed (best of the repeats).  Settings that no other setting beats
+// on both time and the chosen error are on the Pareto front and marked
+// with a '*'.
+//
+// Build it from this file, imagemetrics.cpp and every source of the ray
+// tracer except main.cpp.
+//
+// usage: qualsweep [options] scene.ray
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "imagemetrics.h"
+
+#include "../RayTracer.h"
+#include "../fileio/bitmap.h"
+#include "../stats/timeline.h"
+
+using namespace std;
+
+// from getopt.cpp
+extern int getopt(int argc, char **argv, char *optstring);
+extern char* optarg;
+extern int optind;
+
+struct Setting
+{
+	int depth;
+	int antialiasing;
+	int jitter;
+	int superSampling;
+
+	double seconds;
+	double psnr;
+	double ssim;
+	double flip;
+	bool pareto;
+};
+
+enum Metric { METRIC_PSNR, METRIC_SSIM, METRIC_FLIP };
+
+// The error the Pareto front is taken over: lower is better.
+static double error( const Setting& s, Metric m )
+{
+	switch( m ) {
+	case METRIC_PSNR: return -s.psnr;
+	case METRIC_SSIM: return 1.0 - s.ssim;
+	default: return s.flip;
+	}
+}
+
+static string describe( const Setting& s )
+{
+	char buf[64];
+	if( s.superSampling ) {
+		sprintf( buf, "depth %d, adaptive %d", s.depth, s.superSampling );
+	} else {
+		sprintf( buf, "depth %d%s%s", s.depth, s.antialiasing ? ", 3x3" : "", s.jitter ? ", jitter" : "" );
+	}
+	return buf;
+}
+
+static bool byTime( const Setting& a, const Setting& b )
+{
+	return a.seconds < b.seconds;
+}
+
+static bool parseList( const char *s, vector<int>& out )
+{
+	out.clear();
+	while( *s ) {
+		char *end;
+		long v = strtol( s, &end, 10 );
+		if( end == s || v < 0 ) {
+			return false;
+		}
+		if( *end && *end != ',' ) {
+			return false;
+		}
+		out.push_back( (int)v );
+		s = *end ? end + 1 : end;
+	}
+	return !out.empty();
+}
+
+// Trace the whole image with the tracer's current settings.
+static double render( RayTracer *tracer, int width, int height )
+{
+	tracer->traceSetup( width, height );
+	double start = timelineNow();
+	tracer->traceLines( 0, height );
+	return timelineNow() - start;
+}
+
+// Average each scale x scale block of src into one pixel of dst.
+static void downsample( const unsigned char *src, int scale, int width, int height, vector<unsigned char>& dst )
+{
+	dst.resize( (size_t)width * height * 3 );
+	int srcWidth = width * scale;
+	for( int j = 0; j < height; ++j ) {
+		for( int i = 0; i < width; ++i ) {
+			for( int c = 0; c < 3; ++c ) {
+				int sum = 0;
+				for( int y = 0; y < scale; ++y ) {
+					for( int x = 0; x < scale; ++x ) {
+						sum += src[ ( ( j * scale + y ) * srcWidth + i * scale + x ) * 3 + c ];
+					}
+				}
+				dst[ ( j * width + i ) * 3 + c ] = (unsigned char)( ( sum + scale * scale / 2 ) / ( scale * scale ) );
+			}
+		}
+	}
+}
+
+static void usage( const char *progname )
+{
+	fprintf( stderr, "usage: %s [options] scene.ray\n", progname );
+	fprintf( stderr, "  -w <#>      image width (default 128; the height follows the camera)\n" );
+	fprintf( stderr, "  -d <list>   recursion depths to sweep (default 0,1,2,4)\n" );
+	fprintf( stderr, "  -s <#>      sweep adaptive supersampling up to this level (default 2)\n" );
+	fprintf( stderr, "  -k <#>      reference resolution multiple (default 4)\n" );
+	fprintf( stderr, "  -r <#>      reference recursion depth (default: the deepest swept)\n" );
+	fprintf( stderr, "  -R <file>   use this BMP as the reference instead of rendering one\n" );
+	fprintf( stderr, "  -n <#>      renders per setting; the fastest counts (default 1)\n" );
+	fprintf( stderr, "  -m <metric> psnr, ssim or flip: the error for the Pareto front (default flip)\n" );
+	fprintf( stderr, "  -o <file>   also write the results as CSV, e.g. for plotting\n" );
+	fprintf( stderr, "  -i <prefix> save the reference and every render as <prefix>*.bmp\n" );
+}
+
+int main( int argc, char **argv )
+{
+	int width = 128;
+	int maxSuperSampling = 2;
+	int scale = 4;
+	int refDepth = -1;
+	int repeats = 1;
+	Metric metric = METRIC_FLIP;
+	const char *refName = NULL;
+	const char *csvName = NULL;
+	const char *prefix = NULL;
+	vector<int> depths;
+	parseList( "0,1,2,4", depths );
+
+	int c;
+	while( ( c = getopt( argc, argv, (char *)"w:d:s:k:r:R:n:m:o:i:" ) ) != EOF ) {
+		switch( c ) {
+		case 'w': width = atoi( optarg ); break;
+		case 'd':
+			if( !parseList( optarg, depths ) ) {
+				fprintf( stderr, "bad depth list %s\n", optarg );
+				return 1;
+			}
+			break;
+		case 's': maxSuperSampling = atoi( optarg ); break;
+		case 'k': scale = atoi( optarg ); break;
+		case 'r': refDepth = atoi( optarg ); break;
+		case 'R': refName = optarg; break;
+		case 'n': repeats = atoi( optarg ); break;
+		case 'm':
+			if( !strcmp( optarg, "psnr" ) )
+				metric = METRIC_PSNR;
+			else if( !strcmp( optarg, "ssim" ) )
+				metric = METRIC_SSIM;
+			else if( !strcmp( optarg, "flip" ) )
+				metric = METRIC_FLIP;
+			else {
+				usage( argv[0] );
+				return 1;
+			}
+			break;
+		case 'o': csvName = optarg; break;
+		case 'i': prefix = optarg; break;
+		default:
+			usage( argv[0] );
+			return 1;
+		}
+	}
+	if( optind != argc - 1 || width <= 0 || scale <= 0 || repeats <= 0 || maxSuperSampling < 0 ) {
+		usage( argv[0] );
+		return 1;
+	}
+	if( refDepth < 0 ) {
+		refDepth = *max_element( depths.begin(), depths.end() );
+	}
+
+	RayTracer *tracer = new RayTracer();
+	if( !tracer->loadScene( argv[ optind ] ) ) {
+		fprintf( stderr, "can't load %s\n", argv[ optind ] );
+		return 1;
+	}
+	int height = (int)( width / tracer->aspectRatio() + 0.5 );
+
+	unsigned char *buf;
+	int w, h;
+	vector<unsigned char> reference;
+	if( refName ) {
+		int rw, rh;
+		unsigned char *ref = readBMP( (char *)refName, rw, rh );
+		if( !ref || rw != width || rh != height ) {
+			fprintf( stderr, "%s is not a %dx%d BMP\n", refName, width, height );
+			delete [] ref;
+			return 1;
+		}
+		reference.assign( ref, ref + (size_t)width * height * 3 );
+		delete [] ref;
+	} else {
+		fprintf( stderr, "reference (%dx%d, depth %d)...\n", width * scale, height * scale, refDepth );
+		tracer->setDepth( refDepth );
+		tracer->setAntialiasing( 1 );
+		tracer->setJitter( 0 );
+		tracer->setSuperSampling( 0 );
+		render( tracer, width * scale, height * scale );
+		tracer->getBuffer( buf, w, h );
+		downsample( buf, scale, width, height, reference );
+	}
+	if( prefix ) {
+		writeBMP( (char *)( string( prefix ) + "ref.bmp" ).c_str(), width, height, &reference[0] );
+	}
+
+	// Every fixed pattern at every depth, then the adaptive levels
+	// (which take the place of the fixed patterns when on).
+	vector<Setting> settings;
+	for( size_t d = 0; d < depths.size(); ++d ) {
+		for( int pattern = 0; pattern < 4 + maxSuperSampling; ++pattern ) {
+			Setting s;
+			s.depth = depths[d];
+			s.antialiasing = pattern < 4 ? pattern / 2 : 0;
+			s.jitter = pattern < 4 ? pattern % 2 : 0;
+			s.superSampling = pattern < 4 ? 0 : pattern - 3;
+			settings.push_back( s );
+		}
+	}
+
+	for( size_t k = 0; k < settings.size(); ++k ) {
+		Setting& s = settings[k];
+		fprintf( stderr, "%s...\n", describe( s ).c_str() );
+		tracer->setDepth( s.depth );
+		tracer->setAntialiasing( s.antialiasing );
+		tracer->setJitter( s.jitter );
+		tracer->setSuperSampling( s.superSampling );
+
+		s.seconds = 0.0;
+		for( int r = 0; r < repeats; ++r ) {
+			double t = render( tracer, width, height );
+			if( r == 0 || t < s.seconds ) {
+				s.seconds = t;
+			}
+		}
+
+		tracer->getBuffer( buf, w, h );
+		s.psnr = imagePSNR( &reference[0], buf, width, height );
+		s.ssim = imageSSIM( &reference[0], buf, width, height );
+		s.flip = imageFlipError( &reference[0], buf, width, height );
+
+		if( prefix ) {
+			char name[64];
+			sprintf( name, "d%d_aa%d_j%d_ss%d.bmp", s.depth, s.antialiasing, s.jitter, s.superSampling );
+			writeBMP( (char *)( string( prefix ) + name ).c_str(), width, height, buf );
+		}
+	}
+
+	// A setting is off the front if another is no slower and no worse,
+	// and better in one of the two.
+	sort( settings.begin(), settings.end(), byTime );
+	for( size_t k = 0; k < settings.size(); ++k ) {
+		settings[k].pareto = true;
+		for( size_t o = 0; o < settings.size() && settings[k].pareto; ++o ) {
+			double e = error( settings[k], metric ), eo = error( settings[o], metric );
+			if( o != k && settings[o].seconds <= settings[k].seconds && eo <= e
+				&& ( settings[o].seconds < settings[k].seconds || eo < e ) ) {
+				settings[k].pareto = false;
+			}
+		}
+	}
+
+	printf( "%-26s %10s %8s %8s %8s %s\n", "setting", "seconds", "psnr", "ssim", "flip", "front" );
+	for( size_t k = 0; k < settings.size(); ++k ) {
+		const Setting& s = settings[k];
+		printf( "%-26s %10.4f %8.2f %8.4f %8.4f %s\n", describe( s ).c_str(),
+			s.seconds, s.psnr, s.ssim, s.flip, s.pareto ? "*" : "" );
+	}
+
+	if( csvName ) {
+		FILE *fp = fopen( csvName, "w" );
+		if( !fp ) {
+			fprintf( stderr, "can't write %s\n", csvName );
+			return 1;
+		}
+		fprintf( fp, "depth,antialiasing,jitter,supersampling,seconds,psnr,ssim,flip,pareto\n" );
+		for( size_t k = 0; k < settings.size(); ++k ) {
+			const Setting& s = settings[k];
+			fprintf( fp, "%d,%d,%d,%d,%.6f,%.4f,%.6f,%.6f,%d\n", s.depth, s.antialiasing, s.jitter,
+				s.superSampling, s.seconds, s.psnr, s.ssim, s.flip, s.pareto ? 1 : 0 );
+		}
+		fclose( fp );
+	}
+
+	delete tracer;
+	return 0;
+}
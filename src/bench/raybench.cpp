@@ -0,0 +1,197 @@
+//=============================================================================
+// raybench: renders the procedural scenes of scenegen.h at fixed settings
+// and reports, as JSON, how long each phase took, the ray throughput and
+// the process's peak memory.
+//
+// It is a separate program: build it from this file, scenegen.cpp and
+// every source of the ray tracer except main.cpp.  Build with RAY_STATS
+// defined to count every ray (see stats/raystats.h); otherwise only the
+// primary rays are known and the throughput is for those.
+//
+// usage: raybench [-w <width>] [-r <depth>] [-n <threads>] [-b <scene>] [-o <out.json>]
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "scenegen.h"
+
+#include "../RayTracer.h"
+#include "../TileRenderer.h"
+#include "../scene/scene.h"
+#include "../stats/raystats.h"
+#include "../stats/timeline.h"
+
+// from getopt.cpp
+extern int getopt(int argc, char **argv, char *optstring);
+extern char* optarg;
+extern int optind;
+
+struct Benchmark
+{
+	const char *name;
+	Scene *(*make)();
+};
+
+static Scene *sphereflake()		{ return makeSphereflake( 3 ); }
+static Scene *triangleSoup()	{ return makeTriangleSoup( 2000, 12345 ); }
+static Scene *cornellBox()		{ return makeCornellBox(); }
+static Scene *lightGrid()		{ return makeLightGrid( 8 ); }
+static Scene *transformChains()	{ return makeTransformChains( 4, 64 ); }
+
+static const Benchmark benchmarks[] = {
+	{ "sphereflake", sphereflake },
+	{ "triangle_soup", triangleSoup },
+	{ "cornell_box", cornellBox },
+	{ "light_grid", lightGrid },
+	{ "transform_chains", transformChains },
+};
+static const int NUM_BENCHMARKS = sizeof( benchmarks ) / sizeof( benchmarks[0] );
+
+// The process's high-water mark, so it only ever goes up from one scene
+// to the next.
+static double peakMegabytes()
+{
+#ifdef WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+		return pmc.PeakWorkingSetSize / ( 1024.0 * 1024.0 );
+	return 0.0;
+#else
+	struct rusage usage;
+	if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0.0;
+#ifdef __APPLE__
+	return usage.ru_maxrss / ( 1024.0 * 1024.0 );		// bytes
+#else
+	return usage.ru_maxrss / 1024.0;					// kilobytes
+#endif
+#endif
+}
+
+static void usage( const char *progname )
+{
+	fprintf( stderr, "usage: %s [options]\n", progname );
+	fprintf( stderr, "  -w <#>      image width and height (default 128)\n" );
+	fprintf( stderr, "  -r <#>      recursion depth (default 5)\n" );
+	fprintf( stderr, "  -n <#>      render threads; 0 traces on this thread (default 0)\n" );
+	fprintf( stderr, "  -b <name>   run only this scene\n" );
+	fprintf( stderr, "  -o <file>   write the JSON report here instead of stdout\n" );
+	fprintf( stderr, "scenes:" );
+	for( int b = 0; b < NUM_BENCHMARKS; ++b )
+		fprintf( stderr, " %s", benchmarks[b].name );
+	fprintf( stderr, "\n" );
+}
+
+int main( int argc, char **argv )
+{
+	int width = 128;
+	int depth = 5;
+	int threads = 0;
+	const char *only = NULL;
+	const char *outName = NULL;
+
+	int c;
+	while( ( c = getopt( argc, argv, (char *)"w:r:n:b:o:" ) ) != EOF ) {
+		switch( c ) {
+		case 'w': width = atoi( optarg ); break;
+		case 'r': depth = atoi( optarg ); break;
+		case 'n': threads = atoi( optarg ); break;
+		case 'b': only = optarg; break;
+		case 'o': outName = optarg; break;
+		default:
+			usage( argv[0] );
+			return 1;
+		}
+	}
+	if( width <= 0 || depth < 0 || threads < 0 ) {
+		usage( argv[0] );
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if( outName && !( out = fopen( outName, "w" ) ) ) {
+		fprintf( stderr, "can't write %s\n", outName );
+		return 1;
+	}
+
+	fprintf( out, "{\n  \"settings\": { \"width\": %d, \"height\": %d, \"depth\": %d, \"threads\": %d, \"ray_stats\": %s },\n",
+		width, width, depth, threads, rayStatsEnabled() ? "true" : "false" );
+	fprintf( out, "  \"scenes\": [" );
+
+	bool first = true;
+	for( int b = 0; b < NUM_BENCHMARKS; ++b ) {
+		if( only && strcmp( only, benchmarks[b].name ) != 0 )
+			continue;
+
+		fprintf( stderr, "%s...\n", benchmarks[b].name );
+		resetRayStats();
+
+		double t0 = timelineNow();
+		Scene *scene = benchmarks[b].make();
+		double t1 = timelineNow();
+
+		RayTracer *tracer = new RayTracer();
+		tracer->setDepth( depth );
+		tracer->setScene( scene );
+		double t2 = timelineNow();
+
+		int objects = scene->endObjects() - scene->beginObjects();
+		int lights = 0;
+		for( Scene::cliter l = scene->beginLights(); l != scene->endLights(); ++l )
+			++lights;
+
+		tracer->traceSetup( width, width );
+		double t3 = timelineNow();
+		if( threads == 0 ) {
+			tracer->traceLines( 0, width );
+		} else {
+			TileRenderer renderer( tracer );
+			renderer.start( threads );
+			renderer.wait();
+		}
+		double t4 = timelineNow();
+
+		delete tracer;
+		double t5 = timelineNow();
+
+		double render = t4 - t3;
+		unsigned long long primary = (unsigned long long)width * width;
+
+		fprintf( out, "%s\n    {\n      \"name\": \"%s\",\n      \"objects\": %d,\n      \"lights\": %d,\n",
+			first ? "" : ",", benchmarks[b].name, objects, lights );
+		fprintf( out, "      \"seconds\": { \"build\": %.6f, \"init\": %.6f, \"setup\": %.6f, \"render\": %.6f, \"teardown\": %.6f },\n",
+			t1 - t0, t2 - t1, t3 - t2, render, t5 - t4 );
+		fprintf( out, "      \"primary_rays\": %llu,\n      \"primary_mrays_per_s\": %.4f,\n",
+			primary, render > 0.0 ? primary / render * 1e-6 : 0.0 );
+		if( rayStatsEnabled() ) {
+			RayStatCounters total;
+			totalRayStats( total );
+			unsigned long long rays = total.count[ STAT_PRIMARY_RAYS ] + total.count[ STAT_REFLECTION_RAYS ]
+				+ total.count[ STAT_REFRACTION_RAYS ] + total.count[ STAT_SHADOW_RAYS ];
+			fprintf( out, "      \"rays\": %llu,\n      \"mrays_per_s\": %.4f,\n",
+				rays, render > 0.0 ? rays / render * 1e-6 : 0.0 );
+		}
+		fprintf( out, "      \"peak_memory_mb\": %.1f\n    }", peakMegabytes() );
+		fflush( out );
+		first = false;
+	}
+	fprintf( out, "\n  ]\n}\n" );
+
+	if( out != stdout )
+		fclose( out );
+
+	if( first ) {
+		fprintf( stderr, "no scene called %s\n", only );
+		return 1;
+	}
+	return 0;
+}
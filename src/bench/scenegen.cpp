@@ -0,0 +1,245 @@
+#include <cmath>
+
+#include "scenegen.h"
+
+#include "../scene/scene.h"
+#include "../scene/light.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/trimesh.h"
+
+static const double PI = 3.14159265358979323846;
+
+// xorshift32: the same sequence everywhere, unlike rand().
+class BenchRandom
+{
+public:
+	BenchRandom( unsigned int seed ) : m_nState( seed ? seed : 0x9e3779b9u ) {}
+
+	// uniform in [0,1)
+	double next()
+	{
+		m_nState ^= m_nState << 13;
+		m_nState ^= m_nState >> 17;
+		m_nState ^= m_nState << 5;
+		return ( m_nState & 0xffffff ) / 16777216.0;
+	}
+
+	double range( double lo, double hi ) { return lo + ( hi - lo ) * next(); }
+
+private:
+	unsigned int m_nState;
+};
+
+static Scene *newScene()
+{
+	return new Scene;
+}
+
+static void aimCamera( Scene *scene, const vec3f& eye, const vec3f& target, double fov )
+{
+	vec3f dir = ( target - eye ).normalize();
+	vec3f right = dir.cross( vec3f( 0, 1, 0 ) ).normalize();
+
+	Camera *camera = scene->getCamera();
+	camera->setEye( eye );
+	camera->setLook( dir, right.cross( dir ) );
+	camera->setFOV( fov );
+	camera->setAspectRatio( 1.0 );
+}
+
+static MaterialID diffuse( Scene *scene, const vec3f& kd )
+{
+	Material m;
+	m.kd = kd;
+	return scene->addMaterial( m );
+}
+
+static void addBox( Scene *scene, TransformNode *node, const mat4f& xform, MaterialID mat )
+{
+	Box *box = scene->create<Box>( scene, mat );
+	box->setTransform( node->createChild( xform ) );
+	scene->add( box );
+}
+
+static void addSphere( Scene *scene, TransformNode *node, const mat4f& xform, MaterialID mat )
+{
+	Sphere *sphere = scene->create<Sphere>( scene, mat );
+	sphere->setTransform( node->createChild( xform ) );
+	scene->add( sphere );
+}
+
+static void addPointLight( Scene *scene, const vec3f& pos, const vec3f& color )
+{
+	PointLight *light = scene->create<PointLight>( scene, pos, color );
+	light->setAttenuationCoefficients( 0.25, 0.1, 0.02 );
+	scene->add( light );
+}
+
+// The rotation that takes +y to dir.
+static mat4f alignY( const vec3f& dir )
+{
+	vec3f y( 0, 1, 0 );
+	double c = y.dot( dir );
+	if( c > 0.999999 ) {
+		return mat4f::identity();
+	}
+	if( c < -0.999999 ) {
+		return mat4f::rotate( vec3f( 1, 0, 0 ), PI );
+	}
+	return mat4f::rotate( y.cross( dir ), acos( c ) );
+}
+
+// One unit sphere at node, and nine children a third the size: six
+// around its equator and three above, all in node's frame (+y is away
+// from the parent).
+static void addFlake( Scene *scene, TransformNode *node, MaterialID mat, int depth )
+{
+	Sphere *sphere = scene->create<Sphere>( scene, mat );
+	sphere->setTransform( node );
+	scene->add( sphere );
+
+	if( depth <= 0 ) {
+		return;
+	}
+
+	for( int k = 0; k < 9; ++k ) {
+		double elevation = k < 6 ? 0.0 : PI / 3;
+		double azimuth = k < 6 ? k * PI / 3 : ( 2 * ( k - 6 ) + 1 ) * PI / 3;
+		vec3f dir( cos( azimuth ) * cos( elevation ), sin( elevation ), sin( azimuth ) * cos( elevation ) );
+
+		TransformNode *child = node->createChild( mat4f::translate( dir * ( 4.0 / 3.0 ) )
+			* alignY( dir ) * mat4f::scale( vec3f( 1.0 / 3, 1.0 / 3, 1.0 / 3 ) ) );
+		addFlake( scene, child, mat, depth - 1 );
+	}
+}
+
+Scene *makeSphereflake( int depth )
+{
+	Scene *scene = newScene();
+	aimCamera( scene, vec3f( 3.2, 2.4, 3.2 ), vec3f( 0, 0.2, 0 ), 40 );
+
+	Material chrome;
+	chrome.kd = vec3f( 0.35, 0.3, 0.25 );
+	chrome.ks = vec3f( 0.6, 0.6, 0.6 );
+	chrome.kr = vec3f( 0.5, 0.5, 0.5 );
+	chrome.shininess = 0.6;
+	addFlake( scene, &scene->transformRoot, scene->addMaterial( chrome ), depth );
+
+	addBox( scene, &scene->transformRoot,
+		mat4f::translate( vec3f( 0, -1.1, 0 ) ) * mat4f::scale( vec3f( 12, 0.2, 12 ) ),
+		diffuse( scene, vec3f( 0.6, 0.6, 0.6 ) ) );
+
+	scene->add( scene->create<DirectionalLight>( scene, vec3f( -0.4, -1, -0.3 ).normalize(), vec3f( 0.8, 0.8, 0.8 ) ) );
+	addPointLight( scene, vec3f( 2, 4, -1 ), vec3f( 0.6, 0.6, 0.6 ) );
+
+	return scene;
+}
+
+Scene *makeTriangleSoup( int numTriangles, unsigned int seed )
+{
+	Scene *scene = newScene();
+	aimCamera( scene, vec3f( 0, 0, 3.5 ), vec3f( 0, 0, 0 ), 40 );
+
+	BenchRandom random( seed );
+	Trimesh *mesh = scene->create<Trimesh>( scene, diffuse( scene, vec3f( 0.7, 0.6, 0.4 ) ),
+		&scene->transformRoot );
+	for( int t = 0; t < numTriangles; ++t ) {
+		vec3f center( random.range( -1, 1 ), random.range( -1, 1 ), random.range( -1, 1 ) );
+		for( int v = 0; v < 3; ++v ) {
+			mesh->addVertex( center + vec3f( random.range( -0.1, 0.1 ),
+				random.range( -0.1, 0.1 ), random.range( -0.1, 0.1 ) ) );
+		}
+		mesh->addFace( 3 * t, 3 * t + 1, 3 * t + 2 );
+	}
+	scene->add( mesh );
+
+	scene->add( scene->create<DirectionalLight>( scene, vec3f( -0.3, -0.5, -1 ).normalize(), vec3f( 1, 1, 1 ) ) );
+
+	return scene;
+}
+
+Scene *makeCornellBox()
+{
+	Scene *scene = newScene();
+	aimCamera( scene, vec3f( 0, 0, 3.4 ), vec3f( 0, 0, 0 ), 40 );
+
+	TransformNode *root = &scene->transformRoot;
+	MaterialID white = diffuse( scene, vec3f( 0.75, 0.75, 0.75 ) );
+	MaterialID red = diffuse( scene, vec3f( 0.75, 0.15, 0.15 ) );
+	MaterialID green = diffuse( scene, vec3f( 0.15, 0.75, 0.15 ) );
+
+	addBox( scene, root, mat4f::translate( vec3f( 0, -1.05, 0 ) ) * mat4f::scale( vec3f( 2.2, 0.1, 2.2 ) ), white );
+	addBox( scene, root, mat4f::translate( vec3f( 0, 1.05, 0 ) ) * mat4f::scale( vec3f( 2.2, 0.1, 2.2 ) ), white );
+	addBox( scene, root, mat4f::translate( vec3f( 0, 0, -1.05 ) ) * mat4f::scale( vec3f( 2.2, 2.2, 0.1 ) ), white );
+	addBox( scene, root, mat4f::translate( vec3f( -1.05, 0, 0 ) ) * mat4f::scale( vec3f( 0.1, 2.2, 2.2 ) ), red );
+	addBox( scene, root, mat4f::translate( vec3f( 1.05, 0, 0 ) ) * mat4f::scale( vec3f( 0.1, 2.2, 2.2 ) ), green );
+
+	addBox( scene, root, mat4f::translate( vec3f( 0.4, -0.55, -0.35 ) ) * mat4f::rotate( vec3f( 0, 1, 0 ), 0.35 )
+		* mat4f::scale( vec3f( 0.5, 0.9, 0.5 ) ), white );
+
+	Material glass;
+	glass.kd = vec3f( 0.05, 0.05, 0.05 );
+	glass.ks = vec3f( 0.8, 0.8, 0.8 );
+	glass.kr = vec3f( 0.1, 0.1, 0.1 );
+	glass.kt = vec3f( 0.9, 0.9, 0.9 );
+	glass.shininess = 0.9;
+	glass.index = 1.5;
+	addSphere( scene, root, mat4f::translate( vec3f( -0.4, -0.65, 0.2 ) ) * mat4f::scale( vec3f( 0.35, 0.35, 0.35 ) ),
+		scene->addMaterial( glass ) );
+
+	addPointLight( scene, vec3f( 0, 0.9, 0 ), vec3f( 1, 1, 1 ) );
+
+	return scene;
+}
+
+Scene *makeLightGrid( int n )
+{
+	Scene *scene = newScene();
+	aimCamera( scene, vec3f( 0, 4, 6 ), vec3f( 0, 0, 0 ), 45 );
+
+	TransformNode *root = &scene->transformRoot;
+	addBox( scene, root, mat4f::translate( vec3f( 0, -0.6, 0 ) ) * mat4f::scale( vec3f( 10, 0.2, 10 ) ),
+		diffuse( scene, vec3f( 0.7, 0.7, 0.7 ) ) );
+	for( int k = 0; k < 5; ++k ) {
+		double a = k * 2 * PI / 5;
+		addSphere( scene, root, mat4f::translate( vec3f( 1.6 * cos( a ), 0, 1.6 * sin( a ) ) )
+			* mat4f::scale( vec3f( 0.5, 0.5, 0.5 ) ),
+			diffuse( scene, vec3f( 0.3 + 0.1 * k, 0.7 - 0.1 * k, 0.5 ) ) );
+	}
+
+	double share = 2.0 / ( n * n );
+	for( int i = 0; i < n; ++i ) {
+		for( int j = 0; j < n; ++j ) {
+			double x = n > 1 ? -3 + 6.0 * i / ( n - 1 ) : 0;
+			double z = n > 1 ? -3 + 6.0 * j / ( n - 1 ) : 0;
+			addPointLight( scene, vec3f( x, 3, z ), vec3f( share, share, share ) );
+		}
+	}
+
+	return scene;
+}
+
+Scene *makeTransformChains( int numChains, int levels )
+{
+	Scene *scene = newScene();
+	aimCamera( scene, vec3f( 0, 5, 6 ), vec3f( 0, 0.5, 0 ), 45 );
+
+	MaterialID mat = diffuse( scene, vec3f( 0.4, 0.5, 0.8 ) );
+	mat4f step = mat4f::translate( vec3f( 0.2, 0.03, 0 ) ) * mat4f::rotate( vec3f( 0, 1, 0 ), 0.2 )
+		* mat4f::scale( vec3f( 0.98, 0.98, 0.98 ) );
+	mat4f boxShape = mat4f::scale( vec3f( 0.15, 0.15, 0.15 ) );
+
+	for( int c = 0; c < numChains; ++c ) {
+		TransformNode *node = scene->transformRoot.createChild(
+			mat4f::rotate( vec3f( 0, 1, 0 ), c * 2 * PI / numChains ) );
+		for( int l = 0; l < levels; ++l ) {
+			node = node->createChild( step );
+			addBox( scene, node, boxShape, mat );
+		}
+	}
+
+	scene->add( scene->create<DirectionalLight>( scene, vec3f( -0.3, -1, -0.4 ).normalize(), vec3f( 1, 1, 1 ) ) );
+
+	return scene;
+}
@@ -0,0 +1,34 @@
+//
+// scenegen.h
+//
+// Procedural benchmark scenes.  They are built straight into a Scene,
+// without going through the parser, and are the same on every run and
+// every platform (the random ones use their own generator), so timings
+// from different builds can be compared.
+//
+
+#ifndef __SCENEGEN_H__
+#define __SCENEGEN_H__
+
+class Scene;
+
+// Haines' sphereflake: a reflective sphere with nine children a third
+// its size, recursively.  depth 3 is 820 spheres.
+Scene *makeSphereflake( int depth );
+
+// numTriangles small random triangles in one mesh, filling a unit cube.
+Scene *makeTriangleSoup( int numTriangles, unsigned int seed );
+
+// A Cornell box: red and green side walls, one point light under the
+// ceiling, a glass sphere and a diffuse block.
+Scene *makeCornellBox();
+
+// A few objects on a floor lit by an n x n grid of point lights, so
+// almost all the work is shadow rays.
+Scene *makeLightGrid( int n );
+
+// numChains spiralling chains of boxes, each one levels deep: every box
+// hangs off the previous one's transform.
+Scene *makeTransformChains( int numChains, int levels );
+
+#endif // __SCENEGEN_H__
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "renderfarm.h"
+
+#include "../RayTracer.h"
+#include "../stats/timeline.h"
+
+FarmSettings::FarmSettings()
+	: workers( 2 ), width( 150 ), height( 0 ), bandRows( 0 ), depth( 0 ),
+	  antialiasing( 0 ), jitter( 0 ), superSampling( 0 ), exposure( 0.0 ), bandTimeout( 0.0 ),
+	  report( false )
+{
+}
+
+#ifdef WIN32
+
+bool farmSupported()
+{
+	return false;
+}
+
+bool farmRender( const char *sceneName, const FarmSettings& settings,
+	vector<unsigned char>& rgb, int& width, int& height, FarmStats *stats )
+{
+	fprintf( stderr, "worker processes are not supported on this platform\n" );
+	return false;
+}
+
+#else
+
+// Every message starts with one of these.  The coordinator sends a band
+// to trace (or band = QUIT); a worker answers with the band followed by
+// its rows, or, once, HELLO and the image size after loading the scene.
+struct BandMessage
+{
+	enum { HELLO = -1, FAILED = -2, QUIT = -3 };
+
+	int band;
+	int start, stop;	// rows; for HELLO, the width and height
+};
+
+// The whole of len bytes, or false if the other end went away.
+static bool sendAll( int fd, const void *data, size_t len )
+{
+	const char *p = (const char *)data;
+	while( len > 0 ) {
+		ssize_t n = send( fd, p, len, MSG_NOSIGNAL );
+		if( n < 0 && errno == EINTR )
+			continue;
+		if( n <= 0 )
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool recvAll( int fd, void *data, size_t len )
+{
+	char *p = (char *)data;
+	while( len > 0 ) {
+		ssize_t n = recv( fd, p, len, 0 );
+		if( n < 0 && errno == EINTR )
+			continue;
+		if( n <= 0 )
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool farmSupported()
+{
+	return true;
+}
+
+//
+// worker
+//
+
+static int runWorker( int fd, const char *sceneName, const FarmSettings& s )
+{
+	BandMessage msg;
+	RayTracer *tracer = new RayTracer();
+	if( !tracer->loadScene( (char *)sceneName ) ) {
+		msg.band = BandMessage::FAILED;
+		msg.start = msg.stop = 0;
+		sendAll( fd, &msg, sizeof( msg ) );
+		delete tracer;
+		return 1;
+	}
+
+	int width = s.width;
+	int height = s.height > 0 ? s.height : max( 1, (int)( width / tracer->aspectRatio() + 0.5 ) );
+	if( s.height > 0 )
+		tracer->getCamera()->setAspectRatio( (double)width / height );
+	tracer->setDepth( s.depth );
+	tracer->setAntialiasing( s.antialiasing );
+	tracer->setJitter( s.jitter );
+	tracer->setSuperSampling( s.superSampling );
+	tracer->setHDR( s.exposure != 0.0 );
+	tracer->setExposure( s.exposure );
+	tracer->traceSetup( width, height );
+
+	msg.band = BandMessage::HELLO;
+	msg.start = width;
+	msg.stop = height;
+	bool ok = sendAll( fd, &msg, sizeof( msg ) );
+
+	unsigned char *buf;
+	while( ok && recvAll( fd, &msg, sizeof( msg ) ) && msg.band >= 0 ) {
+		if( msg.start < 0 || msg.stop > height || msg.start >= msg.stop )
+			break;
+		tracer->traceLines( msg.start, msg.stop );
+		tracer->getBuffer( buf, width, height );
+		ok = sendAll( fd, &msg, sizeof( msg ) )
+			&& sendAll( fd, buf + (size_t)msg.start * width * 3, (size_t)( msg.stop - msg.start ) * width * 3 );
+	}
+
+	delete tracer;
+	close( fd );
+	return 0;
+}
+
+//
+// coordinator
+//
+
+struct Worker
+{
+	pid_t pid;
+	int fd;				// -1 once lost or finished
+	deque<int> inFlight;
+	int bandsDone;
+	bool lost;
+
+	double since;		// when it started on inFlight.front()
+	BandMessage msg;	// the answer being read, and how much of it
+	size_t got;			// (message, then rows) has arrived so far
+};
+
+static const int BANDS_IN_FLIGHT = 2;
+
+// Give up on w: its bands go back to the front of the queue.
+static void loseWorker( Worker& w, int index, deque<int>& queue, int& reassigned, bool report )
+{
+	if( report )
+		fprintf( stderr, "worker %d (pid %d) lost; reassigning %d bands\n",
+			index, (int)w.pid, (int)w.inFlight.size() );
+	reassigned += w.inFlight.size();
+	queue.insert( queue.begin(), w.inFlight.begin(), w.inFlight.end() );
+	w.inFlight.clear();
+	close( w.fd );
+	w.fd = -1;
+	w.lost = true;
+	w.got = 0;
+	kill( w.pid, SIGKILL );
+}
+
+// How long a worker may spend on one band before it counts as hung.
+static double bandLimit( const FarmSettings& s, double slowest )
+{
+	if( s.bandTimeout > 0.0 )
+		return s.bandTimeout;
+	return max( 60.0, 10.0 * slowest );
+}
+
+// Read whatever has arrived of w's answer for its current band, without
+// waiting for the rest, and set finished once the whole band is in rgb.
+// False if the worker hung up or answered with something else.
+static bool receiveBand( Worker& w, vector<unsigned char>& rgb, int width, int height, int bandRows,
+	bool& finished )
+{
+	finished = false;
+	char *dst;
+	size_t want;
+	if( w.got < sizeof( w.msg ) ) {
+		dst = (char *)&w.msg + w.got;
+		want = sizeof( w.msg ) - w.got;
+	} else {
+		size_t rows = (size_t)w.msg.start * width * 3;
+		dst = (char *)&rgb[ rows ] + ( w.got - sizeof( w.msg ) );
+		want = sizeof( w.msg ) + (size_t)( w.msg.stop - w.msg.start ) * width * 3 - w.got;
+	}
+
+	ssize_t n = recv( w.fd, dst, want, MSG_DONTWAIT );
+	if( n < 0 )
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	if( n == 0 )
+		return false;
+	w.got += n;
+
+	if( w.got < sizeof( w.msg ) )
+		return true;
+	if( w.got == sizeof( w.msg ) && ( w.msg.band != w.inFlight.front()
+		|| w.msg.start != w.msg.band * bandRows || w.msg.stop != min( height, w.msg.start + bandRows ) ) )
+		return false;
+	finished = w.got == sizeof( w.msg ) + (size_t)( w.msg.stop - w.msg.start ) * width * 3;
+	return true;
+}
+
+static bool sendBand( Worker& w, int band, int bandRows, int height )
+{
+	BandMessage msg;
+	msg.band = band;
+	msg.start = band * bandRows;
+	msg.stop = min( height, msg.start + bandRows );
+	if( !sendAll( w.fd, &msg, sizeof( msg ) ) )
+		return false;
+	w.inFlight.push_back( band );
+	return true;
+}
+
+bool farmRender( const char *sceneName, const FarmSettings& s,
+	vector<unsigned char>& rgb, int& width, int& height, FarmStats *stats )
+{
+	ScopedTimer timer( "farmRender" );
+	double start = timelineNow();
+
+	// Start the workers before this process has any threads: only the
+	// forking thread survives into the child.
+	fflush( stdout );
+	fflush( stderr );
+	vector<Worker> workers;
+	for( int k = 0; k < max( 1, s.workers ); ++k ) {
+		int sv[2];
+		if( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) < 0 ) {
+			perror( "socketpair" );
+			break;
+		}
+		pid_t pid = fork();
+		if( pid == 0 ) {
+			close( sv[0] );
+			for( size_t w = 0; w < workers.size(); ++w )
+				close( workers[w].fd );
+			_exit( runWorker( sv[1], sceneName, s ) );
+		}
+		close( sv[1] );
+		if( pid < 0 ) {
+			perror( "fork" );
+			close( sv[0] );
+			break;
+		}
+
+		Worker w;
+		w.pid = pid;
+		w.fd = sv[0];
+		w.bandsDone = 0;
+		w.lost = false;
+		w.since = 0.0;
+		w.got = 0;
+		workers.push_back( w );
+	}
+
+	// Every worker says how big the image is once it has the scene.
+	width = height = 0;
+	int reassigned = 0;
+	deque<int> queue;
+	for( size_t k = 0; k < workers.size(); ++k ) {
+		BandMessage hello;
+		if( !recvAll( workers[k].fd, &hello, sizeof( hello ) ) || hello.band != BandMessage::HELLO
+			|| ( width && ( hello.start != width || hello.stop != height ) ) ) {
+			loseWorker( workers[k], k, queue, reassigned, s.report );
+			continue;
+		}
+		width = hello.start;
+		height = hello.stop;
+	}
+
+	int bandRows = s.bandRows;
+	if( bandRows <= 0 )
+		bandRows = max( 1, height / ( 8 * (int)workers.size() ) );
+	int numBands = height ? ( height + bandRows - 1 ) / bandRows : 0;
+	for( int b = 0; b < numBands; ++b )
+		queue.push_back( b );
+	rgb.assign( (size_t)width * height * 3, 0 );
+
+	if( s.report && height )
+		fprintf( stderr, "%d workers, %d bands of %d rows\n", (int)workers.size(), numBands, bandRows );
+
+	int done = 0;
+	double slowest = 0.0;		// the longest any band has taken
+	vector<pollfd> fds;
+	vector<int> polled;
+	while( height && done < numBands ) {
+		// keep every live worker busy
+		for( size_t k = 0; k < workers.size(); ++k ) {
+			Worker& w = workers[k];
+			while( w.fd >= 0 && !queue.empty() && (int)w.inFlight.size() < BANDS_IN_FLIGHT ) {
+				if( w.inFlight.empty() )
+					w.since = timelineNow();
+				int band = queue.front();
+				queue.pop_front();
+				if( !sendBand( w, band, bandRows, height ) ) {
+					queue.push_front( band );
+					loseWorker( w, k, queue, reassigned, s.report );
+				}
+			}
+		}
+
+		// Give up on workers that have sat on a band too long (stuck, or
+		// stopped), and wake up in time for the next one that might.
+		double now = timelineNow();
+		double limit = bandLimit( s, slowest );
+		int timeout = 1000;
+		bool timedOut = false;
+		fds.clear();
+		polled.clear();
+		for( size_t k = 0; k < workers.size(); ++k ) {
+			Worker& w = workers[k];
+			if( w.fd < 0 || w.inFlight.empty() )
+				continue;
+			double left = w.since + limit - now;
+			if( left <= 0.0 ) {
+				if( s.report )
+					fprintf( stderr, "worker %d (pid %d) took over %.0f seconds on a band\n",
+						(int)k, (int)w.pid, limit );
+				loseWorker( w, k, queue, reassigned, s.report );
+				timedOut = true;
+				continue;
+			}
+			timeout = min( timeout, (int)( left * 1000.0 ) + 1 );
+
+			pollfd p;
+			p.fd = w.fd;
+			p.events = POLLIN;
+			p.revents = 0;
+			fds.push_back( p );
+			polled.push_back( k );
+		}
+		if( timedOut )
+			continue;	// hand its bands out first
+		if( fds.empty() )
+			break;		// nobody left to do the rest
+
+		if( poll( &fds[0], fds.size(), timeout ) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			perror( "poll" );
+			break;
+		}
+
+		for( size_t p = 0; p < fds.size(); ++p ) {
+			if( !fds[p].revents )
+				continue;
+
+			int k = polled[p];
+			Worker& w = workers[k];
+			bool finished;
+			if( !receiveBand( w, rgb, width, height, bandRows, finished ) ) {
+				loseWorker( w, k, queue, reassigned, s.report );
+				continue;
+			}
+			if( !finished )
+				continue;
+
+			double t = timelineNow();
+			slowest = max( slowest, t - w.since );
+			w.since = t;
+			w.got = 0;
+			w.inFlight.pop_front();
+			++w.bandsDone;
+			++done;
+		}
+	}
+
+	// Tell the rest to stop, then reap everybody.
+	for( size_t k = 0; k < workers.size(); ++k ) {
+		if( workers[k].fd < 0 )
+			continue;
+		BandMessage quit;
+		quit.band = BandMessage::QUIT;
+		quit.start = quit.stop = 0;
+		sendAll( workers[k].fd, &quit, sizeof( quit ) );
+		close( workers[k].fd );
+	}
+	for( size_t k = 0; k < workers.size(); ++k ) {
+		int status;
+		while( waitpid( workers[k].pid, &status, 0 ) < 0 && errno == EINTR )
+			;
+	}
+
+	if( stats ) {
+		stats->seconds = timelineNow() - start;
+		stats->bands = numBands;
+		stats->reassigned = reassigned;
+		stats->bandsDone.clear();
+		stats->lost.clear();
+		for( size_t k = 0; k < workers.size(); ++k ) {
+			stats->bandsDone.push_back( workers[k].bandsDone );
+			stats->lost.push_back( workers[k].lost );
+		}
+	}
+
+	if( !height ) {
+		fprintf( stderr, "no worker could load %s\n", sceneName );
+		return false;
+	}
+	if( done < numBands ) {
+		fprintf( stderr, "every worker was lost with %d of %d bands to go\n", numBands - done, numBands );
+		return false;
+	}
+	return true;
+}
+
+#endif // WIN32
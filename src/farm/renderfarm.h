@@ -0,0 +1,63 @@
+//
+// renderfarm.h
+//
+// Renders one image on several worker processes.  The coordinator starts
+// the workers, each of which loads the scene once and then traces bands
+// of rows (RayTracer::traceLines) as they are handed out, and streams the
+// finished rows back to be assembled.  Every worker has up to two bands in
+// flight so it never waits on the coordinator between them.  A worker that
+// dies, hangs up or takes too long over a band (see bandTimeout) loses
+// nothing: its bands go back on the queue for the others, and the render
+// only fails if every worker is gone.
+//
+// The workers are forked and talk to the coordinator over a socketpair
+// each, in the host's byte order, so they run on this machine; the
+// protocol is a stream of fixed-size messages, though, and doesn't care
+// what kind of socket carries it.  Not available on WIN32.
+//
+
+#ifndef __RENDERFARM_H__
+#define __RENDERFARM_H__
+
+#include <vector>
+
+using namespace std;
+
+struct FarmSettings
+{
+	FarmSettings();
+
+	int workers;
+	int width;
+	int height;				// 0: from the camera's aspect ratio
+	int bandRows;			// rows per band; 0 picks about eight bands per worker
+	int depth;
+	int antialiasing;
+	int jitter;
+	int superSampling;
+	double exposure;		// stops, tone mapped into the 8-bit rows
+	double bandTimeout;		// seconds a worker may spend on a band before it
+							// counts as hung; 0: ten times the slowest band
+							// so far, and at least a minute
+	bool report;			// progress and per-worker totals on stderr
+};
+
+struct FarmStats
+{
+	double seconds;
+	int bands;
+	int reassigned;			// bands handed out again after a worker was lost
+	vector<int> bandsDone;	// per worker
+	vector<bool> lost;		// per worker
+};
+
+// Whether this build can start worker processes.
+bool farmSupported();
+
+// Render sceneName on settings.workers worker processes into rgb (rows
+// bottom-up, as in RayTracer's buffer) and set width and height.  Returns
+// false if no worker could load the scene or all of them were lost.
+bool farmRender( const char *sceneName, const FarmSettings& settings,
+	vector<unsigned char>& rgb, int& width, int& height, FarmStats *stats = NULL );
+
+#endif // __RENDERFARM_H__
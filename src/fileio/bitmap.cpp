@@ -10,12 +10,15 @@
 //
 
 #include "bitmap.h"
- 
-BMP_BITMAPFILEHEADER bmfh; 
-BMP_BITMAPINFOHEADER bmih; 
+#include "../stats/timeline.h"
+
+// The headers are per call, so several threads (or renderers) can read
+// and write bitmaps at once.
 
 unsigned char *readBMP(char *fname, int& width, int& height)
 { 
+	BMP_BITMAPFILEHEADER bmfh; 
+	BMP_BITMAPINFOHEADER bmih; 
 	FILE* file; 
 	BMP_DWORD pos; 
  
@@ -35,10 +38,13 @@ unsigned char *readBMP(char *fname, int& width, int& height)
  
 	// error checking
 	if ( bmfh.bfType!= 0x4d42 ) {	// "BM" actually
+		fclose( file );
 		return NULL;
 	}
-	if ( bmih.biBitCount != 24 )  
+	if ( bmih.biBitCount != 24 ) {
+		fclose( file );
 		return NULL; 
+	}
 /*
  	if ( bmih.biCompression != BMP_BI_RGB ) {
 		return NULL;
@@ -62,12 +68,12 @@ unsigned char *readBMP(char *fname, int& width, int& height)
 
 	int foo = fread( data, bytes, 1, file ); 
 	
+	fclose( file );
+
 	if (!foo) {
 		delete [] data;
 		return NULL;
 	}
-
-	fclose( file );
 	
 	// shuffle bitmap data such that it is (R,G,B) tuples in row-major order
 	int i, j;
@@ -97,8 +103,12 @@ unsigned char *readBMP(char *fname, int& width, int& height)
 	return data; 
 } 
  
-void writeBMP(char *iname, int width, int height, unsigned char *data) 
+bool writeBMP(char *iname, int width, int height, unsigned char *data) 
 { 
+	ScopedTimer timer( "writeBMP" );
+
+	BMP_BITMAPFILEHEADER bmfh; 
+	BMP_BITMAPINFOHEADER bmih; 
 	int bytes, pad;
 	bytes = width * 3;
 	pad = (bytes%4) ? 4-(bytes%4) : 0;
@@ -125,6 +135,10 @@ void writeBMP(char *iname, int width, int height, unsigned char *data)
 	bmih.biClrImportant = 0;
 
 	FILE *foo=fopen(iname, "wb"); 
+	if (!foo) {
+		fprintf( stderr, "Error: couldn't write %s\n", iname );
+		return false;
+	}
 
 	//	fwrite(&bmfh, sizeof(BMP_BITMAPFILEHEADER), 1, foo);
 	fwrite( &(bmfh.bfType), 2, 1, foo); 
@@ -136,10 +150,12 @@ void writeBMP(char *iname, int width, int height, unsigned char *data)
 	fwrite(&bmih, sizeof(BMP_BITMAPINFOHEADER), 1, foo); 
 
 	bytes /= height;
+	// only the row's own pixels come from data; the padding is zeros
 	unsigned char* scanline = new unsigned char [bytes];
+	memset( scanline, 0, bytes );
 	for ( int j = 0; j < height; ++j )
 	{
-		memcpy( scanline, data + j*3*width, bytes );
+		memcpy( scanline, data + j*3*width, 3*width );
 		for ( int i = 0; i < width; ++i )
 		{
 			unsigned char temp = scanline[i*3];
@@ -151,5 +167,6 @@ void writeBMP(char *iname, int width, int height, unsigned char *data)
 
 	delete [] scanline;
 
-	fclose(foo);
+	bool ok = !ferror(foo);
+	return fclose(foo) == 0 && ok;
 } 
\ No newline at end of file
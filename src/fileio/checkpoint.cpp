@@ -0,0 +1,107 @@
+//
+// checkpoint.cpp
+//
+// The checkpoint file: a magic number, the header fields, then the tile
+// flags, the 8-bit image and, if there is one, the float image.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "checkpoint.h"
+#include "../stats/timeline.h"
+
+static const char MAGIC[8] = { 'R', 'A', 'Y', 'C', 'K', 'P', 'T', '1' };
+
+static int numTiles( int width, int height, int tileSize )
+{
+	return ( ( width + tileSize - 1 ) / tileSize ) * ( ( height + tileSize - 1 ) / tileSize );
+}
+
+bool writeCheckpoint( const char *fname, const Checkpoint& cp )
+{
+	ScopedTimer timer( "writeCheckpoint" );
+
+	std::string tmp = std::string( fname ) + ".tmp";
+	FILE *file = fopen( tmp.c_str(), "wb" );
+	if ( file == NULL ) {
+		fprintf( stderr, "Error: couldn't write %s\n", tmp.c_str() );
+		return false;
+	}
+
+	int header[4] = { cp.width, cp.height, cp.tileSize, cp.hdr.empty() ? 0 : 1 };
+	bool ok = fwrite( MAGIC, sizeof( MAGIC ), 1, file ) == 1
+		&& fwrite( &cp.settingsHash, sizeof( cp.settingsHash ), 1, file ) == 1
+		&& fwrite( &cp.seed, sizeof( cp.seed ), 1, file ) == 1
+		&& fwrite( header, sizeof( header ), 1, file ) == 1
+		&& fwrite( &cp.tilesDone[0], 1, cp.tilesDone.size(), file ) == cp.tilesDone.size()
+		&& fwrite( &cp.rgb[0], 1, cp.rgb.size(), file ) == cp.rgb.size()
+		&& ( cp.hdr.empty() || fwrite( &cp.hdr[0], sizeof( float ), cp.hdr.size(), file ) == cp.hdr.size() );
+	ok = fclose( file ) == 0 && ok;
+
+	if ( !ok || rename( tmp.c_str(), fname ) != 0 ) {
+		fprintf( stderr, "Error: couldn't write %s\n", fname );
+		remove( tmp.c_str() );
+		return false;
+	}
+	return true;
+}
+
+bool readCheckpoint( const char *fname, Checkpoint& cp )
+{
+	FILE *file = fopen( fname, "rb" );
+	if ( file == NULL )
+		return false;
+
+	char magic[8];
+	int header[4];
+	bool ok = fread( magic, sizeof( magic ), 1, file ) == 1 && !memcmp( magic, MAGIC, sizeof( MAGIC ) )
+		&& fread( &cp.settingsHash, sizeof( cp.settingsHash ), 1, file ) == 1
+		&& fread( &cp.seed, sizeof( cp.seed ), 1, file ) == 1
+		&& fread( header, sizeof( header ), 1, file ) == 1
+		&& header[0] > 0 && header[1] > 0 && header[2] > 0;
+
+	if ( ok ) {
+		cp.width = header[0];
+		cp.height = header[1];
+		cp.tileSize = header[2];
+		size_t n = (size_t)cp.width * cp.height * 3;
+		cp.tilesDone.resize( numTiles( cp.width, cp.height, cp.tileSize ) );
+		cp.rgb.resize( n );
+		cp.hdr.resize( header[3] ? n : 0 );
+		ok = fread( &cp.tilesDone[0], 1, cp.tilesDone.size(), file ) == cp.tilesDone.size()
+			&& fread( &cp.rgb[0], 1, n, file ) == n
+			&& ( cp.hdr.empty() || fread( &cp.hdr[0], sizeof( float ), n, file ) == n );
+	}
+
+	fclose( file );
+	return ok;
+}
+
+unsigned long long hashBytes( const void *data, size_t n, unsigned long long h )
+{
+	const unsigned char *p = (const unsigned char *)data;
+	for ( size_t k = 0; k < n; ++k ) {
+		h ^= p[k];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+bool hashFile( const char *fname, unsigned long long& h )
+{
+	FILE *file = fopen( fname, "rb" );
+	if ( file == NULL )
+		return false;
+
+	unsigned char buf[65536];
+	size_t n;
+	while ( ( n = fread( buf, 1, sizeof( buf ), file ) ) > 0 )
+		h = hashBytes( buf, n, h );
+
+	bool ok = !ferror( file );
+	fclose( file );
+	return ok;
+}
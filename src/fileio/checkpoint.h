@@ -0,0 +1,42 @@
+//
+// checkpoint.h
+//
+// A partly finished render on disk: which tiles are done and their
+// pixels, so that a render that was cut short can be finished without
+// tracing them again.  The settings hash says what the pixels were traced
+// from (see hashBytes); a checkpoint is only any use to a render
+// with the same hash.  Files are in the host's byte order.
+//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+
+#include <vector>
+
+struct Checkpoint
+{
+	unsigned long long settingsHash;
+	unsigned int seed;					// RayTracer::setSeed
+	int width, height;
+	int tileSize;						// tiles numbered as TileRenderer does
+	std::vector<unsigned char> tilesDone;	// one flag per tile
+	std::vector<unsigned char> rgb;		// width * height * 3, rows bottom-up
+	std::vector<float> hdr;				// the same in floats, or empty
+};
+
+// Written to fname.tmp and renamed over fname, so a reader (or a crash
+// half way through) never sees a partial file.
+extern bool writeCheckpoint( const char *fname, const Checkpoint& cp );
+
+// False if fname can't be read or isn't a whole checkpoint.
+extern bool readCheckpoint( const char *fname, Checkpoint& cp );
+
+// FNV-1a, for building settings hashes: hashBytes folds n bytes into h,
+// hashFile a whole file (false if it can't be read).
+extern unsigned long long hashBytes( const void *data, size_t n,
+	unsigned long long h = 14695981039346656037ULL );
+extern bool hashFile( const char *fname, unsigned long long& h );
+
+#endif
@@ -0,0 +1,230 @@
+//
+// hdrimage.cpp
+//
+// PFM and Radiance RGBE output, and the tone mapping pass that turns a
+// float framebuffer into the 8-bit image used for display and BMP.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <vector>
+
+#include "hdrimage.h"
+#include "../stats/timeline.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HDR_USE_SSE2
+#endif
+
+static bool hasExtension( const char *fname, const char *ext )
+{
+	const char *dot = strrchr( fname, '.' );
+	if ( dot == NULL || strlen( dot + 1 ) != strlen( ext ) )
+		return false;
+	for ( ++dot; *dot; ++dot, ++ext )
+		if ( tolower( *dot ) != *ext )
+			return false;
+	return true;
+}
+
+bool isHDRFileName( const char *fname )
+{
+	return hasExtension( fname, "pfm" ) || hasExtension( fname, "hdr" );
+}
+
+bool writeHDR( const char *fname, int width, int height, const float *data )
+{
+	ScopedTimer timer( "writeHDR" );
+
+	if ( hasExtension( fname, "pfm" ) )
+		return writePFM( fname, width, height, data );
+	if ( hasExtension( fname, "hdr" ) )
+		return writeRGBE( fname, width, height, data );
+	return false;
+}
+
+static bool isLittleEndian()
+{
+	unsigned int one = 1;
+	return *(unsigned char *)&one == 1;
+}
+
+float *readPFM( const char *fname, int& width, int& height )
+{
+	FILE *file = fopen( fname, "rb" );
+	if ( file == NULL )
+		return NULL;
+
+	char magic[3] = { 0, 0, 0 };
+	float scale;
+	if ( fscanf( file, "%2s %d %d %f", magic, &width, &height, &scale ) != 4
+		|| strcmp( magic, "PF" ) || width <= 0 || height <= 0 ) {
+		fclose( file );
+		return NULL;
+	}
+	fgetc( file );	// the single whitespace character ending the header
+
+	size_t n = (size_t)width * height * 3;
+	float *data = new float[ n ];
+	if ( fread( data, sizeof(float), n, file ) != n ) {
+		delete [] data;
+		fclose( file );
+		return NULL;
+	}
+	fclose( file );
+
+	// a negative scale means little-endian data
+	if ( ( scale < 0 ) != isLittleEndian() ) {
+		unsigned char *b = (unsigned char *)data;
+		for ( size_t i = 0; i < n; ++i, b += 4 ) {
+			unsigned char t = b[0]; b[0] = b[3]; b[3] = t;
+			t = b[1]; b[1] = b[2]; b[2] = t;
+		}
+	}
+
+	return data;
+}
+
+bool writePFM( const char *fname, int width, int height, const float *data )
+{
+	FILE *file = fopen( fname, "wb" );
+	if ( file == NULL )
+		return false;
+
+	// PFM rows run bottom to top, just like ours
+	fprintf( file, "PF\n%d %d\n%s\n", width, height, isLittleEndian() ? "-1.0" : "1.0" );
+	size_t n = (size_t)width * height * 3;
+	bool ok = fwrite( data, sizeof(float), n, file ) == n;
+	return fclose( file ) == 0 && ok;
+}
+
+static void floatToRGBE( const float *rgb, unsigned char *rgbe )
+{
+	float v = rgb[0];
+	if ( rgb[1] > v ) v = rgb[1];
+	if ( rgb[2] > v ) v = rgb[2];
+
+	if ( v < 1e-32f ) {
+		rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+	} else {
+		int e;
+		float m = (float)( frexp( v, &e ) * 256.0 / v );
+		rgbe[0] = (unsigned char)( ( rgb[0] > 0 ? rgb[0] : 0 ) * m );
+		rgbe[1] = (unsigned char)( ( rgb[1] > 0 ? rgb[1] : 0 ) * m );
+		rgbe[2] = (unsigned char)( ( rgb[2] > 0 ? rgb[2] : 0 ) * m );
+		rgbe[3] = (unsigned char)( e + 128 );
+	}
+}
+
+// Run-length encode one component of a scanline, Radiance style: runs of
+// 4 or more become (128+count, value), everything else goes in literal
+// packets of up to 128 bytes.
+static void encodeComponent( const unsigned char *data, int n, std::vector<unsigned char>& out )
+{
+	const int MINRUN = 4;
+	int cur = 0;
+
+	while ( cur < n ) {
+		// find the next run long enough to be worth encoding
+		int begRun = cur, runCount = 0;
+		while ( begRun < n ) {
+			runCount = 1;
+			while ( runCount < 127 && begRun + runCount < n
+				&& data[ begRun ] == data[ begRun + runCount ] )
+				++runCount;
+			if ( runCount >= MINRUN )
+				break;
+			begRun += runCount;
+		}
+		if ( runCount < MINRUN )
+			begRun = n;
+
+		// literal bytes up to the run
+		while ( cur < begRun ) {
+			int count = begRun - cur;
+			if ( count > 128 )
+				count = 128;
+			out.push_back( (unsigned char)count );
+			out.insert( out.end(), data + cur, data + cur + count );
+			cur += count;
+		}
+
+		if ( begRun < n ) {
+			out.push_back( (unsigned char)( 128 + runCount ) );
+			out.push_back( data[ begRun ] );
+			cur = begRun + runCount;
+		}
+	}
+}
+
+bool writeRGBE( const char *fname, int width, int height, const float *data )
+{
+	FILE *file = fopen( fname, "wb" );
+	if ( file == NULL )
+		return false;
+
+	// standard orientation is top row first
+	fprintf( file, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width );
+
+	std::vector<unsigned char> rgbe( width * 4 );
+	std::vector<unsigned char> planes( width );
+	std::vector<unsigned char> out;
+	bool ok = true;
+
+	for ( int j = height - 1; j >= 0 && ok; --j ) {
+		const float *row = data + (size_t)j * width * 3;
+		for ( int i = 0; i < width; ++i )
+			floatToRGBE( row + i * 3, &rgbe[ i * 4 ] );
+
+		out.clear();
+		if ( width < 8 || width > 0x7fff ) {
+			// too narrow or too wide for run-length encoding
+			out.insert( out.end(), rgbe.begin(), rgbe.end() );
+		} else {
+			out.push_back( 2 );
+			out.push_back( 2 );
+			out.push_back( (unsigned char)( width >> 8 ) );
+			out.push_back( (unsigned char)( width & 0xff ) );
+			for ( int c = 0; c < 4; ++c ) {
+				for ( int i = 0; i < width; ++i )
+					planes[i] = rgbe[ i * 4 + c ];
+				encodeComponent( &planes[0], width, out );
+			}
+		}
+		ok = fwrite( &out[0], out.size(), 1, file ) == 1;
+	}
+
+	return fclose( file ) == 0 && ok;
+}
+
+void toneMap( const float *hdr, unsigned char *ldr, size_t n, double exposure )
+{
+	const float scale = (float)pow( 2.0, exposure );
+	size_t i = 0;
+
+#ifdef HDR_USE_SSE2
+	// 16 components per iteration: scale, clamp, truncate and pack
+	const __m128 s = _mm_set1_ps( scale * 255.0f );
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 top = _mm_set1_ps( 255.0f );
+	for ( ; i + 16 <= n; i += 16 ) {
+		__m128 a = _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( hdr + i ), s ), zero ), top );
+		__m128 b = _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( hdr + i + 4 ), s ), zero ), top );
+		__m128 c = _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( hdr + i + 8 ), s ), zero ), top );
+		__m128 d = _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( hdr + i + 12 ), s ), zero ), top );
+		__m128i ab = _mm_packs_epi32( _mm_cvttps_epi32( a ), _mm_cvttps_epi32( b ) );
+		__m128i cd = _mm_packs_epi32( _mm_cvttps_epi32( c ), _mm_cvttps_epi32( d ) );
+		_mm_storeu_si128( (__m128i *)( ldr + i ), _mm_packus_epi16( ab, cd ) );
+	}
+#endif
+
+	for ( ; i < n; ++i ) {
+		float v = hdr[i] * scale * 255.0f;
+		v = v < 0.0f ? 0.0f : ( v > 255.0f ? 255.0f : v );
+		ldr[i] = (unsigned char)v;
+	}
+}
@@ -0,0 +1,30 @@
+//
+// hdrimage.h
+//
+// Floating point (linear radiance) image I/O and tone mapping.  Pixels are
+// RGB float triples, rows bottom-up like the ray tracer's 8-bit buffer.
+//
+
+#ifndef HDRIMAGE_H
+#define HDRIMAGE_H
+
+#include <stddef.h>
+
+// Portable float map: uncompressed 32-bit floats.
+extern float *readPFM( const char *fname, int& width, int& height );
+extern bool writePFM( const char *fname, int width, int height, const float *data );
+
+// Radiance RGBE (.hdr) with run-length encoded scanlines.
+extern bool writeRGBE( const char *fname, int width, int height, const float *data );
+
+// Scale n floats by 2^exposure, clamp to [0,1] and quantize them to bytes
+// the same way the ray tracer does (truncating 255*v).
+extern void toneMap( const float *hdr, unsigned char *ldr, size_t n, double exposure );
+
+// True if fname has a floating point image extension (.pfm or .hdr).
+extern bool isHDRFileName( const char *fname );
+
+// Write a float image, choosing the format from the file extension.
+extern bool writeHDR( const char *fname, int width, int height, const float *data );
+
+#endif
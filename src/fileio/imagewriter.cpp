@@ -0,0 +1,259 @@
+//
+// imagewriter.cpp
+//
+// Streaming BMP and run-length encoded TGA output.
+//
+
+#include <string.h>
+#include <ctype.h>
+
+#include <string>
+
+#include "imagewriter.h"
+#include "bitmap.h"
+
+#ifdef WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+// Uncompressed 24-bit BMP.  Rows sit at fixed offsets, so they can be
+// written as soon as they are complete, in any order.
+class BMPWriter
+	: public ImageWriter
+{
+public:
+	BMPWriter( FILE *fp, int width, int height )
+		: ImageWriter( fp, width, height, false )
+	{
+		int bytes = width * 3;
+		m_nPad = (bytes%4) ? 4-(bytes%4) : 0;
+		m_nRowBytes = bytes + m_nPad;
+	}
+
+protected:
+	virtual bool writeHeader()
+	{
+		BMP_BITMAPFILEHEADER bmfh;
+		BMP_BITMAPINFOHEADER bmih;
+
+		bmfh.bfType = 0x4d42;    // "BM"
+		bmfh.bfOffBits = 14 + sizeof(BMP_BITMAPINFOHEADER);
+		bmfh.bfSize = bmfh.bfOffBits + (BMP_DWORD)m_nRowBytes * m_nHeight;
+		bmfh.bfReserved1 = 0;
+		bmfh.bfReserved2 = 0;
+
+		bmih.biSize = sizeof(BMP_BITMAPINFOHEADER);
+		bmih.biWidth = m_nWidth;
+		bmih.biHeight = m_nHeight;
+		bmih.biPlanes = 1;
+		bmih.biBitCount = 24;
+		bmih.biCompression = BMP_BI_RGB;
+		bmih.biSizeImage = 0;
+		bmih.biXPelsPerMeter = (int)(100 / 2.54 * 72);
+		bmih.biYPelsPerMeter = (int)(100 / 2.54 * 72);
+		bmih.biClrUsed = 0;
+		bmih.biClrImportant = 0;
+
+		fwrite( &(bmfh.bfType), 2, 1, m_fp );
+		fwrite( &(bmfh.bfSize), 4, 1, m_fp );
+		fwrite( &(bmfh.bfReserved1), 2, 1, m_fp );
+		fwrite( &(bmfh.bfReserved2), 2, 1, m_fp );
+		fwrite( &(bmfh.bfOffBits), 4, 1, m_fp );
+
+		return fwrite( &bmih, sizeof(BMP_BITMAPINFOHEADER), 1, m_fp ) == 1;
+	}
+
+	virtual bool writeRow( int y, const unsigned char *rgb )
+	{
+		std::vector<unsigned char> scanline( m_nRowBytes, 0 );
+		for ( int i = 0; i < m_nWidth; ++i )
+		{
+			scanline[i*3] = rgb[i*3+2];
+			scanline[i*3+1] = rgb[i*3+1];
+			scanline[i*3+2] = rgb[i*3];
+		}
+
+		long long offset = 14 + sizeof(BMP_BITMAPINFOHEADER) + (long long)y * m_nRowBytes;
+		if ( fseek64( m_fp, offset, SEEK_SET ) )
+			return false;
+		return fwrite( &scanline[0], m_nRowBytes, 1, m_fp ) == 1;
+	}
+
+private:
+	int m_nPad;
+	int m_nRowBytes;
+};
+
+// Run-length encoded truecolour TGA (image type 10), bottom-left origin.
+// Packets never span scanlines, so each row is encoded on its own, but the
+// compressed rows have to be written in order.
+class TGAWriter
+	: public ImageWriter
+{
+public:
+	TGAWriter( FILE *fp, int width, int height )
+		: ImageWriter( fp, width, height, true ) {}
+
+protected:
+	virtual bool writeHeader()
+	{
+		unsigned char header[18];
+		memset( header, 0, sizeof(header) );
+		header[2] = 10;								// RLE truecolour
+		header[12] = (unsigned char)(m_nWidth & 0xff);
+		header[13] = (unsigned char)(m_nWidth >> 8);
+		header[14] = (unsigned char)(m_nHeight & 0xff);
+		header[15] = (unsigned char)(m_nHeight >> 8);
+		header[16] = 24;							// bits per pixel
+		header[17] = 0;								// bottom-left origin
+		return fwrite( header, sizeof(header), 1, m_fp ) == 1;
+	}
+
+	virtual bool writeRow( int, const unsigned char *rgb )
+	{
+		std::vector<unsigned char> out;
+		out.reserve( m_nWidth * 3 + m_nWidth / 128 + 1 );
+
+		int i = 0;
+		while ( i < m_nWidth ) {
+			// length of the run of identical pixels starting at i
+			int run = 1;
+			while ( i + run < m_nWidth && run < 128 && !memcmp( rgb + i*3, rgb + (i+run)*3, 3 ) )
+				++run;
+
+			if ( run > 1 ) {
+				out.push_back( (unsigned char)(0x80 | (run - 1)) );
+				pushBGR( out, rgb + i*3 );
+				i += run;
+			} else {
+				// raw packet up to the next run of at least two
+				int raw = 1;
+				while ( i + raw < m_nWidth && raw < 128
+					&& ( i + raw + 1 >= m_nWidth || memcmp( rgb + (i+raw)*3, rgb + (i+raw+1)*3, 3 ) ) )
+					++raw;
+
+				out.push_back( (unsigned char)(raw - 1) );
+				for ( int k = 0; k < raw; ++k )
+					pushBGR( out, rgb + (i+k)*3 );
+				i += raw;
+			}
+		}
+
+		return fwrite( &out[0], out.size(), 1, m_fp ) == 1;
+	}
+
+private:
+	static void pushBGR( std::vector<unsigned char>& out, const unsigned char *rgb )
+	{
+		out.push_back( rgb[2] );
+		out.push_back( rgb[1] );
+		out.push_back( rgb[0] );
+	}
+};
+
+static std::string extension( const char *fname )
+{
+	const char *dot = strrchr( fname, '.' );
+	std::string ext;
+	if ( dot )
+		for ( ++dot; *dot; ++dot )
+			ext += (char)tolower( *dot );
+	return ext;
+}
+
+ImageWriter *ImageWriter::create( const char *fname, int width, int height )
+{
+	std::string ext = extension( fname );
+	if ( ext != "bmp" && ext != "tga" )
+		return NULL;
+	if ( ext == "tga" && ( width > 0xffff || height > 0xffff ) )
+		return NULL;
+
+	FILE *fp = fopen( fname, "wb" );
+	if ( fp == NULL )
+		return NULL;
+
+	ImageWriter *writer;
+	if ( ext == "bmp" )
+		writer = new BMPWriter( fp, width, height );
+	else
+		writer = new TGAWriter( fp, width, height );
+
+	if ( !writer->writeHeader() ) {
+		delete writer;
+		return NULL;
+	}
+	return writer;
+}
+
+ImageWriter::ImageWriter( FILE *fp, int width, int height, bool inOrder )
+	: m_fp( fp ), m_nWidth( width ), m_nHeight( height ),
+	  m_bInOrder( inOrder ), m_nNextRow( 0 ), m_nRowsWritten( 0 ), m_bFailed( false )
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+	if ( m_fp )
+		fclose( m_fp );
+}
+
+bool ImageWriter::writeTile( int x, int y, int w, int h, const unsigned char *data, int stride )
+{
+	std::lock_guard<std::mutex> guard( m_lock );
+
+	if ( m_bFailed || x < 0 || y < 0 || x + w > m_nWidth || y + h > m_nHeight )
+		return false;
+
+	for ( int j = 0; j < h; ++j ) {
+		Row& row = m_pending[ y + j ];
+		if ( row.pixels.empty() ) {
+			row.pixels.resize( m_nWidth * 3 );
+			row.filled = 0;
+		}
+		memcpy( &row.pixels[ x * 3 ], data + j * stride, w * 3 );
+		row.filled += w;
+	}
+
+	return flushRows();
+}
+
+// Write out, and forget, every complete row that the format allows.
+bool ImageWriter::flushRows()
+{
+	std::map<int, Row>::iterator r = m_pending.begin();
+	while ( r != m_pending.end() ) {
+		if ( m_bInOrder && r->first != m_nNextRow )
+			break;
+
+		if ( r->second.filled < m_nWidth ) {
+			if ( m_bInOrder )
+				break;
+			++r;
+			continue;
+		}
+
+		if ( !writeRow( r->first, &r->second.pixels[0] ) ) {
+			m_bFailed = true;
+			return false;
+		}
+		++m_nRowsWritten;
+		++m_nNextRow;
+		m_pending.erase( r++ );
+	}
+	return true;
+}
+
+bool ImageWriter::close()
+{
+	std::lock_guard<std::mutex> guard( m_lock );
+
+	bool ok = !m_bFailed && m_nRowsWritten == m_nHeight && writeTrailer();
+	if ( fclose( m_fp ) )
+		ok = false;
+	m_fp = NULL;
+	m_pending.clear();
+	return ok;
+}
@@ -0,0 +1,70 @@
+//
+// imagewriter.h
+//
+// Streaming image output.  Finished tiles are handed to an ImageWriter in
+// any order; each scanline is written to disk and released as soon as it
+// is complete (and, for formats that must be written in order, as soon as
+// every scanline below it has been written too).  This way a render
+// never needs the whole image in memory.
+//
+
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <stdio.h>
+
+#include <map>
+#include <vector>
+#include <mutex>
+
+class ImageWriter
+{
+public:
+	// Pick a writer from the file extension: .bmp (uncompressed) or .tga
+	// (run-length encoded).  Returns NULL if the format is unknown or the
+	// file can't be created.
+	static ImageWriter *create( const char *fname, int width, int height );
+
+	virtual ~ImageWriter();
+
+	// Hand over the w x h block of RGB pixels at (x,y), rows bottom-up as
+	// in the ray tracer's buffer, with stride bytes between rows.  Safe to
+	// call from several threads at once.
+	bool writeTile( int x, int y, int w, int h, const unsigned char *data, int stride );
+
+	// Flush everything and close the file.  Fails if rows are missing.
+	bool close();
+
+	int width() const { return m_nWidth; }
+	int height() const { return m_nHeight; }
+
+protected:
+	ImageWriter( FILE *fp, int width, int height, bool inOrder );
+
+	virtual bool writeHeader() = 0;
+	virtual bool writeRow( int y, const unsigned char *rgb ) = 0;
+	virtual bool writeTrailer() { return true; }
+
+	FILE *m_fp;
+	int m_nWidth, m_nHeight;
+
+private:
+	struct Row
+	{
+		std::vector<unsigned char> pixels;
+		int filled;
+	};
+
+	bool flushRows();
+
+	// rows have to reach writeRow() bottom to top
+	bool m_bInOrder;
+	int m_nNextRow;
+	int m_nRowsWritten;
+	bool m_bFailed;
+
+	std::map<int, Row> m_pending;
+	std::mutex m_lock;
+};
+
+#endif
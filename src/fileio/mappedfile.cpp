@@ -0,0 +1,104 @@
+//
+// mappedfile.cpp
+//
+// Memory mapping with CreateFileMapping on Windows and mmap elsewhere.
+//
+
+#include "mappedfile.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile()
+	: m_pData( NULL ), m_nSize( 0 )
+{
+#ifdef WIN32
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+#endif
+}
+
+#ifdef WIN32
+
+MappedFile *MappedFile::open( const char *fname )
+{
+	HANDLE file = CreateFileA( fname, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if ( file == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	LARGE_INTEGER size;
+	if ( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 ) {
+		CloseHandle( file );
+		return NULL;
+	}
+
+	HANDLE mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if ( mapping == NULL ) {
+		CloseHandle( file );
+		return NULL;
+	}
+
+	void *view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( view == NULL ) {
+		CloseHandle( mapping );
+		CloseHandle( file );
+		return NULL;
+	}
+
+	MappedFile *mf = new MappedFile;
+	mf->m_pData = (const char *)view;
+	mf->m_nSize = (size_t)size.QuadPart;
+	mf->m_hFile = file;
+	mf->m_hMapping = mapping;
+	return mf;
+}
+
+MappedFile::~MappedFile()
+{
+	if ( m_pData )
+		UnmapViewOfFile( m_pData );
+	if ( m_hMapping )
+		CloseHandle( (HANDLE)m_hMapping );
+	if ( m_hFile != INVALID_HANDLE_VALUE )
+		CloseHandle( (HANDLE)m_hFile );
+}
+
+#else
+
+MappedFile *MappedFile::open( const char *fname )
+{
+	int fd = ::open( fname, O_RDONLY );
+	if ( fd < 0 )
+		return NULL;
+
+	struct stat st;
+	if ( fstat( fd, &st ) < 0 || st.st_size == 0 ) {
+		close( fd );
+		return NULL;
+	}
+
+	void *p = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );	// the mapping keeps its own reference
+	if ( p == MAP_FAILED )
+		return NULL;
+
+	MappedFile *mf = new MappedFile;
+	mf->m_pData = (const char *)p;
+	mf->m_nSize = (size_t)st.st_size;
+	return mf;
+}
+
+MappedFile::~MappedFile()
+{
+	if ( m_pData )
+		munmap( (void *)m_pData, m_nSize );
+}
+
+#endif
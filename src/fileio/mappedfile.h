@@ -0,0 +1,35 @@
+//
+// mappedfile.h
+//
+// A read-only memory mapping of a whole file.
+//
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+
+class MappedFile
+{
+public:
+	// Map fname into memory; returns NULL if it can't be opened or mapped.
+	static MappedFile *open( const char *fname );
+	~MappedFile();
+
+	const char *data() const { return m_pData; }
+	size_t size() const { return m_nSize; }
+
+private:
+	MappedFile();
+	MappedFile( const MappedFile& );
+	MappedFile& operator =( const MappedFile& );
+
+	const char *m_pData;
+	size_t m_nSize;
+#ifdef WIN32
+	void *m_hFile;
+	void *m_hMapping;
+#endif
+};
+
+#endif
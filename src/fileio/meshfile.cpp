@@ -0,0 +1,679 @@
+#ifdef WIN32
+#pragma warning( disable : 4786 )
+#endif
+
+#include <string.h>
+
+#include <map>
+#include <thread>
+
+#include "meshfile.h"
+#include "mappedfile.h"
+#include "parse.h"
+
+// OBJ files smaller than this are not worth splitting between threads.
+static const size_t OBJ_CHUNK_MIN = 4 << 20;
+
+static bool hasExtension( const string& filename, const char *ext )
+{
+	size_t n = strlen( ext );
+	if( filename.size() < n )
+		return false;
+	for( size_t i = 0; i < n; ++i ) {
+		char c = filename[ filename.size() - n + i ];
+		if( c >= 'A' && c <= 'Z' )
+			c += 'a' - 'A';
+		if( c != ext[i] )
+			return false;
+	}
+	return true;
+}
+
+static string lineError( const string& filename, int line, const string& msg )
+{
+	char buf[ 32 ];
+	sprintf( buf, ":%d: ", line );
+	return filename + buf + msg;
+}
+
+void readMeshFile( const string& filename, MeshData& mesh )
+{
+	if( hasExtension( filename, ".obj" ) )
+		readOBJ( filename, mesh );
+	else if( hasExtension( filename, ".ply" ) )
+		readPLY( filename, mesh );
+	else
+		throw ParseError( "Unknown mesh file type: " + filename + " (use .obj or .ply)" );
+}
+
+//------------------------------------------------------------------ OBJ
+
+struct ObjCorner
+{
+	int v, n;		// 0-based; n is -1 when the corner has no normal
+};
+
+// What one thread makes of its share of the file.  Relative (negative)
+// indices can only be resolved once the counts of the earlier chunks are
+// known, so they are kept chunk-relative and listed for fixing up.
+struct ObjChunk
+{
+	const char *begin, *end;
+
+	vector<vec3f> positions;
+	vector<vec3f> normals;
+	vector<int> faceSizes;
+	vector<ObjCorner> corners;
+	vector<int> relativeV, relativeN;	// corners holding chunk-relative indices
+
+	int lines;
+	int errorLine;			// within the chunk, 0 if none
+	string error;
+};
+
+static inline bool isSpace( char c )
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline void skipSpace( const char *&p, const char *end )
+{
+	while( p < end && isSpace( *p ) )
+		++p;
+}
+
+static bool parseInt( const char *&p, const char *end, int& val )
+{
+	bool negative = false;
+	if( p < end && ( *p == '-' || *p == '+' ) ) {
+		negative = *p == '-';
+		++p;
+	}
+	if( p >= end || *p < '0' || *p > '9' )
+		return false;
+
+	int v = 0;
+	for( ; p < end && *p >= '0' && *p <= '9'; ++p )
+		v = v * 10 + ( *p - '0' );
+	val = negative ? -v : v;
+	return true;
+}
+
+static bool parseVec( const char *&p, const char *end, vec3f& v )
+{
+	for( int i = 0; i < 3; ++i ) {
+		skipSpace( p, end );
+		const char *start = p;
+		v[i] = parseDouble( p, end );
+		if( p == start )
+			return false;
+	}
+	return true;
+}
+
+static void parseOBJChunk( ObjChunk *chunk )
+{
+	const char *p = chunk->begin;
+	const char *end = chunk->end;
+
+	chunk->lines = 0;
+	chunk->errorLine = 0;
+
+	while( p < end ) {
+		const char *eol = (const char *)memchr( p, '\n', end - p );
+		if( !eol )
+			eol = end;
+		++chunk->lines;
+
+		skipSpace( p, eol );
+		if( p + 1 < eol && p[0] == 'v' && isSpace( p[1] ) ) {
+			vec3f v;
+			++p;
+			if( !parseVec( p, eol, v ) ) {
+				chunk->error = "bad vertex";
+				break;
+			}
+			chunk->positions.push_back( v );
+		} else if( p + 2 < eol && p[0] == 'v' && p[1] == 'n' && isSpace( p[2] ) ) {
+			vec3f n;
+			p += 2;
+			if( !parseVec( p, eol, n ) ) {
+				chunk->error = "bad normal";
+				break;
+			}
+			chunk->normals.push_back( n );
+		} else if( p + 1 < eol && p[0] == 'f' && isSpace( p[1] ) ) {
+			++p;
+			int count = 0;
+			while( true ) {
+				skipSpace( p, eol );
+				if( p >= eol )
+					break;
+
+				ObjCorner c;
+				int t;
+				if( !parseInt( p, eol, c.v ) || c.v == 0 )
+					break;
+				c.n = 0;
+				if( p < eol && *p == '/' ) {
+					++p;
+					parseInt( p, eol, t );		// texture coordinate, unused
+					if( p < eol && *p == '/' ) {
+						++p;
+						if( !parseInt( p, eol, c.n ) || c.n == 0 )
+							break;
+					}
+				}
+				if( p < eol && !isSpace( *p ) )
+					break;
+
+				// to 0-based; relative indices count back from here
+				if( c.v > 0 ) {
+					--c.v;
+				} else {
+					c.v += chunk->positions.size();
+					chunk->relativeV.push_back( chunk->corners.size() );
+				}
+				if( c.n > 0 ) {
+					--c.n;
+				} else if( c.n < 0 ) {
+					c.n += chunk->normals.size();
+					chunk->relativeN.push_back( chunk->corners.size() );
+				} else {
+					c.n = -1;
+				}
+
+				chunk->corners.push_back( c );
+				++count;
+			}
+			if( p < eol || count < 3 ) {
+				chunk->error = "bad face";
+				break;
+			}
+			chunk->faceSizes.push_back( count );
+		}
+		// anything else (comments, groups, texture coordinates,
+		// materials) doesn't matter here
+
+		p = eol + 1;
+	}
+
+	if( !chunk->error.empty() )
+		chunk->errorLine = chunk->lines;
+}
+
+void readOBJ( const string& filename, MeshData& mesh )
+{
+	MappedFile *file = MappedFile::open( filename.c_str() );
+	if( !file )
+		throw ParseError( "Couldn't read mesh file " + filename );
+
+	const char *begin = file->data();
+	const char *end = begin + file->size();
+
+	// split at line ends into one chunk per thread
+	int numChunks = 1;
+	if( file->size() >= OBJ_CHUNK_MIN ) {
+		numChunks = std::thread::hardware_concurrency();
+		if( numChunks < 1 )
+			numChunks = 1;
+	}
+
+	vector<ObjChunk> chunks( numChunks );
+	const char *p = begin;
+	for( int i = 0; i < numChunks; ++i ) {
+		const char *q = ( i == numChunks - 1 ) ? end : begin + file->size() / numChunks * ( i + 1 );
+		if( q < p )
+			q = p;
+		while( q < end && q[-1] != '\n' )
+			++q;
+		chunks[i].begin = p;
+		chunks[i].end = q;
+		p = q;
+	}
+
+	if( numChunks == 1 ) {
+		parseOBJChunk( &chunks[0] );
+	} else {
+		vector<std::thread> threads;
+		for( int i = 0; i < numChunks; ++i )
+			threads.push_back( std::thread( parseOBJChunk, &chunks[i] ) );
+		for( int i = 0; i < numChunks; ++i )
+			threads[i].join();
+	}
+
+	delete file;
+
+	// stitch the chunks together
+	int line = 0;
+	size_t numPositions = 0, numNormals = 0, numCorners = 0, numFaces = 0;
+	for( int i = 0; i < numChunks; ++i ) {
+		ObjChunk& c = chunks[i];
+		if( !c.error.empty() )
+			throw ParseError( lineError( filename, line + c.errorLine, c.error ) );
+		line += c.lines;
+
+		for( size_t k = 0; k < c.relativeV.size(); ++k )
+			c.corners[ c.relativeV[k] ].v += numPositions;
+		for( size_t k = 0; k < c.relativeN.size(); ++k )
+			c.corners[ c.relativeN[k] ].n += numNormals;
+
+		numPositions += c.positions.size();
+		numNormals += c.normals.size();
+		numCorners += c.corners.size();
+		numFaces += c.faceSizes.size();
+	}
+
+	// normals are only used if every corner has one
+	bool useNormals = numNormals > 0;
+	for( int i = 0; i < numChunks && useNormals; ++i )
+		for( size_t k = 0; k < chunks[i].corners.size() && useNormals; ++k )
+			useNormals = chunks[i].corners[k].n >= 0;
+
+	// positions straight over
+	mesh.vertices.clear();
+	mesh.vertices.reserve( numPositions );
+	for( int i = 0; i < numChunks; ++i ) {
+		mesh.vertices.insert( mesh.vertices.end(), chunks[i].positions.begin(), chunks[i].positions.end() );
+		vector<vec3f>().swap( chunks[i].positions );
+	}
+
+	vector<vec3f> objNormals;
+	if( useNormals ) {
+		objNormals.reserve( numNormals );
+		for( int i = 0; i < numChunks; ++i )
+			objNormals.insert( objNormals.end(), chunks[i].normals.begin(), chunks[i].normals.end() );
+	}
+
+	// Trimesh wants one normal per vertex.  When each position always comes
+	// with the same normal they line up as they are; otherwise positions
+	// used with several normals are duplicated.
+	vector<int> normalOf( useNormals ? numPositions : 0, -1 );
+	bool split = false;
+	for( int i = 0; i < numChunks; ++i ) {
+		const vector<ObjCorner>& corners = chunks[i].corners;
+		for( size_t k = 0; k < corners.size(); ++k ) {
+			const ObjCorner& c = corners[k];
+			if( c.v < 0 || (size_t)c.v >= numPositions
+				|| ( useNormals && ( c.n < 0 || (size_t)c.n >= numNormals ) ) )
+				throw ParseError( "Bad face in mesh file " + filename + ": index out of range" );
+			if( useNormals ) {
+				if( normalOf[ c.v ] < 0 )
+					normalOf[ c.v ] = c.n;
+				else if( normalOf[ c.v ] != c.n )
+					split = true;
+			}
+		}
+	}
+
+	map<pair<int,int>,int> splitVertex;
+	mesh.normals.clear();
+	if( useNormals ) {
+		mesh.normals.resize( numPositions );
+		for( size_t v = 0; v < numPositions; ++v )
+			if( normalOf[v] >= 0 )
+				mesh.normals[v] = objNormals[ normalOf[v] ];
+	}
+
+	mesh.triangles.clear();
+	mesh.triangles.reserve( ( numCorners - 2 * numFaces ) * 3 );
+	vector<int> ids;
+	for( int i = 0; i < numChunks; ++i ) {
+		const ObjChunk& c = chunks[i];
+		size_t corner = 0;
+		for( size_t f = 0; f < c.faceSizes.size(); ++f ) {
+			ids.clear();
+			for( int k = 0; k < c.faceSizes[f]; ++k, ++corner ) {
+				const ObjCorner& oc = c.corners[ corner ];
+				int v = oc.v;
+				if( split && normalOf[ v ] != oc.n ) {
+					pair<int,int> key( oc.v, oc.n );
+					map<pair<int,int>,int>::iterator it = splitVertex.find( key );
+					if( it == splitVertex.end() ) {
+						v = mesh.vertices.size();
+						mesh.vertices.push_back( mesh.vertices[ oc.v ] );
+						mesh.normals.push_back( objNormals[ oc.n ] );
+						splitVertex[ key ] = v;
+					} else {
+						v = it->second;
+					}
+				}
+				ids.push_back( v );
+			}
+
+			// fan out the polygon
+			for( size_t k = 2; k < ids.size(); ++k ) {
+				mesh.triangles.push_back( ids[0] );
+				mesh.triangles.push_back( ids[k - 1] );
+				mesh.triangles.push_back( ids[k] );
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------ PLY
+
+enum PlyType { PLY_NONE, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+enum PlyFormat { PLY_ASCII, PLY_LITTLE_ENDIAN, PLY_BIG_ENDIAN };
+
+static PlyType plyType( const string& name )
+{
+	if( name == "char" || name == "int8" ) return PLY_INT8;
+	if( name == "uchar" || name == "uint8" ) return PLY_UINT8;
+	if( name == "short" || name == "int16" ) return PLY_INT16;
+	if( name == "ushort" || name == "uint16" ) return PLY_UINT16;
+	if( name == "int" || name == "int32" ) return PLY_INT32;
+	if( name == "uint" || name == "uint32" ) return PLY_UINT32;
+	if( name == "float" || name == "float32" ) return PLY_FLOAT32;
+	if( name == "double" || name == "float64" ) return PLY_FLOAT64;
+	return PLY_NONE;
+}
+
+static const int plySize[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+
+struct PlyProperty
+{
+	string name;
+	PlyType type;
+	PlyType countType;		// PLY_NONE unless this is a list
+};
+
+struct PlyElement
+{
+	string name;
+	int count;
+	vector<PlyProperty> properties;
+};
+
+// Reads values one at a time out of the body of a PLY file.
+class PlyReader
+{
+public:
+	PlyReader( const char *p, const char *end, PlyFormat format, const string& filename )
+		: m_p( p ), m_end( end ), m_format( format ), m_filename( filename )
+	{
+		unsigned int one = 1;
+		bool little = *(unsigned char *)&one == 1;
+		m_bSwap = ( format == PLY_LITTLE_ENDIAN && !little ) || ( format == PLY_BIG_ENDIAN && little );
+	}
+
+	double read( PlyType type )
+	{
+		if( m_format == PLY_ASCII ) {
+			skipWhite();
+			const char *start = m_p;
+			double d = parseDouble( m_p, m_end );
+			if( m_p == start )
+				truncated();
+			return d;
+		}
+
+		int size = plySize[ type ];
+		if( m_end - m_p < size )
+			truncated();
+
+		unsigned char b[8];
+		memcpy( b, m_p, size );
+		m_p += size;
+		if( m_bSwap ) {
+			for( int i = 0; i < size / 2; ++i ) {
+				unsigned char t = b[i];
+				b[i] = b[ size - 1 - i ];
+				b[ size - 1 - i ] = t;
+			}
+		}
+
+		switch( type ) {
+		case PLY_INT8:		return *(signed char *)b;
+		case PLY_UINT8:		return *(unsigned char *)b;
+		case PLY_INT16:		{ short v; memcpy( &v, b, 2 ); return v; }
+		case PLY_UINT16:	{ unsigned short v; memcpy( &v, b, 2 ); return v; }
+		case PLY_INT32:		{ int v; memcpy( &v, b, 4 ); return v; }
+		case PLY_UINT32:	{ unsigned int v; memcpy( &v, b, 4 ); return v; }
+		case PLY_FLOAT32:	{ float v; memcpy( &v, b, 4 ); return v; }
+		default:			{ double v; memcpy( &v, b, 8 ); return v; }
+		}
+	}
+
+	// step over a property we don't care about
+	void skip( const PlyProperty& prop )
+	{
+		if( prop.countType != PLY_NONE ) {
+			int n = (int)read( prop.countType );
+			if( m_format == PLY_ASCII ) {
+				for( int i = 0; i < n; ++i )
+					read( prop.type );
+			} else {
+				if( n < 0 || ( m_end - m_p ) / plySize[ prop.type ] < n )
+					truncated();
+				m_p += n * plySize[ prop.type ];
+			}
+		} else if( m_format == PLY_ASCII ) {
+			read( prop.type );
+		} else {
+			if( m_end - m_p < plySize[ prop.type ] )
+				truncated();
+			m_p += plySize[ prop.type ];
+		}
+	}
+
+	// Throw unless what is left could hold count records of props, so that
+	// a corrupt count in the header can't size the mesh before the data
+	// runs out.  A record is at least one byte per ASCII value, and its
+	// scalars and list lengths in binary.
+	void expect( int count, const vector<PlyProperty>& props )
+	{
+		size_t record = 0;
+		for( size_t k = 0; k < props.size(); ++k ) {
+			if( m_format == PLY_ASCII )
+				record += 1;
+			else
+				record += plySize[ props[k].countType != PLY_NONE ? props[k].countType : props[k].type ];
+		}
+		if( record > 0 && (size_t)( m_end - m_p ) / record < (size_t)count )
+			truncated();
+	}
+
+private:
+	void skipWhite()
+	{
+		while( m_p < m_end && ( isSpace( *m_p ) || *m_p == '\n' ) )
+			++m_p;
+	}
+
+	void truncated()
+	{
+		throw ParseError( "Mesh file " + m_filename + " is truncated or corrupt" );
+	}
+
+	const char *m_p;
+	const char *m_end;
+	PlyFormat m_format;
+	bool m_bSwap;
+	const string& m_filename;
+};
+
+static void readPLYBody( const string& filename, const char *p, const char *end,
+	PlyFormat format, const vector<PlyElement>& elements, MeshData& mesh )
+{
+	PlyReader in( p, end, format, filename );
+
+	for( size_t e = 0; e < elements.size(); ++e ) {
+		const PlyElement& elem = elements[e];
+		const vector<PlyProperty>& props = elem.properties;
+
+		if( elem.name == "vertex" ) {
+			// where x, y, z, nx, ny, nz are among the properties
+			int slot[6] = { -1, -1, -1, -1, -1, -1 };
+			static const char *names[6] = { "x", "y", "z", "nx", "ny", "nz" };
+			for( size_t k = 0; k < props.size(); ++k )
+				for( int s = 0; s < 6; ++s )
+					if( props[k].countType == PLY_NONE && props[k].name == names[s] )
+						slot[s] = k;
+			if( slot[0] < 0 || slot[1] < 0 || slot[2] < 0 )
+				throw ParseError( "Mesh file " + filename + " has no vertex positions" );
+			bool hasNormals = slot[3] >= 0 && slot[4] >= 0 && slot[5] >= 0;
+
+			in.expect( elem.count, props );
+			mesh.vertices.resize( elem.count );
+			mesh.normals.resize( hasNormals ? elem.count : 0 );
+
+			// which of x, y, z, nx, ny, nz each property is, if any
+			vector<int> which( props.size(), -1 );
+			for( int s = 0; s < ( hasNormals ? 6 : 3 ); ++s )
+				which[ slot[s] ] = s;
+
+			for( int i = 0; i < elem.count; ++i ) {
+				for( size_t k = 0; k < props.size(); ++k ) {
+					int s = which[k];
+					if( s < 0 )
+						in.skip( props[k] );
+					else if( s < 3 )
+						mesh.vertices[i][s] = in.read( props[k].type );
+					else
+						mesh.normals[i][ s - 3 ] = in.read( props[k].type );
+				}
+			}
+		} else if( elem.name == "face" ) {
+			in.expect( elem.count, props );
+			mesh.triangles.reserve( (size_t)elem.count * 3 );
+			for( int i = 0; i < elem.count; ++i ) {
+				for( size_t k = 0; k < props.size(); ++k ) {
+					const PlyProperty& prop = props[k];
+					if( prop.countType == PLY_NONE
+						|| ( prop.name != "vertex_indices" && prop.name != "vertex_index" ) ) {
+						in.skip( prop );
+						continue;
+					}
+
+					int n = (int)in.read( prop.countType );
+					if( n < 3 )
+						throw ParseError( "Mesh file " + filename + ": faces must have at least 3 vertices" );
+					int a = (int)in.read( prop.type );
+					int b = (int)in.read( prop.type );
+					for( int j = 2; j < n; ++j ) {
+						int c = (int)in.read( prop.type );
+						mesh.triangles.push_back( a );
+						mesh.triangles.push_back( b );
+						mesh.triangles.push_back( c );
+						b = c;
+					}
+				}
+			}
+		} else {
+			for( int i = 0; i < elem.count; ++i )
+				for( size_t k = 0; k < props.size(); ++k )
+					in.skip( props[k] );
+		}
+	}
+}
+
+void readPLY( const string& filename, MeshData& mesh )
+{
+	MappedFile *file = MappedFile::open( filename.c_str() );
+	if( !file )
+		throw ParseError( "Couldn't read mesh file " + filename );
+
+	const char *p = file->data();
+	const char *end = p + file->size();
+
+	// the header is ascii, one keyword line at a time
+	PlyFormat format = PLY_ASCII;
+	bool haveFormat = false, first = true, done = false;
+	vector<PlyElement> elements;
+	string error;
+	int line = 0;
+
+	while( !done && p < end ) {
+		const char *eol = (const char *)memchr( p, '\n', end - p );
+		if( !eol )
+			break;
+		++line;
+
+		// split the line into words
+		vector<string> words;
+		for( const char *q = p; q < eol; ) {
+			while( q < eol && isSpace( *q ) )
+				++q;
+			const char *w = q;
+			while( q < eol && !isSpace( *q ) )
+				++q;
+			if( q > w )
+				words.push_back( string( w, q ) );
+		}
+		p = eol + 1;
+
+		if( first ) {
+			if( words.size() != 1 || words[0] != "ply" ) {
+				error = "not a PLY file";
+				break;
+			}
+			first = false;
+		} else if( words.empty() || words[0] == "comment" || words[0] == "obj_info" ) {
+			continue;
+		} else if( words[0] == "format" && words.size() >= 2 ) {
+			if( words[1] == "ascii" )
+				format = PLY_ASCII;
+			else if( words[1] == "binary_little_endian" )
+				format = PLY_LITTLE_ENDIAN;
+			else if( words[1] == "binary_big_endian" )
+				format = PLY_BIG_ENDIAN;
+			else {
+				error = "unknown format " + words[1];
+				break;
+			}
+			haveFormat = true;
+		} else if( words[0] == "element" && words.size() == 3 ) {
+			PlyElement elem;
+			elem.name = words[1];
+			elem.count = atoi( words[2].c_str() );
+			if( elem.count < 0 ) {
+				error = "bad element count";
+				break;
+			}
+			elements.push_back( elem );
+		} else if( words[0] == "property" && !elements.empty() ) {
+			PlyProperty prop;
+			if( words.size() == 5 && words[1] == "list" ) {
+				prop.countType = plyType( words[2] );
+				prop.type = plyType( words[3] );
+				prop.name = words[4];
+			} else if( words.size() == 3 ) {
+				prop.countType = PLY_NONE;
+				prop.type = plyType( words[1] );
+				prop.name = words[2];
+			} else {
+				prop.type = PLY_NONE;
+			}
+			if( prop.type == PLY_NONE || ( words[1] == "list" && prop.countType == PLY_NONE ) ) {
+				error = "bad property";
+				break;
+			}
+			elements.back().properties.push_back( prop );
+		} else if( words[0] == "end_header" ) {
+			done = true;
+		} else {
+			error = "unexpected header line";
+			break;
+		}
+	}
+
+	if( error.empty() && ( !done || !haveFormat ) )
+		error = "incomplete header";
+	if( !error.empty() ) {
+		delete file;
+		throw ParseError( lineError( filename, line, error ) );
+	}
+
+	try {
+		readPLYBody( filename, p, end, format, elements, mesh );
+	} catch( ParseError& ) {
+		delete file;
+		throw;
+	}
+	delete file;
+
+	for( size_t i = 0; i < mesh.triangles.size(); ++i )
+		if( mesh.triangles[i] < 0 || (size_t)mesh.triangles[i] >= mesh.vertices.size() )
+			throw ParseError( "Bad face in mesh file " + filename + ": index out of range" );
+}
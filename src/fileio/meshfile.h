@@ -0,0 +1,39 @@
+//
+// meshfile.h
+//
+// Triangle mesh import from Wavefront OBJ and PLY files.  The loaders fill
+// flat arrays that a Trimesh can take over without copying; they never
+// build the parser's Obj tree.
+//
+
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include <string>
+#include <vector>
+
+#include "../vecmath/vecmath.h"
+
+using namespace std;
+
+struct MeshData
+{
+	vector<vec3f> vertices;
+	vector<vec3f> normals;		// empty, or one per vertex
+	vector<int> triangles;		// three vertex indices per triangle
+};
+
+// OBJ: v, vn and f records (polygons are fanned into triangles, texture
+// coordinates are ignored).  Big files are parsed by several threads.
+// Throws ParseError.
+void readOBJ( const string& filename, MeshData& mesh );
+
+// PLY, binary (either byte order) or ascii: x/y/z and optional nx/ny/nz
+// vertex properties and a vertex_indices (or vertex_index) face list.
+// The file is memory mapped.  Throws ParseError.
+void readPLY( const string& filename, MeshData& mesh );
+
+// Pick a loader from the extension (.obj or .ply).  Throws ParseError.
+void readMeshFile( const string& filename, MeshData& mesh );
+
+#endif
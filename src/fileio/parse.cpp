@@ -4,259 +4,376 @@
 #pragma warning( disable : 4786 )
 #endif
 
+#include <algorithm>
 #include <cstring>
+#include <cstdlib>
 
 #include "parse.h"
 
-static string readID( istream& is );
-static Obj *readString( istream& is );
-static Obj *readScalar( istream& is );
-static Obj *readTuple( istream& is );
-static Obj *readDict( istream& is );
-static Obj *readObject( istream& is );
-static Obj *readName( istream& is );
-static void eatWS( istream& is );
-static void eatNL( istream& is );
-
-Obj *readFile( istream& is )
+// The lexer works straight on the input bytes: tokens are found by moving
+// a pointer along the buffer, never by pulling characters out of a stream.
+
+static string readID( ParseBuffer& in );
+static Obj *readString( ParseBuffer& in );
+static Obj *readScalar( ParseBuffer& in );
+static Obj *readTuple( ParseBuffer& in );
+static Obj *readDict( ParseBuffer& in );
+static Obj *readObject( ParseBuffer& in );
+static Obj *readName( ParseBuffer& in );
+static void eatNL( ParseBuffer& in );
+
+Obj *readFile( ParseBuffer& in )
 {
-	return readObject( is );
+	in.open.clear();		// left over if the last read threw
+	return readObject( in );
 }
 
-static void eatWS( istream& is )
+static inline int peek( const ParseBuffer& in )
 {
-	int ch = is.peek();
-	while( ch == ' ' || ch == '\t' || ch == '\n' || ch == 0x0D || ch == 0x0A) {
-		is.get();
-		if( !is ) {
-			return;
-		}
-		ch = is.peek();
+	return in.cur < in.end ? (unsigned char)*in.cur : -1;
+}
+
+static inline int get( ParseBuffer& in )
+{
+	if( in.cur >= in.end ) {
+		return -1;
 	}
+	if( *in.cur == '\n' ) {
+		++in.line;
+	}
+	return (unsigned char)*in.cur++;
 }
 
-static void eatNL( istream& is )
+static inline void eatWS( ParseBuffer& in )
 {
-	int ch = is.peek();
-	while( ch != '\n' ) {
-		is.get();
-		if( !is ) {
-			return;
+	const char *p = in.cur;
+	while( p < in.end ) {
+		char ch = *p;
+		if( ch == '\n' ) {
+			++in.line;
+		} else if( ch != ' ' && ch != '\t' && ch != '\r' ) {
+			break;
 		}
-		ch = is.peek();
+		++p;
+	}
+	in.cur = p;
+}
+
+static void eatNL( ParseBuffer& in )
+{
+	const char *p = (const char *)memchr( in.cur, '\n', in.end - in.cur );
+	in.cur = p ? p : in.end;
+}
+
+static bool eatComments( ParseBuffer& in );
+
+// Skip blanks and comments; false at the end of the input.  Comments are
+// rare, so only the blanks are skipped here.
+static inline bool eat( ParseBuffer& in )
+{
+	eatWS( in );
+	if( in.cur < in.end && *in.cur != '/' ) {
+		return true;
 	}
+	return eatComments( in );
 }
 
-static bool eat( istream& is ) 
+static bool eatComments( ParseBuffer& in )
 {
-	while( is ) {
-		eatWS( is );
-		if( is ) {
-			int ch = is.peek();
-			if( ch == '/' ) {
-				is.get();
-				int ch = is.peek();
-				if( ch == '/' ) {
-					eatNL( is );
-				} else if( ch == '*' ) {
-					while( true ) {
-						is.get();
-						ch = is.peek();
-						if( ch == '*' ) {
-							is.get();
-							ch = is.peek();
-							if( ch == '/' ) {
-								is.get();
-								break;
-							} else if( ch == -1 ) {	
-								is.get();
-								throw ParseError( 
-									"Parse Error: unterminated comment" );
-							}
-						} else if( ch == -1 ) {
-							is.get();
-							throw ParseError( 
-								"Parse Error: unterminated comment" );
-						}
-					}
-				} else {
-					return true;
+	while( true ) {
+		eatWS( in );
+		if( in.cur >= in.end ) {
+			return false;
+		}
+		if( *in.cur != '/' || in.cur + 1 >= in.end ) {
+			return true;
+		}
+
+		char next = in.cur[1];
+		if( next == '/' ) {
+			eatNL( in );
+		} else if( next == '*' ) {
+			int line = in.line;
+			in.cur += 2;
+			while( true ) {
+				if( in.cur + 1 >= in.end ) {
+					throw ParseError( "Parse Error: unterminated comment", line );
+				}
+				if( in.cur[0] == '*' && in.cur[1] == '/' ) {
+					in.cur += 2;
+					break;
 				}
-			} else if( ch == -1 ) {
-				is.get();
-				return false;
-			} else {
-				return true;
+				get( in );
 			}
 		} else {
-			return false;
+			return true;
 		}
 	}
-	return false;
 }
 
-static Obj *readName( istream& is )
+static Obj *readName( ParseBuffer& in )
 {
-	string s = readID( is );
+	string s = readID( in );
 
 	if( s == "true" ) {
-		return new BooleanObj( true );
+		return in.nodes.create<BooleanObj>( true );
 	} else if( s == "false" ) {
-		return new BooleanObj( false );
+		return in.nodes.create<BooleanObj>( false );
 	} else {
-		if( !eat( is ) ) {
-			return new IdObj( s );
+		if( !eat( in ) ) {
+			return in.nodes.create<IdObj>( s );
 		}
 
-		int ch = is.peek();
+		int ch = peek( in );
 		if( strchr( "}),;", ch ) != NULL ) {
-			return new IdObj( s );
+			return in.nodes.create<IdObj>( s );
 		} else {
-			return new NamedObj( s, readObject( is ) );
+			return in.nodes.create<NamedObj>( s, readObject( in ) );
 		}
 	}
 }
 
-static string readID( istream& is )
+static inline bool endsID( char ch )
 {
-	int ch;
-	string ret( "" );
+	switch( ch ) {
+	case ' ': case '\t': case '\n': case '\r':
+	case '=': case '{': case '}': case '(': case ')': case ';': case ',': case '/':
+		return true;
+	default:
+		return false;
+	}
+}
 
-	ret += char( is.get() );
+static string readID( ParseBuffer& in )
+{
+	const char *start = in.cur;
 
-	while( is ) {
-		ch = is.peek();
-		if( strchr( " \t\n={}();,/", ch ) != NULL ) {
-			break;
-		} else {
-			ret += char( ch );
-			is.get();
-		}
+	// the first character is taken whatever it is
+	if( in.cur < in.end ) {
+		get( in );
+	}
+	while( in.cur < in.end && !endsID( *in.cur ) ) {
+		++in.cur;
 	}
 
-	return ret;
+	return string( start, in.cur );
 }
 
-static Obj *readString( istream& is ) 
+static Obj *readString( ParseBuffer& in )
 {
-	int ch;
-	string ret( "" );
+	int line = in.line;
 
-	is.get();
+	get( in );
 
-	while( true ) {
-		ch = is.peek();
-		if( ch == '"' ) {
-			is.get();
-			return new StringObj( ret );
-		} else {
-			ret += char( ch );
-		}
-		is.get();
+	const char *start = in.cur;
+	const char *quote = (const char *)memchr( start, '"', in.end - start );
+	if( !quote ) {
+		throw ParseError( "Parse error: unterminated string.", line );
+	}
+
+	while( in.cur < quote ) {
+		get( in );
 	}
+	in.cur = quote + 1;
+
+	return in.nodes.create<StringObj>( string( start, quote ) );
 }
 
-static Obj *readScalar( istream& is )
+static inline bool isDigit( char ch )
 {
-	int ch;
-	string ret( "" );
+	return ch >= '0' && ch <= '9';
+}
 
-	while( true ) {
-		ch = is.peek();
-		if( (ch == '-') || (ch == '.') || (ch == 'e') || (ch == 'E')
-				|| (ch >= '0' && ch <= '9') ) {
-			ret += char( ch );
-			is.get();
+static Obj *readScalar( ParseBuffer& in )
+{
+	const char *p = in.cur;
+	double val = parseDouble( p, in.end );
+
+	// A scalar is the whole run of number-ish characters, of which the
+	// longest leading number counts (this is what atof did with it).  The
+	// number is always a prefix of the run; skip whatever is left of it.
+	while( p < in.end ) {
+		char ch = *p;
+		if( ch == '-' || ch == '.' || isDigit( ch ) ) {
+			++p;
+		} else if( ch == 'e' || ch == 'E' ) {
+			++p;
+			if( p < in.end && *p == '+' ) {
+				++p;
+			}
 		} else {
 			break;
 		}
 	}
 
-	return new ScalarObj( atof( ret.c_str() ) );
+	in.cur = p;
+
+	return in.nodes.create<ScalarObj>( val );
 }
 
-static Obj *readTuple( istream& is )
+static Obj *readTuple( ParseBuffer& in )
 {
-	vector<Obj*> ret;
+	// The elements pile up on in.open (nested tuples above ours) and are
+	// copied into the arena once we know how many there are.
+	size_t first = in.open.size();
 
-	is.get();
+	get( in );
 
 	while( true ) {
-		eat( is );
-		ret.push_back( readObject( is ) );	
-		eat( is );
-		int ch = is.get();
+		Obj *elem = readObject( in );
+		in.open.push_back( elem );
+		eat( in );
+		int ch = get( in );
 		if( ch == ')' ) {
-			return new TupleObj( ret );
+			size_t n = in.open.size() - first;
+			Obj **elems = (Obj **)in.nodes.allocate( n * sizeof( Obj* ), alignof( Obj* ) );
+			copy( in.open.begin() + first, in.open.end(), elems );
+			in.open.resize( first );
+			return in.nodes.create<TupleObj>( mytuple( elems, n ) );
 		} else if( ch == ',' ) {
 			continue;
 		} else {
-			throw ParseError( "Parse error: expected comma." );
+			throw ParseError( "Parse error: expected comma.", in.line );
 		}
 	}
 
-	throw ParseError( "Parse error: internal error." );
+	throw ParseError( "Parse error: internal error.", in.line );
 }
 
-static Obj *readDict( istream& is )
+static Obj *readDict( ParseBuffer& in )
 {
 	string lhs;
 	Obj *rhs;
 
 	map<string,Obj*> ret;
 
-	is.get();
+	get( in );
 
 	while( true ) {
-		eat( is );
-		if( is.peek() == '}' ) {
-			is.get();
-			return new DictObj( ret );
+		eat( in );
+		if( peek( in ) == '}' ) {
+			get( in );
+			return in.nodes.create<DictObj>( &ret );
 		}
-		lhs = readID( is );
-		eat( is );
-		if( is.get() != '=' ) {
-			throw ParseError( "Parse error: expected equals." );
+		lhs = readID( in );
+		eat( in );
+		if( get( in ) != '=' ) {
+			throw ParseError( "Parse error: expected equals.", in.line );
 		}
-		rhs = readObject( is );
+		rhs = readObject( in );
 		ret[ lhs ] = rhs;
-		eat( is );
-		int ch = is.peek();
+		eat( in );
+		int ch = peek( in );
 		if( ch == ';' ) {
-			is.get();
+			get( in );
 		} else if( ch != '}' ) {
-			throw ParseError( "Parse error: expected semicolon or brace." );
+			throw ParseError( "Parse error: expected semicolon or brace.", in.line );
 		}
 	}
 }
 
-static Obj *readObject( istream& is )
+static Obj *readObject( ParseBuffer& in )
 {
-	if( !eat( is ) ) {
+	if( !eat( in ) ) {
 		return NULL;
 	}
 
-	int ch = is.peek();
+	int ch = peek( in );
 
 	if( (ch == '-') || (ch >= '0' && ch <= '9') ) {
-		return readScalar( is );
+		return readScalar( in );
 	} else if( ch == '"' ) {
-		return readString( is );
+		return readString( in );
 	} else if( ch == '(' ) {
-		return readTuple( is );
+		return readTuple( in );
 	} else if( ch == '{' ) {
-		return readDict( is );
+		return readDict( in );
 	} else {
-		return readName( is );
+		return readName( in );
+	}
+}
+
+// Powers of ten that are exact in a double.
+static const double exactPowersOfTen[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+double parseDouble( const char *&p, const char *end )
+{
+	const char *s = p;
+	bool negative = false;
+
+	if( s < end && ( *s == '-' || *s == '+' ) ) {
+		negative = ( *s == '-' );
+		++s;
 	}
+
+	// Collect the digits without looking at how many there are; with more
+	// than 19 the mantissa may wrap, but then it is too big for the fast
+	// path anyway and strtod does the work.
+	unsigned long long mantissa = 0;
+	const char *intStart = s;
+	for( ; s < end && isDigit( *s ); ++s ) {
+		mantissa = mantissa * 10 + ( *s - '0' );
+	}
+	int digits = (int)( s - intStart );
+	int scale = 0;			// decimal exponent from the fractional digits
+	if( s < end && *s == '.' ) {
+		const char *fracStart = ++s;
+		for( ; s < end && isDigit( *s ); ++s ) {
+			mantissa = mantissa * 10 + ( *s - '0' );
+		}
+		scale = -(int)( s - fracStart );
+		digits -= scale;
+	}
+	if( digits == 0 ) {
+		return 0.0;		// not a number; p stays put like strtod's endptr
+	}
+
+	// the exponent only counts if it has digits
+	if( s < end && ( *s == 'e' || *s == 'E' ) ) {
+		const char *e = s + 1;
+		bool negativeExp = false;
+		if( e < end && ( *e == '-' || *e == '+' ) ) {
+			negativeExp = ( *e == '-' );
+			++e;
+		}
+		if( e < end && isDigit( *e ) ) {
+			int exp = 0;
+			for( ; e < end && isDigit( *e ); ++e ) {
+				if( exp < 100000 ) {
+					exp = exp * 10 + ( *e - '0' );
+				}
+			}
+			scale += negativeExp ? -exp : exp;
+			s = e;
+		}
+	}
+
+	const char *start = p;
+	p = s;
+
+	// Clinger's fast path: both factors are exact, so one correctly
+	// rounded operation gives the correctly rounded result.
+	if( digits <= 19 && mantissa <= ( 1ULL << 53 ) && scale >= -22 && scale <= 22 ) {
+		double val = (double)mantissa;
+		val = scale < 0 ? val / exactPowersOfTen[ -scale ] : val * exactPowersOfTen[ scale ];
+		return negative ? -val : val;
+	}
+
+	// Everything else goes through strtod on a terminated copy.
+	string copy( start, s );
+	return strtod( copy.c_str(), NULL );
 }
 
 /*
 int main( void )
 {
-	Obj *o = readFile( cin );
+	string text( (istreambuf_iterator<char>( cin )), istreambuf_iterator<char>() );
+	ParseBuffer in( text.data(), text.data() + text.size() );
+	Obj *o = readFile( in );
 	o->printOn( cout );
-	delete o;
 	return 0;
 }
 */
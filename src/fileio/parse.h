@@ -8,6 +8,9 @@
 #include <vector>
 #include <map>
 #include <iostream>
+#include <stdio.h>
+
+#include "../scene/arena.h"
 
 using namespace std;
 
@@ -30,7 +33,28 @@ inline ostream& operator <<( ostream& os, const Exception& x )
 
 class Obj;
 
-typedef vector<Obj*> 		mytuple;
+// A tuple's elements, an array in the parse arena (see ParseBuffer).
+class mytuple
+{
+public:
+	typedef Obj *const *const_iterator;
+
+	mytuple()
+		: elems( NULL ), count( 0 ) {}
+	mytuple( Obj *const *e, size_t n )
+		: elems( e ), count( n ) {}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	Obj *operator[]( size_t i ) const { return elems[ i ]; }
+	const_iterator begin() const { return elems; }
+	const_iterator end() const { return elems + count; }
+
+private:
+	Obj *const *elems;
+	size_t count;
+};
+
 typedef map<string,Obj*> 	dict;
 
 class ParseError
@@ -40,6 +64,17 @@ public:
 	ParseError( const string& msg )
 		: Exception( msg )
 	{}
+	ParseError( const string& msg, int line )
+		: Exception( atLine( msg, line ) )
+	{}
+
+private:
+	static string atLine( const string& msg, int line )
+	{
+		char buf[ 32 ];
+		sprintf( buf, "line %d: ", line );
+		return string( buf ) + msg;
+	}
 };
 
 class ObjTypeMismatch
@@ -52,6 +87,9 @@ public:
 	{}
 };
 
+// Every node of a parse tree lives in the arena of the ParseBuffer it
+// was read from, so nodes don't own (or delete) their children; the whole
+// tree goes when the arena is released.
 class Obj
 {
 public:
@@ -102,6 +140,8 @@ private:
 	double val;
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( ScalarObj )
+
 class BooleanObj
 	: public Obj
 {
@@ -121,6 +161,8 @@ private:
 	bool val;
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( BooleanObj )
+
 class IdObj
 	: public Obj
 {
@@ -161,16 +203,11 @@ class TupleObj
 	: public Obj
 {
 public:
-	TupleObj( const mytuple& vec )
+	TupleObj( const mytuple& elems )
 		: Obj()
-		, val( vec )
+		, val( elems )
 	{}
-	virtual ~TupleObj()
-	{
-		for( mytuple::iterator i = val.begin(); i != val.end(); ++i ) {
-			delete (*i);
-		}
-	}
+	virtual ~TupleObj() {}
 
 	virtual string getTypeName() const { return string( "tuple" ); }
 	virtual void printOn( ostream& os ) const 
@@ -194,20 +231,17 @@ private:
 	mytuple val;
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( TupleObj )
+
 class DictObj
 	: public Obj
 {
 public:
-	DictObj( const dict& m )
+	// takes the entries out of m instead of copying them
+	DictObj( dict *m )
 		: Obj()
-		, val( m )
-	{}
-	virtual ~DictObj()
-	{
-		for( dict::iterator i = val.begin(); i != val.end(); ++i ) {
-			delete ((*i).second);
-		}
-	}
+	{ val.swap( *m ); }
+	virtual ~DictObj() {}
 
 	virtual string getTypeName() const { return string( "dict" ); }
 	virtual void printOn( ostream& os ) const 
@@ -241,10 +275,7 @@ public:
 		, name( n )
 		, child( ch )
 	{}
-	virtual ~NamedObj()
-	{
-		delete child;
-	}
+	virtual ~NamedObj() {}
 
 	virtual string getTypeName() const { return string( "named" ); }
 	virtual void printOn( ostream& os ) const 
@@ -261,6 +292,32 @@ private:
 	Obj *child;
 };
 
-Obj *readFile( istream& is );
+// The parser's input: a byte range, usually a whole memory-mapped file,
+// and a cursor into it.  line counts the newlines passed so far.  The
+// objects read from it are made in its arena, and last until
+// releaseObjects() or until the buffer goes.
+class ParseBuffer
+{
+public:
+	ParseBuffer( const char *b, const char *e )
+		: cur( b ), end( e ), line( 1 ) {}
+
+	void releaseObjects() { nodes.release(); }
+
+	const char *cur;
+	const char *end;
+	int line;
+
+	Arena nodes;
+	vector<Obj*> open;		// elements of the tuples being read
+};
+
+// Read the next top level object, or return NULL at the end of input.
+Obj *readFile( ParseBuffer& in );
+
+// Parse a decimal floating point number at p, stopping at end, and advance
+// p past it.  Gives the same result as strtod, but only falls back to it
+// for numbers that can't be converted exactly with one multiply or divide.
+double parseDouble( const char *&p, const char *end );
 
 #endif // __PARSE_H__
@@ -0,0 +1,590 @@
+#ifdef WIN32
+#pragma warning( disable : 4786 )
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "rayb.h"
+#include "mappedfile.h"
+#include "../stats/timeline.h"
+
+#include "../scene/light.h"
+#include "../SceneObjects/trimesh.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+
+typedef unsigned int		RAYB_DWORD;
+typedef int					RAYB_LONG;
+typedef unsigned long long	RAYB_QWORD;
+
+static const char RAYB_MAGIC[8] = { 'S', 'B', 'T', 'R', 'A', 'Y', 'B', '\0' };
+static const RAYB_DWORD RAYB_VERSION = 1;
+static const RAYB_DWORD RAYB_BYTE_ORDER = 0x01020304;
+static const RAYB_QWORD RAYB_ALIGN = 16;
+
+// Mesh vertices and normals are handed to Trimesh as vec3f arrays in place.
+typedef char vec3fIsThreeDoubles[ sizeof(vec3f) == 3 * sizeof(double) ? 1 : -1 ];
+
+enum {
+	SECTION_CAMERA,
+	SECTION_MATERIALS,
+	SECTION_TRANSFORMS,
+	SECTION_LIGHTS,
+	SECTION_OBJECTS,
+	SECTION_VERTICES,		// double[3] per vertex
+	SECTION_NORMALS,		// double[3] per normal
+	SECTION_FACES,			// RAYB_LONG[3] per triangle
+	SECTION_VERTEX_MATERIALS,	// RAYB_LONG material index per vertex
+	NUM_SECTIONS
+};
+
+enum { LIGHT_DIRECTIONAL, LIGHT_POINT, LIGHT_AMBIENT };
+enum { OBJECT_SPHERE, OBJECT_BOX, OBJECT_SQUARE, OBJECT_CYLINDER, OBJECT_CONE, OBJECT_TRIMESH };
+
+typedef struct {
+	char		magic[8];
+	RAYB_DWORD	version;
+	RAYB_DWORD	byteOrder;
+	RAYB_DWORD	numSections;
+	RAYB_DWORD	reserved;
+} RAYB_HEADER;
+
+typedef struct {
+	RAYB_DWORD	type;
+	RAYB_DWORD	count;
+	RAYB_QWORD	offset;		// from the start of the file, RAYB_ALIGN aligned
+} RAYB_SECTION;
+
+typedef struct {
+	double		eye[3];
+	double		look[9];	// rotation matrix, row major
+	double		normalizedHeight;
+	double		aspectRatio;
+} RAYB_CAMERA;
+
+typedef struct {
+	double		ke[3], ka[3], ks[3], kd[3], kr[3], kt[3];
+	double		shininess;
+	double		index;
+} RAYB_MATERIAL;
+
+typedef struct {
+	double		m[16];		// local to world, row major
+} RAYB_TRANSFORM;
+
+typedef struct {
+	RAYB_LONG	type;
+	RAYB_LONG	reserved;
+	double		color[3];
+	double		v[3];		// direction or position
+	double		attenuation[3];	// constant, linear, quadratic
+} RAYB_LIGHT;
+
+typedef struct {
+	RAYB_LONG	type;
+	RAYB_LONG	transform;
+	RAYB_LONG	material;
+	RAYB_LONG	capped;
+	double		params[3];	// cone height, bottom and top radius
+	// trimesh ranges into the array sections
+	RAYB_LONG	firstVertex, numVertices;
+	RAYB_LONG	firstNormal, numNormals;
+	RAYB_LONG	firstFace, numFaces;
+	RAYB_LONG	firstVertexMaterial, numVertexMaterials;
+} RAYB_OBJECT;
+
+static const size_t recordSize[ NUM_SECTIONS ] = {
+	sizeof(RAYB_CAMERA),
+	sizeof(RAYB_MATERIAL),
+	sizeof(RAYB_TRANSFORM),
+	sizeof(RAYB_LIGHT),
+	sizeof(RAYB_OBJECT),
+	3 * sizeof(double),
+	3 * sizeof(double),
+	3 * sizeof(RAYB_LONG),
+	sizeof(RAYB_LONG)
+};
+
+bool isBinarySceneFileName( const string& filename )
+{
+	return filename.size() >= 5
+		&& !strcmp( filename.c_str() + filename.size() - 5, ".rayb" );
+}
+
+static void toArray( const vec3f& v, double *d )
+{
+	d[0] = v[0];
+	d[1] = v[1];
+	d[2] = v[2];
+}
+
+static vec3f fromArray( const double *d )
+{
+	return vec3f( d[0], d[1], d[2] );
+}
+
+//------------------------------------------------------------------ writing
+
+// The sections being gathered from a scene.
+struct RaybBuilder
+{
+	vector<RAYB_CAMERA>		camera;
+	vector<RAYB_MATERIAL>	materials;
+	vector<RAYB_TRANSFORM>	transforms;
+	vector<RAYB_LIGHT>		lights;
+	vector<RAYB_OBJECT>		objects;
+	vector<double>			vertices;
+	vector<double>			normals;
+	vector<RAYB_LONG>		faces;
+	vector<RAYB_LONG>		vertexMaterials;
+
+	map<string,int>					materialIndex;	// keyed on the record bytes
+	map<const TransformNode*,int>	transformIndex;
+
+	int addMaterial( const Material& m )
+	{
+		RAYB_MATERIAL rec;
+		memset( &rec, 0, sizeof(rec) );
+		toArray( m.ke, rec.ke );
+		toArray( m.ka, rec.ka );
+		toArray( m.ks, rec.ks );
+		toArray( m.kd, rec.kd );
+		toArray( m.kr, rec.kr );
+		toArray( m.kt, rec.kt );
+		rec.shininess = m.shininess;
+		rec.index = m.index;
+
+		string key( (const char *)&rec, sizeof(rec) );
+		map<string,int>::iterator i = materialIndex.find( key );
+		if( i != materialIndex.end() )
+			return i->second;
+
+		materials.push_back( rec );
+		return materialIndex[ key ] = materials.size() - 1;
+	}
+
+	int addTransform( const TransformNode *node )
+	{
+		map<const TransformNode*,int>::iterator i = transformIndex.find( node );
+		if( i != transformIndex.end() )
+			return i->second;
+
+		RAYB_TRANSFORM rec;
+		const mat4f& m = node->getXform();
+		for( int r = 0; r < 4; ++r )
+			for( int c = 0; c < 4; ++c )
+				rec.m[ r * 4 + c ] = m[r][c];
+
+		transforms.push_back( rec );
+		return transformIndex[ node ] = transforms.size() - 1;
+	}
+};
+
+static void addCamera( RaybBuilder& b, Camera *cam )
+{
+	RAYB_CAMERA rec;
+	toArray( cam->getEye(), rec.eye );
+	const mat3f& m = cam->getLookMatrix();
+	for( int r = 0; r < 3; ++r )
+		toArray( m[r], rec.look + r * 3 );
+	rec.normalizedHeight = cam->getNormalizedHeight();
+	rec.aspectRatio = cam->getAspectRatio();
+	b.camera.push_back( rec );
+}
+
+static bool addLight( RaybBuilder& b, const Light *light )
+{
+	RAYB_LIGHT rec;
+	memset( &rec, 0, sizeof(rec) );
+	toArray( light->getColor( vec3f() ), rec.color );
+
+	if( const DirectionalLight *dl = dynamic_cast<const DirectionalLight*>( light ) ) {
+		rec.type = LIGHT_DIRECTIONAL;
+		toArray( dl->getOrientation(), rec.v );
+	} else if( const PointLight *pl = dynamic_cast<const PointLight*>( light ) ) {
+		rec.type = LIGHT_POINT;
+		toArray( pl->getPosition(), rec.v );
+		pl->getAttenuationCoefficients( rec.attenuation[0], rec.attenuation[1], rec.attenuation[2] );
+	} else if( dynamic_cast<const AmbientLight*>( light ) ) {
+		rec.type = LIGHT_AMBIENT;
+	} else {
+		return false;
+	}
+
+	b.lights.push_back( rec );
+	return true;
+}
+
+static void addTrimesh( RaybBuilder& b, RAYB_OBJECT& rec, const Trimesh *mesh )
+{
+	rec.type = OBJECT_TRIMESH;
+
+	// compacted meshes are written out decoded
+	rec.firstVertex = b.vertices.size() / 3;
+	rec.numVertices = mesh->getNumVertices();
+	for( int v = 0; v < rec.numVertices; ++v ) {
+		vec3f p = mesh->getVertex( v );
+		b.vertices.insert( b.vertices.end(), (const double *)&p, (const double *)( &p + 1 ) );
+	}
+
+	rec.firstNormal = b.normals.size() / 3;
+	rec.numNormals = mesh->getNumNormals();
+	for( int n = 0; n < rec.numNormals; ++n ) {
+		vec3f p = mesh->getNormal( n );
+		b.normals.insert( b.normals.end(), (const double *)&p, (const double *)( &p + 1 ) );
+	}
+
+	rec.firstFace = b.faces.size() / 3;
+	rec.numFaces = mesh->getNumFaces();
+	for( int f = 0; f < rec.numFaces; ++f ) {
+		const TrimeshFace& face = *mesh->getFace( f );
+		b.faces.push_back( face[0] );
+		b.faces.push_back( face[1] );
+		b.faces.push_back( face[2] );
+	}
+
+	rec.firstVertexMaterial = b.vertexMaterials.size();
+	rec.numVertexMaterials = 0;
+	if( mesh->hasVertexMaterials() ) {
+		rec.numVertexMaterials = rec.numVertices;
+		for( int v = 0; v < rec.numVertices; ++v )
+			b.vertexMaterials.push_back( b.addMaterial( mesh->getScene()->getMaterial( mesh->getVertexMaterial( v ) ) ) );
+	}
+}
+
+static bool addObject( RaybBuilder& b, const Geometry *geom )
+{
+	// faces are written with their mesh
+	if( dynamic_cast<const TrimeshFace*>( geom ) )
+		return true;
+
+	const SceneObject *obj = dynamic_cast<const SceneObject*>( geom );
+	if( !obj )
+		return false;
+
+	RAYB_OBJECT rec;
+	memset( &rec, 0, sizeof(rec) );
+	rec.transform = b.addTransform( obj->getTransform() );
+	rec.material = b.addMaterial( obj->getMaterial() );
+
+	if( dynamic_cast<const Sphere*>( obj ) ) {
+		rec.type = OBJECT_SPHERE;
+	} else if( dynamic_cast<const Box*>( obj ) ) {
+		rec.type = OBJECT_BOX;
+	} else if( dynamic_cast<const Square*>( obj ) ) {
+		rec.type = OBJECT_SQUARE;
+	} else if( const Cylinder *cyl = dynamic_cast<const Cylinder*>( obj ) ) {
+		rec.type = OBJECT_CYLINDER;
+		rec.capped = cyl->isCapped();
+	} else if( const Cone *cone = dynamic_cast<const Cone*>( obj ) ) {
+		rec.type = OBJECT_CONE;
+		rec.capped = cone->isCapped();
+		rec.params[0] = cone->getHeight();
+		rec.params[1] = cone->getBottomRadius();
+		rec.params[2] = cone->getTopRadius();
+	} else if( const Trimesh *mesh = dynamic_cast<const Trimesh*>( obj ) ) {
+		addTrimesh( b, rec, mesh );
+	} else {
+		return false;
+	}
+
+	b.objects.push_back( rec );
+	return true;
+}
+
+static RAYB_QWORD alignUp( RAYB_QWORD n )
+{
+	return ( n + RAYB_ALIGN - 1 ) & ~( RAYB_ALIGN - 1 );
+}
+
+bool writeBinaryScene( const string& filename, Scene *scene )
+{
+	ScopedTimer timer( "writeBinaryScene" );
+
+	RaybBuilder b;
+
+	addCamera( b, scene->getCamera() );
+
+	for( Scene::cliter l = scene->beginLights(); l != scene->endLights(); ++l ) {
+		if( !addLight( b, *l ) ) {
+			cerr << "Error: scene has a light the compiled format can't store" << endl;
+			return false;
+		}
+	}
+
+	for( Scene::cgiter g = scene->beginObjects(); g != scene->endObjects(); ++g ) {
+		if( !addObject( b, *g ) ) {
+			cerr << "Error: scene has an object the compiled format can't store" << endl;
+			return false;
+		}
+	}
+
+	const void *data[ NUM_SECTIONS ] = {
+		b.camera.empty() ? NULL : &b.camera[0],
+		b.materials.empty() ? NULL : &b.materials[0],
+		b.transforms.empty() ? NULL : &b.transforms[0],
+		b.lights.empty() ? NULL : &b.lights[0],
+		b.objects.empty() ? NULL : &b.objects[0],
+		b.vertices.empty() ? NULL : &b.vertices[0],
+		b.normals.empty() ? NULL : &b.normals[0],
+		b.faces.empty() ? NULL : &b.faces[0],
+		b.vertexMaterials.empty() ? NULL : &b.vertexMaterials[0]
+	};
+	size_t counts[ NUM_SECTIONS ] = {
+		b.camera.size(),
+		b.materials.size(),
+		b.transforms.size(),
+		b.lights.size(),
+		b.objects.size(),
+		b.vertices.size() / 3,
+		b.normals.size() / 3,
+		b.faces.size() / 3,
+		b.vertexMaterials.size()
+	};
+
+	RAYB_HEADER header;
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, RAYB_MAGIC, sizeof(RAYB_MAGIC) );
+	header.version = RAYB_VERSION;
+	header.byteOrder = RAYB_BYTE_ORDER;
+	header.numSections = NUM_SECTIONS;
+
+	RAYB_SECTION sections[ NUM_SECTIONS ];
+	RAYB_QWORD offset = alignUp( sizeof(header) + sizeof(sections) );
+	for( int s = 0; s < NUM_SECTIONS; ++s ) {
+		sections[s].type = s;
+		sections[s].count = counts[s];
+		sections[s].offset = offset;
+		offset = alignUp( offset + counts[s] * recordSize[s] );
+	}
+
+	FILE *file = fopen( filename.c_str(), "wb" );
+	if( !file ) {
+		cerr << "Error: couldn't write compiled scene " << filename << endl;
+		return false;
+	}
+
+	static const char zeros[ RAYB_ALIGN ] = { 0 };
+	bool ok = fwrite( &header, sizeof(header), 1, file ) == 1
+		&& fwrite( sections, sizeof(sections), 1, file ) == 1;
+
+	RAYB_QWORD pos = sizeof(header) + sizeof(sections);
+	for( int s = 0; ok && s < NUM_SECTIONS; ++s ) {
+		size_t bytes = counts[s] * recordSize[s];
+		ok = fwrite( zeros, 1, sections[s].offset - pos, file ) == sections[s].offset - pos
+			&& ( !bytes || fwrite( data[s], 1, bytes, file ) == bytes );
+		pos = sections[s].offset + bytes;
+	}
+
+	if( fclose( file ) != 0 )
+		ok = false;
+	if( !ok )
+		cerr << "Error: couldn't write compiled scene " << filename << endl;
+
+	return ok;
+}
+
+//------------------------------------------------------------------ reading
+
+static mat4f toMatrix( const RAYB_TRANSFORM& t )
+{
+	const double *m = t.m;
+	return mat4f( vec4f( m[0], m[1], m[2], m[3] ),
+		vec4f( m[4], m[5], m[6], m[7] ),
+		vec4f( m[8], m[9], m[10], m[11] ),
+		vec4f( m[12], m[13], m[14], m[15] ) );
+}
+
+static Material toMaterial( const RAYB_MATERIAL& m )
+{
+	return Material( fromArray( m.ke ), fromArray( m.ka ), fromArray( m.ks ),
+		fromArray( m.kd ), fromArray( m.kr ), fromArray( m.kt ),
+		m.shininess, m.index );
+}
+
+static bool inRange( RAYB_LONG first, RAYB_LONG count, RAYB_DWORD size )
+{
+	return first >= 0 && count >= 0 && (RAYB_QWORD)first + count <= size;
+}
+
+// Build the scene from a mapped file whose section table has been checked.
+static bool buildScene( Scene *scene, const char *base, const RAYB_SECTION *sections )
+{
+	const RAYB_CAMERA *camera = (const RAYB_CAMERA *)( base + sections[ SECTION_CAMERA ].offset );
+	const RAYB_MATERIAL *materials = (const RAYB_MATERIAL *)( base + sections[ SECTION_MATERIALS ].offset );
+	const RAYB_TRANSFORM *transforms = (const RAYB_TRANSFORM *)( base + sections[ SECTION_TRANSFORMS ].offset );
+	const RAYB_LIGHT *lights = (const RAYB_LIGHT *)( base + sections[ SECTION_LIGHTS ].offset );
+	const RAYB_OBJECT *objects = (const RAYB_OBJECT *)( base + sections[ SECTION_OBJECTS ].offset );
+	const vec3f *vertices = (const vec3f *)( base + sections[ SECTION_VERTICES ].offset );
+	const vec3f *normals = (const vec3f *)( base + sections[ SECTION_NORMALS ].offset );
+	const RAYB_LONG *faces = (const RAYB_LONG *)( base + sections[ SECTION_FACES ].offset );
+	const RAYB_LONG *vertexMaterials = (const RAYB_LONG *)( base + sections[ SECTION_VERTEX_MATERIALS ].offset );
+
+	RAYB_DWORD numMaterials = sections[ SECTION_MATERIALS ].count;
+	RAYB_DWORD numTransforms = sections[ SECTION_TRANSFORMS ].count;
+
+	if( sections[ SECTION_CAMERA ].count ) {
+		Camera *cam = scene->getCamera();
+		cam->setEye( fromArray( camera->eye ) );
+		cam->setLookMatrix( mat3f( fromArray( camera->look ),
+			fromArray( camera->look + 3 ), fromArray( camera->look + 6 ) ) );
+		cam->setNormalizedHeight( camera->normalizedHeight );
+		cam->setAspectRatio( camera->aspectRatio );
+	}
+
+	vector<MaterialID> materialIds( numMaterials );
+	for( RAYB_DWORD m = 0; m < numMaterials; ++m )
+		materialIds[m] = scene->addMaterial( toMaterial( materials[m] ) );
+
+	vector<TransformNode*> xforms( numTransforms );
+	for( RAYB_DWORD t = 0; t < numTransforms; ++t )
+		xforms[t] = scene->transformRoot.createChild( toMatrix( transforms[t] ) );
+
+	for( RAYB_DWORD l = 0; l < sections[ SECTION_LIGHTS ].count; ++l ) {
+		const RAYB_LIGHT& rec = lights[l];
+		switch( rec.type ) {
+		case LIGHT_DIRECTIONAL:
+			scene->add( scene->create<DirectionalLight>( scene, fromArray( rec.v ), fromArray( rec.color ) ) );
+			break;
+		case LIGHT_POINT: {
+			PointLight *pl = scene->create<PointLight>( scene, fromArray( rec.v ), fromArray( rec.color ) );
+			pl->setAttenuationCoefficients( rec.attenuation[0], rec.attenuation[1], rec.attenuation[2] );
+			scene->add( pl );
+			break;
+		}
+		case LIGHT_AMBIENT:
+			scene->add( scene->create<AmbientLight>( scene, fromArray( rec.color ) ) );
+			break;
+		default:
+			return false;
+		}
+	}
+
+	for( RAYB_DWORD o = 0; o < sections[ SECTION_OBJECTS ].count; ++o ) {
+		const RAYB_OBJECT& rec = objects[o];
+		if( rec.transform < 0 || (RAYB_DWORD)rec.transform >= numTransforms
+			|| rec.material < 0 || (RAYB_DWORD)rec.material >= numMaterials )
+			return false;
+
+		TransformNode *transform = xforms[ rec.transform ];
+		MaterialID mat = materialIds[ rec.material ];
+		SceneObject *obj = NULL;
+
+		switch( rec.type ) {
+		case OBJECT_SPHERE:
+			obj = scene->create<Sphere>( scene, mat );
+			break;
+		case OBJECT_BOX:
+			obj = scene->create<Box>( scene, mat );
+			break;
+		case OBJECT_SQUARE:
+			obj = scene->create<Square>( scene, mat );
+			break;
+		case OBJECT_CYLINDER:
+			obj = scene->create<Cylinder>( scene, mat, rec.capped != 0 );
+			break;
+		case OBJECT_CONE:
+			obj = scene->create<Cone>( scene, mat, rec.params[0], rec.params[1], rec.params[2], rec.capped != 0 );
+			break;
+		case OBJECT_TRIMESH: {
+			if( !inRange( rec.firstVertex, rec.numVertices, sections[ SECTION_VERTICES ].count )
+				|| !inRange( rec.firstNormal, rec.numNormals, sections[ SECTION_NORMALS ].count )
+				|| !inRange( rec.firstFace, rec.numFaces, sections[ SECTION_FACES ].count )
+				|| !inRange( rec.firstVertexMaterial, rec.numVertexMaterials,
+					sections[ SECTION_VERTEX_MATERIALS ].count ) ) {
+				return false;
+			}
+
+			Trimesh *mesh = scene->create<Trimesh>( scene, mat, transform );
+			mesh->setVertexArrays( vertices + rec.firstVertex, rec.numVertices,
+				rec.numNormals ? normals + rec.firstNormal : NULL, rec.numNormals );
+
+			const RAYB_LONG *f = faces + 3 * rec.firstFace;
+			for( RAYB_LONG i = 0; i < rec.numFaces; ++i, f += 3 ) {
+				if( !mesh->addFace( f[0], f[1], f[2] ) ) {
+					scene->add( mesh );
+					return false;
+				}
+			}
+
+			const RAYB_LONG *vm = vertexMaterials + rec.firstVertexMaterial;
+			for( RAYB_LONG i = 0; i < rec.numVertexMaterials; ++i ) {
+				if( vm[i] < 0 || (RAYB_DWORD)vm[i] >= numMaterials ) {
+					scene->add( mesh );
+					return false;
+				}
+				mesh->addMaterial( materialIds[ vm[i] ] );
+			}
+
+			scene->add( mesh );
+			if( mesh->doubleCheck() )
+				return false;
+			continue;
+		}
+		default:
+			return false;
+		}
+
+		obj->setTransform( transform );
+		scene->add( obj );
+	}
+
+	return true;
+}
+
+Scene *readBinaryScene( const string& filename )
+{
+	MappedFile *file = MappedFile::open( filename.c_str() );
+	if( !file ) {
+		cerr << "Error: couldn't read scene file " << filename << endl;
+		return NULL;
+	}
+
+	const char *base = file->data();
+	size_t size = file->size();
+
+	const RAYB_HEADER *header = (const RAYB_HEADER *)base;
+	if( size < sizeof(RAYB_HEADER) || memcmp( header->magic, RAYB_MAGIC, sizeof(RAYB_MAGIC) ) ) {
+		cerr << "Error: " << filename << " is not a compiled scene" << endl;
+		delete file;
+		return NULL;
+	}
+	if( header->byteOrder != RAYB_BYTE_ORDER || header->version != RAYB_VERSION
+		|| header->numSections != NUM_SECTIONS
+		|| size < sizeof(RAYB_HEADER) + NUM_SECTIONS * sizeof(RAYB_SECTION) ) {
+		cerr << "Error: " << filename << " was compiled for another version or machine; "
+			<< "recompile it from the .ray file" << endl;
+		delete file;
+		return NULL;
+	}
+
+	const RAYB_SECTION *sections = (const RAYB_SECTION *)( base + sizeof(RAYB_HEADER) );
+	for( int s = 0; s < NUM_SECTIONS; ++s ) {
+		const RAYB_SECTION& sec = sections[s];
+		if( sec.type != (RAYB_DWORD)s || sec.offset % RAYB_ALIGN
+			|| sec.offset > size || ( size - sec.offset ) / recordSize[s] < sec.count ) {
+			cerr << "Error: compiled scene " << filename << " is corrupt" << endl;
+			delete file;
+			return NULL;
+		}
+	}
+
+	Scene *scene = new Scene;
+	scene->addMapping( file );
+
+	if( !buildScene( scene, base, sections ) ) {
+		cerr << "Error: compiled scene " << filename << " is corrupt" << endl;
+		delete scene;
+		return NULL;
+	}
+
+	return scene;
+}
@@ -0,0 +1,31 @@
+//
+// rayb.h
+//
+// The compiled (.rayb) scene format.  A .rayb file is a flattened copy of
+// a loaded scene: camera, lights, materials, world transforms, primitives
+// and the vertex/normal/face arrays of every mesh, each in its own 16-byte
+// aligned section.  Loading maps the file into memory and points the meshes
+// straight at the mapped arrays, so nothing is parsed.
+//
+// Files are written in the byte order of the machine that wrote them and
+// are refused elsewhere; recompile from the .ray file in that case.
+//
+
+#ifndef __RAYB_H__
+#define __RAYB_H__
+
+#include <string>
+
+#include "../scene/scene.h"
+
+// Returns NULL (after saying why on stderr) if the file is not a valid
+// compiled scene.
+Scene *readBinaryScene( const string& filename );
+
+// Write a loaded scene out in compiled form.
+bool writeBinaryScene( const string& filename, Scene *scene );
+
+// True if filename ends in .rayb.
+bool isBinarySceneFileName( const string& filename );
+
+#endif // __RAYB_H__
@@ -5,12 +5,17 @@
 #include <cmath>
 #include <cstring>
 #include <fstream>
+#include <iterator>
 #include <strstream>
 
 #include <vector>
 
 #include "read.h"
 #include "parse.h"
+#include "rayb.h"
+#include "mappedfile.h"
+#include "meshfile.h"
+#include "../stats/timeline.h"
 
 #include "../scene/scene.h"
 #include "../SceneObjects/trimesh.h"
@@ -21,64 +26,84 @@
 #include "../SceneObjects/Square.h"
 #include "../scene/light.h"
 
-typedef map<string,Material*> mmap;
+typedef map<string,MaterialID> mmap;
 
-static void processObject( Obj *obj, Scene *scene, mmap& materials );
+static void processObject( Obj *obj, Scene *scene, mmap& materials, const string& dir );
 static Obj *getColorField( Obj *obj );
+static bool extractNormalOptions( Obj *child, NormalOptions& opts );
+static void maybeCompactMesh( Obj *child, Trimesh *tmesh );
 static Obj *getField( Obj *obj, const string& name );
 static bool hasField( Obj *obj, const string& name );
 static vec3f tupleToVec( Obj *obj );
 static void processGeometry( string name, Obj *child, Scene *scene,
-	const mmap& materials, TransformNode *transform );
+	const mmap& materials, const string& dir, TransformNode *transform );
 static void processTrimesh( string name, Obj *child, Scene *scene,
                                      const mmap& materials, TransformNode *transform );
+static void processMeshFile( Obj *child, Scene *scene, const mmap& materials,
+                             const string& dir, TransformNode *transform );
 static void processCamera( Obj *child, Scene *scene );
-static Material *getMaterial( Obj *child, const mmap& bindings );
-static Material *processMaterial( Obj *child, mmap *bindings = NULL );
+static MaterialID getMaterial( Obj *child, Scene *scene, const mmap& bindings );
+static MaterialID processMaterial( Obj *child, Scene *scene, mmap *bindings = NULL );
 static void verifyTuple( const mytuple& tup, size_t size );
+static void maybeNameObject( Obj *child, Scene *scene, const Geometry *obj, const string& fallback = string() );
 
 Scene *readScene( const string& filename )
 {
-	ifstream ifs( filename.c_str() );
-	if( !ifs ) {
+	ScopedTimer timer( "readScene" );
+
+	if( isBinarySceneFileName( filename ) )
+		return readBinaryScene( filename );
+
+	MappedFile *file = MappedFile::open( filename.c_str() );
+	if( !file ) {
 		cerr << "Error: couldn't read scene file " << filename << endl;
 		return NULL;
 	}
 
+	Scene *ret = NULL;
 	try {
-		return readScene( ifs );
+		// mesh files are found relative to the scene
+		size_t slash = filename.find_last_of( "/\\" );
+		string dir = slash == string::npos ? string() : filename.substr( 0, slash + 1 );
+
+		ret = readScene( file->data(), file->data() + file->size(), dir );
 	} catch( ParseError& pe ) {
 		cout << "Parse error: " << pe << endl;
-		return NULL;
 	}
+
+	delete file;
+	return ret;
 }
 
 Scene *readScene( istream& is )
 {
-	Scene *ret = new Scene;
-	
+	string text( (istreambuf_iterator<char>( is )), istreambuf_iterator<char>() );
+	return readScene( text.data(), text.data() + text.size() );
+}
+
+Scene *readScene( const char *begin, const char *end, const string& dir )
+{
+	ParseBuffer in( begin, end );
+
 	// Extract the file header
 	static const int MAXNAME = 80;
-	char buf[ MAXNAME ];
-	int ct = 0;
-
-	while( ct < MAXNAME - 1 ) {
-		char c;
-		is.get( c );
+	const char *name = in.cur;
+	while( in.cur < in.end && in.cur - name < MAXNAME - 1 ) {
+		char c = *in.cur;
 		if( c == ' ' || c == '\t' || c == '\n' ) {
 			break;
 		}
-		buf[ ct++ ] = c;
+		++in.cur;
 	}
 
-	buf[ ct ] = '\0';
-
-	if( strcmp( buf, "SBT-raytracer" ) ) {
+	if( string( name, in.cur ) != "SBT-raytracer" ) {
 		throw ParseError( string( "Input is not an SBT input file." ) );
 	}
 
-	float version;
-	is >> version;
+	while( in.cur < in.end && ( *in.cur == ' ' || *in.cur == '\t' ) ) {
+		++in.cur;
+	}
+	double version = parseDouble( in.cur, in.end );
 
 	if( version != 1.0 ) {
 		ostrstream oss;
@@ -87,17 +112,30 @@ Scene *readScene( istream& is )
 		throw ParseError( string( oss.str() ) );
 	}
 
+	Scene *ret = new Scene;
+
 	// vector<Obj*> result;
 	mmap materials;
 
-	while( true ) {
-		Obj *cur = readFile( is );
-		if( !cur ) {
-			break;
+	try {
+		while( true ) {
+			Obj *cur = readFile( in );
+			if( !cur ) {
+				break;
+			}
+
+			// report problems against the line the object ends on
+			try {
+				processObject( cur, ret, materials, dir );
+			} catch( ParseError& pe ) {
+				throw ParseError( pe.getMsg(), in.line );
+			}
+			in.releaseObjects();
 		}
-
-		processObject( cur, ret, materials );
-		delete cur;
+	} catch( ... ) {
+		// whatever was built so far goes with the scene's arena
+		delete ret;
+		throw;
 	}
 
 	return ret;
@@ -163,7 +201,7 @@ static vec3f tupleToVec( Obj *obj )
 }
 
 static void processGeometry( Obj *obj, Scene *scene,
-	const mmap& materials, TransformNode *transform )
+	const mmap& materials, const string& dir, TransformNode *transform )
 {
 	string name;
 	Obj *child; 
@@ -178,11 +216,12 @@ static void processGeometry( Obj *obj, Scene *scene,
 		ostrstream oss;
 		oss << "Unknown input object ";
 		obj->printOn( oss );
+		oss << ends;
 
 		throw ParseError( string( oss.str() ) );
 	}
 
-	processGeometry( name, child, scene, materials, transform );
+	processGeometry( name, child, scene, materials, dir, transform );
 }
 
 // Extract the named scalar field into ret, if it exists.
@@ -209,19 +248,36 @@ static bool maybeExtractField( Obj *child, const string& name, bool& ret )
 	return false;
 }
 
+// Label an object for reports with its name field, if it has one:
+//
+//   sphere { name = "moon"; material = ...; }
+//
+// or else with fallback, if that isn't empty.
+static void maybeNameObject( Obj *child, Scene *scene, const Geometry *obj, const string& fallback )
+{
+	string label = fallback;
+	if( hasField( child, "name" ) ) {
+		Obj *n = getField( child, "name" );
+		label = n->getTypeName() == "id" ? n->getID() : n->getString();
+	}
+	if( !label.empty() ) {
+		scene->setObjectName( obj, label );
+	}
+}
+
 // Check that a tuple has the expected size.
 static void verifyTuple( const mytuple& tup, size_t size )
 {
 	if( tup.size() != size ) {
 		ostrstream oss;
-		oss << "Bad tuple size " << tup.size() << ", expected " << size;
+		oss << "Bad tuple size " << tup.size() << ", expected " << size << ends;
 
 		throw ParseError( string( oss.str() ) );
 	}
 }
 
 static void processGeometry( string name, Obj *child, Scene *scene,
-	const mmap& materials, TransformNode *transform )
+	const mmap& materials, const string& dir, TransformNode *transform )
 {
 	if( name == "translate" ) {
 		const mytuple& tup = child->getTuple();
@@ -229,6 +285,7 @@ static void processGeometry( string name, Obj *child, Scene *scene,
         processGeometry( tup[3],
                          scene,
                          materials,
+                         dir,
                          transform->createChild(mat4f::translate( vec3f(tup[0]->getScalar(), 
                                                                         tup[1]->getScalar(), 
                                                                         tup[2]->getScalar() ) ) ) );
@@ -238,6 +295,7 @@ static void processGeometry( string name, Obj *child, Scene *scene,
 		processGeometry( tup[4],
                          scene,
                          materials,
+                         dir,
                          transform->createChild(mat4f::rotate( vec3f(tup[0]->getScalar(),
                                                                      tup[1]->getScalar(),
                                                                      tup[2]->getScalar() ),
@@ -249,12 +307,14 @@ static void processGeometry( string name, Obj *child, Scene *scene,
 			processGeometry( tup[1],
                              scene,
                              materials,
+                             dir,
                              transform->createChild(mat4f::scale( vec3f( sc, sc, sc ) ) ) );
 		} else {
 			verifyTuple( tup, 4 );
 			processGeometry( tup[3],
                              scene,
                              materials,
+                             dir,
                              transform->createChild(mat4f::scale( vec3f(tup[0]->getScalar(),
                                                                         tup[1]->getScalar(),
                                                                         tup[2]->getScalar() ) ) ) );
@@ -275,6 +335,7 @@ static void processGeometry( string name, Obj *child, Scene *scene,
 		processGeometry( tup[4],
 			             scene,
                          materials,
+                         dir,
                          transform->createChild(mat4f(vec4f( l1[0]->getScalar(),
                                                              l1[1]->getScalar(),
                                                              l1[2]->getScalar(),
@@ -293,24 +354,26 @@ static void processGeometry( string name, Obj *child, Scene *scene,
                                                              l4[3]->getScalar() ) ) ) );
 	} else if( name == "trimesh" || name == "polymesh" ) { // 'polymesh' is for backwards compatibility
         processTrimesh( name, child, scene, materials, transform);
+    } else if( name == "meshfile" ) {
+        processMeshFile( child, scene, materials, dir, transform );
     } else {
 		SceneObject *obj = NULL;
-       	Material *mat;
+       	MaterialID mat;
         
         //if( hasField( child, "material" ) )
-        mat = getMaterial(getField( child, "material" ), materials );
+        mat = getMaterial(getField( child, "material" ), scene, materials );
         //else
-        //    mat = new Material();
+        //    mat = scene->addMaterial( Material() );
 
 		if( name == "sphere" ) {
-			obj = new Sphere( scene, mat );
+			obj = scene->create<Sphere>( scene, mat );
 		} else if( name == "box" ) {
-			obj = new Box( scene, mat );
+			obj = scene->create<Box>( scene, mat );
 		}
 		else if (name == "cylinder") {
 			bool capped = true;
 			maybeExtractField(child, "capped", capped);
-			obj = new Cylinder(scene, mat, capped);
+			obj = scene->create<Cylinder>( scene, mat, capped);
 		} else if( name == "cone" ) {
 			double height = 1.0;
 			double bottom_radius = 1.0;
@@ -322,27 +385,91 @@ static void processGeometry( string name, Obj *child, Scene *scene,
 			maybeExtractField( child, "top_radius", top_radius );
 			maybeExtractField( child, "capped", capped );
 
-			obj = new Cone( scene, mat, height, bottom_radius, top_radius, capped );
+			obj = scene->create<Cone>( scene, mat, height, bottom_radius, top_radius, capped );
 		} else if( name == "square" ) {
-			obj = new Square( scene, mat );
+			obj = scene->create<Square>( scene, mat );
 		}
 
         obj->setTransform(transform);
+		maybeNameObject( child, scene, obj );
 		scene->add(obj);
 	}
 }
 
+// Read gennormals and the fields that tune it:
+//
+//   gennormals = true;
+//   normalweight = "angle";     // or "area", "uniform" (the default)
+//   weld = 0.0001;              // share normals between vertices this close
+//   creaseangle = 60;           // degrees; sharper edges stay sharp
+//
+// Returns whether normals should be generated.
+static bool extractNormalOptions( Obj *child, NormalOptions& opts )
+{
+    bool generateNormals = false;
+    maybeExtractField( child, "gennormals", generateNormals );
+
+    if( hasField( child, "normalweight" ) )
+    {
+        Obj *w = getField( child, "normalweight" );
+        string weighting = w->getTypeName() == "id" ? w->getID() : w->getString();
+        if( weighting == "uniform" )
+            opts.weighting = NormalOptions::UNIFORM;
+        else if( weighting == "area" )
+            opts.weighting = NormalOptions::AREA;
+        else if( weighting == "angle" )
+            opts.weighting = NormalOptions::ANGLE;
+        else
+            throw ParseError( "Unknown normalweight '" + weighting + "'." );
+    }
+    maybeExtractField( child, "weld", opts.weldDistance );
+    maybeExtractField( child, "creaseangle", opts.creaseAngle );
+
+    return generateNormals;
+}
+
+// Store a mesh compactly if it asks for it:
+//
+//   compact = true;             // float positions
+//   compact = "quantized";      // 16-bit positions
+//
+// Either way normals are packed into 32 bits and vertex materials become
+// palette indices.
+static void maybeCompactMesh( Obj *child, Trimesh *tmesh )
+{
+    if( !hasField( child, "compact" ) )
+        return;
+
+    Obj *c = getField( child, "compact" );
+    string type = c->getTypeName();
+    if( type == "bool" ) {
+        if( c->getBoolean() )
+            tmesh->compact( Trimesh::POSITIONS_FLOAT );
+        return;
+    }
+
+    string mode = type == "id" ? c->getID() : c->getString();
+    if( mode == "float" )
+        tmesh->compact( Trimesh::POSITIONS_FLOAT );
+    else if( mode == "quantized" )
+        tmesh->compact( Trimesh::POSITIONS_QUANTIZED );
+    else if( mode == "double" )
+        tmesh->compact( Trimesh::POSITIONS_DOUBLE );
+    else
+        throw ParseError( "Unknown compact mode '" + mode + "'." );
+}
+
 static void processTrimesh( string name, Obj *child, Scene *scene,
                                      const mmap& materials, TransformNode *transform )
 {
-    Material *mat;
+    MaterialID mat;
     
     if( hasField( child, "material" ) )
-        mat = getMaterial( getField( child, "material" ), materials );
+        mat = getMaterial( getField( child, "material" ), scene, materials );
     else
-        mat = new Material();
+        mat = scene->addMaterial( Material() );
     
-    Trimesh *tmesh = new Trimesh( scene, mat, transform);
+    Trimesh *tmesh = scene->create<Trimesh>( scene, mat, transform);
 
     const mytuple &points = getField( child, "points" )->getTuple();
     for( mytuple::const_iterator pi = points.begin(); pi != points.end(); ++pi )
@@ -370,17 +497,18 @@ static void processTrimesh( string name, Obj *child, Scene *scene,
         }
     }
 
-    bool generateNormals = false;
-    maybeExtractField( child, "gennormals", generateNormals );
-    if( generateNormals )
-        tmesh->generateNormals();
-            
     if( hasField( child, "materials" ) )
     {
         const mytuple &mats = getField( child, "materials" )->getTuple();
         for( mytuple::const_iterator mi = mats.begin(); mi != mats.end(); ++mi )
-            tmesh->addMaterial( getMaterial( *mi, materials ) );
+            tmesh->addMaterial( getMaterial( *mi, scene, materials ) );
     }
+
+    // after the materials, which crease splitting has to copy
+    NormalOptions normalOpts;
+    if( extractNormalOptions( child, normalOpts ) )
+        tmesh->generateNormals( normalOpts );
+            
     if( hasField( child, "normals" ) )
     {
         const mytuple &norms = getField( child, "normals" )->getTuple();
@@ -392,10 +520,55 @@ static void processTrimesh( string name, Obj *child, Scene *scene,
     if( error = tmesh->doubleCheck() )
         throw ParseError( error );
 
+    maybeCompactMesh( child, tmesh );
+
+    maybeNameObject( child, scene, tmesh );
     scene->add(tmesh);
 }
 
-static Material *getMaterial( Obj *child, const mmap& bindings )
+// A mesh loaded from an OBJ or PLY file:
+//
+//   meshfile { file = "bunny.ply"; material = ...; gennormals = true; }
+//
+// Normals in the file are used if it has them; otherwise gennormals
+// generates them as for polymesh.  Relative names are looked up next to
+// the scene file.
+static void processMeshFile( Obj *child, Scene *scene, const mmap& materials,
+                             const string& dir, TransformNode *transform )
+{
+    string given = getField( child, "file" )->getString();
+    string fname = given;
+    if( !dir.empty() && !fname.empty() && fname[0] != '/' && fname[0] != '\\' && fname.find( ':' ) == string::npos )
+        fname = dir + fname;
+
+    MeshData data;
+    readMeshFile( fname, data );
+
+    MaterialID mat;
+    if( hasField( child, "material" ) )
+        mat = getMaterial( getField( child, "material" ), scene, materials );
+    else
+        mat = scene->addMaterial( Material() );
+
+    Trimesh *tmesh = scene->create<Trimesh>( scene, mat, transform );
+    bool hasNormals = !data.normals.empty();
+    tmesh->swapVertices( data.vertices, data.normals );
+
+    for( size_t i = 0; i + 2 < data.triangles.size(); i += 3 )
+        if( !tmesh->addFace( data.triangles[i], data.triangles[i + 1], data.triangles[i + 2] ) )
+            throw ParseError( "Bad face in " + fname );
+
+    NormalOptions normalOpts;
+    if( extractNormalOptions( child, normalOpts ) && !hasNormals )
+        tmesh->generateNormals( normalOpts );
+
+    maybeCompactMesh( child, tmesh );
+
+    maybeNameObject( child, scene, tmesh, given );
+    scene->add( tmesh );
+}
+
+static MaterialID getMaterial( Obj *child, Scene *scene, const mmap& bindings )
 {
 	string tfield = child->getTypeName();
 	if( tfield == "id" ) {
@@ -410,46 +583,48 @@ static Material *getMaterial( Obj *child, const mmap& bindings )
 		} 
 	} 
 	// Don't allow binding.
-	return processMaterial( child );
+	return processMaterial( child, scene );
 }
 
-static Material *processMaterial( Obj *child, mmap *bindings )
-// Generate a material from a parse sub-tree
+static MaterialID processMaterial( Obj *child, Scene *scene, mmap *bindings )
+// Generate a material from a parse sub-tree and add it to the scene's
+// material table
 //
 // child   - root of parse tree
+// scene   - the scene whose table gets the material
 // mmap    - bindings of names to materials (if non-null)
-// defmat  - material to start with (if non-null)
 {
-    Material *mat;
-    mat = new Material();
+    Material mat;
 	
     if( hasField( child, "emissive" ) ) {
-        mat->ke = tupleToVec( getField( child, "emissive" ) );
+        mat.ke = tupleToVec( getField( child, "emissive" ) );
     }
     if( hasField( child, "ambient" ) ) {
-        mat->ka = tupleToVec( getField( child, "ambient" ) );
+        mat.ka = tupleToVec( getField( child, "ambient" ) );
     }
     if( hasField( child, "specular" ) ) {
-        mat->ks = tupleToVec( getField( child, "specular" ) );
+        mat.ks = tupleToVec( getField( child, "specular" ) );
     }
     if( hasField( child, "diffuse" ) ) {
-        mat->kd = tupleToVec( getField( child, "diffuse" ) );
+        mat.kd = tupleToVec( getField( child, "diffuse" ) );
     }
     if( hasField( child, "reflective" ) ) {
-        mat->kr = tupleToVec( getField( child, "reflective" ) );
+        mat.kr = tupleToVec( getField( child, "reflective" ) );
     } else {
-        mat->kr = mat->ks; // defaults to ks if none given.
+        mat.kr = mat.ks; // defaults to ks if none given.
     }
     if( hasField( child, "transmissive" ) ) {
-        mat->kt = tupleToVec( getField( child, "transmissive" ) );
+        mat.kt = tupleToVec( getField( child, "transmissive" ) );
     }
     if( hasField( child, "index" ) ) { // index of refraction
-        mat->index = getField( child, "index" )->getScalar();
+        mat.index = getField( child, "index" )->getScalar();
     }
     if( hasField( child, "shininess" ) ) {
-        mat->shininess = getField( child, "shininess" )->getScalar();
+        mat.shininess = getField( child, "shininess" )->getScalar();
     }
 
+    MaterialID id = scene->addMaterial( mat );
+
     if( bindings != NULL ) {
         // Want to bind, better have "name" field:
         if( hasField( child, "name" ) ) {
@@ -462,14 +637,14 @@ static Material *processMaterial( Obj *child, mmap *bindings )
                 name = field->getString();
             }
 
-            (*bindings)[ name ] = mat;
+            (*bindings)[ name ] = id;
         } else {
             throw ParseError( 
                 string( "Attempt to bind material with no name" ) );
         }
     }
 
-    return mat;
+    return id;
 }
 
 static void
@@ -499,7 +674,7 @@ processCamera( Obj *child, Scene *scene )
     }
 }
 
-static void processObject( Obj *obj, Scene *scene, mmap& materials )
+static void processObject( Obj *obj, Scene *scene, mmap& materials, const string& dir )
 {
 	// Assume the object is named.
 	string name;
@@ -515,6 +690,7 @@ static void processObject( Obj *obj, Scene *scene, mmap& materials )
 		ostrstream oss;
 		oss << "Unknown input object ";
 		obj->printOn( oss );
+		oss << ends;
 
 		throw ParseError( string( oss.str() ) );
 	}
@@ -524,14 +700,14 @@ static void processObject( Obj *obj, Scene *scene, mmap& materials )
 			throw ParseError( "No info for directional_light" );
 		}
 
-		scene->add( new DirectionalLight( scene, 
+		scene->add( scene->create<DirectionalLight>( scene, 
 			tupleToVec( getField( child, "direction" ) ).normalize(),
 			tupleToVec( getColorField( child ) ) ) );
 	} else if( name == "point_light" ) {
 		if( child == NULL ) {
 			throw ParseError( "No info for point_light" );
 		}
-		PointLight* pointLight = new PointLight(scene,
+		PointLight* pointLight = scene->create<PointLight>( scene,
 			tupleToVec(getField(child, "position")),
 			tupleToVec(getColorField(child)));
 		scene->add(pointLight);
@@ -550,7 +726,7 @@ static void processObject( Obj *obj, Scene *scene, mmap& materials )
 		if (child == NULL) {
 			throw ParseError("No info for ambient_light");
 		}
-		AmbientLight* ambientLight = new AmbientLight(scene,
+		AmbientLight* ambientLight = scene->create<AmbientLight>( scene,
 			tupleToVec(getColorField(child)));
 		scene->add(ambientLight);
 	} else if( 	name == "sphere" ||
@@ -563,11 +739,12 @@ static void processObject( Obj *obj, Scene *scene, mmap& materials )
 				name == "scale" ||
 				name == "transform" ||
                 name == "trimesh" ||
-                name == "polymesh") { // polymesh is for backwards compatibility.
-		processGeometry( name, child, scene, materials, &scene->transformRoot);
+                name == "polymesh" ||
+                name == "meshfile") { // polymesh is for backwards compatibility.
+		processGeometry( name, child, scene, materials, dir, &scene->transformRoot);
 		//scene->add( geo );
 	} else if( name == "material" ) {
-		processMaterial( child, &materials );
+		processMaterial( child, scene, &materials );
 	} else if( name == "camera" ) {
 		processCamera( child, scene );
 	} else {
@@ -9,4 +9,8 @@
 Scene *readScene( const string& filename );
 Scene *readScene( istream& is );
 
+// Parse a whole .ray file held in memory.  Throws ParseError.
+// dir is prepended to relative file names inside the scene.
+Scene *readScene( const char *begin, const char *end, const string& dir = string() );
+
 #endif // __READ_H__
@@ -56,6 +56,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include <FL/Fl.h>
 #include <FL/Fl_Window.H>
@@ -64,9 +69,23 @@
 #include <FL/fl_ask.h>
 
 #include "ui/TraceUI.h"
+#include "Checkpointer.h"
 #include "RayTracer.h"
+#include "SequenceRenderer.h"
+#include "TileRenderer.h"
+
+#include "farm/renderfarm.h"
 
 #include "fileio/bitmap.h"
+#include "fileio/checkpoint.h"
+#include "fileio/imagewriter.h"
+#include "fileio/hdrimage.h"
+#include "fileio/read.h"
+#include "fileio/rayb.h"
+#include "scene/animation.h"
+#include "stats/objectstats.h"
+#include "stats/raystats.h"
+#include "stats/timeline.h"
 
 // ***********************************************************
 // from getopt.cpp 
@@ -77,40 +96,147 @@ extern char* optarg;
 extern int optind, opterr, optopt;
 // ***********************************************************
 
-RayTracer* theRayTracer;
-TraceUI* traceUI;
-
 //
 // options from program parameters
 //
 int recursion_depth = 0;
 int g_height;
 int g_width = 150;
+int g_objectRows = -1;
 bool bReport = false;
+bool bStream = false;
+bool bCompile = false;
+double g_exposure = 0.0;
 char *progname, *rayName, *imgName;
+char *statsName = NULL;
+char *traceName = NULL;
+char *animName = NULL;
+int g_firstFrame = 0;
+int g_lastFrame = -1;
+int g_workers = 0;
+char *checkpointName = NULL;
+double g_checkpointInterval = 60.0;
+bool bResume = false;
+RayTracer::HeatmapMetric g_heatmap = RayTracer::HEATMAP_OFF;
 
 void usage()
 {
 #ifdef WIN32
-	fl_alert( "usage: %s [-r <#> -w <#> -t] [input.ray output.bmp]\n", progname );
+	fl_alert( "usage: %s [-r <#> -w <#> -e <#> -t -j <stats.json> -p <trace.json> -m <metric> -o <#> -s -c -a <anim> -f <#[-#]> -n <#> -k <file> -K <#> -R] [input.ray output.bmp]\n", progname );
 #else
 	fprintf( stderr, "usage: %s [options] [input.ray output.bmp]\n", progname );
 	fprintf( stderr, "  -r <#>      set recurssion level (default %d)\n", recursion_depth );
 	fprintf( stderr, "  -w <#>      set output image width (default %d)\n", g_width );
-	fprintf( stderr, "  -t			report time statistics\n" );
+	fprintf( stderr, "  -t			report time and ray statistics\n" );
+	fprintf( stderr, "  -j <file>   write the statistics as JSON\n" );
+	fprintf( stderr, "  -p <file>   write a Chrome trace of the phases and tiles\n" );
+	fprintf( stderr, "  -m <metric> write a per-pixel cost heatmap instead of the image:\n" );
+	fprintf( stderr, "              time, rays or tests (the last two need RAY_STATS);\n" );
+	fprintf( stderr, "              the raw costs go to output.pfm\n" );
+	fprintf( stderr, "  -o <#>      rank the # costliest objects after the render (0: all)\n" );
+	fprintf( stderr, "  -s			stream tiles to disk as they finish (.bmp or .tga)\n" );
+	fprintf( stderr, "  -e <#>      exposure in stops for 8-bit output (default 0)\n" );
+	fprintf( stderr, "  -c			compile input.ray to output.rayb instead of tracing\n" );
+	fprintf( stderr, "  -a <file>   render the keyframed sequence in file (see scene/animation.h)\n" );
+	fprintf( stderr, "              to output%%04d.bmp, or a name with its own %%d\n" );
+	fprintf( stderr, "  -f <#[-#]>  only render this frame, or range of frames, of -a\n" );
+	fprintf( stderr, "  -n <#>      render on # worker processes, each loading the scene\n" );
+	fprintf( stderr, "  -k <file>   render in tiles, saving the finished ones to a checkpoint\n" );
+	fprintf( stderr, "  -K <#>      seconds between checkpoints (default %g)\n", g_checkpointInterval );
+	fprintf( stderr, "  -R			resume from the -k checkpoint if there is one\n" );
+	fprintf( stderr, "output.pfm or output.hdr keeps the unclamped radiance;\n" );
+	fprintf( stderr, "input.pfm re-exposes a saved float image without tracing.\n" );
 #endif
 }
 
 bool processArgs(int argc, char **argv) {
 	int i;
 
-    while ( (i = getopt( argc, argv, "tr:w:h:" )) != EOF )
+    while ( (i = getopt( argc, argv, "tscRr:w:h:e:j:p:m:o:a:f:n:k:K:" )) != EOF )
 	{
 		switch ( i )
 		{
 			case 't':
 			bReport = true;
 			break;
+
+			case 'j':
+			statsName = optarg;
+			break;
+
+			case 'p':
+			traceName = optarg;
+			break;
+
+			case 'm':
+			if (!strcmp(optarg, "time"))
+				g_heatmap = RayTracer::HEATMAP_TIME;
+			else if (!strcmp(optarg, "rays"))
+				g_heatmap = RayTracer::HEATMAP_RAYS;
+			else if (!strcmp(optarg, "tests"))
+				g_heatmap = RayTracer::HEATMAP_TESTS;
+			else {
+				fprintf( stderr, "unknown heatmap metric %s\n", optarg );
+				return false;
+			}
+			if (!RayTracer::heatmapSupported(g_heatmap)) {
+				fprintf( stderr, "-m %s needs a build with RAY_STATS\n", optarg );
+				return false;
+			}
+			break;
+
+			case 'o':
+			g_objectRows = atoi( optarg );
+			break;
+
+			case 's':
+			bStream = true;
+			break;
+
+			case 'c':
+			bCompile = true;
+			break;
+
+			case 'a':
+			animName = optarg;
+			break;
+
+			case 'k':
+			checkpointName = optarg;
+			break;
+
+			case 'K':
+			g_checkpointInterval = atof( optarg );
+			if ( g_checkpointInterval <= 0.0 ) {
+				fprintf( stderr, "bad checkpoint interval %s\n", optarg );
+				return false;
+			}
+			break;
+
+			case 'R':
+			bResume = true;
+			break;
+
+			case 'n':
+			g_workers = atoi( optarg );
+			if ( g_workers <= 0 || !farmSupported() ) {
+				fprintf( stderr, "-n needs a positive number of workers and a POSIX build\n" );
+				return false;
+			}
+			break;
+
+			case 'f':
+			{
+				char *end;
+				g_firstFrame = g_lastFrame = (int)strtol( optarg, &end, 10 );
+				if ( *end == '-' )
+					g_lastFrame = (int)strtol( end + 1, &end, 10 );
+				if ( *end || g_firstFrame < 0 || g_lastFrame < g_firstFrame ) {
+					fprintf( stderr, "bad frame range %s\n", optarg );
+					return false;
+				}
+			}
+			break;
 	    
 			case 'r':
 			recursion_depth = atoi( optarg );
@@ -124,6 +250,10 @@ bool processArgs(int argc, char **argv) {
 			g_height = atoi( optarg );
 			break;
 
+			case 'e':
+			g_exposure = atof( optarg );
+			break;
+
 			default:
 			return false;
 		}
@@ -138,17 +268,95 @@ bool processArgs(int argc, char **argv) {
     rayName = argv[optind];
     imgName = argv[optind+1];
 
+	if ( bResume && !checkpointName ) {
+		fprintf( stderr, "-R needs the checkpoint file given with -k\n" );
+		return false;
+	}
+
 	return true;
 }
 
+// TileRenderer callback for -s: pass each finished tile to the writer.
+static void writeTile(int x, int y, int w, int h, const unsigned char* pixels, int stride, void* data)
+{
+	((ImageWriter*)data)->writeTile(x, y, w, h, pixels, stride);
+}
+
+// The raw per-pixel costs of a -m render, as a float image next to the
+// heatmap (out.bmp -> out.pfm) with the cost in all three channels.
+static void writeHeatmapValues(RayTracer* tracer, const char* imgName)
+{
+	int w, h;
+	const float* heat = tracer->getHeatmapValues(w, h);
+	if (!heat)
+		return;
+
+	std::string name(imgName);
+	size_t dot = name.find_last_of('.');
+	if (dot != std::string::npos && name.find_first_of("/\\", dot) == std::string::npos)
+		name.erase(dot);
+	name += ".pfm";
+
+	std::vector<float> rgb((size_t)w * h * 3);
+	for (size_t p = 0; p < (size_t)w * h; ++p)
+		rgb[p * 3] = rgb[p * 3 + 1] = rgb[p * 3 + 2] = heat[p];
+	if (!writePFM(name.c_str(), w, h, &rgb[0]))
+		fprintf( stderr, "error writing %s\n", name.c_str() );
+}
+
+// -k: trace on every core, a tile at a time, with the finished tiles saved
+// to the checkpoint as the render goes; with -R, first take back the
+// tiles an earlier run of the same render saved, and trace only the rest.
+static bool renderWithCheckpoints(RayTracer* tracer)
+{
+	// a checkpoint only fits a render of the same scene file and settings
+	unsigned long long hash = hashBytes(NULL, 0);
+	if (!hashFile(rayName, hash)) {
+		fprintf( stderr, "can't read %s\n", rayName );
+		return false;
+	}
+	int settings[4] = { g_width, g_height, recursion_depth, isHDRFileName(imgName) ? 1 : 0 };
+	unsigned int seed = tracer->getSeed();
+	hash = hashBytes(settings, sizeof(settings), hash);
+	hash = hashBytes(&g_exposure, sizeof(g_exposure), hash);
+	hash = hashBytes(&seed, sizeof(seed), hash);
+
+	std::vector<unsigned char> done;
+	if (bResume) {
+		FILE* fp = fopen(checkpointName, "rb");
+		if (fp) {
+			fclose(fp);
+			if (!Checkpointer::resume(tracer, checkpointName, hash, done))
+				return false;
+			if (bReport)
+				fprintf( stderr, "resuming with %d of %d tiles done\n",
+					(int)std::count(done.begin(), done.end(), 1), (int)done.size() );
+		} else
+			fprintf( stderr, "no checkpoint %s yet: starting from scratch\n", checkpointName );
+	}
+
+	Checkpointer checkpointer(tracer, checkpointName, g_checkpointInterval, hash, done);
+	{
+		ScopedTimer timer("renderTiles");
+		TileRenderer renderer(tracer);
+		renderer.skipTiles(done);
+		renderer.start(0, Checkpointer::tileDone, &checkpointer);
+		renderer.wait();
+	}
+	bool ok = checkpointer.finish();
+	if (bReport)
+		fprintf( stderr, "%d checkpoints written\n", checkpointer.numSaves() );
+	return ok;
+}
+
 // usage : ray [option] in.ray out.bmp
 // Simply keying in ray will invoke a graphics mode version.
 // Use "ray --help" to see the detailed usage.
 // OK. I am lying. any illegal option such as "ray blahbalh" will print
 // out the usage
 //
-// Graphics mode will be substantially slower than text mode because of
-// event handling overhead.
+// Graphics mode renders on background threads (see TileRenderer), so the
+// UI stays responsive while an image is being traced.
 int main(int argc, char **argv) {
 	progname=argv[0];
 
@@ -158,46 +366,253 @@ int main(int argc, char **argv) {
 			usage();
 			exit(1);
 		}
+
+		if (bReport || traceName) {
+			enableTimeline(true);
+			nameTimelineThread("main");
+		}
 		
-		theRayTracer=new RayTracer();
-		theRayTracer->loadScene(rayName);
+		if (isHDRFileName(rayName)) {
+			// re-expose a float image: no tracing involved
+			int w, h;
+			float* hdr = readPFM(rayName, w, h);
+			if (!hdr) {
+				fprintf( stderr, "can't read %s (only .pfm can be re-exposed)\n", rayName );
+				return 1;
+			}
+
+			unsigned char* buf = new unsigned char[ w * h * 3 ];
+			toneMap(hdr, buf, (size_t)w * h * 3, g_exposure);
+			writeBMP(imgName, w, h, buf);
+
+			delete [] buf;
+			delete [] hdr;
+			return 1;
+		}
+
+		if (bCompile) {
+			if (!isBinarySceneFileName(imgName)) {
+				fprintf( stderr, "-c writes a .rayb file\n" );
+				return 1;
+			}
+
+			Scene* scene = readScene(rayName);
+			bool ok = scene && writeBinaryScene(imgName, scene);
+			if (traceName)
+				writeChromeTrace(traceName);
+			return ok ? 0 : 1;
+		}
+
+		if (animName) {
+			if (bStream || g_heatmap != RayTracer::HEATMAP_OFF || g_objectRows >= 0
+				|| g_workers > 0 || checkpointName) {
+				fprintf( stderr, "-a can't be used with -s, -m, -o, -n or -k\n" );
+				return 1;
+			}
+
+			Animation anim;
+			std::string error;
+			Scene* scene = anim.load(animName, error) ? readScene(rayName) : NULL;
+			if (scene) {
+				scene->initScene();
+				if (!anim.bind(scene, error)) {
+					delete scene;
+					scene = NULL;
+				}
+			}
+			if (!scene) {
+				if (!error.empty())
+					fprintf( stderr, "%s\n", error.c_str() );
+				return 1;
+			}
+
+			SequenceSettings settings;
+			settings.width = g_width;
+			settings.height = g_height;
+			settings.first = g_firstFrame;
+			settings.last = g_lastFrame;
+			settings.depth = recursion_depth;
+			settings.exposure = g_exposure;
+			settings.report = bReport;
+			settings.outName = imgName;
+
+			double start = timelineNow();
+			bool ok = renderSequence(scene, anim, settings);
+			double t = timelineNow() - start;
+
+			if (bReport) {
+				fprintf( stderr, "total time = %.3f seconds\n", t);
+				printTimelineSummary(stderr);
+				printRayStats(stderr, t, false);
+			}
+			if (traceName)
+				writeChromeTrace(traceName);
+			delete scene;
+			return ok ? 0 : 1;
+		}
+
+		if (g_workers > 0) {
+			if (bStream || g_heatmap != RayTracer::HEATMAP_OFF || g_objectRows >= 0
+				|| checkpointName || isHDRFileName(imgName)) {
+				fprintf( stderr, "-n writes one .bmp and can't be used with -s, -m, -o or -k\n" );
+				return 1;
+			}
+
+			FarmSettings settings;
+			settings.workers = g_workers;
+			settings.width = g_width;
+			settings.height = g_height;
+			settings.depth = recursion_depth;
+			settings.exposure = g_exposure;
+			settings.report = bReport;
+
+			std::vector<unsigned char> rgb;
+			int width, height;
+			FarmStats stats;
+			if (!farmRender(rayName, settings, rgb, width, height, &stats))
+				return 1;
+			if (!writeBMP(imgName, width, height, &rgb[0])) {
+				fprintf( stderr, "error writing %s\n", imgName );
+				return 1;
+			}
+
+			if (bReport) {
+				fprintf( stderr, "total time = %.3f seconds\n", stats.seconds);
+				for (size_t k = 0; k < stats.bandsDone.size(); ++k)
+					fprintf( stderr, "  worker %d: %d bands%s\n", (int)k, stats.bandsDone[k],
+						stats.lost[k] ? " (lost)" : "" );
+				if (stats.reassigned)
+					fprintf( stderr, "  %d bands reassigned\n", stats.reassigned );
+				printTimelineSummary(stderr);
+			}
+			if (traceName)
+				writeChromeTrace(traceName);
+			return 0;
+		}
+
+		bool bHDR = isHDRFileName(imgName);
+		if (bHDR && bStream) {
+			fprintf( stderr, "-s only supports .bmp and .tga output\n" );
+			return 1;
+		}
+		if (g_heatmap != RayTracer::HEATMAP_OFF && (bHDR || bStream)) {
+			fprintf( stderr, "-m writes a .bmp heatmap and can't be used with -s\n" );
+			return 1;
+		}
+		if (checkpointName && (bStream || g_heatmap != RayTracer::HEATMAP_OFF)) {
+			fprintf( stderr, "-k can't be used with -s or -m\n" );
+			return 1;
+		}
+
+		// an exposure is applied by tone mapping the unclamped radiance,
+		// so 8-bit output traces in HDR too when one is given
+		RayTracer* tracer=new RayTracer();
+		tracer->setHDR(bHDR || g_exposure != 0.0);
+		tracer->setExposure(g_exposure);
+		tracer->setDepth(recursion_depth);
+		tracer->setHeatmap(g_heatmap);
+		enableObjectStats(g_objectRows >= 0);
+		tracer->loadScene(rayName);
 	
-		if (theRayTracer->sceneLoaded()) {
-			g_height = (int)(g_width / theRayTracer->aspectRatio() + 0.5);
+		if (tracer->sceneLoaded()) {
+			g_height = (int)(g_width / tracer->aspectRatio() + 0.5);
 
-			theRayTracer->traceSetup(g_width, g_height);
-		
-			clock_t start, end;
-			start=clock();
+			// wall-clock time: clock() would add up the CPU time of
+			// every render thread
+			double start, end;
 
-			theRayTracer->traceLines(0, g_height);
-		
-			end=clock();
+			if (bStream) {
+				// no image buffer: tiles go straight to the writer
+				ImageWriter* writer = ImageWriter::create(imgName, g_width, g_height);
+				if (!writer) {
+					fprintf( stderr, "can't write %s (use .bmp or .tga)\n", imgName );
+					return 1;
+				}
+
+				tracer->traceSetup(g_width, g_height, false);
+
+				start=timelineNow();
+
+				{
+					ScopedTimer timer("renderTiles");
+					TileRenderer renderer(tracer);
+					renderer.start(0, writeTile, writer);
+					renderer.wait();
+				}
 
-			// save image
-			unsigned char* buf;
+				end=timelineNow();
 
-			theRayTracer->getBuffer(buf, g_width, g_height);
-			if (buf)
-				writeBMP(imgName, g_width, g_height, buf); 
+				if (!writer->close())
+					fprintf( stderr, "error writing %s\n", imgName );
+				delete writer;
+			} else {
+				tracer->traceSetup(g_width, g_height);
+			
+				start=timelineNow();
 
+				if (checkpointName) {
+					if (!renderWithCheckpoints(tracer))
+						return 1;
+				} else
+					tracer->traceLines(0, g_height);
+			
+				end=timelineNow();
+
+				// save image
+				unsigned char* buf;
+
+				tracer->getBuffer(buf, g_width, g_height);
+				bool written = true;
+				if (bHDR) {
+					float* hdr;
+					tracer->getHDRBuffer(hdr, g_width, g_height);
+					if (!hdr || !writeHDR(imgName, g_width, g_height, hdr)) {
+						fprintf( stderr, "error writing %s\n", imgName );
+						written = false;
+					}
+				} else if (g_heatmap != RayTracer::HEATMAP_OFF) {
+					tracer->heatmapImage();
+					writeBMP(imgName, g_width, g_height, buf);
+					writeHeatmapValues(tracer, imgName);
+				} else if (buf)
+					written = writeBMP(imgName, g_width, g_height, buf); 
+
+				// the image is safe: its checkpoint has done its job
+				if (checkpointName && written)
+					remove(checkpointName);
+			}
+
+			double t=end-start;
 			if (bReport) {
-				double t=(double)(end-start)/CLOCKS_PER_SEC;
 #ifdef WIN32
 				fl_message( "total time = %.3f seconds\n", t); 
 #else
 				fprintf( stderr, "total time = %.3f seconds\n", t); 
 #endif
+				printTimelineSummary(stderr);
+				printRayStats(stderr, t, false);
+			}
+			if (g_objectRows >= 0)
+				printObjectStats(stderr, tracer->getScene(), g_objectRows);
+			if (traceName)
+				writeChromeTrace(traceName);
+			if (statsName) {
+				FILE* fp = fopen(statsName, "w");
+				if (fp) {
+					printRayStats(fp, t, true);
+					fclose(fp);
+				} else
+					fprintf( stderr, "can't write %s\n", statsName );
 			}
 		}
 
 		return 1;
 	} else {
 		// graphics mode
-		traceUI=new TraceUI();
-		theRayTracer=new RayTracer();
+		TraceUI* traceUI=new TraceUI();
+		RayTracer* tracer=new RayTracer();
 
-		traceUI->setRayTracer(theRayTracer);
+		traceUI->setRayTracer(tracer);
 
 		Fl::visual(FL_DOUBLE|FL_INDEX);
 
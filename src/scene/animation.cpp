@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "animation.h"
+#include "camera.h"
+#include "scene.h"
+
+void Track::add( double frame, const double *v )
+{
+	size_t k = lower_bound( frames.begin(), frames.end(), frame ) - frames.begin();
+	if( k == frames.size() || frames[k] != frame ) {
+		frames.insert( frames.begin() + k, frame );
+		values.insert( values.begin() + k * width, width, 0.0 );
+	}
+	copy( v, v + width, values.begin() + k * width );
+}
+
+void Track::eval( double frame, double *out ) const
+{
+	size_t k = upper_bound( frames.begin(), frames.end(), frame ) - frames.begin();
+	if( k == 0 || k == frames.size() ) {
+		// before the first key or after the last: hold it
+		k = ( k == 0 ) ? 0 : k - 1;
+		copy( values.begin() + k * width, values.begin() + ( k + 1 ) * width, out );
+		return;
+	}
+
+	double t = ( frame - frames[k-1] ) / ( frames[k] - frames[k-1] );
+	const double *a = &values[ ( k - 1 ) * width ];
+	const double *b = &values[ k * width ];
+	for( int c = 0; c < width; ++c ) {
+		out[c] = a[c] + t * ( b[c] - a[c] );
+	}
+}
+
+static vec3f evalVec( const Track& track, double frame )
+{
+	double v[3];
+	track.eval( frame, v );
+	return vec3f( v[0], v[1], v[2] );
+}
+
+// n comma-separated numbers, or one when single is allowed (a uniform
+// scale), copied to all n.
+static bool parseNumbers( const string& s, int n, double *v, bool single = false )
+{
+	const char *p = s.c_str();
+	int count = 0;
+	while( count < n ) {
+		char *end;
+		v[ count++ ] = strtod( p, &end );
+		if( end == p ) {
+			return false;
+		}
+		p = end;
+		if( *p != ',' ) {
+			break;
+		}
+		++p;
+	}
+	if( *p ) {
+		return false;
+	}
+	if( count == 1 && single ) {
+		fill( v + 1, v + n, v[0] );
+		return true;
+	}
+	return count == n;
+}
+
+Animation::Animation()
+	: m_nFrames( 0 ), m_fov( 1 )
+{
+}
+
+bool Animation::movesCamera() const
+{
+	return !m_eye.empty() || !m_at.empty() || !m_up.empty() || !m_fov.empty();
+}
+
+bool Animation::load( const string& filename, string& error )
+{
+	ifstream in( filename.c_str() );
+	if( !in ) {
+		error = "can't read " + filename;
+		return false;
+	}
+
+	int lastKey = -1;
+	int frames = 0;
+	string line;
+	for( int n = 1; getline( in, line ); ++n ) {
+		istringstream words( line );
+		string kind;
+		if( !( words >> kind ) || kind[0] == '#' ) {
+			continue;
+		}
+
+		string lineError;
+		if( kind.compare( 0, 7, "frames=" ) == 0 ) {
+			frames = atoi( kind.c_str() + 7 );
+			if( frames <= 0 ) {
+				lineError = "bad frame count";
+			}
+		} else if( parseKey( line, lineError ) ) {
+			continue;
+		}
+
+		if( !lineError.empty() ) {
+			ostringstream msg;
+			msg << filename << " line " << n << ": " << lineError;
+			error = msg.str();
+			return false;
+		}
+	}
+
+	// with no frames= the sequence runs to the last key
+	const Track *tracks[] = { &m_eye, &m_at, &m_up, &m_fov };
+	for( int t = 0; t < 4; ++t ) {
+		if( !tracks[t]->empty() )
+			lastKey = max( lastKey, (int)tracks[t]->frames.back() );
+	}
+	for( size_t o = 0; o < m_objects.size(); ++o ) {
+		const ObjectKeys& keys = m_objects[o];
+		const Track *objTracks[] = { &keys.translate, &keys.rotate, &keys.scale, &keys.pivot };
+		for( int t = 0; t < 4; ++t ) {
+			if( !objTracks[t]->empty() )
+				lastKey = max( lastKey, (int)objTracks[t]->frames.back() );
+		}
+	}
+
+	m_nFrames = frames > 0 ? frames : lastKey + 1;
+	if( m_nFrames <= 0 ) {
+		error = filename + " has no keys and no frames=";
+		return false;
+	}
+	return true;
+}
+
+// One "camera ..." or "object ..." line.
+bool Animation::parseKey( const string& line, string& error )
+{
+	istringstream words( line );
+	string kind, word;
+	words >> kind;
+	if( kind != "camera" && kind != "object" ) {
+		error = "expected camera, object or frames=, got " + kind;
+		return false;
+	}
+
+	// gather the words first: the frame and name can come anywhere
+	vector< pair<string, string> > keys;
+	double frame = -1.0;
+	string name;
+	while( words >> word ) {
+		size_t eq = word.find( '=' );
+		if( eq == string::npos ) {
+			error = "expected key=value, got " + word;
+			return false;
+		}
+		string key = word.substr( 0, eq );
+		string value = word.substr( eq + 1 );
+		if( key == "frame" ) {
+			char *end;
+			frame = strtod( value.c_str(), &end );
+			if( value.empty() || *end || frame < 0.0 ) {
+				error = "bad frame " + value;
+				return false;
+			}
+		} else if( key == "name" && kind == "object" ) {
+			name = value;
+		} else {
+			keys.push_back( make_pair( key, value ) );
+		}
+	}
+	if( frame < 0.0 ) {
+		error = "a key needs frame=";
+		return false;
+	}
+
+	ObjectKeys *obj = NULL;
+	if( kind == "object" ) {
+		if( name.empty() ) {
+			error = "an object key needs name=";
+			return false;
+		}
+		for( size_t o = 0; o < m_objects.size() && !obj; ++o ) {
+			if( m_objects[o].name == name )
+				obj = &m_objects[o];
+		}
+		if( !obj ) {
+			m_objects.push_back( ObjectKeys() );
+			obj = &m_objects.back();
+			obj->name = name;
+		}
+	}
+
+	for( size_t k = 0; k < keys.size(); ++k ) {
+		const string& key = keys[k].first;
+		const string& value = keys[k].second;
+
+		Track *track = NULL;
+		bool single = false;
+		if( !obj ) {
+			if( key == "eye" ) track = &m_eye;
+			else if( key == "at" ) track = &m_at;
+			else if( key == "up" ) track = &m_up;
+			else if( key == "fov" ) track = &m_fov;
+		} else {
+			if( key == "translate" ) track = &obj->translate;
+			else if( key == "rotate" ) track = &obj->rotate;
+			else if( key == "scale" ) { track = &obj->scale; single = true; }
+			else if( key == "pivot" ) track = &obj->pivot;
+		}
+		if( !track ) {
+			error = "unknown " + kind + " key " + key;
+			return false;
+		}
+
+		double v[4];
+		if( !parseNumbers( value, track->width, v, single )
+			|| ( track == &m_fov && ( v[0] <= 0.0 || v[0] >= 180.0 ) ) ) {
+			error = "bad value for " + key + ": " + value;
+			return false;
+		}
+		track->add( frame, v );
+	}
+	return true;
+}
+
+bool Animation::bind( const Scene *scene, string& error )
+{
+	for( size_t o = 0; o < m_objects.size(); ++o ) {
+		m_objects[o].owner = scene->findObject( m_objects[o].name );
+		if( !m_objects[o].owner ) {
+			error = "the scene has no object named " + m_objects[o].name;
+			return false;
+		}
+	}
+	return true;
+}
+
+void Animation::poseCamera( double frame, Camera *camera ) const
+{
+	if( !m_eye.empty() )
+		camera->setEye( evalVec( m_eye, frame ) );
+
+	if( !m_at.empty() ) {
+		vec3f up = m_up.empty() ? vec3f( 0, 1, 0 ) : evalVec( m_up, frame );
+		vec3f dir = evalVec( m_at, frame ) - camera->getEye();
+
+		// looking straight along up has no orientation: keep the last one
+		if( !dir.iszero() && !dir.cross( up ).iszero() ) {
+			dir = dir.normalize();
+			vec3f right = dir.cross( up ).normalize();
+			camera->setLook( dir, right.cross( dir ) );
+		}
+	}
+
+	if( !m_fov.empty() ) {
+		double fov;
+		m_fov.eval( frame, &fov );
+		camera->setFOV( fov );
+	}
+}
+
+void Animation::poseObjects( double frame, Scene *scene ) const
+{
+	for( size_t o = 0; o < m_objects.size(); ++o ) {
+		const ObjectKeys& keys = m_objects[o];
+		if( !keys.owner )
+			continue;
+
+		vec3f translate( 0, 0, 0 ), scale( 1, 1, 1 ), pivot( 0, 0, 0 );
+		double rotate[4] = { 0, 1, 0, 0 };
+		if( !keys.translate.empty() )
+			translate = evalVec( keys.translate, frame );
+		if( !keys.scale.empty() )
+			scale = evalVec( keys.scale, frame );
+		if( !keys.pivot.empty() )
+			pivot = evalVec( keys.pivot, frame );
+		if( !keys.rotate.empty() )
+			keys.rotate.eval( frame, rotate );
+
+		vec3f axis( rotate[0], rotate[1], rotate[2] );
+		mat4f spin = axis.iszero() ? mat4f() : mat4f::rotate( axis, rotate[3] );
+		scene->setObjectMotion( keys.owner,
+			mat4f::translate( pivot + translate ) * spin * mat4f::scale( scale ) * mat4f::translate( -pivot ) );
+	}
+}
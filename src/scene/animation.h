@@ -0,0 +1,92 @@
+//
+// animation.h
+//
+// Keyframed camera and object motion, for rendering a sequence of frames
+// from one loaded scene.  An animation file is lines of key=value words:
+//
+//   frames=120
+//   camera frame=0 eye=0,2,8 at=0,0,0 fov=40
+//   camera frame=60 eye=8,2,0
+//   object name=teapot frame=0 rotate=0,1,0,0
+//   object name=teapot frame=120 rotate=0,1,0,6.283185
+//
+//   frames        frames 0 to frames-1 (default: up to the last key)
+//   camera        eye, at, up (default 0,1,0) and fov (vertical, degrees)
+//   object        moves the object given that name= in the scene file:
+//                 translate, rotate=axis,angle (radians, as in .ray
+//                 files), scale (one factor or three) and the pivot that
+//                 rotate and scale turn about (default the origin)
+//
+// Every value is a track of its own, linear between the keys that set it
+// and held before the first and after the last, so a key only needs the
+// values that change there.  What no key sets keeps the scene's value.
+// Blank lines and lines starting with '#' are skipped.
+//
+
+#ifndef __ANIMATION_H__
+#define __ANIMATION_H__
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Camera;
+class Geometry;
+class Scene;
+
+// One animated value of width numbers.
+struct Track
+{
+	Track( int w = 3 ) : width( w ) {}
+
+	bool empty() const { return frames.empty(); }
+
+	// Key v (width numbers) at frame, replacing any key already there.
+	void add( double frame, const double *v );
+	void eval( double frame, double *out ) const;
+
+	int width;
+	vector<double> frames;		// ascending
+	vector<double> values;		// width per key
+};
+
+class Animation
+{
+public:
+	Animation();
+
+	// Read filename; on failure error says why (and on which line).
+	bool load( const string& filename, string& error );
+
+	// Look the objects' names up in scene; false if one isn't there.
+	bool bind( const Scene *scene, string& error );
+
+	int numFrames() const { return m_nFrames; }
+	bool movesCamera() const;
+	bool movesObjects() const { return !m_objects.empty(); }
+
+	// Set camera to frame's view.  Values without keys are left alone.
+	void poseCamera( double frame, Camera *camera ) const;
+
+	// Set the bound objects' motion for frame; call Scene::refit after.
+	void poseObjects( double frame, Scene *scene ) const;
+
+private:
+	struct ObjectKeys
+	{
+		ObjectKeys() : owner( NULL ), rotate( 4 ) {}
+
+		string name;
+		const Geometry *owner;
+		Track translate, rotate, scale, pivot;
+	};
+
+	bool parseKey( const string& line, string& error );
+
+	int m_nFrames;
+	Track m_eye, m_at, m_up, m_fov;
+	vector<ObjectKeys> m_objects;
+};
+
+#endif // __ANIMATION_H__
@@ -0,0 +1,71 @@
+#include <cstdint>
+#include <cstdlib>
+
+#include "arena.h"
+
+// Blocks start small, so tiny scenes stay tiny, and double up to a limit.
+static const size_t FIRST_BLOCK_SIZE = 64 * 1024;
+static const size_t MAX_BLOCK_SIZE = 4 * 1024 * 1024;
+
+Arena::Arena()
+	: m_pCur( NULL ), m_pEnd( NULL ),
+	  m_nNextBlockSize( FIRST_BLOCK_SIZE ), m_nBytes( 0 )
+{
+}
+
+// Bytes to skip from p to the next multiple of align.
+static inline size_t padding( const char *p, size_t align )
+{
+	return (size_t)( -(uintptr_t)p ) & ( align - 1 );
+}
+
+void *Arena::allocate( size_t size, size_t align )
+{
+	size_t pad = padding( m_pCur, align );
+	if( m_pCur == NULL || size + pad > (size_t)( m_pEnd - m_pCur ) ) {
+		size_t blockSize = m_nNextBlockSize;
+		if( blockSize < size + align ) {
+			blockSize = size + align;
+		}
+		if( m_nNextBlockSize < MAX_BLOCK_SIZE ) {
+			m_nNextBlockSize *= 2;
+		}
+
+		char *block = (char *)malloc( blockSize );
+		if( block == NULL ) {
+			throw bad_alloc();
+		}
+		m_blocks.push_back( block );
+		m_pCur = block;
+		m_pEnd = block + blockSize;
+		pad = padding( m_pCur, align );
+	}
+
+	void *p = m_pCur + pad;
+	m_pCur += pad + size;
+	m_nBytes += size;
+	return p;
+}
+
+void Arena::addFinalizer( void (*fn)( void * ), void *obj )
+{
+	Finalizer f = { fn, obj };
+	m_finalizers.push_back( f );
+}
+
+void Arena::release()
+{
+	for( size_t i = m_finalizers.size(); i-- > 0; ) {
+		m_finalizers[i].fn( m_finalizers[i].obj );
+	}
+	m_finalizers.clear();
+
+	for( size_t i = 0; i < m_blocks.size(); ++i ) {
+		free( m_blocks[i] );
+	}
+	m_blocks.clear();
+
+	m_pCur = m_pEnd = NULL;
+	m_nNextBlockSize = FIRST_BLOCK_SIZE;
+	m_nBytes = 0;
+}
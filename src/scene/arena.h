@@ -0,0 +1,79 @@
+//
+// arena.h
+//
+// A monotonic allocator: objects are bump-allocated out of large blocks
+// and are never freed one at a time.  Releasing the arena runs whatever
+// destructors still matter and frees the blocks, so tearing down a scene
+// of millions of objects costs a handful of frees.
+//
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Whether release() has to run T's destructor.  A class with a virtual
+// destructor that owns nothing outside the arena can skip it by saying
+// ARENA_TRIVIAL_DESTRUCTOR( T ) after its definition.
+template <class T>
+struct ArenaNeedsDestructor
+{
+	static const bool value = !is_trivially_destructible<T>::value;
+};
+
+#define ARENA_TRIVIAL_DESTRUCTOR( T ) \
+	template <> struct ArenaNeedsDestructor<T> { static const bool value = false; };
+
+class Arena
+{
+public:
+	Arena();
+	~Arena() { release(); }
+
+	// Raw memory; align must be a power of two.
+	void *allocate( size_t size, size_t align );
+
+	template <class T, class... Args>
+	T *create( Args&&... args )
+	{
+		T *obj = new( allocate( sizeof( T ), alignof( T ) ) ) T( std::forward<Args>( args )... );
+		if( ArenaNeedsDestructor<T>::value )
+			addFinalizer( &destroy<T>, obj );
+		return obj;
+	}
+
+	// Destroy everything (newest first) and give the memory back.
+	void release();
+
+	size_t bytesAllocated() const { return m_nBytes; }
+
+private:
+	Arena( const Arena& );
+	Arena& operator=( const Arena& );
+
+	template <class T>
+	static void destroy( void *obj ) { static_cast<T*>( obj )->~T(); }
+
+	void addFinalizer( void (*fn)( void * ), void *obj );
+
+	struct Finalizer
+	{
+		void (*fn)( void * );
+		void *obj;
+	};
+
+	vector<char*> m_blocks;
+	vector<Finalizer> m_finalizers;
+	char *m_pCur;
+	char *m_pEnd;
+	size_t m_nNextBlockSize;
+	size_t m_nBytes;
+};
+
+#endif // __ARENA_H__
@@ -75,6 +75,20 @@ Camera::setFOV( double fov )
     update();
 }
 
+void
+Camera::setLookMatrix( const mat3f& rot )
+{
+    m = rot;
+    update();
+}
+
+void
+Camera::setNormalizedHeight( double h )
+{
+    normalizedHeight = h;
+    update();
+}
+
 void
 Camera::setAspectRatio( double ar )
 // ar - ratio of width to height
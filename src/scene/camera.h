@@ -15,6 +15,13 @@ public:
     void setAspectRatio( double );
 
     double getAspectRatio() { return aspectRatio; }
+
+    // raw state, for saving and restoring a camera exactly
+    const vec3f& getEye() const { return eye; }
+    const mat3f& getLookMatrix() const { return m; }
+    double getNormalizedHeight() const { return normalizedHeight; }
+    void setLookMatrix( const mat3f& rot );
+    void setNormalizedHeight( double h );
 private:
     mat3f m;                     // rotation matrix
     double normalizedHeight;    // dimensions of image place at unit dist from eye
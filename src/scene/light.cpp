@@ -1,8 +1,9 @@
 #include <cmath>
 
 #include "light.h"
+#include "../stats/raystats.h"
 
-double DirectionalLight::distanceAttenuation( const vec3f& P ) const
+double DirectionalLight::distanceAttenuation( const vec3f& P, const LightingOptions& ) const
 {
 	// distance to light is infinite, so f(di) goes to 0.  Return 1.
 	return 1.0;
@@ -17,16 +18,20 @@ vec3f DirectionalLight::shadowAttenuation( const vec3f& P ) const
 	vec3f direction = getDirection(P);
 	vec3f currentP = P;
 	isect isectP;
+	Material scratch;
 	vec3f color = getColor(P);
 	ray r = ray(currentP, direction);
+	RAY_STAT( STAT_SHADOW_RAYS );
 	while (scene->intersect(r, isectP))
 	{
-		if (isectP.getMaterial().kt.iszero()) {
+		const vec3f& kt = isectP.getMaterial(scratch).kt;
+		if (kt.iszero()) {
 			return vec3f(0, 0, 0);
 		}
 		currentP = r.at(isectP.t);
 		r = ray(currentP, direction);
-		color = prod(color, isectP.getMaterial().kt);
+		RAY_STAT( STAT_SHADOW_RAYS );
+		color = prod(color, kt);
 	}
 
 	return color;
@@ -45,7 +50,7 @@ vec3f DirectionalLight::getDirection( const vec3f& P ) const
 	return -orientation;
 }
 
-double PointLight::distanceAttenuation( const vec3f& P ) const
+double PointLight::distanceAttenuation( const vec3f& P, const LightingOptions& lighting ) const
 {
 	// YOUR CODE HERE
 
@@ -53,9 +58,9 @@ double PointLight::distanceAttenuation( const vec3f& P ) const
 	// of the light based on the distance between the source and the 
 	// point P.  For now, I assume no attenuation and just return 1.0
 
-	double constantAttenuationCoefficient = (scene->isCustomDistanceAttenuation() ? scene->getConstantAttenuationCoefficient() : m_nConstantAttenuationCoefficient);
-	double linearAttenuationCoefficient = (scene->isCustomDistanceAttenuation() ? scene->getLinearAttenuationCoefficient() : m_nLinearAttenuationCoefficient);
-	double quadraticAttenuationCoefficient = (scene->isCustomDistanceAttenuation() ? scene->getQuadraticAttenuationCoefficient() : m_nQuadraticAttenuationCoefficient);
+	double constantAttenuationCoefficient = (lighting.customAttenuation ? lighting.constantAttenuation : m_nConstantAttenuationCoefficient);
+	double linearAttenuationCoefficient = (lighting.customAttenuation ? lighting.linearAttenuation : m_nLinearAttenuationCoefficient);
+	double quadraticAttenuationCoefficient = (lighting.customAttenuation ? lighting.quadraticAttenuation : m_nQuadraticAttenuationCoefficient);
 
 	double result = constantAttenuationCoefficient + linearAttenuationCoefficient * sqrt((P - position).length_squared()) + quadraticAttenuationCoefficient * (P - position).length_squared();
 	return 1.0 / max<double>(result, 1.0);
@@ -84,19 +89,23 @@ vec3f PointLight::shadowAttenuation(const vec3f& P) const
 	double distance = (position - P).length();
 	vec3f currentP = P;
 	isect isectP;
+	Material scratch;
 	vec3f color = getColor(P);
 	ray r = ray(currentP, direction);
+	RAY_STAT( STAT_SHADOW_RAYS );
 	while (scene->intersect(r, isectP))
 	{
 		if ((distance -= isectP.t) < RAY_EPSILON) {
 			return color;
 		}
-		if (isectP.getMaterial().kt.iszero()) {
+		const vec3f& kt = isectP.getMaterial(scratch).kt;
+		if (kt.iszero()) {
 			return vec3f(0, 0, 0);
 		}
 		currentP = r.at(isectP.t);
 		r = ray(currentP, direction);
-		color = prod(color, isectP.getMaterial().kt);
+		RAY_STAT( STAT_SHADOW_RAYS );
+		color = prod(color, kt);
 	}
 
 	return color;
@@ -113,7 +122,7 @@ void PointLight::setAttenuationCoefficients(const double m_nConstantAttenuationC
 	m_nQuadraticAttenuationCoefficient = m_nQuadraticAttenuationCoeff;
 }
 
-double AmbientLight::distanceAttenuation(const vec3f& P) const
+double AmbientLight::distanceAttenuation(const vec3f& P, const LightingOptions&) const
 {
 	return 1.0;
 }
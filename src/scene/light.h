@@ -3,12 +3,27 @@
 
 #include "scene.h"
 
+// Lighting settings that belong to a tracer rather than to the scene, so
+// that tracers sharing one scene can each light it their own way.
+struct LightingOptions
+{
+	LightingOptions()
+		: ambient( 0.0, 0.0, 0.0 ), customAttenuation( false ),
+		  constantAttenuation( 0.0 ), linearAttenuation( 0.0 ), quadraticAttenuation( 0.0 ),
+		  clampLights( true ) {}
+
+	vec3f ambient;
+	bool customAttenuation;		// the coefficients below in place of each point light's
+	double constantAttenuation, linearAttenuation, quadraticAttenuation;
+	bool clampLights;			// each light's term to [0,1]; off for HDR output
+};
+
 class Light
 	: public SceneElement
 {
 public:
 	virtual vec3f shadowAttenuation(const vec3f& P) const = 0;
-	virtual double distanceAttenuation( const vec3f& P ) const = 0;
+	virtual double distanceAttenuation( const vec3f& P, const LightingOptions& lighting ) const = 0;
 	virtual vec3f getColor( const vec3f& P ) const = 0;
 	virtual vec3f getDirection( const vec3f& P ) const = 0;
 
@@ -26,10 +41,12 @@ public:
 	DirectionalLight( Scene *scene, const vec3f& orien, const vec3f& color )
 		: Light( scene, color ), orientation( orien ) {}
 	virtual vec3f shadowAttenuation(const vec3f& P) const;
-	virtual double distanceAttenuation( const vec3f& P ) const;
+	virtual double distanceAttenuation( const vec3f& P, const LightingOptions& lighting ) const;
 	virtual vec3f getColor( const vec3f& P ) const;
 	virtual vec3f getDirection( const vec3f& P ) const;
 
+	const vec3f& getOrientation() const { return orientation; }
+
 protected:
 	vec3f 		orientation;
 };
@@ -44,13 +61,21 @@ public:
 		m_nLinearAttenuationCoefficient(0.0), 
 		m_nQuadraticAttenuationCoefficient(0.0) {}
 	virtual vec3f shadowAttenuation(const vec3f& P) const;
-	virtual double distanceAttenuation( const vec3f& P ) const;
+	virtual double distanceAttenuation( const vec3f& P, const LightingOptions& lighting ) const;
 	virtual vec3f getColor( const vec3f& P ) const;
 	virtual vec3f getDirection( const vec3f& P ) const;
 	void setAttenuationCoefficients(const double m_nConstantAttenuationCoeff,
 		const double m_nLinearAttenuationCoeff,
 		const double m_nQuadraticAttenuationCoeff);
 
+	const vec3f& getPosition() const { return position; }
+	void getAttenuationCoefficients(double& constant, double& linear, double& quadratic) const
+	{
+		constant = m_nConstantAttenuationCoefficient;
+		linear = m_nLinearAttenuationCoefficient;
+		quadratic = m_nQuadraticAttenuationCoefficient;
+	}
+
 protected:
 	vec3f position;
 	double m_nConstantAttenuationCoefficient, m_nLinearAttenuationCoefficient, m_nQuadraticAttenuationCoefficient;
@@ -63,7 +88,7 @@ public:
 	AmbientLight(Scene *scene, const vec3f& color)
 		: Light(scene, color), color(color){}
 	virtual vec3f shadowAttenuation(const vec3f& P) const;
-	virtual double distanceAttenuation(const vec3f& P) const;
+	virtual double distanceAttenuation(const vec3f& P, const LightingOptions& lighting) const;
 	virtual vec3f getColor(const vec3f& P) const;
 	virtual vec3f getDirection(const vec3f& P) const;
 
@@ -71,4 +96,8 @@ protected:
 	vec3f color;
 };
 
+ARENA_TRIVIAL_DESTRUCTOR( DirectionalLight )
+ARENA_TRIVIAL_DESTRUCTOR( PointLight )
+ARENA_TRIVIAL_DESTRUCTOR( AmbientLight )
+
 #endif // __LIGHT_H__
@@ -4,7 +4,7 @@
 
 // Apply the phong model to this point on the surface of the object, returning
 // the color of that point.
-vec3f Material::shade( Scene *scene, const ray& r, const isect& i ) const
+vec3f Material::shade( Scene *scene, const ray& r, const isect& i, const LightingOptions& lighting ) const
 {
 	// YOUR CODE HERE
 
@@ -19,14 +19,14 @@ vec3f Material::shade( Scene *scene, const ray& r, const isect& i ) const
     // somewhere in your code in order to compute shadows and light falloff.
 	vec3f color = vec3f( 0.0, 0.0, 0.0);
 	color += ke;
-	color += prod(ka, scene->getAmbientLight());
+	color += prod(ka, lighting.ambient);
 	
 	vec3f point = r.at(i.t);
 	vec3f zeroVector = vec3f(0.0,0.0,0.0);
 
 	list<Light*>::const_iterator it;
 	for (it = scene->beginLights(); it != scene->endLights(); it++){
-		vec3f attenuation = (*it)->distanceAttenuation(point) * (*it)->shadowAttenuation(point + i.N*RAY_EPSILON);
+		vec3f attenuation = (*it)->distanceAttenuation(point, lighting) * (*it)->shadowAttenuation(point + i.N*RAY_EPSILON);
 
 		vec3f incidentLight = ((*it)->getDirection( point)).normalize();
 		vec3f reflectLight = -(incidentLight + 2 * -incidentLight.dot(i.N) * i.N.normalize()).normalize();
@@ -36,7 +36,8 @@ vec3f Material::shade( Scene *scene, const ray& r, const isect& i ) const
 		vec3f diffuseIndex = kd * max( i.N.normalize().dot( incidentLight), 0.0);
 		vec3f specularIndex = ks * pow( max( -r.getDirection().dot( reflectLight), 0.0) , shininess*128);
 
-		color += prod( prod( lightColor, attenuation), diffuseIndex + specularIndex).clamp();
+		vec3f lit = prod( prod( lightColor, attenuation), diffuseIndex + specularIndex);
+		color += lighting.clampLights ? lit.clamp() : lit;
 	}
 
 	return color;
@@ -12,6 +12,10 @@
 class Scene;
 class ray;
 class isect;
+struct LightingOptions;
+
+// A material's index in its scene's material table (see Scene::addMaterial).
+typedef unsigned int MaterialID;
 
 class Material
 {
@@ -30,7 +34,7 @@ public:
               const vec3f& d, const vec3f& r, const vec3f& t, double sh, double in)
         : ke( e ), ka( a ), ks( s ), kd( d ), kr( r ), kt( t ), shininess( sh ), index( in ) {}
 
-	virtual vec3f shade( Scene *scene, const ray& r, const isect& i ) const;
+	virtual vec3f shade( Scene *scene, const ray& r, const isect& i, const LightingOptions& lighting ) const;
 
     vec3f ke;                    // emissive
     vec3f ka;                    // ambient
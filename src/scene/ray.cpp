@@ -2,8 +2,8 @@
 #include "material.h"
 #include "scene.h"
 
-const Material &
-isect::getMaterial() const
+const Material&
+isect::getMaterial( Material& scratch ) const
 {
-    return material ? *material : obj->getMaterial();
+    return obj->getMaterialAt( *this, scratch );
 }
@@ -43,51 +43,25 @@ class isect
 {
 public:
     isect()
-        : obj( NULL ), t( 0.0 ), N(), material(0) {}
+        : obj( NULL ), t( 0.0 ), N(), bary(), material( 0 ) {}
 
-    ~isect()
-    {
-        delete material;
-    }
-    
     void setObject( SceneObject *o ) { obj = o; }
     void setT( double tt ) { t = tt; }
     void setN( const vec3f& n ) { N = n; }
-    void setMaterial( Material *m ) { delete material; material = m; }
-        
-    isect& operator =( const isect& other )
-    {
-        if( this != &other )
-        {
-            obj = other.obj;
-            t = other.t;
-            N = other.N;
-//            material = other.material ? new Material( *(other.material) ) : 0;
-			if( other.material )
-            {
-                if( material )
-                    *material = *other.material;
-                else
-                    material = new Material(*other.material );
-            }
-            else
-            {
-                material = 0;
-            }
-        }
-        return *this;
-    }
+    void setMaterial( MaterialID m ) { material = m; }
 
 public:
     const SceneObject 	*obj;
     double t;
     vec3f N;
-    Material *material;         // if this intersection has its own material
-                                // (as opposed to one in its associated object)
-                                // as in the case where the material was interpolated
-
-    const Material &getMaterial() const;
-    // Other info here.
+    vec3f bary;                 // barycentric coordinates on a triangle, kept
+                                // for Geometry::finishIntersection
+    MaterialID material;        // the hit object's material
+
+    // The material to shade with: the scene's entry, or for a material
+    // interpolated across a mesh, one worked out into scratch.  Only hits
+    // that get shaded pay for the interpolation.
+    const Material& getMaterial( Material& scratch ) const;
 };
 
 const double RAY_EPSILON = 0.00001;
@@ -2,8 +2,10 @@
 
 #include "scene.h"
 #include "light.h"
-#include "../ui/TraceUI.h"
-extern TraceUI* traceUI;
+#include "../fileio/mappedfile.h"
+#include "../stats/objectstats.h"
+#include "../stats/raystats.h"
+#include "../stats/timeline.h"
 
 void BoundingBox::operator=(const BoundingBox& target)
 {
@@ -32,6 +34,8 @@ bool BoundingBox::intersects(const vec3f& point) const
 // Using Kay/Kajiya algorithm.
 bool BoundingBox::intersect(const ray& r, double& tMin, double& tMax) const
 {
+	RAY_STAT( STAT_BBOX_TESTS );
+
 	vec3f R0 = r.getPosition();
 	vec3f Rd = r.getDirection();
 
@@ -74,11 +78,29 @@ bool BoundingBox::intersect(const ray& r, double& tMin, double& tMax) const
 }
 
 
+void AffineTransform::set( const mat4f& xform )
+{
+	mat4f inverse = xform.inverse();
+	mat3f normi = xform.upper33().inverse().transpose();
+
+	for( int r = 0; r < 3; ++r ) {
+		for( int c = 0; c < 4; ++c ) {
+			toGlobal[r][c] = xform[r][c];
+			toLocal[r][c] = inverse[r][c];
+		}
+		for( int c = 0; c < 3; ++c ) {
+			normal[r][c] = normi[r][c];
+		}
+	}
+}
+
 bool Geometry::intersect(const ray&r, isect&i) const
 {
+    const AffineTransform& xf = getWorldTransform();
+
     // Transform the ray into the object's local coordinate space
-    vec3f pos = transform->globalToLocalCoords(r.getPosition());
-    vec3f dir = transform->globalToLocalCoords(r.getPosition() + r.getDirection()) - pos;
+    vec3f pos = xf.globalToLocalCoords(r.getPosition());
+    vec3f dir = xf.globalToLocalDirection(r.getDirection());
     double length = dir.length();
     dir /= length;
 
@@ -86,7 +108,7 @@ bool Geometry::intersect(const ray&r, isect&i) const
 
     if (intersectLocal(localRay, i)) {
         // Transform the intersection point & normal returned back into global space.
-		i.N = transform->localToGlobalCoordsNormal(i.N);
+		i.N = xf.localToGlobalCoordsNormal(i.N);
 		i.t /= length;
 
 		return true;
@@ -117,41 +139,69 @@ bool Geometry::hasBoundingBoxCapability() const
 
 Scene::~Scene()
 {
-    giter g;
-    liter l;
-    
-	for( g = objects.begin(); g != objects.end(); ++g ) {
-		delete (*g);
-	}
+	// the objects, lights, transforms and materials all go with the arena
+	arena.release();
 
-	for( g = boundedobjects.begin(); g != boundedobjects.end(); ++g ) {
-		delete (*g);
+	for( list<MappedFile*>::iterator m = mappings.begin(); m != mappings.end(); ++m ) {
+		delete (*m);
 	}
+}
 
-	for( g = nonboundedobjects.begin(); g != boundedobjects.end(); ++g ) {
-		delete (*g);
+MaterialID Scene::addMaterial( const Material& m )
+{
+	const vec3f *c[6] = { &m.ke, &m.ka, &m.ks, &m.kd, &m.kr, &m.kt };
+	vector<double> key;
+	key.reserve( 20 );
+	for( int i = 0; i < 6; ++i ) {
+		for( int k = 0; k < 3; ++k ) {
+			key.push_back( (*c[i])[k] );
+		}
 	}
+	key.push_back( m.shininess );
+	key.push_back( m.index );
 
-	for( l = lights.begin(); l != lights.end(); ++l ) {
-		delete (*l);
+	map< vector<double>, MaterialID >::const_iterator found = materialIndex.find( key );
+	if( found != materialIndex.end() ) {
+		return found->second;
 	}
+
+	MaterialID id = materials.size();
+	materials.push_back( arena.create<Material>( m ) );
+	materialIndex[ key ] = id;
+	return id;
+}
+
+const Material& MaterialSceneObject::getMaterial() const
+{
+	return scene->getMaterial( material );
+}
+
+const Material& SceneObject::getMaterialAt( const isect& i, Material& ) const
+{
+	return scene->getMaterial( i.material );
 }
 
 // Get any intersection with an object.  Return information about the 
 // intersection through the reference parameter.
 bool Scene::intersect( const ray& r, isect& i ) const
 {
-	typedef list<Geometry*>::const_iterator iter;
+	typedef cgiter iter;
 	iter j;
 
 	isect cur;
 	bool have_one = false;
 
+	ObjectCost *costs = objectStatsEnabled() ? threadObjectCosts( owners.size() ) : NULL;
+
 	// try the non-bounded objects
 	for( j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j ) {
+		if( costs ) {
+			++costs[ (*j)->getOwnerIndex() ].tests;
+		}
 		if( (*j)->intersect( r, cur ) ) {
 			if( !have_one || (cur.t < i.t) ) {
 				i = cur;
+				RAY_STAT( STAT_ISECT_COPIES );
 				have_one = true;
 			}
 		}
@@ -159,24 +209,77 @@ bool Scene::intersect( const ray& r, isect& i ) const
 
 	// try the bounded objects
 	for( j = boundedobjects.begin(); j != boundedobjects.end(); ++j ) {
+		if( costs ) {
+			++costs[ (*j)->getOwnerIndex() ].tests;
+		}
 		if( (*j)->intersect( r, cur ) ) {
 			if( !have_one || (cur.t < i.t) ) {
 				i = cur;
+				RAY_STAT( STAT_ISECT_COPIES );
 				have_one = true;
 			}
 		}
 	}
 
+	if( have_one ) {
+		RAY_STAT( STAT_HITS );
+		if( costs ) {
+			++costs[ i.obj->getOwnerIndex() ].hits;
+		}
+		i.material = i.obj->getMaterialID();
+		i.obj->finishIntersection( i );
+	}
 
 	return have_one;
 }
 
 void Scene::initScene()
 {
+	ScopedTimer timer( "initScene" );
+
 	bool first_boundedobject = true;
 	BoundingBox b;
 	
-	typedef list<Geometry*>::const_iterator iter;
+	typedef cgiter iter;
+
+	// Flatten the transform tree: objects with the same world matrix
+	// share one entry, whatever nodes they hung from.
+	worldTransforms.clear();
+	map< vector<double>, unsigned int > transformIndex;
+	for( iter j = objects.begin(); j != objects.end(); ++j ) {
+		const mat4f& xform = (*j)->getTransform()->getXform();
+		vector<double> key;
+		key.reserve( 12 );
+		for( int r = 0; r < 3; ++r ) {
+			for( int c = 0; c < 4; ++c ) {
+				key.push_back( xform[r][c] );
+			}
+		}
+
+		map< vector<double>, unsigned int >::iterator found = transformIndex.find( key );
+		if( found == transformIndex.end() ) {
+			AffineTransform flat;
+			flat.set( xform );
+			found = transformIndex.insert( make_pair( key, (unsigned int)worldTransforms.size() ) ).first;
+			worldTransforms.push_back( flat );
+		}
+		(*j)->setTransformIndex( found->second );
+	}
+	staticTransforms = worldTransforms.size();
+
+	// Number the top-level objects in the order they were added, then
+	// point every part (a mesh's triangles, say) at its owner's number.
+	owners.clear();
+	for( iter j = objects.begin(); j != objects.end(); ++j ) {
+		if( (*j)->getOwner() == *j ) {
+			(*j)->setOwnerIndex( owners.size() );
+			owners.push_back( *j );
+		}
+	}
+	for( iter j = objects.begin(); j != objects.end(); ++j ) {
+		(*j)->setOwnerIndex( (*j)->getOwner()->getOwnerIndex() );
+	}
+
 	// split the objects into two categories: bounded and non-bounded
 	for( iter j = objects.begin(); j != objects.end(); ++j ) {
 		if( (*j)->hasBoundingBoxCapability() )
@@ -200,60 +303,56 @@ void Scene::initScene()
 	}
 }
 
-void Scene::setAmbientLight(vec3f& v)
+void Scene::refit()
 {
-	ambientLight = v;
-}
+	ScopedTimer timer( "refit" );
+
+	// Moved objects get transforms of their own after initScene's, one per
+	// owner and transform node: a mesh's triangles all share one.  The rest
+	// keep the entries initScene gave them.
+	worldTransforms.resize( staticTransforms );
+	map< pair<const Geometry*, const TransformNode*>, unsigned int > moved;
+	for( cgiter j = objects.begin(); j != objects.end(); ++j ) {
+		map< const Geometry*, mat4f >::const_iterator motion = motions.find( (*j)->getOwner() );
+		if( motion == motions.end() )
+			continue;
 
-vec3f Scene::getAmbientLight() const
-{
-	return ambientLight;
-}
+		const TransformNode *node = (*j)->getTransform();
+		mat4f xform = motion->second * node->getXform();
+		pair<const Geometry*, const TransformNode*> key( motion->first, node );
+		map< pair<const Geometry*, const TransformNode*>, unsigned int >::iterator found = moved.find( key );
+		if( found == moved.end() ) {
+			AffineTransform flat;
+			flat.set( xform );
+			found = moved.insert( make_pair( key, (unsigned int)worldTransforms.size() ) ).first;
+			worldTransforms.push_back( flat );
+		}
+		(*j)->setTransformIndex( found->second );
+		(*j)->ComputeBoundingBox( xform );
+	}
 
-void Scene::setAmbientLightRed(double d)
-{
-	ambientLight[0] = d;
-}
-void Scene::setAmbientLightGreen(double d)
-{
-	ambientLight[1] = d;
-}
-void Scene::setAmbientLightBlue(double d)
-{
-	ambientLight[2] = d;
+	for( cgiter j = boundedobjects.begin(); j != boundedobjects.end(); ++j ) {
+		const BoundingBox& b = (*j)->getBoundingBox();
+		if( j == boundedobjects.begin() ) {
+			sceneBounds = b;
+		} else {
+			sceneBounds.max = maximum( sceneBounds.max, b.max );
+			sceneBounds.min = minimum( sceneBounds.min, b.min );
+		}
+	}
 }
 
-void Scene::setConstantAttenuationCoefficient(double d)
-{
-	m_nConstantAttenuationCoefficient = d;
-}
-void Scene::setLinearAttenuationCoefficient(double d)
-{
-	m_nLinearAttenuationCoefficient = d;
-}
-void Scene::setQuadraticAttenuationCoefficient(double d)
-{
-	m_nQuadraticAttenuationCoefficient = d;
-}
-void Scene::setCustomDistanceAttenuation(bool b)
-{
-	m_bIsCustomDistanceAttenuation = b;
-}
-bool Scene::isCustomDistanceAttenuation()
-{
-	return m_bIsCustomDistanceAttenuation;
-}
-double Scene::getConstantAttenuationCoefficient()
+const Geometry *Scene::findObject( const string& name ) const
 {
-	return m_nConstantAttenuationCoefficient;
+	for( map< const Geometry*, string >::const_iterator n = objectNames.begin(); n != objectNames.end(); ++n ) {
+		if( n->second == name )
+			return n->first;
+	}
+	return NULL;
 }
 
-double Scene::getLinearAttenuationCoefficient()
+string Scene::getObjectName( const Geometry *obj ) const
 {
-	return m_nLinearAttenuationCoefficient;
+	map< const Geometry*, string >::const_iterator found = objectNames.find( obj );
+	return found != objectNames.end() ? found->second : string();
 }
-
-double Scene::getQuadraticAttenuationCoefficient()
-{
-	return m_nQuadraticAttenuationCoefficient;
-}
\ No newline at end of file
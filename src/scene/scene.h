@@ -8,10 +8,14 @@
 #define __SCENE_H__
 
 #include <list>
+#include <map>
+#include <vector>
 #include <algorithm>
+#include <string>
 
 using namespace std;
 
+#include "arena.h"
 #include "ray.h"
 #include "material.h"
 #include "camera.h"
@@ -19,6 +23,7 @@ using namespace std;
 
 class Light;
 class Scene;
+class MappedFile;
 
 class SceneElement
 {
@@ -58,38 +63,22 @@ class TransformNode
 {
 protected:
 
-    // information about this node's transformation
+    // information about this node's transformation; the inverses are
+    // only worked out for the flattened copies (see AffineTransform)
     mat4f    xform;
-	mat4f    inverse;
-	mat3f    normi;
 
-    // information about parent & children
+    // information about parent; children live in the scene's arena
     TransformNode *parent;
-    list<TransformNode*> children;
+    Arena *arena;
     
 public:
-   	typedef list<TransformNode*>::iterator          child_iter;
-	typedef list<TransformNode*>::const_iterator    child_citer;
-
-    ~TransformNode()
-    {
-        for(child_iter c = children.begin(); c != children.end(); ++c )
-            delete (*c);
-    }
-
     TransformNode *createChild(const mat4f& xform)
     {
-        TransformNode *child = new TransformNode(this, xform);
-        children.push_back(child);
-        return child;
+        void *mem = arena->allocate( sizeof( TransformNode ), alignof( TransformNode ) );
+        return new( mem ) TransformNode(this, xform);
     }
     
     // Coordinate-Space transformation
-    vec3f globalToLocalCoords(const vec3f &v)
-    {
-        return inverse * v;
-    }
-
     vec3f localToGlobalCoords(const vec3f &v)
     {
         return xform * v;
@@ -100,34 +89,76 @@ public:
         return xform * v;
     }
 
-    vec3f localToGlobalCoordsNormal(const vec3f &v)
-    {
-        return (normi * v).normalize();
-    }
+    // the accumulated local-to-world matrix
+    const mat4f& getXform() const { return xform; }
 
 protected:
     // protected so that users can't directly construct one of these...
     // force them to use the createChild() method.  Note that they CAN
     // directly create a TransformRoot object.
-    TransformNode(TransformNode *parent, const mat4f& xform )
-        : children()
+    TransformNode(TransformNode *parent, const mat4f& xform, Arena *arena = NULL )
     {
         this->parent = parent;
+        this->arena = parent ? parent->arena : arena;
         if (parent == NULL)
             this->xform = xform;
         else
             this->xform = parent->xform * xform;
-        
-        inverse = this->xform.inverse();
-        normi = this->xform.upper33().inverse().transpose();
     }
 };
 
 class TransformRoot : public TransformNode
 {
 public:
-    TransformRoot()
-        : TransformNode(NULL, mat4f()) {}
+    TransformRoot( Arena *arena )
+        : TransformNode(NULL, mat4f(), arena) {}
+};
+
+// A world transform flattened for intersection testing: local-to-world
+// and world-to-local as 3x4 affine matrices, and the matrix that takes
+// normals to world space.  Scene::initScene keeps one of these per
+// distinct world matrix, in one array, and geometry refers to its entry
+// by index.
+struct AffineTransform
+{
+	double toGlobal[3][4];
+	double toLocal[3][4];
+	double normal[3][3];
+
+	void set( const mat4f& xform );
+
+	vec3f globalToLocalCoords( const vec3f& v ) const
+	{
+		return vec3f(
+			v[0] * toLocal[0][0] + v[1] * toLocal[0][1] + v[2] * toLocal[0][2] + toLocal[0][3],
+			v[0] * toLocal[1][0] + v[1] * toLocal[1][1] + v[2] * toLocal[1][2] + toLocal[1][3],
+			v[0] * toLocal[2][0] + v[1] * toLocal[2][1] + v[2] * toLocal[2][2] + toLocal[2][3] );
+	}
+
+	// directions ignore the translation
+	vec3f globalToLocalDirection( const vec3f& v ) const
+	{
+		return vec3f(
+			v[0] * toLocal[0][0] + v[1] * toLocal[0][1] + v[2] * toLocal[0][2],
+			v[0] * toLocal[1][0] + v[1] * toLocal[1][1] + v[2] * toLocal[1][2],
+			v[0] * toLocal[2][0] + v[1] * toLocal[2][1] + v[2] * toLocal[2][2] );
+	}
+
+	vec3f localToGlobalCoords( const vec3f& v ) const
+	{
+		return vec3f(
+			v[0] * toGlobal[0][0] + v[1] * toGlobal[0][1] + v[2] * toGlobal[0][2] + toGlobal[0][3],
+			v[0] * toGlobal[1][0] + v[1] * toGlobal[1][1] + v[2] * toGlobal[1][2] + toGlobal[1][3],
+			v[0] * toGlobal[2][0] + v[1] * toGlobal[2][1] + v[2] * toGlobal[2][2] + toGlobal[2][3] );
+	}
+
+	vec3f localToGlobalCoordsNormal( const vec3f& v ) const
+	{
+		return vec3f(
+			normal[0][0] * v[0] + normal[0][1] * v[1] + normal[0][2] * v[2],
+			normal[1][0] * v[0] + normal[1][1] * v[1] + normal[1][2] * v[2],
+			normal[2][0] * v[0] + normal[2][1] * v[1] + normal[2][2] * v[2] ).normalize();
+	}
 };
 
 // A Geometry object is anything that has extent in three dimensions.
@@ -144,10 +175,23 @@ public:
     // do not call directly - this should only be called by intersect()
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 
+    // Called by Scene::intersect for the closest hit only, to do the work
+    // that would be wasted on hits further along the ray (e.g. interpolating
+    // a mesh's vertex normals and materials).
+    virtual void finishIntersection( isect& ) const {}
+
+    // The top-level scene object this is part of, for cost reports: itself,
+    // or the mesh a triangle belongs to.  Primitives are counted per owner.
+    virtual const Geometry *getOwner() const { return this; }
+    virtual int getPrimitiveCount() const { return 1; }
+    virtual const char *getTypeName() const { return "geometry"; }
 
 	virtual bool hasBoundingBoxCapability() const;
 	const BoundingBox& getBoundingBox() const { return bounds; }
-	virtual void ComputeBoundingBox()
+	virtual void ComputeBoundingBox() { ComputeBoundingBox( transform->getXform() ); }
+
+    // the same, as if xform were the object's local-to-world matrix
+    void ComputeBoundingBox( const mat4f& xform )
     {
         // take the object's local bounding box, transform all 8 points on it,
         // and use those to find a new bounding box.
@@ -159,28 +203,28 @@ public:
 
 		vec4f v, newMax, newMin;
 
-		v = transform->localToGlobalCoords( vec4f(min[0], min[1], min[2], 1) );
+		v = xform * vec4f(min[0], min[1], min[2], 1);
 		newMax = v;
 		newMin = v;
-		v = transform->localToGlobalCoords( vec4f(max[0], min[1], min[2], 1) );
+		v = xform * vec4f(max[0], min[1], min[2], 1);
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( vec4f(min[0], max[1], min[2], 1) );
+		v = xform * vec4f(min[0], max[1], min[2], 1);
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( vec4f(max[0], max[1], min[2], 1) );
+		v = xform * vec4f(max[0], max[1], min[2], 1);
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( vec4f(min[0], min[1], max[2], 1) );
+		v = xform * vec4f(min[0], min[1], max[2], 1);
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( vec4f(max[0], min[1], max[2], 1) );
+		v = xform * vec4f(max[0], min[1], max[2], 1);
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( vec4f(min[0], max[1], max[2], 1) );
+		v = xform * vec4f(min[0], max[1], max[2], 1);
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
-		v = transform->localToGlobalCoords( vec4f(max[0], max[1], max[2], 1) );
+		v = xform * vec4f(max[0], max[1], max[2], 1);
 		newMax = maximum(newMax, v);
 		newMin = minimum(newMin, v);
 		
@@ -193,13 +237,24 @@ public:
     virtual BoundingBox ComputeLocalBoundingBox() { return BoundingBox(); }
 
     void setTransform(TransformNode *transform) { this->transform = transform; };
+    TransformNode *getTransform() const { return transform; }
+
+    // this object's entry in the scene's flattened transforms
+    void setTransformIndex( unsigned int index ) { transformIndex = index; }
+    const AffineTransform& getWorldTransform() const;
+
+    // the owner's position among the scene's top-level objects
+    void setOwnerIndex( unsigned int index ) { ownerIndex = index; }
+    unsigned int getOwnerIndex() const { return ownerIndex; }
     
 	Geometry( Scene *scene ) 
-		: SceneElement( scene ) {}
+		: SceneElement( scene ), transformIndex( 0 ), ownerIndex( 0 ) {}
 
 protected:
 	BoundingBox bounds;
     TransformNode *transform;
+    unsigned int transformIndex;
+    unsigned int ownerIndex;
 };
 
 // A SceneObject is a real actual thing that we want to model in the 
@@ -211,31 +266,34 @@ class SceneObject
 {
 public:
 	virtual const Material& getMaterial() const = 0;
-	virtual void setMaterial( Material *m ) = 0;
+	virtual MaterialID getMaterialID() const = 0;
+	virtual void setMaterial( MaterialID m ) = 0;
+
+	// The material at an intersection with this object: by default the
+	// scene's entry for i.material.  An object whose material varies
+	// across it works it out into scratch and returns that.
+	virtual const Material& getMaterialAt( const isect& i, Material& scratch ) const;
 
 protected:
 	SceneObject( Scene *scene )
 		: Geometry( scene ) {}
 };
 
-// A simple extension of SceneObject that adds an instance of Material
-// for simple material bindings.
+// A simple extension of SceneObject that refers to one material in the
+// scene's table for simple material bindings.
 class MaterialSceneObject
 	: public SceneObject
 {
 public:
-	virtual ~MaterialSceneObject() { if( material ) delete material; }
-
-	virtual const Material& getMaterial() const { return *material; }
-	virtual void setMaterial( Material *m )	{ material = m; }
+	virtual const Material& getMaterial() const;
+	virtual MaterialID getMaterialID() const { return material; }
+	virtual void setMaterial( MaterialID m )	{ material = m; }
 
 protected:
-	MaterialSceneObject( Scene *scene, Material *mat ) 
+	MaterialSceneObject( Scene *scene, MaterialID mat ) 
 		: SceneObject( scene ), material( mat ) {}
-    //	MaterialSceneObject( Scene *scene ) 
-	//	: SceneObject( scene ), material( new Material ) {}
 
-	Material *material;
+	MaterialID material;
 };
 
 class Scene
@@ -244,16 +302,25 @@ public:
 	typedef list<Light*>::iterator 			liter;
 	typedef list<Light*>::const_iterator 	cliter;
 
-	typedef list<Geometry*>::iterator 		giter;
-	typedef list<Geometry*>::const_iterator cgiter;
+	typedef vector<Geometry*>::iterator 		giter;
+	typedef vector<Geometry*>::const_iterator cgiter;
 
+private:
+	Arena arena;		// first, so it outlives everything in it
+
+public:
     TransformRoot transformRoot;
 
 public:
 	Scene() 
-		: transformRoot(), objects(), lights() {}
+		: transformRoot( &arena ), objects(), lights(), staticTransforms( 0 ) {}
 	virtual ~Scene();
 
+	// Objects, lights and transforms belong to the scene's arena: make
+	// them with create() and they are freed, all at once, with the scene.
+	template <class T, class... Args>
+	T *create( Args&&... args ) { return arena.create<T>( std::forward<Args>( args )... ); }
+
 	void add( Geometry* obj )
 	{
 		obj->ComputeBoundingBox();
@@ -267,34 +334,58 @@ public:
 
 	list<Light*>::const_iterator beginLights() const { return lights.begin(); }
 	list<Light*>::const_iterator endLights() const { return lights.end(); }
+
+	cgiter beginObjects() const { return objects.begin(); }
+	cgiter endObjects() const { return objects.end(); }
+
+	// Keep a mapped file alive for as long as the scene; objects loaded
+	// from a .rayb file point straight into it.
+	void addMapping( MappedFile *file ) { mappings.push_back( file ); }
+
+	// Materials are interned: equal materials share one entry in the
+	// scene's table, and objects and intersections refer to it by ID.
+	MaterialID addMaterial( const Material& m );
+	const Material& getMaterial( MaterialID id ) const { return *materials[id]; }
+	int getNumMaterials() const { return materials.size(); }
+
+	// Built by initScene: the objects as the scene file gave them (a mesh
+	// is one, however many triangles it has), in that order.
+	int getNumOwners() const { return owners.size(); }
+	const Geometry *getOwner( int i ) const { return owners[i]; }
+
+	// An optional label for a top-level object in reports.
+	void setObjectName( const Geometry *obj, const string& name ) { objectNames[ obj ] = name; }
+	string getObjectName( const Geometry *obj ) const;
+	// The top-level object labelled name, or NULL.
+	const Geometry *findObject( const string& name ) const;
+
+	// Animation: move a top-level object, and every part of it, by a
+	// world-space matrix applied after its own transform.  It takes
+	// effect at the next refit(), which brings the moved objects'
+	// transforms and bounds up to date without redoing initScene.
+	void setObjectMotion( const Geometry *owner, const mat4f& motion ) { motions[ owner ] = motion; }
+	void refit();
+
+	// Built by initScene: one per distinct world matrix.
+	const AffineTransform& getWorldTransform( unsigned int i ) const { return worldTransforms[i]; }
+	int getNumWorldTransforms() const { return worldTransforms.size(); }
         
 	Camera *getCamera() { return &camera; }
 
-	void setAmbientLight(vec3f& v);
-	vec3f getAmbientLight() const;
-	void setAmbientLightRed(double d);
-	void setAmbientLightGreen(double d);
-	void setAmbientLightBlue(double d);
-	void setCustomDistanceAttenuation(bool b);
-	void			setConstantAttenuationCoefficient(double d);
-	void			setLinearAttenuationCoefficient(double d);
-	void			setQuadraticAttenuationCoefficient(double d);
-	bool      isCustomDistanceAttenuation();
-	double		getConstantAttenuationCoefficient();
-	double		getLinearAttenuationCoefficient();
-	double		getQuadraticAttenuationCoefficient();
-
 private:
-    list<Geometry*> objects;
-	list<Geometry*> nonboundedobjects;
-	list<Geometry*> boundedobjects;
+    vector<Geometry*> objects;
+	vector<Geometry*> nonboundedobjects;
+	vector<Geometry*> boundedobjects;
+	vector<const Geometry*> owners;
+	map< const Geometry*, string > objectNames;
     list<Light*> lights;
+	list<MappedFile*> mappings;
+	vector<Material*> materials;		// in the arena
+	map< vector<double>, MaterialID > materialIndex;
+	vector<AffineTransform> worldTransforms;
+	unsigned int staticTransforms;		// those made by initScene; refit adds the rest
+	map< const Geometry*, mat4f > motions;
 	Camera camera;
-	vec3f ambientLight;
-	double      m_nConstantAttenuationCoefficient;
-	double      m_nLinearAttenuationCoefficient;
-	double      m_nQuadraticAttenuationCoefficient;
-	bool      m_bIsCustomDistanceAttenuation;
 	
 	// Each object in the scene, provided that it has hasBoundingBoxCapability(),
 	// must fall within this bounding box.  Objects that don't have hasBoundingBoxCapability()
@@ -302,4 +393,9 @@ private:
 	BoundingBox sceneBounds;
 };
 
+inline const AffineTransform& Geometry::getWorldTransform() const
+{
+	return scene->getWorldTransform( transformIndex );
+}
+
 #endif // __SCENE_H__
@@ -0,0 +1,337 @@
+//=============================================================================
+// rayserver: runs render jobs (see renderservice.h for the job format)
+// against scenes that stay loaded between them, so that a pipeline
+// rendering many frames or views of the same scenes pays for parsing and
+// setup once instead of once per image.
+//
+// Jobs come one per line from a file (or stdin with -f -), or from any
+// number of clients of a Unix-domain socket (-u).  Each finished job is
+// answered with one line of JSON: on stdout for a job file, back down the
+// client's connection for the socket.  Blank lines and lines starting
+// with '#' are skipped; a client line "quit" stops the server once the
+// jobs it has are done.
+//
+// Build it from this file, renderservice.cpp and every source of the ray
+// tracer except main.cpp and ui/.
+//
+// usage: rayserver [-n <threads>] [-c <scenes>] [-f <jobs.txt|->] [-u <socket>]
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "renderservice.h"
+
+#include "../stats/timeline.h"
+
+using namespace std;
+
+// from getopt.cpp (<unistd.h> declares its own, hence the cast below)
+extern int getopt(int argc, char **argv, char *optstring);
+extern char* optarg;
+extern int optind;
+
+static string trim( const string& s )
+{
+	size_t b = s.find_first_not_of( " \t\r\n" );
+	if( b == string::npos ) {
+		return "";
+	}
+	size_t e = s.find_last_not_of( " \t\r\n" );
+	return s.substr( b, e - b + 1 );
+}
+
+static string errorLine( const string& error )
+{
+	RenderResult r;
+	r.ok = false;
+	r.error = error;
+	r.cached = false;
+	r.queueSeconds = r.loadSeconds = r.renderSeconds = 0.0;
+	r.width = r.height = 0;
+	for( int s = 0; s < NUM_RAY_STATS; ++s )
+		r.rays.count[s] = 0;
+	return formatRenderResult( r );
+}
+
+//
+// job file
+//
+
+static mutex s_outLock;
+static int s_nFailed;
+
+static void printResult( const RenderResult& result, void * )
+{
+	lock_guard<mutex> guard( s_outLock );
+	printf( "%s\n", formatRenderResult( result ).c_str() );
+	fflush( stdout );
+	if( !result.ok ) {
+		++s_nFailed;
+	}
+}
+
+static int runJobFile( RenderService& service, const char *name )
+{
+	FILE *fp = strcmp( name, "-" ) ? fopen( name, "r" ) : stdin;
+	if( !fp ) {
+		fprintf( stderr, "can't read %s\n", name );
+		return 1;
+	}
+
+	double start = timelineNow();
+	int nJobs = 0;
+	char buf[4096];
+	while( fgets( buf, sizeof( buf ), fp ) ) {
+		string line = trim( buf );
+		if( line.empty() || line[0] == '#' ) {
+			continue;
+		}
+
+		RenderJob job;
+		string error;
+		if( !parseRenderJob( line, job, error ) ) {
+			lock_guard<mutex> guard( s_outLock );
+			printf( "%s\n", errorLine( error ).c_str() );
+			++s_nFailed;
+			continue;
+		}
+		service.submit( job, printResult, NULL );
+		++nJobs;
+	}
+	if( fp != stdin ) {
+		fclose( fp );
+	}
+
+	service.waitIdle();
+	fprintf( stderr, "%d jobs, %d failed, %d scenes loaded, %.3f seconds\n",
+		nJobs, s_nFailed, service.numCachedScenes(), timelineNow() - start );
+	return s_nFailed ? 1 : 0;
+}
+
+//
+// Unix socket
+//
+
+#ifndef WIN32
+
+// Owned by runSocket, which joins its thread before closing fd, so that
+// shutting fd down never hits a descriptor that has been reused.
+struct Connection
+{
+	Connection( int f ) : fd( f ), outstanding( 0 ), finished( false ) {}
+
+	int fd;
+	mutex lock;				// one writer at a time, and outstanding
+	condition_variable done;
+	int outstanding;		// submitted and not yet answered
+	atomic<bool> finished;	// serveConnection has returned
+	thread server;
+};
+
+static void sendLine( Connection *conn, const string& line )
+{
+	string s = line + "\n";
+	size_t sent = 0;
+	while( sent < s.size() ) {
+		ssize_t n = write( conn->fd, s.data() + sent, s.size() - sent );
+		if( n <= 0 ) {
+			return;			// the client went away; its jobs still finish
+		}
+		sent += n;
+	}
+}
+
+static void answer( const RenderResult& result, void *data )
+{
+	Connection *conn = (Connection *)data;
+	lock_guard<mutex> guard( conn->lock );
+	sendLine( conn, formatRenderResult( result ) );
+	if( --conn->outstanding == 0 ) {
+		conn->done.notify_all();
+	}
+}
+
+static void serveConnection( RenderService *service, Connection *conn, int listenFd )
+{
+	string pending;
+	char buf[4096];
+	bool quit = false;
+	ssize_t n;
+	while( !quit && ( n = read( conn->fd, buf, sizeof( buf ) ) ) > 0 ) {
+		pending.append( buf, n );
+		size_t eol;
+		while( !quit && ( eol = pending.find( '\n' ) ) != string::npos ) {
+			string line = trim( pending.substr( 0, eol ) );
+			pending.erase( 0, eol + 1 );
+			if( line.empty() || line[0] == '#' ) {
+				continue;
+			}
+			if( line == "quit" ) {
+				quit = true;
+				break;
+			}
+
+			RenderJob job;
+			string error;
+			if( !parseRenderJob( line, job, error ) ) {
+				lock_guard<mutex> guard( conn->lock );
+				sendLine( conn, errorLine( error ) );
+				continue;
+			}
+			{
+				lock_guard<mutex> guard( conn->lock );
+				++conn->outstanding;
+			}
+			service->submit( job, answer, conn );
+		}
+	}
+
+	// The callbacks still write to this connection, so it has to outlive
+	// every job it submitted.
+	{
+		unique_lock<mutex> lock( conn->lock );
+		while( conn->outstanding > 0 )
+			conn->done.wait( lock );
+	}
+
+	if( quit ) {
+		shutdown( listenFd, SHUT_RDWR );	// wakes accept() in runSocket
+	}
+	conn->finished = true;
+}
+
+static void closeConnection( Connection *conn )
+{
+	conn->server.join();
+	close( conn->fd );
+	delete conn;
+}
+
+static int runSocket( RenderService& service, const char *path )
+{
+	int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if( fd < 0 ) {
+		perror( "socket" );
+		return 1;
+	}
+
+	sockaddr_un addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	if( strlen( path ) >= sizeof( addr.sun_path ) ) {
+		fprintf( stderr, "socket path %s is too long\n", path );
+		close( fd );
+		return 1;
+	}
+	strcpy( addr.sun_path, path );
+	unlink( path );
+	if( bind( fd, (sockaddr *)&addr, sizeof( addr ) ) < 0 || listen( fd, 16 ) < 0 ) {
+		perror( path );
+		close( fd );
+		return 1;
+	}
+
+	// A client hanging up mid-answer must not kill the server.
+	signal( SIGPIPE, SIG_IGN );
+
+	fprintf( stderr, "listening on %s with %d threads\n", path, service.numThreads() );
+	vector<Connection *> conns;
+	int client;
+	while( ( client = accept( fd, NULL, NULL ) ) >= 0 ) {
+		// clean up after the clients that have gone
+		for( size_t k = 0; k < conns.size(); ) {
+			if( conns[k]->finished ) {
+				closeConnection( conns[k] );
+				conns[k] = conns.back();
+				conns.pop_back();
+			} else {
+				++k;
+			}
+		}
+
+		Connection *conn = new Connection( client );
+		conn->server = thread( serveConnection, &service, conn, fd );
+		conns.push_back( conn );
+	}
+
+	// Stop reading from the clients still connected: their threads finish
+	// answering what they submitted and return, after which nothing more
+	// can reach the service.
+	for( size_t k = 0; k < conns.size(); ++k ) {
+		shutdown( conns[k]->fd, SHUT_RD );
+	}
+	for( size_t k = 0; k < conns.size(); ++k ) {
+		closeConnection( conns[k] );
+	}
+
+	service.waitIdle();
+	close( fd );
+	unlink( path );
+	fprintf( stderr, "%d scenes loaded\n", service.numCachedScenes() );
+	return 0;
+}
+
+#endif // WIN32
+
+static void usage( const char *progname )
+{
+	fprintf( stderr, "usage: %s [-n <threads>] [-c <scenes>] [-f <jobs.txt|->] [-u <socket>]\n", progname );
+	fprintf( stderr, "  -n <#>      render threads (default: one per core)\n" );
+	fprintf( stderr, "  -c <#>      scenes kept loaded between jobs (default %d)\n", RenderService::DEFAULT_MAX_SCENES );
+	fprintf( stderr, "  -f <file>   run the jobs in file, one per line ('-' for stdin)\n" );
+#ifndef WIN32
+	fprintf( stderr, "  -u <path>   serve jobs to clients of a Unix socket at path\n" );
+#endif
+}
+
+int main( int argc, char **argv )
+{
+	int numThreads = 0;
+	int maxScenes = RenderService::DEFAULT_MAX_SCENES;
+	const char *jobFile = NULL;
+	const char *socketPath = NULL;
+
+	int c;
+	while( ( c = getopt( argc, argv, (char *)"n:c:f:u:" ) ) != EOF ) {
+		switch( c ) {
+		case 'n': numThreads = atoi( optarg ); break;
+		case 'c': maxScenes = atoi( optarg ); break;
+		case 'f': jobFile = optarg; break;
+		case 'u': socketPath = optarg; break;
+		default:
+			usage( argv[0] );
+			return 1;
+		}
+	}
+	if( optind != argc || ( jobFile == NULL ) == ( socketPath == NULL ) ) {
+		usage( argv[0] );
+		return 1;
+	}
+
+	RenderService service( numThreads, maxScenes );
+	if( jobFile ) {
+		return runJobFile( service, jobFile );
+	}
+#ifndef WIN32
+	return runSocket( service, socketPath );
+#else
+	fprintf( stderr, "sockets are not supported on this platform\n" );
+	return 1;
+#endif
+}
@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "renderservice.h"
+
+#include "../RayTracer.h"
+#include "../TileRenderer.h"
+#include "../fileio/bitmap.h"
+#include "../fileio/hdrimage.h"
+#include "../fileio/parse.h"
+#include "../fileio/read.h"
+#include "../scene/scene.h"
+#include "../stats/timeline.h"
+
+RenderJob::RenderJob()
+	: width( 256 ), height( 0 ), depth( 0 ), antialiasing( 0 ), jitter( 0 ), superSampling( 0 ),
+	  hasEye( false ), hasDir( false ), hasAt( false ), hasFOV( false ),
+	  up( 0, 1, 0 ), fov( 0.0 )
+{
+}
+
+static bool parseInt( const string& s, int& v )
+{
+	char *end;
+	long n = strtol( s.c_str(), &end, 10 );
+	if( s.empty() || *end || n < 0 ) {
+		return false;
+	}
+	v = (int)n;
+	return true;
+}
+
+static bool parseDouble( const string& s, double& v )
+{
+	char *end;
+	v = strtod( s.c_str(), &end );
+	return !s.empty() && !*end;
+}
+
+static bool parseVec( const string& s, vec3f& v )
+{
+	double x, y, z;
+	int used = 0;
+	if( sscanf( s.c_str(), "%lf,%lf,%lf%n", &x, &y, &z, &used ) != 3 || used != (int)s.size() ) {
+		return false;
+	}
+	v = vec3f( x, y, z );
+	return true;
+}
+
+bool parseRenderJob( const string& line, RenderJob& job, string& error )
+{
+	job = RenderJob();
+
+	istringstream words( line );
+	string word;
+	while( words >> word ) {
+		size_t eq = word.find( '=' );
+		if( eq == string::npos ) {
+			error = "expected key=value, got " + word;
+			return false;
+		}
+		string key = word.substr( 0, eq );
+		string value = word.substr( eq + 1 );
+
+		bool ok = true;
+		if( key == "id" ) job.id = value;
+		else if( key == "scene" ) job.sceneName = value;
+		else if( key == "out" ) job.outName = value;
+		else if( key == "width" ) ok = parseInt( value, job.width ) && job.width > 0;
+		else if( key == "height" ) ok = parseInt( value, job.height ) && job.height > 0;
+		else if( key == "depth" ) ok = parseInt( value, job.depth );
+		else if( key == "aa" ) ok = parseInt( value, job.antialiasing );
+		else if( key == "jitter" ) ok = parseInt( value, job.jitter );
+		else if( key == "super" ) ok = parseInt( value, job.superSampling );
+		else if( key == "eye" ) ok = job.hasEye = parseVec( value, job.eye );
+		else if( key == "dir" ) ok = job.hasDir = parseVec( value, job.dir );
+		else if( key == "at" ) ok = job.hasAt = parseVec( value, job.at );
+		else if( key == "up" ) ok = parseVec( value, job.up );
+		else if( key == "fov" ) ok = job.hasFOV = parseDouble( value, job.fov ) && job.fov > 0.0 && job.fov < 180.0;
+		else {
+			error = "unknown key " + key;
+			return false;
+		}
+		if( !ok ) {
+			error = "bad value for " + key + ": " + value;
+			return false;
+		}
+	}
+
+	if( job.sceneName.empty() || job.outName.empty() ) {
+		error = "a job needs scene= and out=";
+		return false;
+	}
+	return true;
+}
+
+static string quote( const string& s )
+{
+	string q = "\"";
+	for( size_t k = 0; k < s.size(); ++k ) {
+		unsigned char c = s[k];
+		if( c == '"' || c == '\\' ) {
+			q += '\\';
+			q += c;
+		} else if( c < 0x20 ) {
+			char buf[8];
+			sprintf( buf, "\\u%04x", c );
+			q += buf;
+		} else {
+			q += c;
+		}
+	}
+	return q + "\"";
+}
+
+string formatRenderResult( const RenderResult& r )
+{
+	ostringstream out;
+	out << "{ \"id\": " << quote( r.id ) << ", \"out\": " << quote( r.outName )
+		<< ", \"ok\": " << ( r.ok ? "true" : "false" );
+	if( !r.ok ) {
+		out << ", \"error\": " << quote( r.error );
+	}
+
+	char buf[256];
+	sprintf( buf, ", \"cached\": %s, \"queue_seconds\": %.6f, \"load_seconds\": %.6f, \"render_seconds\": %.6f",
+		r.cached ? "true" : "false", r.queueSeconds, r.loadSeconds, r.renderSeconds );
+	out << buf;
+	if( r.ok ) {
+		out << ", \"width\": " << r.width << ", \"height\": " << r.height;
+	}
+	if( rayStatsEnabled() ) {
+		unsigned long long rays = r.rays.count[ STAT_PRIMARY_RAYS ] + r.rays.count[ STAT_REFLECTION_RAYS ]
+			+ r.rays.count[ STAT_REFRACTION_RAYS ] + r.rays.count[ STAT_SHADOW_RAYS ];
+		out << ", \"rays\": " << rays;
+	}
+	out << " }";
+	return out.str();
+}
+
+// A submitted job on its way through the pool.  Everything but the
+// tracer's pixels is guarded by the service's lock.
+struct RenderService::ActiveJob
+{
+	enum State { WAITING, PREPARING, RENDERING };
+
+	RenderJob job;
+	DoneCallback callback;
+	void *data;
+
+	State state;
+	shared_ptr<CachedScene> scene;	// held from prepare until finish
+	RayTracer *tracer;
+	int tilesX, tilesY;
+	int nextTile;
+	int tilesDone;
+
+	double submitted;
+	double prepared;
+	RenderResult result;
+};
+
+RenderService::RenderService( int numThreads, int maxScenes )
+	: m_nPending( 0 ), m_bQuit( false ), m_nMaxScenes( max( maxScenes, 0 ) ), m_nUseClock( 0 )
+{
+	if( numThreads <= 0 )
+		numThreads = thread::hardware_concurrency();
+	if( numThreads <= 0 )
+		numThreads = 1;
+
+	for( int i = 0; i < numThreads; ++i )
+		m_threads.push_back( thread( &RenderService::worker, this ) );
+}
+
+RenderService::~RenderService()
+{
+	waitIdle();
+	{
+		lock_guard<mutex> guard( m_lock );
+		m_bQuit = true;
+	}
+	m_wake.notify_all();
+	for( size_t i = 0; i < m_threads.size(); ++i )
+		m_threads[i].join();
+}
+
+RenderService::CachedScene::~CachedScene()
+{
+	delete scene;
+}
+
+void RenderService::submit( const RenderJob& job, DoneCallback cb, void *data )
+{
+	ActiveJob *active = new ActiveJob;
+	active->job = job;
+	active->callback = cb;
+	active->data = data;
+	active->state = ActiveJob::WAITING;
+	active->tracer = NULL;
+	active->tilesX = active->tilesY = 0;
+	active->nextTile = active->tilesDone = 0;
+	active->submitted = timelineNow();
+	active->prepared = 0.0;
+
+	RenderResult& r = active->result;
+	r.id = job.id;
+	r.outName = job.outName;
+	r.ok = false;
+	r.cached = false;
+	r.queueSeconds = r.loadSeconds = r.renderSeconds = 0.0;
+	r.width = r.height = 0;
+	for( int s = 0; s < NUM_RAY_STATS; ++s )
+		r.rays.count[s] = 0;
+
+	{
+		lock_guard<mutex> guard( m_lock );
+		m_jobs.push_back( active );
+		++m_nPending;
+	}
+	m_wake.notify_one();
+}
+
+void RenderService::waitIdle()
+{
+	unique_lock<mutex> lock( m_lock );
+	while( m_nPending > 0 )
+		m_idle.wait( lock );
+}
+
+int RenderService::numCachedScenes()
+{
+	lock_guard<mutex> guard( m_cacheLock );
+	return m_scenes.size();
+}
+
+// The name a scene is cached under: its absolute path with links, "."
+// and ".." resolved, so that every spelling of a file shares one entry.
+// A name that doesn't resolve (the file is missing, say) is kept as is.
+static string canonicalSceneName( const string& name )
+{
+#ifdef WIN32
+	char path[ _MAX_PATH ];
+	if( _fullpath( path, name.c_str(), _MAX_PATH ) )
+		return path;
+#else
+	char *path = realpath( name.c_str(), NULL );
+	if( path ) {
+		string ret( path );
+		free( path );
+		return ret;
+	}
+#endif
+	return name;
+}
+
+// The scene called name, read and initialized by the first job to ask
+// for it; later jobs (and any waiting on the first) share it.  The caller
+// holds it until giveBackScene.  A scene that fails to load is dropped
+// from the cache so the next job retries, and NULL is returned.
+shared_ptr<RenderService::CachedScene> RenderService::takeScene( const string& name, bool& cached, double& loadSeconds )
+{
+	string key = canonicalSceneName( name );
+
+	shared_ptr<CachedScene> entry;
+	{
+		lock_guard<mutex> guard( m_cacheLock );
+		shared_ptr<CachedScene>& slot = m_scenes[ key ];
+		if( !slot )
+			slot = make_shared<CachedScene>();
+		entry = slot;
+		++entry->users;
+		entry->lastUsed = ++m_nUseClock;
+	}
+
+	cached = true;
+	loadSeconds = 0.0;
+	call_once( entry->loaded, [&]() {
+		double start = timelineNow();
+		Scene *scene = NULL;
+		try {
+			scene = readScene( name );
+		} catch( ParseError& pe ) {
+			fprintf( stderr, "Parse error: %s\n", pe.getMsg().c_str() );
+		}
+		if( scene )
+			scene->initScene();
+		entry->scene = scene;
+		entry->loadSeconds = timelineNow() - start;
+		cached = false;
+		loadSeconds = entry->loadSeconds;
+	} );
+
+	if( !entry->scene ) {
+		{
+			lock_guard<mutex> guard( m_cacheLock );
+			--entry->users;
+			map< string, shared_ptr<CachedScene> >::iterator found = m_scenes.find( key );
+			if( found != m_scenes.end() && found->second == entry )
+				m_scenes.erase( found );
+		}
+		return shared_ptr<CachedScene>();
+	}
+
+	// a new scene may have put the cache over its limit
+	vector< shared_ptr<CachedScene> > evicted;
+	{
+		lock_guard<mutex> guard( m_cacheLock );
+		evictScenes( evicted );
+	}
+	return entry;
+}
+
+// A job is done with entry; if the cache is over its limit, that may be
+// what lets the oldest idle scene go.
+void RenderService::giveBackScene( const shared_ptr<CachedScene>& entry )
+{
+	vector< shared_ptr<CachedScene> > evicted;
+	{
+		lock_guard<mutex> guard( m_cacheLock );
+		--entry->users;
+		evictScenes( evicted );
+	}
+	// the scenes themselves are freed here, outside the lock
+}
+
+// Under m_cacheLock: while there are more than m_nMaxScenes scenes, take
+// out the least recently used one that no job holds.  Scenes in use (or
+// still loading) stay, so the cache can be over its limit for a while.
+// The entries go to evicted, to be freed once the lock is dropped.
+void RenderService::evictScenes( vector< shared_ptr<CachedScene> >& evicted )
+{
+	while( (int)m_scenes.size() > m_nMaxScenes ) {
+		map< string, shared_ptr<CachedScene> >::iterator oldest = m_scenes.end();
+		for( map< string, shared_ptr<CachedScene> >::iterator s = m_scenes.begin(); s != m_scenes.end(); ++s ) {
+			if( s->second->users == 0 && ( oldest == m_scenes.end() || s->second->lastUsed < oldest->second->lastUsed ) )
+				oldest = s;
+		}
+		if( oldest == m_scenes.end() )
+			break;
+		evicted.push_back( oldest->second );
+		m_scenes.erase( oldest );
+	}
+}
+
+// Load the scene if need be and set up a tracer for the job, or record
+// why not.
+void RenderService::prepare( ActiveJob *active )
+{
+	const RenderJob& job = active->job;
+	RenderResult& r = active->result;
+
+	active->scene = takeScene( job.sceneName, r.cached, r.loadSeconds );
+	if( !active->scene ) {
+		r.error = "can't load " + job.sceneName;
+		return;
+	}
+
+	RayTracer *tracer = new RayTracer();
+	tracer->useScene( active->scene->scene );
+
+	Camera *camera = tracer->getCamera();
+	if( job.hasEye )
+		camera->setEye( job.eye );
+	if( job.hasAt || job.hasDir ) {
+		vec3f dir = job.hasAt ? job.at - camera->getEye() : job.dir;
+		if( dir.iszero() || dir.cross( job.up ).iszero() ) {
+			r.error = "the view direction is zero or along up";
+			delete tracer;
+			return;
+		}
+		dir = dir.normalize();
+		vec3f right = dir.cross( job.up ).normalize();
+		camera->setLook( dir, right.cross( dir ) );
+	}
+	if( job.hasFOV )
+		camera->setFOV( job.fov );
+
+	int width = job.width;
+	int height = job.height;
+	if( height > 0 )
+		camera->setAspectRatio( (double)width / height );
+	else
+		height = max( 1, (int)( width / camera->getAspectRatio() + 0.5 ) );
+
+	tracer->setDepth( job.depth );
+	tracer->setAntialiasing( job.antialiasing );
+	tracer->setJitter( job.jitter );
+	tracer->setSuperSampling( job.superSampling );
+	tracer->setHDR( isHDRFileName( job.outName.c_str() ) );
+	tracer->traceSetup( width, height );
+
+	active->tracer = tracer;
+	active->tilesX = ( width + TileRenderer::TILE_SIZE - 1 ) / TileRenderer::TILE_SIZE;
+	active->tilesY = ( height + TileRenderer::TILE_SIZE - 1 ) / TileRenderer::TILE_SIZE;
+	r.width = width;
+	r.height = height;
+}
+
+void RenderService::renderTile( ActiveJob *active, int tile )
+{
+	const int size = TileRenderer::TILE_SIZE;
+	int x = ( tile % active->tilesX ) * size;
+	int y = ( tile / active->tilesX ) * size;
+	int w = min( size, active->result.width - x );
+	int h = min( size, active->result.height - y );
+
+	ScopedTimer timer( "tile", "tile", tile );
+	for( int j = y; j < y + h; ++j )
+		for( int i = x; i < x + w; ++i )
+			active->tracer->tracePixel( i, j );
+}
+
+// Write the image (if the job got that far) and report.
+void RenderService::finish( ActiveJob *active )
+{
+	RenderResult& r = active->result;
+	RayTracer *tracer = active->tracer;
+
+	if( tracer ) {
+		const char *name = active->job.outName.c_str();
+		int w, h;
+		if( isHDRFileName( name ) ) {
+			float *hdr;
+			tracer->getHDRBuffer( hdr, w, h );
+			r.ok = hdr && writeHDR( name, w, h, hdr );
+		} else {
+			unsigned char *buf;
+			tracer->getBuffer( buf, w, h );
+			r.ok = writeBMP( (char *)name, w, h, buf );
+		}
+		if( !r.ok )
+			r.error = "can't write " + active->job.outName;
+		r.renderSeconds = timelineNow() - active->prepared;
+		delete tracer;
+	}
+	if( active->scene )
+		giveBackScene( active->scene );
+
+	if( active->callback )
+		active->callback( r, active->data );
+	delete active;
+}
+
+// Under the lock: the next thing to do, oldest job first.  tile is -1
+// for a job that still has to be prepared.
+bool RenderService::takeWork( ActiveJob *&job, int& tile )
+{
+	for( deque<ActiveJob*>::iterator j = m_jobs.begin(); j != m_jobs.end(); ++j ) {
+		ActiveJob *a = *j;
+		if( a->state == ActiveJob::WAITING ) {
+			a->state = ActiveJob::PREPARING;
+			a->result.queueSeconds = timelineNow() - a->submitted;
+			job = a;
+			tile = -1;
+			return true;
+		}
+		if( a->state == ActiveJob::RENDERING && a->nextTile < a->tilesX * a->tilesY ) {
+			job = a;
+			tile = a->nextTile++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void RenderService::worker()
+{
+	nameTimelineThread( "render service" );
+
+	unique_lock<mutex> lock( m_lock );
+	while( true ) {
+		ActiveJob *job;
+		int tile;
+		if( !takeWork( job, tile ) ) {
+			if( m_bQuit )
+				return;
+			m_wake.wait( lock );
+			continue;
+		}
+		lock.unlock();
+
+		bool done;
+		if( tile < 0 ) {
+			prepare( job );
+			lock.lock();
+			done = job->tracer == NULL;
+			if( !done ) {
+				job->state = ActiveJob::RENDERING;
+				job->prepared = timelineNow();
+				m_wake.notify_all();
+			}
+		} else {
+			RayStatCounters before, after;
+			threadRayStats( before );
+			renderTile( job, tile );
+			threadRayStats( after );
+
+			lock.lock();
+			for( int s = 0; s < NUM_RAY_STATS; ++s )
+				job->result.rays.count[s] += after.count[s] - before.count[s];
+			done = ++job->tilesDone == job->tilesX * job->tilesY;
+		}
+
+		if( done ) {
+			// nobody else can reach it once it is off the queue
+			m_jobs.erase( find( m_jobs.begin(), m_jobs.end(), job ) );
+			lock.unlock();
+			finish( job );
+			lock.lock();
+			if( --m_nPending == 0 )
+				m_idle.notify_all();
+		}
+	}
+}
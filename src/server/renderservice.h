@@ -0,0 +1,158 @@
+//
+// renderservice.h
+//
+// A long-running renderer for pipelines that render the same scenes many
+// times over.  Scenes are loaded (and initScene'd) once per file (however
+// its name is spelled) and kept, up to a limit past which the least
+// recently used scene no job is rendering is dropped; every job gets its
+// own RayTracer on the cached scene, with its own camera, size and
+// sampling.  Jobs are cut into tiles that one shared pool of threads
+// works through, oldest job first, so a lone job gets every thread and
+// independent jobs overlap, including one job's scene loading with
+// another's rendering.
+//
+// Jobs are one line of key=value words, e.g.
+//
+//   scene=shot.ray out=f001.bmp width=640 height=360 depth=3 aa=1
+//       eye=0,1,5 at=0,0,0 fov=40 id=f001
+//
+//   scene, out    the scene file (.ray or .rayb) and the image to write
+//                 (.bmp, or .pfm/.hdr for the float image)
+//   width         default 256
+//   height        default: from width and the camera's aspect ratio;
+//                 giving both sets the aspect ratio
+//   depth, aa, jitter, super
+//                 recursion depth, 3x3 antialiasing, jitter and adaptive
+//                 supersampling level, as in the UI (all default 0)
+//   eye, dir, at, up, fov
+//                 camera overrides: position, view direction or a point
+//                 to look at, up vector (default 0,1,0) and vertical fov
+//   id            any word, echoed back in the result
+//
+
+#ifndef __RENDERSERVICE_H__
+#define __RENDERSERVICE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../vecmath/vecmath.h"
+#include "../stats/raystats.h"
+
+using namespace std;
+
+class Scene;
+class RayTracer;
+
+struct RenderJob
+{
+	RenderJob();
+
+	string id;
+	string sceneName;
+	string outName;
+	int width;
+	int height;				// 0: from the camera's aspect ratio
+	int depth;
+	int antialiasing;
+	int jitter;
+	int superSampling;
+
+	bool hasEye, hasDir, hasAt, hasFOV;
+	vec3f eye, dir, at, up;
+	double fov;
+};
+
+// Parse one job line; on failure error says why.
+bool parseRenderJob( const string& line, RenderJob& job, string& error );
+
+struct RenderResult
+{
+	string id;
+	string outName;
+	bool ok;
+	string error;
+
+	bool cached;			// the scene was already loaded
+	double queueSeconds;	// submitted until first picked up
+	double loadSeconds;		// reading and initScene, if this job did it
+	double renderSeconds;	// first tile started until the image was written
+	int width, height;
+	RayStatCounters rays;	// all zero without RAY_STATS
+};
+
+// The result as one line of JSON (no newline).
+string formatRenderResult( const RenderResult& result );
+
+class RenderService
+{
+public:
+	// Called on a pool thread once a job has finished or failed.
+	typedef void (*DoneCallback)( const RenderResult& result, void *data );
+
+	enum { DEFAULT_MAX_SCENES = 8 };
+
+	// numThreads = 0 uses one thread per hardware core.  At most
+	// maxScenes scenes stay loaded once no job needs them.
+	RenderService( int numThreads = 0, int maxScenes = DEFAULT_MAX_SCENES );
+
+	// Finishes the jobs already submitted, then stops the pool.
+	~RenderService();
+
+	void submit( const RenderJob& job, DoneCallback cb, void *data );
+
+	// Wait until every submitted job has finished.
+	void waitIdle();
+
+	int numThreads() const { return m_threads.size(); }
+	int numCachedScenes();
+
+private:
+	RenderService( const RenderService& );
+	RenderService& operator=( const RenderService& );
+
+	struct CachedScene
+	{
+		CachedScene() : scene( NULL ), loadSeconds( 0.0 ), users( 0 ), lastUsed( 0 ) {}
+		~CachedScene();
+
+		once_flag loaded;
+		Scene *scene;			// NULL if it failed to load
+		double loadSeconds;
+		int users;				// jobs holding it; guarded by m_cacheLock
+		unsigned long lastUsed;	// m_nUseClock when last taken
+	};
+
+	struct ActiveJob;
+
+	shared_ptr<CachedScene> takeScene( const string& name, bool& cached, double& loadSeconds );
+	void giveBackScene( const shared_ptr<CachedScene>& entry );
+	void evictScenes( vector< shared_ptr<CachedScene> >& evicted );
+	void prepare( ActiveJob *job );
+	void renderTile( ActiveJob *job, int tile );
+	void finish( ActiveJob *job );
+	bool takeWork( ActiveJob *&job, int& tile );
+	void worker();
+
+	vector<thread> m_threads;
+
+	mutex m_lock;				// guards the jobs, m_nPending and m_bQuit
+	condition_variable m_wake;	// work arrived, or shutting down
+	condition_variable m_idle;	// the last pending job was reported
+	deque<ActiveJob*> m_jobs;	// oldest first, until their last tile is done
+	int m_nPending;				// submitted and not yet reported
+	bool m_bQuit;
+
+	mutex m_cacheLock;
+	map< string, shared_ptr<CachedScene> > m_scenes;	// by canonical path
+	int m_nMaxScenes;
+	unsigned long m_nUseClock;
+};
+
+#endif // __RENDERSERVICE_H__
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <string>
+
+#include "objectstats.h"
+
+#include "../scene/scene.h"
+
+using namespace std;
+
+bool g_bObjectStats = false;
+
+thread_local vector<ObjectCost> *t_pObjectCosts = NULL;
+
+// The arrays of the threads still running; list nodes never move, though
+// an array's contents do when its own thread grows it.  A thread's costs
+// are added to retired when it exits, and its array goes.
+static mutex costsLock;
+static list< vector<ObjectCost> > costBlocks;
+static vector<ObjectCost> retired;
+
+// Retires the thread's array when the thread exits.
+struct ObjectCostThread
+{
+	ObjectCostThread() : registered( false ) {}
+	~ObjectCostThread();
+
+	list< vector<ObjectCost> >::iterator block;
+	bool registered;
+};
+
+static thread_local ObjectCostThread t_costThread;
+
+// Add from's costs into into, which grows to fit.
+static void addCosts( vector<ObjectCost>& into, const vector<ObjectCost>& from, int limit )
+{
+	ObjectCost zero = { 0, 0, 0.0 };
+	int n = min( limit, (int)from.size() );
+	if( (int)into.size() < n ) {
+		into.resize( n, zero );
+	}
+	for( int k = 0; k < n; ++k ) {
+		into[k].tests += from[k].tests;
+		into[k].hits += from[k].hits;
+		into[k].shadeSeconds += from[k].shadeSeconds;
+	}
+}
+
+ObjectCostThread::~ObjectCostThread()
+{
+	if( !registered ) {
+		return;
+	}
+	lock_guard<mutex> guard( costsLock );
+	addCosts( retired, *block, (int)block->size() );
+	costBlocks.erase( block );
+	t_pObjectCosts = NULL;
+}
+
+void enableObjectStats( bool on )
+{
+	g_bObjectStats = on;
+}
+
+ObjectCost *growObjectCosts( int numObjects )
+{
+	lock_guard<mutex> guard( costsLock );
+	if( t_pObjectCosts == NULL ) {
+		costBlocks.push_back( vector<ObjectCost>() );
+		t_costThread.block = --costBlocks.end();
+		t_costThread.registered = true;
+		t_pObjectCosts = &costBlocks.back();
+	}
+
+	ObjectCost zero = { 0, 0, 0.0 };
+	if( (int)t_pObjectCosts->size() < numObjects || t_pObjectCosts->empty() ) {
+		t_pObjectCosts->resize( max( numObjects, 1 ), zero );
+	}
+	return &(*t_pObjectCosts)[0];
+}
+
+void totalObjectStats( vector<ObjectCost>& total, int numObjects )
+{
+	ObjectCost zero = { 0, 0, 0.0 };
+	total.assign( numObjects, zero );
+
+	lock_guard<mutex> guard( costsLock );
+	addCosts( total, retired, numObjects );
+	for( list< vector<ObjectCost> >::const_iterator b = costBlocks.begin(); b != costBlocks.end(); ++b ) {
+		addCosts( total, *b, numObjects );
+	}
+}
+
+void resetObjectStats()
+{
+	ObjectCost zero = { 0, 0, 0.0 };
+
+	lock_guard<mutex> guard( costsLock );
+	retired.clear();
+	for( list< vector<ObjectCost> >::iterator b = costBlocks.begin(); b != costBlocks.end(); ++b ) {
+		fill( b->begin(), b->end(), zero );
+	}
+}
+
+struct MoreWork
+{
+	const vector<ObjectCost>& costs;
+
+	MoreWork( const vector<ObjectCost>& c ) : costs( c ) {}
+
+	bool operator()( int a, int b ) const
+	{
+		if( costs[a].tests != costs[b].tests ) {
+			return costs[a].tests > costs[b].tests;
+		}
+		if( costs[a].shadeSeconds != costs[b].shadeSeconds ) {
+			return costs[a].shadeSeconds > costs[b].shadeSeconds;
+		}
+		return a < b;
+	}
+};
+
+static double percent( double part, double whole )
+{
+	return whole > 0.0 ? 100.0 * part / whole : 0.0;
+}
+
+void printObjectStats( FILE *fp, const Scene *scene, int limit )
+{
+	int n = scene->getNumOwners();
+	vector<ObjectCost> costs;
+	totalObjectStats( costs, n );
+
+	unsigned long long tests = 0, hits = 0;
+	double shade = 0.0;
+	vector<int> order( n );
+	for( int k = 0; k < n; ++k ) {
+		order[k] = k;
+		tests += costs[k].tests;
+		hits += costs[k].hits;
+		shade += costs[k].shadeSeconds;
+	}
+	sort( order.begin(), order.end(), MoreWork( costs ) );
+
+	fprintf( fp, "objects: %d, %llu tests, %llu hits, %.3f s shading\n", n, tests, hits, shade );
+	fprintf( fp, "%5s %6s %-10s %-20s %9s %14s %7s %12s %10s %7s\n",
+		"rank", "#", "type", "name", "prims", "tests", "%tests", "hits", "shade ms", "%shade" );
+
+	int rows = limit > 0 ? min( limit, n ) : n;
+	for( int r = 0; r < rows; ++r ) {
+		int k = order[r];
+		const Geometry *obj = scene->getOwner( k );
+		string name = scene->getObjectName( obj );
+		fprintf( fp, "%5d %6d %-10s %-20s %9d %14llu %6.2f%% %12llu %10.3f %6.2f%%\n",
+			r + 1, k, obj->getTypeName(), name.empty() ? "-" : name.c_str(),
+			obj->getPrimitiveCount(), costs[k].tests, percent( (double)costs[k].tests, (double)tests ),
+			costs[k].hits, costs[k].shadeSeconds * 1e3, percent( costs[k].shadeSeconds, shade ) );
+	}
+	if( rows < n ) {
+		fprintf( fp, "  (%d more)\n", n - rows );
+	}
+}
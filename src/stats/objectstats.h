@@ -0,0 +1,68 @@
+//
+// objectstats.h
+//
+// Where the work of a render goes, object by object: how many times each
+// top-level scene object (see Scene::getOwner) was tested against a ray,
+// how many closest hits it took, and how long shading those hits took.
+// Off until enableObjectStats( true ); while off, Scene::intersect and
+// RayTracer::shadeHit only pay for one test.
+//
+// Like the ray counters, each thread counts into its own array, so the
+// increments need no atomics, and the arrays are summed when asked (with
+// the costs of threads that have exited, whose arrays are freed).
+//
+
+#ifndef __OBJECTSTATS_H__
+#define __OBJECTSTATS_H__
+
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+class Scene;
+
+struct ObjectCost
+{
+	unsigned long long tests;		// rays tested against it (shadow rays too)
+	unsigned long long hits;		// closest hits
+	double shadeSeconds;			// shading its hits, without the recursion
+};
+
+void enableObjectStats( bool on );
+
+extern bool g_bObjectStats;
+
+inline bool objectStatsEnabled()
+{
+	return g_bObjectStats;
+}
+
+// This thread's array, with room for at least numObjects entries.  Made
+// and registered on first use.
+ObjectCost *growObjectCosts( int numObjects );
+
+extern thread_local vector<ObjectCost> *t_pObjectCosts;
+
+inline ObjectCost *threadObjectCosts( int numObjects )
+{
+	vector<ObjectCost> *costs = t_pObjectCosts;
+	if( costs == NULL || (int)costs->size() < numObjects ) {
+		return growObjectCosts( numObjects );
+	}
+	return &(*costs)[0];
+}
+
+// Sum of every thread's arrays, one entry per top-level object.  Call it
+// while no render is running.
+void totalObjectStats( vector<ObjectCost>& total, int numObjects );
+
+// Zero every thread's counts, e.g. before rendering another scene.
+void resetObjectStats();
+
+// The objects of scene ranked by intersection tests, most first, with
+// their share of the tests and of the shading time.  At most limit rows
+// (0: all of them).
+void printObjectStats( FILE *fp, const Scene *scene, int limit );
+
+#endif // __OBJECTSTATS_H__
@@ -0,0 +1,210 @@
+#include <list>
+#include <mutex>
+
+#include "raystats.h"
+
+using namespace std;
+
+static const char *statNames[ NUM_RAY_STATS ] = {
+	"primary", "reflection", "refraction", "shadow",
+	"bbox", "sphere", "box", "square", "cylinder", "cone", "triangle",
+	"hits", "isect_copies", "material_copies"
+};
+
+const char *rayStatName( RayStat s )
+{
+	return statNames[ s ];
+}
+
+#ifdef RAY_STATS
+
+thread_local RayStatCounters *t_pRayStats = NULL;
+
+// The blocks of the threads still running; list nodes never move.  A
+// thread's counts go into retired when it exits, and its block goes, so
+// a process that keeps starting threads doesn't keep every block.
+static mutex statsLock;
+static list<RayStatCounters> statsBlocks;
+static RayStatCounters retired;
+
+// Retires the thread's block when the thread exits.
+struct RayStatThread
+{
+	RayStatThread() : registered( false ) {}
+	~RayStatThread();
+
+	list<RayStatCounters>::iterator block;
+	bool registered;
+};
+
+static thread_local RayStatThread t_statThread;
+
+RayStatThread::~RayStatThread()
+{
+	if( !registered ) {
+		return;
+	}
+	lock_guard<mutex> guard( statsLock );
+	for( int s = 0; s < NUM_RAY_STATS; ++s ) {
+		retired.count[s] += block->count[s];
+	}
+	statsBlocks.erase( block );
+	t_pRayStats = NULL;
+}
+
+RayStatCounters *registerRayStatThread()
+{
+	lock_guard<mutex> guard( statsLock );
+	RayStatCounters zero = { { 0 } };
+	statsBlocks.push_back( zero );
+	t_statThread.block = --statsBlocks.end();
+	t_statThread.registered = true;
+	t_pRayStats = &statsBlocks.back();
+	return t_pRayStats;
+}
+
+bool rayStatsEnabled()
+{
+	return true;
+}
+
+void totalRayStats( RayStatCounters& total )
+{
+	lock_guard<mutex> guard( statsLock );
+	total = retired;
+	for( list<RayStatCounters>::const_iterator b = statsBlocks.begin(); b != statsBlocks.end(); ++b ) {
+		for( int s = 0; s < NUM_RAY_STATS; ++s ) {
+			total.count[s] += b->count[s];
+		}
+	}
+}
+
+void threadRayStats( RayStatCounters& c )
+{
+	RayStatCounters *mine = t_pRayStats;
+	if( mine == NULL ) {
+		mine = registerRayStatThread();
+	}
+	c = *mine;
+}
+
+void resetRayStats()
+{
+	lock_guard<mutex> guard( statsLock );
+	for( int s = 0; s < NUM_RAY_STATS; ++s ) {
+		retired.count[s] = 0;
+	}
+	for( list<RayStatCounters>::iterator b = statsBlocks.begin(); b != statsBlocks.end(); ++b ) {
+		for( int s = 0; s < NUM_RAY_STATS; ++s ) {
+			b->count[s] = 0;
+		}
+	}
+}
+
+#else
+
+bool rayStatsEnabled()
+{
+	return false;
+}
+
+void totalRayStats( RayStatCounters& total )
+{
+	for( int s = 0; s < NUM_RAY_STATS; ++s ) {
+		total.count[s] = 0;
+	}
+}
+
+void threadRayStats( RayStatCounters& c )
+{
+	totalRayStats( c );
+}
+
+void resetRayStats()
+{
+}
+
+#endif // RAY_STATS
+
+static double perSecond( unsigned long long n, double seconds )
+{
+	return seconds > 0.0 ? n / seconds : 0.0;
+}
+
+static double perRay( unsigned long long n, unsigned long long rays )
+{
+	return rays > 0 ? (double)n / rays : 0.0;
+}
+
+static void printText( FILE *fp, double seconds, const RayStatCounters& c, unsigned long long rays )
+{
+	fprintf( fp, "%-16s %14s %12s\n", "rays", "count", "Mrays/s" );
+	for( int s = STAT_PRIMARY_RAYS; s <= STAT_SHADOW_RAYS; ++s ) {
+		fprintf( fp, "  %-14s %14llu %12.3f\n", statNames[s], c.count[s],
+			perSecond( c.count[s], seconds ) * 1e-6 );
+	}
+	fprintf( fp, "  %-14s %14llu %12.3f\n", "total", rays, perSecond( rays, seconds ) * 1e-6 );
+
+	fprintf( fp, "%-16s %14s %12s\n", "tests", "count", "per ray" );
+	for( int s = STAT_BBOX_TESTS; s <= STAT_TRIANGLE_TESTS; ++s ) {
+		fprintf( fp, "  %-14s %14llu %12.2f\n", statNames[s], c.count[s],
+			perRay( c.count[s], rays ) );
+	}
+
+	fprintf( fp, "%-16s %14llu %12.2f\n", statNames[ STAT_HITS ], c.count[ STAT_HITS ],
+		perRay( c.count[ STAT_HITS ], rays ) );
+	fprintf( fp, "%-16s %14llu %12.2f\n", statNames[ STAT_ISECT_COPIES ], c.count[ STAT_ISECT_COPIES ],
+		perRay( c.count[ STAT_ISECT_COPIES ], rays ) );
+	fprintf( fp, "%-16s %14llu %12.2f\n", statNames[ STAT_MATERIAL_COPIES ], c.count[ STAT_MATERIAL_COPIES ],
+		perRay( c.count[ STAT_MATERIAL_COPIES ], rays ) );
+}
+
+static void printJSON( FILE *fp, double seconds, const RayStatCounters& c, unsigned long long rays )
+{
+	fprintf( fp, "{\n  \"seconds\": %.6f,\n  \"rays\": {\n", seconds );
+	for( int s = STAT_PRIMARY_RAYS; s <= STAT_SHADOW_RAYS; ++s ) {
+		fprintf( fp, "    \"%s\": { \"count\": %llu, \"per_second\": %.1f },\n", statNames[s],
+			c.count[s], perSecond( c.count[s], seconds ) );
+	}
+	fprintf( fp, "    \"total\": { \"count\": %llu, \"per_second\": %.1f }\n  },\n",
+		rays, perSecond( rays, seconds ) );
+
+	fprintf( fp, "  \"tests\": {\n" );
+	for( int s = STAT_BBOX_TESTS; s <= STAT_TRIANGLE_TESTS; ++s ) {
+		fprintf( fp, "    \"%s\": %llu%s\n", statNames[s], c.count[s],
+			s < STAT_TRIANGLE_TESTS ? "," : "" );
+	}
+	fprintf( fp, "  },\n" );
+
+	for( int s = STAT_HITS; s < NUM_RAY_STATS; ++s ) {
+		fprintf( fp, "  \"%s\": %llu%s\n", statNames[s], c.count[s],
+			s < NUM_RAY_STATS - 1 ? "," : "" );
+	}
+	fprintf( fp, "}\n" );
+}
+
+void printRayStats( FILE *fp, double seconds, bool json )
+{
+	if( !rayStatsEnabled() ) {
+		if( json ) {
+			fprintf( fp, "{\n  \"seconds\": %.6f,\n  \"counters\": false\n}\n", seconds );
+		} else {
+			fprintf( fp, "ray counters are not compiled in (build with RAY_STATS)\n" );
+		}
+		return;
+	}
+
+	RayStatCounters c;
+	totalRayStats( c );
+
+	unsigned long long rays = 0;
+	for( int s = STAT_PRIMARY_RAYS; s <= STAT_SHADOW_RAYS; ++s ) {
+		rays += c.count[s];
+	}
+
+	if( json ) {
+		printJSON( fp, seconds, c, rays );
+	} else {
+		printText( fp, seconds, c, rays );
+	}
+}
@@ -0,0 +1,88 @@
+//
+// raystats.h
+//
+// Hot-path event counters: rays by kind, intersection tests by primitive
+// type, hits and per-hit copies.  They only exist in builds made with
+// RAY_STATS defined; otherwise RAY_STAT( ... ) compiles to nothing and the
+// report just says the counters are off.
+//
+// Each thread counts into its own block, so the increments need no
+// atomics.  The blocks are summed when asked; a thread's counts are kept
+// in a running total when it exits, and its block is freed.
+//
+
+#ifndef __RAYSTATS_H__
+#define __RAYSTATS_H__
+
+#include <stdio.h>
+
+enum RayStat
+{
+	STAT_PRIMARY_RAYS,
+	STAT_REFLECTION_RAYS,
+	STAT_REFRACTION_RAYS,
+	STAT_SHADOW_RAYS,
+
+	STAT_BBOX_TESTS,
+	STAT_SPHERE_TESTS,
+	STAT_BOX_TESTS,
+	STAT_SQUARE_TESTS,
+	STAT_CYLINDER_TESTS,
+	STAT_CONE_TESTS,
+	STAT_TRIANGLE_TESTS,
+
+	STAT_HITS,
+	STAT_ISECT_COPIES,
+	STAT_MATERIAL_COPIES,
+
+	NUM_RAY_STATS
+};
+
+struct RayStatCounters
+{
+	unsigned long long count[ NUM_RAY_STATS ];
+};
+
+#ifdef RAY_STATS
+
+// This thread's block, made and registered on first use.
+RayStatCounters *registerRayStatThread();
+
+extern thread_local RayStatCounters *t_pRayStats;
+
+inline void countRayStat( RayStat s )
+{
+	RayStatCounters *c = t_pRayStats;
+	if( c == NULL ) {
+		c = registerRayStatThread();
+	}
+	++c->count[ s ];
+}
+
+#define RAY_STAT( s ) countRayStat( s )
+
+#else
+
+#define RAY_STAT( s ) ((void)0)
+
+#endif // RAY_STATS
+
+// Whether this build counts anything.
+bool rayStatsEnabled();
+
+// Sum of every thread's counters.  Call it while no render is running.
+void totalRayStats( RayStatCounters& total );
+
+// The calling thread's own counters so far (all zero without RAY_STATS).
+// Differences between two calls give the cost of the work in between.
+void threadRayStats( RayStatCounters& c );
+
+// Zero every thread's counters.
+void resetRayStats();
+
+const char *rayStatName( RayStat s );
+
+// The totals, with rates over the given wall-clock time, as text or JSON.
+void printRayStats( FILE *fp, double seconds, bool json );
+
+#endif // __RAYSTATS_H__
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "timeline.h"
+
+using namespace std;
+
+struct TimelineSpan
+{
+	const char *name;
+	const char *category;
+	double start, end;
+	int arg;
+};
+
+// One per thread that has recorded.  Only its own thread appends to
+// spans, so recording takes no lock.  The spans of a thread that has
+// exited are still part of the trace, so its block stays until
+// resetTimeline (or goes at once if it has none).
+struct ThreadTimeline
+{
+	int tid;
+	string name;
+	vector<TimelineSpan> spans;
+	bool exited;
+};
+
+static bool enabled = false;
+static const chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+
+static mutex timelineLock;
+static list<ThreadTimeline> threads;
+static int nextTid = 1;
+
+// The calling thread's block, which it gives up when it exits.
+struct TimelineThread
+{
+	TimelineThread() : block( NULL ) {}
+	~TimelineThread();
+
+	ThreadTimeline *block;
+};
+
+static thread_local TimelineThread t_thread;
+
+TimelineThread::~TimelineThread()
+{
+	if( block == NULL ) {
+		return;
+	}
+	lock_guard<mutex> guard( timelineLock );
+	block->exited = true;
+	if( block->spans.empty() ) {
+		for( list<ThreadTimeline>::iterator t = threads.begin(); t != threads.end(); ++t ) {
+			if( &*t == block ) {
+				threads.erase( t );
+				break;
+			}
+		}
+	}
+	block = NULL;
+}
+
+static ThreadTimeline *thisThread()
+{
+	if( t_thread.block == NULL ) {
+		lock_guard<mutex> guard( timelineLock );
+		ThreadTimeline t;
+		t.tid = nextTid++;
+		t.exited = false;
+		threads.push_back( t );
+		t_thread.block = &threads.back();
+	}
+	return t_thread.block;
+}
+
+void enableTimeline( bool on )
+{
+	enabled = on;
+}
+
+bool timelineEnabled()
+{
+	return enabled;
+}
+
+double timelineNow()
+{
+	return chrono::duration<double>( chrono::steady_clock::now() - origin ).count();
+}
+
+void nameTimelineThread( const char *name )
+{
+	if( enabled ) {
+		thisThread()->name = name;
+	}
+}
+
+void addTimelineSpan( const char *name, const char *category,
+	double start, double end, int arg )
+{
+	TimelineSpan s = { name, category, start, end, arg };
+	thisThread()->spans.push_back( s );
+}
+
+void resetTimeline()
+{
+	lock_guard<mutex> guard( timelineLock );
+	for( list<ThreadTimeline>::iterator t = threads.begin(); t != threads.end(); ) {
+		if( t->exited ) {
+			t = threads.erase( t );
+		} else {
+			t->spans.clear();
+			++t;
+		}
+	}
+}
+
+static string threadName( const ThreadTimeline& t )
+{
+	if( !t.name.empty() ) {
+		return t.name;
+	}
+	char buf[32];
+	sprintf( buf, "thread %d", t.tid );
+	return buf;
+}
+
+static bool earlier( const TimelineSpan& a, const TimelineSpan& b )
+{
+	return a.start < b.start;
+}
+
+void printTimelineSummary( FILE *fp )
+{
+	lock_guard<mutex> guard( timelineLock );
+
+	vector<TimelineSpan> phases;
+	for( list<ThreadTimeline>::const_iterator t = threads.begin(); t != threads.end(); ++t ) {
+		for( size_t i = 0; i < t->spans.size(); ++i ) {
+			if( string( t->spans[i].category ) == "phase" ) {
+				phases.push_back( t->spans[i] );
+			}
+		}
+	}
+	sort( phases.begin(), phases.end(), earlier );
+
+	vector<string> names;
+	vector<double> totals;
+	for( size_t i = 0; i < phases.size(); ++i ) {
+		size_t k = find( names.begin(), names.end(), phases[i].name ) - names.begin();
+		if( k == names.size() ) {
+			names.push_back( phases[i].name );
+			totals.push_back( 0.0 );
+		}
+		totals[k] += phases[i].end - phases[i].start;
+	}
+
+	fprintf( fp, "%-24s %10s\n", "phase", "seconds" );
+	for( size_t k = 0; k < names.size(); ++k ) {
+		fprintf( fp, "  %-22s %10.3f\n", names[k].c_str(), totals[k] );
+	}
+
+	bool header = false;
+	for( list<ThreadTimeline>::const_iterator t = threads.begin(); t != threads.end(); ++t ) {
+		int tiles = 0;
+		double busy = 0.0;
+		for( size_t i = 0; i < t->spans.size(); ++i ) {
+			if( string( t->spans[i].category ) == "tile" ) {
+				++tiles;
+				busy += t->spans[i].end - t->spans[i].start;
+			}
+		}
+		if( tiles == 0 ) {
+			continue;
+		}
+		if( !header ) {
+			fprintf( fp, "%-24s %10s %10s\n", "thread", "tiles", "busy s" );
+			header = true;
+		}
+		fprintf( fp, "  %-22s %10d %10.3f\n", threadName( *t ).c_str(), tiles, busy );
+	}
+}
+
+// Names come from string literals in the code, but be safe anyway.
+static void writeJSONString( FILE *fp, const string& s )
+{
+	fputc( '"', fp );
+	for( size_t i = 0; i < s.size(); ++i ) {
+		unsigned char ch = s[i];
+		if( ch == '"' || ch == '\\' ) {
+			fprintf( fp, "\\%c", ch );
+		} else if( ch < 0x20 ) {
+			fprintf( fp, "\\u%04x", ch );
+		} else {
+			fputc( ch, fp );
+		}
+	}
+	fputc( '"', fp );
+}
+
+bool writeChromeTrace( const char *filename )
+{
+	FILE *fp = fopen( filename, "w" );
+	if( !fp ) {
+		fprintf( stderr, "can't write %s\n", filename );
+		return false;
+	}
+
+	lock_guard<mutex> guard( timelineLock );
+
+	// ts and dur are in microseconds
+	fprintf( fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	bool first = true;
+	for( list<ThreadTimeline>::const_iterator t = threads.begin(); t != threads.end(); ++t ) {
+		fprintf( fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+			first ? "" : ",\n", t->tid );
+		writeJSONString( fp, threadName( *t ) );
+		fprintf( fp, "}}" );
+		first = false;
+
+		for( size_t i = 0; i < t->spans.size(); ++i ) {
+			const TimelineSpan& s = t->spans[i];
+			fprintf( fp, ",\n{\"name\":" );
+			writeJSONString( fp, s.name );
+			fprintf( fp, ",\"cat\":" );
+			writeJSONString( fp, s.category );
+			fprintf( fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+				t->tid, s.start * 1e6, ( s.end - s.start ) * 1e6 );
+			if( s.arg >= 0 ) {
+				fprintf( fp, ",\"args\":{\"index\":%d}", s.arg );
+			}
+			fputc( '}', fp );
+		}
+	}
+	fprintf( fp, "\n]}\n" );
+
+	bool ok = !ferror( fp );
+	if( fclose( fp ) != 0 ) {
+		ok = false;
+	}
+	if( !ok ) {
+		fprintf( stderr, "error writing %s\n", filename );
+	}
+	return ok;
+}
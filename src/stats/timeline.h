@@ -0,0 +1,73 @@
+//
+// timeline.h
+//
+// Wall-clock spans for the phases of a run (readScene, initScene,
+// traceLines, writeBMP, ...) and for every render tile, recorded per
+// thread.  Recording is off until enableTimeline() is called; a timer
+// that is off costs one test.
+//
+// The spans can be summed per phase, or written out as a Chrome
+// trace-event file to look at in chrome://tracing or Perfetto.
+//
+
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+#include <stdio.h>
+
+void enableTimeline( bool on );
+bool timelineEnabled();
+
+// Seconds since the program started, on the steady clock.
+double timelineNow();
+
+// Label the calling thread in the trace.  Threads that never say get
+// "thread <n>".
+void nameTimelineThread( const char *name );
+
+// Record a finished span on the calling thread.  name and category must
+// be string literals (they are kept by pointer); arg, if not negative,
+// is shown as the span's "index" (the tile number, say).
+void addTimelineSpan( const char *name, const char *category,
+	double start, double end, int arg = -1 );
+
+// Times its own scope.
+class ScopedTimer
+{
+public:
+	ScopedTimer( const char *name, const char *category = "phase", int arg = -1 )
+		: m_name( name ), m_category( category ), m_nArg( arg ),
+		  m_nStart( timelineEnabled() ? timelineNow() : -1.0 )
+	{
+	}
+
+	~ScopedTimer()
+	{
+		if( m_nStart >= 0.0 ) {
+			addTimelineSpan( m_name, m_category, m_nStart, timelineNow(), m_nArg );
+		}
+	}
+
+private:
+	ScopedTimer( const ScopedTimer& );
+	ScopedTimer& operator=( const ScopedTimer& );
+
+	const char *m_name;
+	const char *m_category;
+	int m_nArg;
+	double m_nStart;
+};
+
+// Drop everything recorded so far, and the blocks of threads that have
+// exited.  Call it while no render is running.
+void resetTimeline();
+
+// Total wall-clock time per "phase" span name, in first-seen order, plus
+// the tile count and busy time per thread.
+void printTimelineSummary( FILE *fp );
+
+// Every span, as a Chrome trace-event JSON file.  Call it while no render
+// is running.
+bool writeChromeTrace( const char *filename );
+
+#endif // __TIMELINE_H__
@@ -2,16 +2,23 @@
 // A subclass of FL_GL_Window that handles drawing the traced image to the screen
 // 
 
+#include <FL/fl_ask.h>
+
 #include "TraceGLWindow.h"
 #include "../RayTracer.h"
 
 #include "../fileio/bitmap.h"
+#include "../fileio/hdrimage.h"
 
 TraceGLWindow::TraceGLWindow(int x, int y, int w, int h, const char *l)
 			: Fl_Gl_Window(x,y,w,h,l)
 {
 	m_nWindowWidth = w;
 	m_nWindowHeight = h;
+
+	m_nTexture = 0;
+	m_nTextureWidth = m_nTextureHeight = 0;
+	m_bAllDirty = true;
 }
 
 int TraceGLWindow::handle(int event)
@@ -41,18 +48,101 @@ void TraceGLWindow::draw()
 	raytracer->getBuffer(buf, m_nDrawWidth, m_nDrawHeight);
 
 	if ( buf ) {
-		// just copy image to GLwindow conceptually
-		glRasterPos2i( 0, 0 );
-		glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
-		glPixelStorei( GL_UNPACK_ROW_LENGTH, m_nDrawWidth );
+		uploadDirty( buf );
+
+		// draw the image as a textured quad
+		double s = (double)m_nDrawWidth / m_nTextureWidth;
+		double t = (double)m_nDrawHeight / m_nTextureHeight;
+
 		glDrawBuffer( GL_BACK );
-		glDrawPixels( m_nDrawWidth, m_nDrawHeight, GL_RGB, GL_UNSIGNED_BYTE, buf );
+		glEnable( GL_TEXTURE_2D );
+		glBindTexture( GL_TEXTURE_2D, m_nTexture );
+		glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
+		glBegin( GL_QUADS );
+			glTexCoord2d( 0, 0 );	glVertex2i( 0, 0 );
+			glTexCoord2d( s, 0 );	glVertex2i( m_nDrawWidth, 0 );
+			glTexCoord2d( s, t );	glVertex2i( m_nDrawWidth, m_nDrawHeight );
+			glTexCoord2d( 0, t );	glVertex2i( 0, m_nDrawHeight );
+		glEnd();
+		glDisable( GL_TEXTURE_2D );
 	}
 		
 	glFlush();
 }
 
+// Bring the texture up to date with the parts of buf that changed since
+// the last draw, (re)creating it first if the image size has changed.
+void TraceGLWindow::uploadDirty(unsigned char* buf)
+{
+	int texWidth = 1, texHeight = 1;
+	while ( texWidth < m_nDrawWidth )
+		texWidth *= 2;
+	while ( texHeight < m_nDrawHeight )
+		texHeight *= 2;
+
+	if ( !m_nTexture || !glIsTexture( m_nTexture )
+		|| texWidth != m_nTextureWidth || texHeight != m_nTextureHeight ) {
+		if ( !m_nTexture || !glIsTexture( m_nTexture ) )
+			glGenTextures( 1, &m_nTexture );
+		glBindTexture( GL_TEXTURE_2D, m_nTexture );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, texWidth, texHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+		m_nTextureWidth = texWidth;
+		m_nTextureHeight = texHeight;
+
+		m_dirtyLock.lock();
+		m_bAllDirty = true;
+		m_dirtyLock.unlock();
+	}
+
+	std::vector<DirtyRect> dirty;
+	m_dirtyLock.lock();
+	if ( m_bAllDirty ) {
+		DirtyRect all = { 0, 0, m_nDrawWidth, m_nDrawHeight };
+		dirty.push_back( all );
+	} else {
+		dirty.swap( m_dirty );
+	}
+	m_dirty.clear();
+	m_bAllDirty = false;
+	m_dirtyLock.unlock();
+
+	glBindTexture( GL_TEXTURE_2D, m_nTexture );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glPixelStorei( GL_UNPACK_ROW_LENGTH, m_nDrawWidth );
+	for ( size_t k = 0; k < dirty.size(); ++k ) {
+		const DirtyRect& r = dirty[k];
+		if ( r.x + r.w > m_nDrawWidth || r.y + r.h > m_nDrawHeight )
+			continue;	// from an image of a different size
+		glPixelStorei( GL_UNPACK_SKIP_PIXELS, r.x );
+		glPixelStorei( GL_UNPACK_SKIP_ROWS, r.y );
+		glTexSubImage2D( GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h, GL_RGB, GL_UNSIGNED_BYTE, buf );
+	}
+	glPixelStorei( GL_UNPACK_SKIP_PIXELS, 0 );
+	glPixelStorei( GL_UNPACK_SKIP_ROWS, 0 );
+	glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+}
+
 void TraceGLWindow::refresh()
+{
+	m_dirtyLock.lock();
+	m_bAllDirty = true;
+	m_dirtyLock.unlock();
+
+	redraw();
+}
+
+void TraceGLWindow::markDirty(int x, int y, int w, int h)
+{
+	DirtyRect r = { x, y, w, h };
+
+	m_dirtyLock.lock();
+	m_dirty.push_back( r );
+	m_dirtyLock.unlock();
+}
+
+void TraceGLWindow::refreshDirty()
 {
 	redraw();
 }
@@ -68,6 +158,16 @@ void TraceGLWindow::saveImage(char *iname)
 {
 	unsigned char* buf;
 
+	if (isHDRFileName(iname)) {
+		float* hdr;
+		raytracer->getHDRBuffer(hdr, m_nDrawWidth, m_nDrawHeight);
+		if (hdr)
+			writeHDR(iname, m_nDrawWidth, m_nDrawHeight, hdr);
+		else
+			fl_alert("No HDR image: tick HDR and render again.");
+		return;
+	}
+
 	raytracer->getBuffer(buf, m_nDrawWidth, m_nDrawHeight);
 	if (buf)
 		writeBMP(iname, m_nDrawWidth, m_nDrawHeight, buf); 
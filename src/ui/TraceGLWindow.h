@@ -14,6 +14,9 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 
+#include <vector>
+#include <mutex>
+
 #include "../RayTracer.h"
 
 class TraceGLWindow : public Fl_Gl_Window
@@ -25,8 +28,14 @@ public:
 
 	RayTracer *raytracer;
 
+	// Redraw, re-uploading the whole image.
 	void refresh();
 
+	// Note that a part of the image has changed.  Safe to call from
+	// render threads; refreshDirty() then uploads just those parts.
+	void markDirty(int x, int y, int w, int h);
+	void refreshDirty();
+
 	void resizeWindow(int width, int height);
 
 	void saveImage(char *iname);
@@ -34,8 +43,24 @@ public:
 	void setRayTracer(RayTracer *tracer);
 
 private:
+	struct DirtyRect
+	{
+		int x, y, w, h;
+	};
+
+	void uploadDirty(unsigned char* buf);
+
 	int m_nWindowWidth, m_nWindowHeight;
 	int m_nDrawWidth, m_nDrawHeight;
+
+	// the image lives in a persistent texture that is only updated
+	// where it has changed
+	GLuint m_nTexture;
+	int m_nTextureWidth, m_nTextureHeight;
+
+	std::mutex m_dirtyLock;
+	std::vector<DirtyRect> m_dirty;
+	bool m_bAllDirty;
 };
 
 #endif // __TRACE_GL_WINDOW_H__
\ No newline at end of file
@@ -4,15 +4,18 @@
 // Handles FLTK integration and other user interface tasks
 //
 #include <stdio.h>
-#include <time.h>
 #include <string.h>
 
 #include <FL/fl_ask.h>
 
 #include "TraceUI.h"
 #include "../RayTracer.h"
+#include "../TileRenderer.h"
 
-static bool done;
+static bool done = true;
+
+// seconds between the UI thread's looks at a running render
+static const double RENDER_POLL = 0.05;
 
 //------------------------------------- Help Functions --------------------------------------------
 TraceUI* TraceUI::whoami(Fl_Menu_* o)	// from menu item back to UI itself
@@ -25,16 +28,19 @@ void TraceUI::cb_load_scene(Fl_Menu_* o, void* v)
 {
 	TraceUI* pUI=whoami(o);
 	
-	char* newfile = fl_file_chooser("Open Scene?", "*.ray", NULL );
+	char* newfile = fl_file_chooser("Open Scene?", "*.{ray,rayb}", NULL );
 
 	if (newfile != NULL) {
 		char buf[256];
 
+		// terminate the previous rendering
+		pUI->stopRendering();
+
 		if (pUI->raytracer->loadScene(newfile)) {
 			sprintf(buf, "Ray <%s>", newfile);
-			done=true;	// terminate the previous rendering
 		} else{
 			sprintf(buf, "Ray <Not Loaded>");
+			fl_alert("Can't load %s", newfile);
 		}
 
 		pUI->m_mainWindow->label(buf);
@@ -45,7 +51,7 @@ void TraceUI::cb_save_image(Fl_Menu_* o, void* v)
 {
 	TraceUI* pUI=whoami(o);
 	
-	char* savefile = fl_file_chooser("Save Image?", "*.bmp", "save.bmp" );
+	char* savefile = fl_file_chooser("Save Image?", "*.{bmp,pfm,hdr}", "save.bmp" );
 	if (savefile != NULL) {
 		pUI->m_traceGlWindow->saveImage(savefile);
 	}
@@ -56,7 +62,7 @@ void TraceUI::cb_exit(Fl_Menu_* o, void* v)
 	TraceUI* pUI=whoami(o);
 
 	// terminate the rendering
-	done=true;
+	pUI->stopRendering();
 
 	pUI->m_traceGlWindow->hide();
 	pUI->m_mainWindow->hide();
@@ -67,12 +73,18 @@ void TraceUI::cb_exit2(Fl_Widget* o, void* v)
 	TraceUI* pUI=(TraceUI *)(o->user_data());
 	
 	// terminate the rendering
-	done=true;
+	pUI->stopRendering();
 
 	pUI->m_traceGlWindow->hide();
 	pUI->m_mainWindow->hide();
 }
 
+// Diagnostics menu: v is the RayTracer::HeatmapMetric to render next.
+void TraceUI::cb_heatmap(Fl_Menu_* o, void* v)
+{
+	whoami(o)->m_nHeatmap = (int)(long)v;
+}
+
 void TraceUI::cb_about(Fl_Menu_* o, void* v) 
 {
 	fl_message("RayTracer Project, FLTK version for CS 341 Spring 2002. Latest modifications by Jeff Maurer, jmaurer@cs.washington.edu");
@@ -95,14 +107,17 @@ void TraceUI::cb_depthSlides(Fl_Widget* o, void* v)
 void TraceUI::cb_ambientLightRedSlides(Fl_Widget* o, void* v)
 {
 	((TraceUI*)(o->user_data()))->m_nAmbientLightRed = double(((Fl_Slider *)o)->value());
+	((TraceUI*)(o->user_data()))->reshade();
 }
 void TraceUI::cb_ambientLightGreenSlides(Fl_Widget* o, void* v)
 {
 	((TraceUI*)(o->user_data()))->m_nAmbientLightGreen = double(((Fl_Slider *)o)->value());
+	((TraceUI*)(o->user_data()))->reshade();
 }
 void TraceUI::cb_ambientLightBlueSlides(Fl_Widget* o, void* v)
 {
 	((TraceUI*)(o->user_data()))->m_nAmbientLightBlue = double(((Fl_Slider *)o)->value());
+	((TraceUI*)(o->user_data()))->reshade();
 }
 void TraceUI::cb_antialiasingSlides(Fl_Widget* o, void* v)
 {
@@ -120,113 +135,174 @@ void TraceUI::cb_constantAttenuationCoeffSlides(Fl_Widget* o, void* v)
 {
 	((TraceUI*)(o->user_data()))->m_nConstantAttenuationCoefficient = double(((Fl_Slider *)o)->value());
 	((TraceUI*)(o->user_data()))->m_bIsCustomDistanceAttenuation = true;
+	((TraceUI*)(o->user_data()))->reshade();
 }
 void TraceUI::cb_linearAttenuationCoeffSlides(Fl_Widget* o, void* v)
 {
 	((TraceUI*)(o->user_data()))->m_nLinearAttenuationCoefficient = double(((Fl_Slider *)o)->value());
 	((TraceUI*)(o->user_data()))->m_bIsCustomDistanceAttenuation = true;
+	((TraceUI*)(o->user_data()))->reshade();
 }
 void TraceUI::cb_quadraticAttenuationCoeffSlides(Fl_Widget* o, void* v)
 {
 	((TraceUI*)(o->user_data()))->m_nQuadraticAttenuationCoefficient = double(((Fl_Slider *)o)->value());
 	((TraceUI*)(o->user_data()))->m_bIsCustomDistanceAttenuation = true;
+	((TraceUI*)(o->user_data()))->reshade();
 }
 void TraceUI::cb_superSamplingSlides(Fl_Widget* o, void* v)
 {
 	((TraceUI*)(o->user_data()))->m_nSuperSampling = int(((Fl_Slider *)o)->value());
 }
+void TraceUI::cb_exposureSlides(Fl_Widget* o, void* v)
+{
+	TraceUI* pUI=((TraceUI*)(o->user_data()));
+	pUI->m_nExposure = double(((Fl_Slider *)o)->value());
+
+	// only the tone mapping changes: requantize the float image
+	if (done) {
+		pUI->raytracer->setExposure(pUI->m_nExposure);
+		pUI->raytracer->toneMap();
+		pUI->m_traceGlWindow->refresh();
+	}
+}
+void TraceUI::cb_hdrButton(Fl_Widget* o, void* v)
+{
+	((TraceUI*)(o->user_data()))->m_bHDR = ((Fl_Check_Button *)o)->value() != 0;
+}
 
 void TraceUI::cb_render(Fl_Widget* o, void* v)
 {
-	char buffer[256];
-
 	TraceUI* pUI=((TraceUI*)(o->user_data()));
 	
 	if (pUI->raytracer->sceneLoaded()) {
+		// the workers read the tracer's settings, so finish with them first
+		pUI->stopRendering();
+
 		int width=pUI->getSize();
 		int	height = (int)(width / pUI->raytracer->aspectRatio() + 0.5);
 		pUI->m_traceGlWindow->resizeWindow( width, height );
 
 		pUI->m_traceGlWindow->show();
 
+		pUI->applySettings();
+
+		// nothing but the lighting changed since the last full render,
+		// so the cached primary hits can be re-shaded instead
+		unsigned char* buf;
+		int bufWidth, bufHeight;
+		pUI->raytracer->getBuffer(buf, bufWidth, bufHeight);
+		if (bufWidth == width && bufHeight == height && pUI->raytracer->canReshade()) {
+			pUI->reshade();
+			return;
+		}
+
 		pUI->raytracer->traceSetup(width, height);
 		
 		// Save the window label
-		const char *old_label = pUI->m_traceGlWindow->label();
+		pUI->m_oldLabel = pUI->m_traceGlWindow->label();
 
 		// start to render here	
 		done=false;
-		clock_t prev, now;
-		prev=clock();
-		
 		pUI->m_traceGlWindow->refresh();
-		Fl::check();
-		Fl::flush();
-
-		for (int y=0; y<height; y++) {
-			for (int x=0; x<width; x++) {
-				if (done) break;
-				
-				// current time
-				now = clock();
-
-				// check event every 1/2 second
-				if (((double)(now-prev)/CLOCKS_PER_SEC)>0.5) {
-					prev=now;
-
-					if (Fl::ready()) {
-						// refresh
-						pUI->m_traceGlWindow->refresh();
-						// check event
-						Fl::check();
-
-						if (Fl::damage()) {
-							Fl::flush();
-						}
-					}
-				}
-
-				pUI->raytracer->setDepth(pUI->getDepth());
-				pUI->raytracer->setAmbientLightRed(pUI->getAmbientLightRed());
-				pUI->raytracer->setAmbientLightGreen(pUI->getAmbientLightGreen());
-				pUI->raytracer->setAmbientLightBlue(pUI->getAmbientLightBlue());
-				pUI->raytracer->setAntialiasing(pUI->getAntialiasing());
-				pUI->raytracer->setJitter(pUI->getJitter());
-				pUI->raytracer->setAdaptiveThreshold(pUI->getAdaptiveThreshold());
-				pUI->raytracer->setConstantAttenuationCoefficient(pUI->getConstantAttenuationCoefficient());
-				pUI->raytracer->setLinearAttenuationCoefficient(pUI->getLinearAttenuationCoefficient());
-				pUI->raytracer->setQuadraticAttenuationCoefficient(pUI->getQuadraticAttenuationCoefficient());
-				pUI->raytracer->setSuperSampling(pUI->getSuperSampling());
-				pUI->raytracer->tracePixel( x, y );
-		
-			}
-			if (done) break;
-
-			// flush when finish a row
-			if (Fl::ready()) {
-				// refresh
-				pUI->m_traceGlWindow->refresh();
-
-				if (Fl::damage()) {
-					Fl::flush();
-				}
-			}
-			// update the window label
-			sprintf(buffer, "(%d%%) %s", (int)((double)y / (double)height * 100.0), old_label);
-			pUI->m_traceGlWindow->label(buffer);
-			
-		}
+
+		pUI->m_renderer->start(0, cb_tileDone, pUI);
+		Fl::add_timeout(RENDER_POLL, cb_renderProgress, pUI);
+	}
+}
+
+// Runs on a render thread: the UI thread picks the tile up on its next poll.
+void TraceUI::cb_tileDone(int x, int y, int w, int h, const unsigned char*, int, void* v)
+{
+	((TraceUI*)v)->m_traceGlWindow->markDirty(x, y, w, h);
+}
+
+// Runs on the UI thread every RENDER_POLL seconds until the render is done.
+// A timer rather than an Fl::awake per tile: FLTK drops awake messages
+// when its queue is full, and a lost last one would leave the render
+// never finishing.
+void TraceUI::cb_renderProgress(void* v)
+{
+	TraceUI* pUI=(TraceUI*)v;
+
+	// left over from a render that has been stopped
+	if (done)
+		return;
+
+	pUI->m_traceGlWindow->refreshDirty();
+
+	int finished = pUI->m_renderer->tilesDone();
+	int tiles = pUI->m_renderer->numTiles();
+	if (finished < tiles) {
+		// update the window label
+		sprintf(pUI->m_progressLabel, "(%d%%) %s", (int)((double)finished / (double)tiles * 100.0), pUI->m_oldLabel);
+		pUI->m_traceGlWindow->label(pUI->m_progressLabel);
+		Fl::repeat_timeout(RENDER_POLL, cb_renderProgress, v);
+	} else {
+		pUI->m_renderer->wait();
 		done=true;
-		pUI->m_traceGlWindow->refresh();
+
+		// the costs are only known once every pixel is
+		if (pUI->raytracer->getHeatmap() != RayTracer::HEATMAP_OFF) {
+			pUI->raytracer->heatmapImage();
+			pUI->m_traceGlWindow->refresh();
+		}
 
 		// Restore the window label
-		pUI->m_traceGlWindow->label(old_label);		
+		pUI->m_traceGlWindow->label(pUI->m_oldLabel);
 	}
 }
 
 void TraceUI::cb_stop(Fl_Widget* o, void* v)
 {
+	((TraceUI*)(o->user_data()))->stopRendering();
+}
+
+// Cancel a running render; the workers give up after their current tile.
+void TraceUI::stopRendering()
+{
+	if (done)
+		return;
+
+	m_renderer->stop();
+	Fl::remove_timeout(cb_renderProgress, this);
 	done=true;
+
+	m_traceGlWindow->label(m_oldLabel);
+	m_traceGlWindow->refresh();
+}
+
+// Push the current slider values into the ray tracer.
+void TraceUI::applySettings()
+{
+	raytracer->setDepth(getDepth());
+	raytracer->setAmbientLightRed(getAmbientLightRed());
+	raytracer->setAmbientLightGreen(getAmbientLightGreen());
+	raytracer->setAmbientLightBlue(getAmbientLightBlue());
+	raytracer->setAntialiasing(getAntialiasing());
+	raytracer->setJitter(getJitter());
+	raytracer->setAdaptiveThreshold(getAdaptiveThreshold());
+	raytracer->setConstantAttenuationCoefficient(getConstantAttenuationCoefficient());
+	raytracer->setLinearAttenuationCoefficient(getLinearAttenuationCoefficient());
+	raytracer->setQuadraticAttenuationCoefficient(getQuadraticAttenuationCoefficient());
+	raytracer->setSuperSampling(getSuperSampling());
+	raytracer->setHDR(isHDR());
+	raytracer->setExposure(getExposure());
+	raytracer->setHeatmap((RayTracer::HeatmapMetric)m_nHeatmap);
+}
+
+// Re-shade the last finished image from its cached primary hits.  Does
+// nothing while a render is running or if no usable G-buffer exists.
+void TraceUI::reshade()
+{
+	if (!done || !raytracer->sceneLoaded())
+		return;
+
+	applySettings();
+	if (!raytracer->canReshade())
+		return;
+
+	raytracer->reshadeLines();
+	m_traceGlWindow->refresh();
 }
 
 void TraceUI::show()
@@ -237,7 +313,11 @@ void TraceUI::show()
 void TraceUI::setRayTracer(RayTracer *tracer)
 {
 	raytracer = tracer;
+	raytracer->setCachePrimaryHits(true);
 	m_traceGlWindow->setRayTracer(tracer);
+
+	delete m_renderer;
+	m_renderer = new TileRenderer(tracer);
 }
 
 int TraceUI::getSize()
@@ -300,6 +380,16 @@ int TraceUI::getSuperSampling()
 	return m_nSuperSampling;
 }
 
+double TraceUI::getExposure()
+{
+	return m_nExposure;
+}
+
+bool TraceUI::isHDR()
+{
+	return m_bHDR;
+}
+
 bool TraceUI::isCustomDistanceAttenuation()
 {
 	return m_bIsCustomDistanceAttenuation;
@@ -315,6 +405,13 @@ Fl_Menu_Item TraceUI::menuitems[] = {
 		{ "&Exit",			FL_ALT + 'e', (Fl_Callback *)TraceUI::cb_exit },
 		{ 0 },
 
+	{ "&Diagnostics",	0, 0, 0, FL_SUBMENU },
+		{ "&Image",					0, (Fl_Callback *)TraceUI::cb_heatmap, (void *)RayTracer::HEATMAP_OFF, FL_MENU_RADIO | FL_MENU_VALUE },
+		{ "Heatmap: &Time",			0, (Fl_Callback *)TraceUI::cb_heatmap, (void *)RayTracer::HEATMAP_TIME, FL_MENU_RADIO },
+		{ "Heatmap: &Rays",			0, (Fl_Callback *)TraceUI::cb_heatmap, (void *)RayTracer::HEATMAP_RAYS, FL_MENU_RADIO },
+		{ "Heatmap: Te&sts",		0, (Fl_Callback *)TraceUI::cb_heatmap, (void *)RayTracer::HEATMAP_TESTS, FL_MENU_RADIO },
+		{ 0 },
+
 	{ "&Help",		0, 0, 0, FL_SUBMENU },
 		{ "&About",	FL_ALT + 'a', (Fl_Callback *)TraceUI::cb_about },
 		{ 0 },
@@ -324,6 +421,9 @@ Fl_Menu_Item TraceUI::menuitems[] = {
 
 TraceUI::TraceUI() {
 	// init.
+	raytracer = NULL;
+	m_renderer = NULL;
+	m_oldLabel = NULL;
 	m_nDepth = 0;
 	m_nSize = 150;
 	m_nAmbientLightRed = 0.2;
@@ -336,7 +436,17 @@ TraceUI::TraceUI() {
 	m_nLinearAttenuationCoefficient = 0.0;
 	m_nQuadraticAttenuationCoefficient = 0.0;
 	m_nSuperSampling = 0;
+	m_nExposure = 0.0;
+	m_bHDR = false;
 	m_bIsCustomDistanceAttenuation = false;
+	m_nHeatmap = RayTracer::HEATMAP_OFF;
+
+	// ray and test counts are only there in a RAY_STATS build
+	for (Fl_Menu_Item* item = menuitems; item->text || item[1].text; ++item) {
+		if (item->callback() == (Fl_Callback *)cb_heatmap &&
+			!RayTracer::heatmapSupported((RayTracer::HeatmapMetric)(long)item->user_data()))
+			item->deactivate();
+	}
 
 	m_mainWindow = new Fl_Window(100, 40, 320, 500, "Ray <Not Loaded>");
 		m_mainWindow->user_data((void*)(this));	// record self to be used by static callback functions
@@ -490,6 +600,25 @@ TraceUI::TraceUI() {
 		m_superSamplingSlider->align(FL_ALIGN_RIGHT);
 		m_superSamplingSlider->callback(cb_superSamplingSlides);
 
+		m_exposureSlider = new Fl_Value_Slider(10, 330, 180, 20, "Exposure");
+		m_exposureSlider->user_data((void*)(this));	// record self to be used by static callback functions
+		m_exposureSlider->type(FL_HOR_NICE_SLIDER);
+		m_exposureSlider->labelfont(FL_COURIER);
+		m_exposureSlider->labelsize(12);
+		m_exposureSlider->minimum(-4);
+		m_exposureSlider->maximum(4);
+		m_exposureSlider->step(0.1);
+		m_exposureSlider->value(m_nExposure);
+		m_exposureSlider->align(FL_ALIGN_RIGHT);
+		m_exposureSlider->callback(cb_exposureSlides);
+
+		m_hdrButton = new Fl_Check_Button(10, 355, 180, 20, "HDR (keep float image)");
+		m_hdrButton->user_data((void*)(this));	// record self to be used by static callback functions
+		m_hdrButton->labelfont(FL_COURIER);
+		m_hdrButton->labelsize(12);
+		m_hdrButton->value(m_bHDR);
+		m_hdrButton->callback(cb_hdrButton);
+
 		m_renderButton = new Fl_Button(240, 27, 70, 25, "&Render");
 		m_renderButton->user_data((void*)(this));
 		m_renderButton->callback(cb_render);
@@ -18,6 +18,8 @@
 
 #include "TraceGLWindow.h"
 
+class TileRenderer;
+
 class TraceUI {
 public:
 	TraceUI();
@@ -38,6 +40,9 @@ public:
 	Fl_Slider*			m_linearAttenuationCoeffSlider;
 	Fl_Slider*			m_quadraticAttenuationCoeffSlider;
 	Fl_Slider*	m_superSamplingSlider;
+	Fl_Slider*			m_exposureSlider;
+
+	Fl_Check_Button*	m_hdrButton;
 
 	Fl_Button*			m_renderButton;
 	Fl_Button*			m_stopButton;
@@ -61,10 +66,20 @@ public:
 	double		getLinearAttenuationCoefficient();
 	double		getQuadraticAttenuationCoefficient();
 	int getSuperSampling();
+	double		getExposure();
+	bool		isHDR();
 	bool      isCustomDistanceAttenuation();
 
+	void		applySettings();
+	void		reshade();
+	void		stopRendering();
+
 private:
 	RayTracer*	raytracer;
+	TileRenderer*	m_renderer;
+
+	const char*	m_oldLabel;
+	char		m_progressLabel[256];
 
 	int			m_nSize;
 	int			m_nDepth;
@@ -78,7 +93,10 @@ private:
 	double      m_nLinearAttenuationCoefficient;
 	double      m_nQuadraticAttenuationCoefficient;
 	int m_nSuperSampling;
+	double		m_nExposure;
+	bool		m_bHDR;
 	bool      m_bIsCustomDistanceAttenuation;
+	int			m_nHeatmap;		// a RayTracer::HeatmapMetric
 	
 // static class members
 	static Fl_Menu_Item menuitems[];
@@ -89,6 +107,7 @@ private:
 	static void cb_save_image(Fl_Menu_* o, void* v);
 	static void cb_exit(Fl_Menu_* o, void* v);
 	static void cb_about(Fl_Menu_* o, void* v);
+	static void cb_heatmap(Fl_Menu_* o, void* v);
 
 	static void cb_exit2(Fl_Widget* o, void* v);
 
@@ -104,9 +123,13 @@ private:
 	static void cb_linearAttenuationCoeffSlides(Fl_Widget* o, void* v);
 	static void cb_quadraticAttenuationCoeffSlides(Fl_Widget* o, void* v);
 	static void cb_superSamplingSlides(Fl_Widget* o, void* v);
+	static void cb_exposureSlides(Fl_Widget* o, void* v);
+	static void cb_hdrButton(Fl_Widget* o, void* v);
 
 	static void cb_render(Fl_Widget* o, void* v);
 	static void cb_stop(Fl_Widget* o, void* v);
+	static void cb_tileDone(int x, int y, int w, int h, const unsigned char*, int, void* v);
+	static void cb_renderProgress(void* v);
 };
 
 #endif
@@ -39,12 +39,11 @@ public:
 		{ n[0] = x; n[1] = y; n[2] = z; }
 //	vec3f( const double d )
 //		{ n[0] = d; n[1] = d; n[2] = d; }
-	vec3f( const vec3f& v )
-		{ n[0] = v.n[0]; n[1] = v.n[1]; n[2] = v.n[2]; }
 	vec3f( const vec4f& v4 );
 
-	vec3f& operator	=( const vec3f& v )
-		{ n[0] = v.n[0]; n[1] = v.n[1]; n[2] = v.n[2]; return *this; }
+	// copying is left to the compiler, which keeps vec3f (and the
+	// structures holding it) trivially copyable
+
 	vec3f& operator +=( const vec3f& v )
 		{ n[0] += v.n[0]; n[1] += v.n[1]; n[2] += v.n[2]; return *this; }
 	vec3f& operator -= ( const vec3f& v )